@@ -0,0 +1,188 @@
+/* -*- Mode: C; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+
+#include "generic.h"
+
+#include <assert.h>
+#include <string.h>
+
+#include "admission.h"
+#include "memcached.h"
+
+/* each row and the doorkeeper index the counters by a different multiplicative
+ * hash of the key's hash value. */
+static const uint32_t row_seeds[ADMISSION_ROWS] = {
+    0x9e3779b1, 0x85ebca77, 0xc2b2ae3d, 0x27d4eb2f,
+};
+#define DOORKEEPER_SEED_0 0x165667b1
+#define DOORKEEPER_SEED_1 0xd3a2646d
+
+/* each thread counts its own sightings, and only adds them to the total,
+ * which decides when to age, this many at a time. */
+#define ADMISSION_SAMPLE_BATCH 64
+
+static struct {
+    uint8_t* counters;          /* ADMISSION_ROWS rows of width counters. */
+    uint64_t* doorkeeper;       /* width bits. */
+    uint32_t width_bits;        /* log2 of the width. */
+    /* sightings since the last aging, in batches.  on a cache line of its
+     * own, away from the fields every sighting reads. */
+    size_t samples __attribute__((aligned(CACHE_LINE_SIZE)));
+    size_t sample_limit;
+    int aging;                  /* 1 while a thread is aging the sketch. */
+    uint64_t agings;
+} ad;
+
+
+static inline uint32_t index_for(const uint32_t hv, const uint32_t seed) {
+    return (hv * seed) >> (32 - ad.width_bits);
+}
+
+
+bool admission_init(const size_t maxbytes) {
+    size_t width = ADMISSION_MIN_COUNTERS;
+
+    memset(&ad, 0, sizeof(ad));
+    if (! settings.admission_filter) {
+        return true;
+    }
+
+    for (ad.width_bits = 0; ((size_t) 1 << ad.width_bits) < width; ad.width_bits++) {
+    }
+    while (((size_t) 1 << ad.width_bits) * ADMISSION_BYTES_PER_COUNTER < maxbytes &&
+           ad.width_bits < 30) {
+        ad.width_bits++;
+    }
+    width = (size_t) 1 << ad.width_bits;
+
+    ad.counters = pool_calloc(ADMISSION_ROWS, width, ADMISSION_POOL);
+    ad.doorkeeper = pool_calloc(width / 64, sizeof(uint64_t), ADMISSION_POOL);
+    if (ad.counters == NULL || ad.doorkeeper == NULL) {
+        return false;
+    }
+    ad.sample_limit = width * ADMISSION_SAMPLE_FACTOR;
+
+    return true;
+}
+
+
+/* sets the key's bits in the doorkeeper, and returns whether they were
+ * already set. */
+static bool doorkeeper_test_and_set(const uint32_t hv) {
+    uint32_t i0 = index_for(hv, DOORKEEPER_SEED_0);
+    uint32_t i1 = index_for(hv, DOORKEEPER_SEED_1);
+    uint64_t m0 = (uint64_t) 1 << (i0 % 64), m1 = (uint64_t) 1 << (i1 % 64);
+    bool present = (ad.doorkeeper[i0 / 64] & m0) && (ad.doorkeeper[i1 / 64] & m1);
+
+    if (! present) {
+        ad.doorkeeper[i0 / 64] |= m0;
+        ad.doorkeeper[i1 / 64] |= m1;
+    }
+    return present;
+}
+
+
+/* halves every counter and clears the doorkeeper.  only one thread ages the
+ * sketch at a time; the others keep recording while it does. */
+static void age(void) {
+    size_t width = (size_t) 1 << ad.width_bits;
+    uint64_t* words = (uint64_t*) ad.counters;
+    size_t i;
+
+    if (! __sync_bool_compare_and_swap(&ad.aging, 0, 1)) {
+        return;
+    }
+
+    /* counters never exceed ADMISSION_COUNTER_MAX, so halving a word at a
+     * time only needs the bits shifted in from the next counter masked off. */
+    for (i = 0; i < ADMISSION_ROWS * width / sizeof(uint64_t); i++) {
+        words[i] = (words[i] >> 1) & UINT64_C(0x7f7f7f7f7f7f7f7f);
+    }
+    memset(ad.doorkeeper, 0, width / 8);
+    ad.samples = 0;
+    ad.agings++;
+
+    memory_barrier();
+    ad.aging = 0;
+}
+
+
+void admission_record(const uint32_t hv) {
+    stats_t *stats;
+    size_t width;
+    int row;
+
+    if (! settings.admission_filter) {
+        return;
+    }
+
+    if (doorkeeper_test_and_set(hv)) {
+        width = (size_t) 1 << ad.width_bits;
+        for (row = 0; row < ADMISSION_ROWS; row++) {
+            uint8_t* counter = &ad.counters[row * width + index_for(hv, row_seeds[row])];
+
+            if (*counter < ADMISSION_COUNTER_MAX) {
+                (*counter)++;
+            }
+        }
+    }
+
+    stats = STATS_GET_TLS();
+    if (++stats->admission_samples >= ADMISSION_SAMPLE_BATCH) {
+        size_t samples = __sync_add_and_fetch(&ad.samples, stats->admission_samples);
+
+        stats->admission_samples = 0;
+        if (samples >= ad.sample_limit) {
+            age();
+        }
+    }
+}
+
+
+/* the sketch's estimate of how often the key has been seen. */
+static unsigned int estimate(const uint32_t hv) {
+    size_t width = (size_t) 1 << ad.width_bits;
+    unsigned int min = ADMISSION_COUNTER_MAX;
+    uint32_t i0 = index_for(hv, DOORKEEPER_SEED_0);
+    uint32_t i1 = index_for(hv, DOORKEEPER_SEED_1);
+    int row;
+
+    for (row = 0; row < ADMISSION_ROWS; row++) {
+        uint8_t counter = ad.counters[row * width + index_for(hv, row_seeds[row])];
+
+        if (counter < min) {
+            min = counter;
+        }
+    }
+
+    if ((ad.doorkeeper[i0 / 64] & ((uint64_t) 1 << (i0 % 64))) &&
+        (ad.doorkeeper[i1 / 64] & ((uint64_t) 1 << (i1 % 64)))) {
+        min++;
+    }
+    return min;
+}
+
+
+bool admission_admit(const uint32_t candidate_hv, const uint32_t victim_hv) {
+    if (! settings.admission_filter) {
+        return true;
+    }
+    return estimate(candidate_hv) >= estimate(victim_hv);
+}
+
+
+/* appends the state of the sketch to a "stats" response. */
+size_t append_admission_stats(char* const buffer_start, const size_t buffer_size,
+                              const size_t buffer_off, const size_t reserved) {
+    size_t off = buffer_off;
+
+    if (! settings.admission_filter) {
+        return off;
+    }
+
+    off = append_to_buffer(buffer_start, buffer_size, off, reserved,
+                           "STAT admission_counters %lu\r\n",
+                           (unsigned long) ((size_t) 1 << ad.width_bits));
+    off = append_to_buffer(buffer_start, buffer_size, off, reserved,
+                           "STAT admission_agings %" PRINTF_INT64_MODIFIER "u\r\n", ad.agings);
+    return off;
+}
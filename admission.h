@@ -0,0 +1,55 @@
+/* -*- Mode: C; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+
+/**
+ * TinyLFU admission: when storing an item would evict another, the item is
+ * turned away if its key has been seen less often than the victim's.  key
+ * frequencies are estimated with a count-min sketch of ADMISSION_ROWS rows of
+ * small saturating counters, indexed by the hash of the key.  a doorkeeper
+ * bloom filter in front of the sketch absorbs the first sighting of each key,
+ * so the many keys that are only ever seen once don't crowd the counters.
+ *
+ * after every ADMISSION_SAMPLE_FACTOR sightings per counter, every counter is
+ * halved and the doorkeeper cleared, so that the estimates follow changes in
+ * popularity.
+ *
+ * the sketch is updated by the workers without any locks; increments that
+ * race are simply lost, which only makes the estimates a little low.  each
+ * worker counts its sightings in its own stats and adds them to the shared
+ * total a batch at a time, so aging can come a batch per thread late.
+ */
+
+#include "generic.h"
+
+#if !defined(_admission_h_)
+#define _admission_h_
+
+#include "memcached.h"
+
+#define ADMISSION_ROWS           4
+#define ADMISSION_COUNTER_MAX    15
+
+/* one counter per row for every this many bytes of item memory, rounded up to
+ * a power of 2. */
+#define ADMISSION_BYTES_PER_COUNTER 512
+#define ADMISSION_MIN_COUNTERS      4096
+
+/* sightings per counter between agings. */
+#define ADMISSION_SAMPLE_FACTOR  10
+
+/* sizes the sketch for maxbytes of items.  returns false if it can't be
+ * allocated. */
+extern bool admission_init(const size_t maxbytes);
+
+/* records a sighting of the key with hash value hv.  does nothing unless the
+ * filter is enabled. */
+extern void admission_record(const uint32_t hv);
+
+/* returns true if an item with hash value candidate_hv should be stored at the
+ * expense of evicting the one with hash value victim_hv, that is, unless the
+ * candidate's key has been seen less often. */
+extern bool admission_admit(const uint32_t candidate_hv, const uint32_t victim_hv);
+
+extern size_t append_admission_stats(char* const buffer_start, const size_t buffer_size,
+                                     const size_t buffer_off, const size_t reserved);
+
+#endif /* #if !defined(_admission_h_) */
@@ -455,19 +455,61 @@ typedef  unsigned long  int  ub4;   /* unsigned 4-byte quantities */
 typedef  unsigned       char ub1;   /* unsigned 1-byte quantities */
 
 /* how many powers of 2's worth of buckets we use */
-static unsigned int hashpower = 16;
+static unsigned int hashpower = HASHPOWER_DEFAULT;
 
 #define hashsize(n) ((ub4)1<<(n))
 #define hashmask(n) (hashsize(n)-1)
 
+/*
+ * The hashtable comes in two layouts, chosen at startup with -I:
+ *
+ * - chained: each bucket is the head of a list of items, linked through their
+ *   h_next pointers.  every hop down a chain is another cache miss.
+ *
+ * - bucketed: each bucket is a cache line holding INDEX_SLOTS item pointers,
+ *   each tagged with a byte of its key's hash, and the head of a chain for the
+ *   items that don't fit.  lookups compare the tags without touching the items,
+ *   so most hits and misses cost a single cache miss in the table.
+ *
+ * the bucketed layout doesn't probe other buckets for free slots (as linear
+ * probing or cuckoo hashing would), since a bucket is only protected by the
+ * item lock of the keys that hash to it.  overflow goes to the chain instead.
+ */
+#define INDEX_SLOTS ((CACHE_LINE_SIZE - 1 - sizeof(item_ptr_t)) / (sizeof(item_ptr_t) + 1))
+
+typedef struct index_bucket_s index_bucket_t;
+struct index_bucket_s {
+    item_ptr_t slots[INDEX_SLOTS];
+    item_ptr_t spill;                   /* items that didn't fit in the slots */
+    uint8_t tags[INDEX_SLOTS];
+} __attribute__((aligned(CACHE_LINE_SIZE)));
+
+/* the low bits of the hash value pick the bucket, so tag with the high ones. */
+#define INDEX_TAG(hv) ((uint8_t) ((hv) >> 24))
+
+/* average number of items per bucket before the bucketed layout expands. */
+#define INDEX_LOAD 3
+
+typedef struct {
+    void* mem;                          /* as allocated */
+    item_ptr_t* chains;                 /* chained layout, or NULL */
+    index_bucket_t* buckets;            /* bucketed layout, or NULL */
+} hashtable_t;
+
+/* a bucket of either layout. */
+typedef struct {
+    index_bucket_t* index;              /* NULL for the chained layout */
+    item_ptr_t* chain;
+} bucket_ref_t;
+
 /* Main hash table. This is where we look except during expansion. */
-static item_ptr_t* primary_hashtable = 0;
+static hashtable_t primary_hashtable;
 
 /*
  * Previous hash table. During expansion, we look here for keys that haven't
  * been moved over to the primary yet.
  */
-static item_ptr_t* old_hashtable = 0;
+static hashtable_t old_hashtable;
 
 /* Number of items in the hash table. */
 static unsigned int hash_items = 0;
@@ -481,196 +523,352 @@ static bool expanding = false;
  */
 static unsigned int expand_bucket = 0;
 
-void assoc_init(void) {
-    unsigned int hash_size = hashsize(hashpower) * sizeof(item_ptr_t);
-    primary_hashtable = pool_malloc(hash_size, ASSOC_POOL);
-    if (! primary_hashtable) {
-        fprintf(stderr, "Failed to init hashtable.\n");
-        exit(EXIT_FAILURE);
+/* Number of expansions that have completed. */
+static unsigned int expansions = 0;
+
+static size_t table_bytes(const unsigned int power) {
+    if (settings.hash_index == HASH_INDEX_BUCKETED) {
+        /* leave room to align the buckets on cache lines. */
+        return hashsize(power) * sizeof(index_bucket_t) + CACHE_LINE_SIZE;
     }
-    memset(primary_hashtable, 0, hash_size);
+    return hashsize(power) * sizeof(item_ptr_t);
 }
 
-item *assoc_find(const char *key, const size_t nkey) {
-    uint32_t hv = hash(key, nkey, 0);
-    item_ptr_t iptr;
+/* allocates an empty table of 2^power buckets.  returns false, leaving the
+ * table untouched, if we're out of memory. */
+static bool table_alloc(hashtable_t* table, const unsigned int power) {
+    void* mem = pool_calloc(table_bytes(power), 1, ASSOC_POOL);
+
+    if (mem == NULL) {
+        return false;
+    }
+    table->mem = mem;
+    if (settings.hash_index == HASH_INDEX_BUCKETED) {
+        table->buckets = (index_bucket_t*)
+            (((uintptr_t) mem + CACHE_LINE_SIZE - 1) & ~((uintptr_t) CACHE_LINE_SIZE - 1));
+    } else {
+        table->chains = mem;
+    }
+    return true;
+}
+
+static void table_free(hashtable_t* table, const unsigned int power) {
+    pool_free(table->mem, table_bytes(power), ASSOC_POOL);
+}
+
+static bucket_ref_t table_bucket(const hashtable_t* table, const uint32_t bucket) {
+    bucket_ref_t ref;
+
+    if (table->buckets != NULL) {
+        ref.index = &table->buckets[bucket];
+        ref.chain = &ref.index->spill;
+    } else {
+        ref.index = NULL;
+        ref.chain = &table->chains[bucket];
+    }
+    return ref;
+}
+
+/* returns the bucket that holds (or would hold) the key with hash value hv. */
+static bucket_ref_t find_bucket(const unsigned int power, const bool is_expanding,
+                                const uint32_t hv) {
     unsigned int oldbucket;
 
-    if (expanding &&
-        (oldbucket = (hv & hashmask(hashpower - 1))) >= expand_bucket)
+    if (is_expanding &&
+        (oldbucket = (hv & hashmask(power - 1))) >= expand_bucket)
     {
-        iptr = old_hashtable[oldbucket];
-    } else {
-        iptr = primary_hashtable[hv & hashmask(hashpower)];
+        return table_bucket(&old_hashtable, oldbucket);
     }
+    return table_bucket(&primary_hashtable, hv & hashmask(power));
+}
 
-    while (iptr) {
-        if (item_key_compare(ITEM(iptr), key, nkey) == 0) {
+static item* bucket_find(const bucket_ref_t ref, const char *key, const size_t nkey,
+                         const uint32_t hv) {
+    item_ptr_t iptr;
+    unsigned int i;
+
+    if (ref.index != NULL) {
+        for (i = 0; i < INDEX_SLOTS; i++) {
+            if (ref.index->tags[i] != INDEX_TAG(hv)) {
+                continue;
+            }
+            iptr = ref.index->slots[i];
+            if (iptr != NULL_ITEM_PTR &&
+                ITEM_hv(ITEM(iptr)) == hv &&
+                item_key_compare(ITEM(iptr), key, nkey) == 0) {
+                return ITEM(iptr);
+            }
+        }
+    }
+
+    for (iptr = *ref.chain; ITEM_PTR_IS_NULL(iptr); iptr = ITEM_PTR_h_next(iptr)) {
+        if (ITEM_hv(ITEM(iptr)) == hv &&
+            item_key_compare(ITEM(iptr), key, nkey) == 0) {
             return ITEM(iptr);
         }
-        iptr = ITEM_PTR_h_next(iptr);
     }
-    return 0;
+    return NULL;
 }
 
-/* returns the address of the item pointer before the key.  if *item == 0,
-   the item wasn't found */
+/* adds an item to a bucket.  the item must be complete before lock-free
+ * readers can see it. */
+static void bucket_insert(const bucket_ref_t ref, item* it, const uint32_t hv) {
+    unsigned int i;
+
+    if (ref.index != NULL) {
+        for (i = 0; i < INDEX_SLOTS; i++) {
+            if (ref.index->slots[i] == NULL_ITEM_PTR) {
+                ref.index->tags[i] = INDEX_TAG(hv);
+                memory_barrier();
+                ref.index->slots[i] = ITEM_PTR(it);
+                return;
+            }
+        }
+    }
 
-static item_ptr_t* _hashitem_before (const char *key, const size_t nkey) {
-    uint32_t hv = hash(key, nkey, 0);
+    ITEM_set_h_next(it, *ref.chain);
+    memory_barrier();
+    *ref.chain = ITEM_PTR(it);
+}
+
+/* returns the pointer to it in a bucket, which is NULL_ITEM_PTR if it isn't
+ * there.  *in_slot is set if the pointer is one of the bucket's slots rather
+ * than a link in the chain. */
+static item_ptr_t* bucket_pos(const bucket_ref_t ref, item* it, bool* in_slot) {
+    item_ptr_t iptr = ITEM_PTR(it);
     item_ptr_t* pos;
-    unsigned int oldbucket;
+    unsigned int i;
 
-    if (expanding &&
-        (oldbucket = (hv & hashmask(hashpower - 1))) >= expand_bucket)
-    {
-        pos = &old_hashtable[oldbucket];
-    } else {
-        pos = &primary_hashtable[hv & hashmask(hashpower)];
+    if (ref.index != NULL) {
+        for (i = 0; i < INDEX_SLOTS; i++) {
+            if (ref.index->slots[i] == iptr) {
+                *in_slot = true;
+                return &ref.index->slots[i];
+            }
+        }
     }
 
-    while (*pos && item_key_compare(ITEM(*pos), key, nkey)) {
-        pos = ITEM_h_next_p(ITEM(*pos));
+    *in_slot = false;
+    for (pos = ref.chain; *pos != NULL_ITEM_PTR && *pos != iptr;
+         pos = ITEM_h_next_p(ITEM(*pos))) {
     }
     return pos;
 }
 
+void assoc_init(void) {
+    hashpower = settings.hashpower_init;
 
-/* returns the address of the item pointer before it.  if *item == 0,
-   the item wasn't found */
-static item_ptr_t* _hashitem_before_item (item* it) {
-    /* this is one of the few times we totally break the storage layer
-     * abstraction.  the only way we could do this cleanly is to either:
-     *
-     * 1) Have the flat allocator malloc a block of memory and use that to
-     *    duplicate the key.  This is inefficient because malloc is an overkill
-     *    for this.
-     *
-     * 2) Have the slab allocator copy out the key as well.  This is
-     *    inefficient because it is totally unnecessary and unfairly punishes
-     *    the slab allocator.
-     */
-#if defined(USE_FLAT_ALLOCATOR)
-    char key_temp[KEY_MAX_LENGTH];
-#endif /* #if defined(USE_FLAT_ALLOCATOR) */
-    const char* key;
-    uint32_t hv;
-    item_ptr_t* pos;
-    unsigned int oldbucket;
+    /* every bucket, in both the primary and the old table, must map onto a
+     * single item lock.  see ITEM_LOCK_HASHPOWER. */
+    always_assert(hashpower - 1 >= ITEM_LOCK_HASHPOWER);
+    always_assert(sizeof(index_bucket_t) == CACHE_LINE_SIZE);
+    if (! table_alloc(&primary_hashtable, hashpower)) {
+        fprintf(stderr, "Failed to init hashtable.\n");
+        exit(EXIT_FAILURE);
+    }
+}
 
-#if defined(USE_FLAT_ALLOCATOR)
-    key = item_key_copy(it, key_temp);
-#endif /* #if defined(USE_FLAT_ALLOCATOR) */
-#if defined(USE_SLAB_ALLOCATOR)
-    key = ITEM_key(it);
-#endif /* #if defined(USE_SLAB_ALLOCATOR) */
-    hv = hash(key, ITEM_nkey(it), 0);
+/* hv is the key's hash value; see hash(). */
+item *assoc_find(const char *key, const size_t nkey, const uint32_t hv) {
+    return bucket_find(find_bucket(hashpower, expanding, hv), key, nkey, hv);
+}
 
-    if (expanding &&
-        (oldbucket = (hv & hashmask(hashpower - 1))) >= expand_bucket)
-    {
-        pos = &old_hashtable[oldbucket];
+/*
+ * like assoc_find(..), but without the item lock for the key.  the caller must
+ * be inside an epoch (see epoch_enter()), which keeps everything we walk from
+ * being reused under us.  chains may be rearranged while we walk them, so a
+ * miss is not authoritative; the caller must retry under the item lock.
+ */
+item *assoc_find_lockfree(const char *key, const size_t nkey, const uint32_t hv) {
+    unsigned int power;
+    bool was_expanding;
+
+    /* the tables are published before hashpower and expanding are changed, so
+     * we never index past the end of a table, even if we see a mix of old and
+     * new values. */
+    power = hashpower;
+    was_expanding = expanding;
+    memory_barrier();
+    return bucket_find(find_bucket(power, was_expanding, hv), key, nkey, hv);
+}
+
+/*
+ * returns the item whose key hashes to hv and which expires at exptime, if
+ * there is one.  the expiry queues only keep those two things about an item
+ * (see expiry.h), so this is how they find it again.  the caller must hold
+ * the item lock for hv.
+ */
+item *assoc_find_expiring(const uint32_t hv, const rel_time_t exptime) {
+    bucket_ref_t ref = find_bucket(hashpower, expanding, hv);
+    item_ptr_t iptr;
+    unsigned int i;
+
+    if (ref.index != NULL) {
+        for (i = 0; i < INDEX_SLOTS; i++) {
+            iptr = ref.index->slots[i];
+            if (ref.index->tags[i] == INDEX_TAG(hv) &&
+                iptr != NULL_ITEM_PTR &&
+                ITEM_hv(ITEM(iptr)) == hv &&
+                ITEM_exptime(ITEM(iptr)) == exptime) {
+                return ITEM(iptr);
+            }
+        }
+    }
+
+    for (iptr = *ref.chain; ITEM_PTR_IS_NULL(iptr); iptr = ITEM_PTR_h_next(iptr)) {
+        if (ITEM_hv(ITEM(iptr)) == hv &&
+            ITEM_exptime(ITEM(iptr)) == exptime) {
+            return ITEM(iptr);
+        }
+    }
+    return NULL;
+}
+
+/* starts pulling the bucket for hash value hv into the cache, ahead of a
+ * lookup.  no locks are needed; if the table changes under us, all we've lost
+ * is a prefetch. */
+void assoc_prefetch(const uint32_t hv) {
+    bucket_ref_t ref = find_bucket(hashpower, expanding, hv);
+
+    if (ref.index != NULL) {
+        prefetch(ref.index);
+    } else {
+        prefetch(ref.chain);
+    }
+}
+
+/* returns the hash value of an item's key.  it is computed when the item is
+ * allocated, so the key never has to be copied out or rehashed. */
+uint32_t assoc_item_hash(const item* it) {
+    return ITEM_hv(it);
+}
+
+
+/* returns true if the hashtable has grown past its load factor and should be
+ * expanded.  this only peeks at the counters, so callers must recheck with
+ * all the item locks held before calling do_assoc_expand(). */
+bool assoc_expand_needed(void) {
+    unsigned int limit;
+
+    if (primary_hashtable.buckets != NULL) {
+        limit = hashsize(hashpower) * INDEX_LOAD;
     } else {
-        pos = &primary_hashtable[hv & hashmask(hashpower)];
+        limit = (hashsize(hashpower) * 3) / 2;
     }
+    return (! expanding && hash_items > limit);
+}
 
-    while (*pos && (ITEM(*pos) != it)) {
-        pos = ITEM_h_next_p(ITEM(*pos));
+/* returns true if an expansion is in progress, storing the next bucket of the
+ * old table to be migrated in *bucket. */
+bool assoc_expanding(uint32_t* bucket) {
+    if (expanding) {
+        *bucket = expand_bucket;
+        return true;
     }
-    return pos;
+    return false;
 }
 
+/* grows the hashtable to the next power of 2.  the caller must hold every item
+ * lock, since this swaps the tables out from under all the buckets. */
+void do_assoc_expand(void) {
+    if (! assoc_expand_needed()) {
+        return;
+    }
 
-/* grows the hashtable to the next power of 2. */
-static void assoc_expand(void) {
     old_hashtable = primary_hashtable;
 
-    primary_hashtable = pool_calloc(hashsize(hashpower + 1), sizeof(item_ptr_t), ASSOC_POOL);
-    if (primary_hashtable) {
+    if (table_alloc(&primary_hashtable, hashpower + 1)) {
         if (settings.verbose > 1)
             fprintf(stderr, "Hash table expansion starting\n");
+        /* lock-free readers look at these without any locks; publish them in
+         * an order that never lets them index past the end of a table. */
+        expand_bucket = 0;
+        memory_barrier();
         hashpower++;
+        memory_barrier();
         expanding = true;
-        expand_bucket = 0;
-        do_assoc_move_next_bucket();
-    } else {
-        primary_hashtable = old_hashtable;
-        /* Bad news, but we can keep running. */
+        /* the migration is left to the maintenance thread. */
     }
+    /* otherwise, bad news, but we can keep running. */
 }
 
-/* migrates the next bucket to the primary hashtable if we're expanding. */
+/* migrates the next bucket to the primary hashtable if we're expanding.  the
+ * caller must hold the item lock for that bucket; the items in it all hash to
+ * the same lock, in both the old and the new table. */
 void do_assoc_move_next_bucket(void) {
+    bucket_ref_t from;
     item_ptr_t iptr, next;
-    int bucket;
-    /* this is one of the few times we totally break the storage layer
-     * abstraction.  the only way we could do this cleanly is to either:
-     *
-     * 1) Have the flat allocator malloc a block of memory and use that to
-     *    duplicate the key.  This is inefficient because malloc is an overkill
-     *    for this.
-     *
-     * 2) Have the slab allocator copy out the key as well.  This is
-     *    inefficient because it is totally unnecessary and unfairly punishes
-     *    the slab allocator.
-     */
-#if defined(USE_FLAT_ALLOCATOR)
-    char key_temp[KEY_MAX_LENGTH];
-#endif /* #if defined(USE_FLAT_ALLOCATOR) */
-    const char* key;
+    uint32_t hv;
+    unsigned int i;
 
     if (expanding) {
-        for (iptr = old_hashtable[expand_bucket]; ITEM_PTR_IS_NULL(iptr); iptr = next) {
+        from = table_bucket(&old_hashtable, expand_bucket);
+        if (from.index != NULL) {
+            for (i = 0; i < INDEX_SLOTS; i++) {
+                iptr = from.index->slots[i];
+                if (iptr != NULL_ITEM_PTR) {
+                    hv = assoc_item_hash(ITEM(iptr));
+                    bucket_insert(table_bucket(&primary_hashtable, hv & hashmask(hashpower)),
+                                  ITEM(iptr), hv);
+                }
+            }
+        }
+        for (iptr = *from.chain; ITEM_PTR_IS_NULL(iptr); iptr = next) {
             next = ITEM_PTR_h_next(iptr);
 
-#if defined(USE_FLAT_ALLOCATOR)
-            key = item_key_copy(ITEM(iptr), key_temp);
-#endif /* #if defined(USE_FLAT_ALLOCATOR) */
-#if defined(USE_SLAB_ALLOCATOR)
-            key = ITEM_key(ITEM(iptr));
-#endif /* #if defined(USE_SLAB_ALLOCATOR) */
-
-            bucket = hash(key, ITEM_nkey(ITEM(iptr)), 0) & hashmask(hashpower);
-            ITEM_set_h_next(ITEM(iptr), primary_hashtable[bucket]);
-            primary_hashtable[bucket] = iptr;
+            hv = assoc_item_hash(ITEM(iptr));
+            bucket_insert(table_bucket(&primary_hashtable, hv & hashmask(hashpower)),
+                          ITEM(iptr), hv);
         }
 
-        old_hashtable[expand_bucket] = NULL_ITEM_PTR;
+        if (from.index != NULL) {
+            memset(from.index, 0, sizeof(index_bucket_t));
+        } else {
+            *from.chain = NULL_ITEM_PTR;
+        }
 
         expand_bucket++;
         if (expand_bucket == hashsize(hashpower - 1)) {
             expanding = false;
-            pool_free(old_hashtable,
-                      (hashsize(hashpower - 1) * sizeof(item_ptr_t)),
-                      ASSOC_POOL);
+            /* wait out any lock-free readers still walking the old table. */
+            epoch_synchronize();
+            table_free(&old_hashtable, hashpower - 1);
+            expansions++;
             if (settings.verbose > 1)
                 fprintf(stderr, "Hash table expansion done\n");
         }
     }
 }
 
+/* appends the hashtable's size and expansion progress to a "stats" response.
+ * the counters are read without any locks, so they may be slightly stale. */
+size_t append_assoc_stats(char* const buffer_start, const size_t buffer_size,
+                          const size_t buffer_off, const size_t reserved) {
+    size_t off = buffer_off;
+
+    off = append_to_buffer(buffer_start, buffer_size, off, reserved,
+                           "STAT hash_power_level %u\r\n", hashpower);
+    off = append_to_buffer(buffer_start, buffer_size, off, reserved,
+                           "STAT hash_is_expanding %d\r\n", expanding ? 1 : 0);
+    off = append_to_buffer(buffer_start, buffer_size, off, reserved,
+                           "STAT hash_buckets_migrated %u\r\n", expanding ? expand_bucket : 0);
+    off = append_to_buffer(buffer_start, buffer_size, off, reserved,
+                           "STAT hash_expansions %u\r\n", expansions);
+    return off;
+}
+
 /* Note: this isn't an assoc_update.  The key must not already exist to call this */
 int assoc_insert(item *it, const char* key) {
     uint32_t hv;
-    unsigned int oldbucket;
 
-    assert(assoc_find(key, ITEM_nkey(it)) == 0);  /* shouldn't have duplicately named things defined */
-
-    hv = hash(key, ITEM_nkey(it), 0);
-    if (expanding &&
-        (oldbucket = (hv & hashmask(hashpower - 1))) >= expand_bucket)
-    {
-        ITEM_set_h_next(it, old_hashtable[oldbucket]);
-        old_hashtable[oldbucket] = ITEM_PTR(it);
-    } else {
-        ITEM_set_h_next(it, primary_hashtable[hv & hashmask(hashpower)]);
-        primary_hashtable[hv & hashmask(hashpower)] = ITEM_PTR(it);
-    }
+    hv = ITEM_hv(it);
+    assert(hv == hash(key, ITEM_nkey(it), 0));
+    assert(assoc_find(key, ITEM_nkey(it), hv) == 0);  /* shouldn't have duplicately named things defined */
+    bucket_insert(find_bucket(hashpower, expanding, hv), it, hv);
 
+    /* expansion is left to the caller (see assoc_expand_needed()), as it
+     * cannot take the other item locks from here. */
     hash_items++;
-    if (! expanding && hash_items > (hashsize(hashpower) * 3) / 2) {
-        assoc_expand();
-    }
 
     return 1;
 }
@@ -680,34 +878,71 @@ int assoc_insert(item *it, const char* key) {
  * old_it with (ITEM_key(it), ITEM_nkey(it)) -> it.  returns old_it.
  */
 void assoc_update(item* old_it, item *it) {
-    item_ptr_t* before = _hashitem_before_item(old_it);
-    assert(before != NULL &&
-           ITEM(*before) == old_it);
+    bool in_slot;
+    item_ptr_t* pos = bucket_pos(find_bucket(hashpower, expanding, assoc_item_hash(old_it)),
+                                 old_it, &in_slot);
+    assert(*pos == ITEM_PTR(old_it));
 
-    *before = ITEM_PTR(it);
+    memory_barrier();
+    *pos = ITEM_PTR(it);
 }
 
 
 void assoc_delete(const char *key, const size_t nkey) {
-    item_ptr_t* before = _hashitem_before(key, nkey);
+    uint32_t hv = hash(key, nkey, 0);
+    bucket_ref_t ref = find_bucket(hashpower, expanding, hv);
+    item* it = bucket_find(ref, key, nkey, hv);
+    item_ptr_t* pos;
+    bool in_slot;
 
-    if (*before) {
-        item_ptr_t next = ITEM_PTR_h_next(*before);
-        *before = next;
+    /* Note:  the callers don't delete things they can't find. */
+    assert(it != NULL);
+    if (it != NULL) {
+        pos = bucket_pos(ref, it, &in_slot);
+        *pos = in_slot ? NULL_ITEM_PTR : ITEM_PTR_h_next(*pos);
         hash_items--;
-        return;
     }
-    /* Note:  we never actually get here.  the callers don't delete things
-       they can't find. */
-    assert(*before != 0);
 }
 
-/* marks all items whose keys match a regular expression as expired. */
-int do_assoc_expire_regex(char *pattern) {
-#ifdef HAVE_REGEX_H
-    regex_t regex;
-    int bucket;
+/* calls fn on every item in a bucket. */
+static void bucket_walk(const bucket_ref_t ref, void (*fn)(item* it, void* arg), void* arg) {
     item_ptr_t iptr;
+    unsigned int i;
+
+    if (ref.index != NULL) {
+        for (i = 0; i < INDEX_SLOTS; i++) {
+            if (ref.index->slots[i] != NULL_ITEM_PTR) {
+                fn(ITEM(ref.index->slots[i]), arg);
+            }
+        }
+    }
+    for (iptr = *ref.chain; ITEM_PTR_IS_NULL(iptr); iptr = ITEM_PTR_h_next(iptr)) {
+        fn(ITEM(iptr), arg);
+    }
+}
+
+/* calls fn on every item whose bucket maps onto the item lock of the given
+ * stripe, in both tables.  the caller must hold that item lock, which keeps
+ * the buckets from changing, and the expand lock, which keeps the old table
+ * from being freed. */
+void do_assoc_walk_stripe(const uint32_t stripe, void (*fn)(item* it, void* arg), void* arg) {
+    uint32_t bucket;
+
+    for (bucket = ITEM_LOCK_INDEX(stripe); bucket < hashsize(hashpower); bucket += ITEM_LOCK_COUNT) {
+        bucket_walk(table_bucket(&primary_hashtable, bucket), fn, arg);
+    }
+    /* buckets that have already been migrated are empty. */
+    if (expanding) {
+        for (bucket = ITEM_LOCK_INDEX(stripe); bucket < hashsize(hashpower - 1); bucket += ITEM_LOCK_COUNT) {
+            bucket_walk(table_bucket(&old_hashtable, bucket), fn, arg);
+        }
+    }
+}
+
+#ifdef HAVE_REGEX_H
+/* marks an item expired if its key matches a regular expression. */
+static void item_expire_regex(item* it, void* arg) {
+    regex_t* regex = arg;
     /* this is one of the few times we totally break the storage layer
      * abstraction.  the only way we could do this cleanly is to either:
      *
@@ -724,40 +959,38 @@ int do_assoc_expire_regex(char *pattern) {
 #endif /* #if defined(USE_FLAT_ALLOCATOR) */
     const char* key;
 
-    if (regcomp(&regex, pattern, REG_EXTENDED | REG_NOSUB))
-        return 0;
-    for (bucket = 0; bucket < hashsize(hashpower); bucket++) {
-        for (iptr = primary_hashtable[bucket]; ITEM_PTR_IS_NULL(iptr); iptr = ITEM_PTR_h_next(iptr)) {
 #if defined(USE_FLAT_ALLOCATOR)
-            key = item_key_copy(ITEM(iptr), key_temp);
+    key = item_key_copy(it, key_temp);
 #endif /* #if defined(USE_FLAT_ALLOCATOR) */
 #if defined(USE_SLAB_ALLOCATOR)
-            key = ITEM_key(ITEM(iptr));
+    key = ITEM_key(it);
 #endif /* #if defined(USE_SLAB_ALLOCATOR) */
 
-            if (regexec(&regex, key, 0, NULL, 0) == 0) {
-                /* the item matches; mark it expired. */
-                ITEM_set_exptime(ITEM(iptr), 1);
-            }
-        }
+    if (regexec(regex, key, 0, NULL, 0) == 0) {
+        /* the item matches; mark it expired. */
+        ITEM_set_exptime(it, 1);
+    }
+}
+
+#endif
+
+/* marks all items whose keys match a regular expression as expired. */
+int do_assoc_expire_regex(char *pattern) {
+#ifdef HAVE_REGEX_H
+    regex_t regex;
+    int bucket;
+
+    if (regcomp(&regex, pattern, REG_EXTENDED | REG_NOSUB))
+        return 0;
+    for (bucket = 0; bucket < hashsize(hashpower); bucket++) {
+        bucket_walk(table_bucket(&primary_hashtable, bucket), item_expire_regex, &regex);
     }
     if (expanding) {
         for (bucket = expand_bucket; bucket < hashsize(hashpower-1); bucket++) {
-            for (iptr = old_hashtable[bucket]; ITEM_PTR_IS_NULL(iptr); iptr = ITEM_PTR_h_next(iptr)) {
-#if defined(USE_FLAT_ALLOCATOR)
-                key = item_key_copy(ITEM(iptr), key_temp);
-#endif /* #if defined(USE_FLAT_ALLOCATOR) */
-#if defined(USE_SLAB_ALLOCATOR)
-                key = ITEM_key(ITEM(iptr));
-#endif /* #if defined(USE_SLAB_ALLOCATOR) */
-
-                if (regexec(&regex, key, 0, NULL, 0) == 0) {
-                    /* the item matches; mark it expired. */
-                    ITEM_set_exptime(ITEM(iptr), 1);
-                }
-            }
+            bucket_walk(table_bucket(&old_hashtable, bucket), item_expire_regex, &regex);
         }
     }
+    regfree(&regex);
     return 1; /* success */
 #else
     return 0;
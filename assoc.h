@@ -4,13 +4,26 @@
 
 #include "items.h"
 
+/* default hashtable size, as a power of 2.  see -H. */
+#define HASHPOWER_DEFAULT 16
+
 /* associative array */
 void assoc_init(void);
-item *assoc_find(const char *key, const size_t nkey);
+item *assoc_find(const char *key, const size_t nkey, const uint32_t hv);
+item *assoc_find_lockfree(const char *key, const size_t nkey, const uint32_t hv);
+item *assoc_find_expiring(const uint32_t hv, const rel_time_t exptime);
+void assoc_prefetch(const uint32_t hv);
 int assoc_insert(item *item, const char* key);
 void assoc_update(item* old_it, item *it);
 void assoc_delete(const char *key, const size_t nkey);
+bool assoc_expand_needed(void);
+bool assoc_expanding(uint32_t* bucket);
+void do_assoc_expand(void);
 void do_assoc_move_next_bucket(void);
 uint32_t hash( const void *key, size_t length, const uint32_t initval);
+uint32_t assoc_item_hash(const item* it);
 int do_assoc_expire_regex(char *pattern);
+void do_assoc_walk_stripe(const uint32_t stripe, void (*fn)(item* it, void* arg), void* arg);
+size_t append_assoc_stats(char* const buffer_start, const size_t buffer_size,
+                          const size_t buffer_off, const size_t reserved);
 #endif /* #if !defined(_assoc_h_) */
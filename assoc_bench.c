@@ -0,0 +1,169 @@
+/* -*- Mode: C; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ * Microbenchmark for the hashtable layouts (see -I and assoc.c).
+ *
+ *     assoc-bench <chained|bucketed> [items] [lookups]
+ *
+ * fills a table with items, growing it the way the server does, then times
+ * lookups of keys that are there (hits) and keys that aren't (misses).  the
+ * table is compiled straight from assoc.c, and the stubs below stand in for
+ * the rest of the server.  run "make bench" to compare both layouts.
+ *
+ * flat storage items live in the flat storage arena, which the benchmark
+ * doesn't set up, so this only supports the slab allocator.
+ */
+#include "generic.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#if defined(USE_SLAB_ALLOCATOR)
+#include "assoc.c"
+
+struct settings_s settings;
+static stats_t bench_stats;
+
+/* the benchmark is single-threaded; nothing to lock or wait for. */
+void mt_epoch_synchronize(void) {
+}
+
+stats_t *mt_stats_get_tls(void) {
+    return &bench_stats;
+}
+
+size_t append_to_buffer(char* const buffer_start,
+                        const size_t buffer_size,
+                        const size_t buffer_off,
+                        const size_t reserved,
+                        const char* fmt,
+                        ...) {
+    return buffer_off;
+}
+
+int item_key_compare(const item* it, const char* key, const size_t nkey) {
+    if (nkey != ITEM_nkey(it)) {
+        return ITEM_nkey(it) - nkey;
+    }
+
+    return memcmp(ITEM_key_const(it), key, nkey);
+}
+
+#define KEY_LENGTH 24
+
+static item* bench_item(const char* key) {
+    size_t nkey = strlen(key);
+    item* it = calloc(1, sizeof(item) + nkey + 1);
+
+    if (it == NULL) {
+        fprintf(stderr, "out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    it->nkey = nkey;
+    memcpy(ITEM_key(it), key, nkey + 1);
+    it->hv = hash(key, nkey, 0);
+    return it;
+}
+
+static double now(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* returns the average time of a lookup, in nanoseconds.  keys is an array of
+ * nkeys keys of KEY_LENGTH bytes each, looked up in a scattered order. */
+static double time_lookups(const char* keys, const unsigned int nkeys,
+                           const unsigned int lookups, const bool expect_hit) {
+    unsigned int i, ix, found = 0;
+    double start;
+
+    start = now();
+    for (i = 0, ix = 0; i < lookups; i++) {
+        const char* key = keys + (size_t) ix * KEY_LENGTH;
+
+        if (assoc_find(key, strlen(key), hash(key, strlen(key), 0)) != NULL) {
+            found++;
+        }
+        /* a large odd stride visits every key without following the order
+         * in which they were inserted. */
+        ix = (ix + 2654435761U) % nkeys;
+    }
+    start = now() - start;
+
+    if (found != (expect_hit ? lookups : 0)) {
+        fprintf(stderr, "found %u of %u keys, expected %s\n", found, lookups,
+                expect_hit ? "all" : "none");
+        exit(EXIT_FAILURE);
+    }
+    return start * 1e9 / lookups;
+}
+
+int main(int argc, char** argv) {
+    unsigned int items = 1 << 20, lookups = 1 << 24;
+    unsigned int i;
+    uint32_t bucket;
+    char* hits;
+    char* misses;
+
+    if (argc < 2 || argc > 4) {
+        fprintf(stderr, "usage: %s <chained|bucketed> [items] [lookups]\n", argv[0]);
+        return 1;
+    }
+    if (strcmp(argv[1], "chained") == 0) {
+        settings.hash_index = HASH_INDEX_CHAINED;
+    } else if (strcmp(argv[1], "bucketed") == 0) {
+        settings.hash_index = HASH_INDEX_BUCKETED;
+    } else {
+        fprintf(stderr, "Hashtable layout must be chained or bucketed\n");
+        return 1;
+    }
+    if (argc > 2) {
+        items = atoi(argv[2]);
+    }
+    if (argc > 3) {
+        lookups = atoi(argv[3]);
+    }
+    if (items == 0 || lookups == 0) {
+        fprintf(stderr, "items and lookups must be positive\n");
+        return 1;
+    }
+    settings.hashpower_init = HASHPOWER_DEFAULT;
+
+    hits = malloc((size_t) items * KEY_LENGTH);
+    misses = malloc((size_t) items * KEY_LENGTH);
+    if (hits == NULL || misses == NULL) {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+
+    assoc_init();
+    for (i = 0; i < items; i++) {
+        snprintf(hits + (size_t) i * KEY_LENGTH, KEY_LENGTH, "key:%u", i);
+        snprintf(misses + (size_t) i * KEY_LENGTH, KEY_LENGTH, "missing:%u", i);
+        assoc_insert(bench_item(hits + (size_t) i * KEY_LENGTH),
+                     hits + (size_t) i * KEY_LENGTH);
+
+        /* grow the table as the server would, but without a maintenance
+         * thread to migrate it in the background. */
+        if (assoc_expand_needed()) {
+            do_assoc_expand();
+            while (assoc_expanding(&bucket)) {
+                do_assoc_move_next_bucket();
+            }
+        }
+    }
+
+    printf("%-8s %u items: hit %.1f ns, miss %.1f ns\n", argv[1], items,
+           time_lookups(hits, items, lookups, true),
+           time_lookups(misses, items, lookups, false));
+    return 0;
+}
+#else
+int main(int argc, char** argv) {
+    fprintf(stderr, "%s: only the slab allocator is supported\n", argv[0]);
+    return 0;
+}
+#endif /* #if defined(USE_SLAB_ALLOCATOR) */
@@ -390,6 +390,7 @@ static inline bp_handler_res_t handle_header_size_known(conn* c)
         memcpy(&c->u.empty_req, c->rcurr, bytes_needed);
         c->rcurr += bytes_needed;
         c->rbytes -= bytes_needed;
+        conn_latency_start(c, LATENCY_BINARY);
 
         if (c->bp_info.has_key == 1) {
             /*
@@ -540,7 +541,7 @@ static inline bp_handler_res_t handle_direct_receive(conn* c)
                     it = item_alloc(c->bp_key, c->u.key_value_req.keylen,
                                     ntohl(c->u.key_value_req.flags),
                                     realtime(ntohl(c->u.key_value_req.exptime)),
-                                    value_len, get_request_addr(c));
+                                    value_len, get_request_addr(c), NULL);
 
                     if (it == NULL ||
                         item_setup_receive(it, c) == false) {
@@ -709,6 +710,11 @@ static inline bp_handler_res_t handle_process(conn* c)
             assert(0);
     }
 
+    /* quiet commands may not have anything to send. */
+    if (! settings.latency_to_send || c->state != conn_bp_writing) {
+        conn_latency_finish(c);
+    }
+
     return retval;
 }
 
@@ -719,6 +725,7 @@ static inline bp_handler_res_t handle_writing(conn* c)
 
     switch (transmit(c)) {
         case TRANSMIT_COMPLETE:
+            conn_latency_finish(c);
             c->icurr = c->ilist;
             while (c->ileft > 0) {
                 item *it = *(c->icurr);
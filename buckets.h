@@ -1,11 +0,0 @@
-#ifndef BUCKETS_RANGE
-#define BUCKETS_RANGE(start, end, skip)
-#endif
-
-BUCKETS_RANGE (0, 128, 1)
-BUCKETS_RANGE (128, 1024, 8)
-BUCKETS_RANGE (1024, 8192, 64)
-BUCKETS_RANGE (8192, 65536, 512)
-BUCKETS_RANGE (65536, 1048576, 4096)
-
-#undef BUCKETS_RANGE
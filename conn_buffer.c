@@ -7,6 +7,11 @@
 #define CONN_BUFFER_MODULE
 #include "memcached.h"
 
+#if defined(USE_NUMA)
+#include <numa.h>
+#include <numaif.h>
+#endif /* #if defined(USE_NUMA) */
+
 #include "conn_buffer.h"
 
 // this will enable the rigorous checking of the free list following any
@@ -240,6 +245,23 @@ static conn_buffer_t* remove_conn_buffer_from_freelist(conn_buffer_group_t* cbg,
 }
 
 
+#if defined(USE_NUMA)
+/**
+ * prefer the given node for the pages of a buffer.  this is only a placement
+ * hint, so failures are ignored; if flags has MPOL_MF_MOVE, pages that are
+ * already resident are migrated too.
+ */
+static void place_conn_buffer(conn_buffer_t* buffer, int node, unsigned flags) {
+    struct bitmask* nodes = numa_allocate_nodemask();
+
+    numa_bitmask_setbit(nodes, node);
+    mbind(buffer, CONN_BUFFER_SIZE, MPOL_PREFERRED, nodes->maskp,
+          nodes->size + 1, flags);
+    numa_bitmask_free(nodes);
+}
+#endif /* #if defined(USE_NUMA) */
+
+
 static conn_buffer_t* make_conn_buffer(conn_buffer_group_t* cbg) {
     conn_buffer_t* buffer;
 
@@ -260,6 +282,12 @@ static conn_buffer_t* make_conn_buffer(conn_buffer_group_t* cbg) {
         return NULL;
     }
 
+#if defined(USE_NUMA)
+    if (cbg->settings.node >= 0) {
+        place_conn_buffer(buffer, cbg->settings.node, 0);
+    }
+#endif /* #if defined(USE_NUMA) */
+
     buffer->signature = CONN_BUFFER_SIGNATURE;
     buffer->max_rusage = round_up_to_page(CONN_BUFFER_HEADER_SZ);
     buffer->in_freelist = false;
@@ -413,6 +441,9 @@ static void conn_buffer_group_init(conn_buffer_group_t* const cbg,
     cbg->settings.buffer_rsize_limit = buffer_rsize_limit;
     cbg->settings.total_rsize_range_bottom = total_rsize_range_bottom;
     cbg->settings.total_rsize_range_top = total_rsize_range_top;
+#if defined(USE_NUMA)
+    cbg->settings.node = -1;
+#endif /* #if defined(USE_NUMA) */
 
     for (i = 0; i < initial_buffer_count; i ++) {
         conn_buffer_t* buffer;
@@ -621,6 +652,28 @@ bool assign_thread_id_to_conn_buffer_group(unsigned group, pthread_t tid) {
 }
 
 
+#if defined(USE_NUMA)
+/**
+ * place a connection buffer group's buffers on a NUMA node, normally the one
+ * its thread is pinned to.  the initial buffers were made by the main thread,
+ * so they are moved over.  must be called before the group's thread starts.
+ */
+void conn_buffer_group_set_node(unsigned group, int node) {
+    conn_buffer_group_t* cbg;
+    size_t ix;
+
+    assert(group < l.cbg_count);
+    cbg = &l.cbg_list[group];
+    assert(cbg->settings.tid == 0);
+    cbg->settings.node = node;
+
+    for (ix = 0; ix < cbg->num_free_buffers; ix ++) {
+        place_conn_buffer(cbg->free_buffers[ix], node, MPOL_MF_MOVE);
+    }
+}
+#endif /* #if defined(USE_NUMA) */
+
+
 char* conn_buffer_stats(size_t* result_size) {
     size_t bufsize = 2048, offset = 0;
     char* buffer = malloc(bufsize);
@@ -91,6 +91,11 @@ struct conn_buffer_group_s {
                                          * this value *or* there's nothing else
                                          * on the freelist to return. */
         size_t page_size;               /* page size on the OS. */
+#if defined(USE_NUMA)
+        int node;                       /* NUMA node the buffers are placed
+                                         * on, or -1 to leave it to first
+                                         * touch. */
+#endif /* #if defined(USE_NUMA) */
     } settings;
 
     conn_buffer_stats_t stats;
@@ -112,6 +117,9 @@ extern void conn_buffer_init(unsigned threads,
 
 extern conn_buffer_group_t* get_conn_buffer_group(unsigned thread);
 extern bool assign_thread_id_to_conn_buffer_group(unsigned group, pthread_t tid);
+#if defined(USE_NUMA)
+extern void conn_buffer_group_set_node(unsigned group, int node);
+#endif /* #if defined(USE_NUMA) */
 
 CB_STATIC_DECL(int cb_freelist_check(conn_buffer_group_t* cbg));
 
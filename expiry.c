@@ -0,0 +1,315 @@
+/* -*- Mode: C; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+
+#include "generic.h"
+
+#include <assert.h>
+#include <string.h>
+
+#include "assoc.h"
+#include "expiry.h"
+#include "items.h"
+#include "memcached.h"
+
+/* how far ahead the calendar reaches. */
+#define EXPIRY_HORIZON (EXPIRY_SLOTS * EXPIRY_SLOT_SECS)
+
+/* how many entries a bucket starts with room for.  a power of two. */
+#define EXPIRY_SLOT_INITIAL 64
+
+/* the expiration time of an entry that was removed.  lookups carry on past
+ * it, as past any other entry; an exptime of 0 marks an entry never used. */
+#define EXPIRY_REMOVED ((rel_time_t) -1)
+
+/* an allocation looks at no more than this many due entries for each item it
+ * wants reclaimed; the rest may be stale. */
+#define EXPIRY_RECLAIM_TRIES 4
+
+/* a bucket is a table of entries, open-addressed by hash value, so that an
+ * item's entry can be found again when it's unlinked. */
+typedef struct expiry_slot_s expiry_slot_t;
+struct expiry_slot_s {
+    expiry_entry_t* entries;
+    uint32_t count;             /* entries in use. */
+    uint32_t used;              /* entries in use or removed. */
+    uint32_t capacity;          /* a power of two, or 0. */
+    uint32_t cursor;            /* while the bucket is being taken, the
+                                 * entries below this are still to be looked
+                                 * at. */
+    bool taking;
+};
+
+static struct {
+    expiry_slot_t slots[EXPIRY_SLOTS];
+    rel_time_t next;            /* the start of the seconds covered by the
+                                 * next bucket to come due.  always a multiple
+                                 * of EXPIRY_SLOT_SECS. */
+    expiry_entry_t* due;        /* entries filed once their bucket was
+                                 * already the next to come due. */
+    uint32_t due_count;
+    uint32_t due_capacity;
+    size_t queued;              /* entries in the calendar. */
+    uint64_t dropped;           /* entries we had no room to file. */
+} eq;
+
+
+static expiry_slot_t* slot_for(const rel_time_t t) {
+    return &eq.slots[(t / EXPIRY_SLOT_SECS) % EXPIRY_SLOTS];
+}
+
+
+static void slot_free(expiry_slot_t* slot) {
+    if (slot->entries != NULL) {
+        pool_free(slot->entries, sizeof(expiry_entry_t) * slot->capacity, EXPIRY_POOL);
+    }
+    slot->entries = NULL;
+    slot->count = slot->used = slot->capacity = 0;
+}
+
+
+static void slot_insert(expiry_slot_t* slot, const uint32_t hv, const rel_time_t exptime) {
+    uint32_t ix = hv & (slot->capacity - 1);
+
+    while (slot->entries[ix].exptime != 0 &&
+           slot->entries[ix].exptime != EXPIRY_REMOVED) {
+        ix = (ix + 1) & (slot->capacity - 1);
+    }
+    if (slot->entries[ix].exptime == 0) {
+        slot->used++;
+    }
+    slot->entries[ix].hv = hv;
+    slot->entries[ix].exptime = exptime;
+    slot->count++;
+}
+
+
+/* makes room for one more entry, dropping the removed ones.  if the bucket is
+ * being taken, it's looked at from the top again. */
+static bool slot_reserve(expiry_slot_t* slot) {
+    expiry_entry_t* old = slot->entries;
+    uint32_t old_capacity = slot->capacity, capacity = EXPIRY_SLOT_INITIAL, ix;
+
+    if ((slot->used + 1) * 4 <= slot->capacity * 3) {
+        return true;
+    }
+
+    while (capacity < (slot->count + 1) * 2) {
+        capacity *= 2;
+    }
+    slot->entries = pool_malloc(sizeof(expiry_entry_t) * capacity, EXPIRY_POOL);
+    if (slot->entries == NULL) {
+        slot->entries = old;
+        return false;
+    }
+    memset(slot->entries, 0, sizeof(expiry_entry_t) * capacity);
+    slot->capacity = capacity;
+    slot->count = slot->used = 0;
+    for (ix = 0; ix < old_capacity; ix++) {
+        if (old[ix].exptime != 0 && old[ix].exptime != EXPIRY_REMOVED) {
+            slot_insert(slot, old[ix].hv, old[ix].exptime);
+        }
+    }
+    if (old != NULL) {
+        pool_free(old, sizeof(expiry_entry_t) * old_capacity, EXPIRY_POOL);
+    }
+    if (slot->taking) {
+        slot->cursor = slot->capacity;
+    }
+    return true;
+}
+
+
+void expiry_init(const rel_time_t now) {
+    memset(&eq, 0, sizeof(eq));
+    eq.next = now - (now % EXPIRY_SLOT_SECS);
+}
+
+
+void expiry_add(const uint32_t hv, const rel_time_t exptime) {
+    expiry_slot_t* slot;
+
+    if (exptime == 0) {
+        return;
+    }
+
+    if (exptime < eq.next + EXPIRY_SLOT_SECS) {
+        /* its bucket is the next to come due, and may be being taken. */
+        if (eq.due_count == eq.due_capacity) {
+            uint32_t capacity = eq.due_capacity == 0 ? EXPIRY_SLOT_INITIAL : eq.due_capacity * 2;
+            expiry_entry_t* due = pool_realloc(eq.due,
+                                               sizeof(expiry_entry_t) * capacity,
+                                               sizeof(expiry_entry_t) * eq.due_capacity,
+                                               EXPIRY_POOL);
+
+            if (due == NULL) {
+                eq.dropped++;
+                return;
+            }
+            eq.due = due;
+            eq.due_capacity = capacity;
+        }
+        eq.due[eq.due_count].hv = hv;
+        eq.due[eq.due_count].exptime = exptime;
+        eq.due_count++;
+        eq.queued++;
+        return;
+    }
+
+    /* items expiring beyond the horizon wrap around, and are passed over
+     * until their bucket comes up on the right lap. */
+    slot = slot_for(exptime);
+    if (! slot_reserve(slot)) {
+        eq.dropped++;
+        return;
+    }
+    slot_insert(slot, hv, exptime);
+    eq.queued++;
+}
+
+
+void expiry_remove(const uint32_t hv, const rel_time_t exptime) {
+    expiry_slot_t* slot;
+    uint32_t ix;
+
+    /* entries that are already due are taken soon enough. */
+    if (exptime == 0 || exptime < eq.next) {
+        return;
+    }
+
+    slot = slot_for(exptime);
+    if (slot->count == 0) {
+        return;
+    }
+    for (ix = hv & (slot->capacity - 1);
+         slot->entries[ix].exptime != 0;
+         ix = (ix + 1) & (slot->capacity - 1)) {
+        if (slot->entries[ix].hv == hv && slot->entries[ix].exptime == exptime) {
+            slot->entries[ix].exptime = EXPIRY_REMOVED;
+            slot->count--;
+            eq.queued--;
+            if (slot->count == 0 && ! slot->taking) {
+                slot_free(slot);
+            }
+            return;
+        }
+    }
+}
+
+
+size_t expiry_take_due(const rel_time_t now, expiry_entry_t* due, const size_t max) {
+    size_t n = 0;
+
+    if (eq.queued == 0) {
+        /* nothing to take, so skip straight ahead. */
+        if (now - (now % EXPIRY_SLOT_SECS) > eq.next) {
+            expiry_slot_t* slot = slot_for(eq.next);
+
+            if (slot->taking) {
+                slot->taking = false;
+                slot_free(slot);
+            }
+            eq.next = now - (now % EXPIRY_SLOT_SECS);
+        }
+        return 0;
+    }
+
+    /* a bucket comes due once the last of its seconds has passed. */
+    while (n < max && eq.next + EXPIRY_SLOT_SECS - 1 <= now) {
+        expiry_slot_t* slot = slot_for(eq.next);
+
+        while (eq.due_count > 0 && n < max) {
+            due[n++] = eq.due[--eq.due_count];
+            eq.queued--;
+        }
+
+        if (! slot->taking) {
+            slot->taking = true;
+            slot->cursor = slot->capacity;
+        }
+        while (slot->cursor > 0 && n < max) {
+            expiry_entry_t* entry = &slot->entries[--slot->cursor];
+
+            if (entry->exptime == 0 || entry->exptime == EXPIRY_REMOVED ||
+                entry->exptime > now) {
+                /* unused, removed, or due on a later lap. */
+                continue;
+            }
+            due[n++] = *entry;
+            entry->exptime = EXPIRY_REMOVED;
+            slot->count--;
+            eq.queued--;
+        }
+
+        if (slot->cursor > 0 || eq.due_count > 0) {
+            break;
+        }
+        slot->taking = false;
+        if (slot->count == 0) {
+            slot_free(slot);
+        }
+        eq.next += EXPIRY_SLOT_SECS;
+    }
+
+    return n;
+}
+
+
+bool do_expiry_reap(const expiry_entry_t* entry) {
+    stats_t *stats = STATS_GET_TLS();
+    item* it = assoc_find_expiring(entry->hv, entry->exptime);
+
+    /* delete-locked items are the deferred deletes' to reclaim. */
+    if (it == NULL || ITEM_is_deleted(it) ||
+        ITEM_exptime(it) > current_time) {
+        return false;
+    }
+
+    do_item_unlink(it, UNLINK_IS_EXPIRED, NULL);
+    STATS_LOCK(stats);
+    stats->expired_reclaimed++;
+    STATS_UNLOCK(stats);
+    return true;
+}
+
+
+size_t do_expiry_reclaim(const size_t max) {
+    expiry_entry_t due[EXPIRY_RECLAIM_TRIES];
+    size_t reclaimed = 0, tries = max * EXPIRY_RECLAIM_TRIES;
+
+    while (reclaimed < max && tries > 0) {
+        size_t count, ix;
+
+        count = expiry_take_due(current_time, due,
+                                tries < EXPIRY_RECLAIM_TRIES ? tries : EXPIRY_RECLAIM_TRIES);
+        if (count == 0) {
+            break;
+        }
+        tries -= count;
+
+        for (ix = 0; ix < count; ix++) {
+            if (reclaimed < max && item_trylock(due[ix].hv)) {
+                if (do_expiry_reap(&due[ix])) {
+                    reclaimed++;
+                }
+                item_unlock(due[ix].hv);
+            } else {
+                expiry_add(due[ix].hv, due[ix].exptime);
+            }
+        }
+    }
+
+    return reclaimed;
+}
+
+
+/* appends the state of the calendar to a "stats" response.  the counters are
+ * read without any locks, so they may be slightly stale. */
+size_t append_expiry_stats(char* const buffer_start, const size_t buffer_size,
+                           const size_t buffer_off, const size_t reserved) {
+    size_t off = buffer_off;
+
+    off = append_to_buffer(buffer_start, buffer_size, off, reserved,
+                           "STAT expiry_queued %lu\r\n", (unsigned long) eq.queued);
+    off = append_to_buffer(buffer_start, buffer_size, off, reserved,
+                           "STAT expiry_dropped %" PRINTF_INT64_MODIFIER "u\r\n", eq.dropped);
+    return off;
+}
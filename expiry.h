@@ -0,0 +1,70 @@
+/* -*- Mode: C; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+
+/**
+ * Expiry queues: every item stored with an expiration time is filed in a
+ * calendar of EXPIRY_SLOTS buckets, each covering EXPIRY_SLOT_SECS seconds of
+ * expiration times.  once a bucket's seconds have all passed, the items in it
+ * have expired and can be reclaimed without waiting for a get to notice them
+ * or for the LRU to push them out.
+ *
+ * a bucket only holds the hash value and expiration time of each item, which
+ * is enough to find it again in the hashtable (see assoc_find_expiring()).
+ * an item's entry is removed when it's unlinked, so a key that is set over and
+ * over doesn't leave a trail of stale entries behind.  the calendar reaches
+ * EXPIRY_SLOTS * EXPIRY_SLOT_SECS seconds ahead; items expiring later than
+ * that wrap around, and are passed over until their bucket comes up on the
+ * right lap.
+ *
+ * everything here must be called with the cache lock held.
+ */
+
+#include "generic.h"
+
+#if !defined(_expiry_h_)
+#define _expiry_h_
+
+#include "memcached.h"
+
+#define EXPIRY_SLOTS     4096
+#define EXPIRY_SLOT_SECS 4
+
+/* how many expired items the slab allocator reclaims when it runs out of
+ * memory, before it turns to the LRU. */
+#define EXPIRY_RECLAIM_ON_ALLOC 4
+
+typedef struct expiry_entry_s expiry_entry_t;
+struct expiry_entry_s {
+    uint32_t hv;
+    rel_time_t exptime;
+};
+
+extern void expiry_init(const rel_time_t now);
+
+/* files an item that has just been linked.  items without an expiration time
+ * are ignored.  if there's no memory to file it, the item will be reclaimed
+ * lazily as before. */
+extern void expiry_add(const uint32_t hv, const rel_time_t exptime);
+
+/* removes the entry of an item that is being unlinked, or whose expiration
+ * time is about to change.  entries that are already due are left to be
+ * taken, and then aren't found in the hashtable. */
+extern void expiry_remove(const uint32_t hv, const rel_time_t exptime);
+
+/* takes up to max entries whose expiration time has passed out of the
+ * calendar, and returns how many it stored in due.  if it returns max, more
+ * may be due. */
+extern size_t expiry_take_due(const rel_time_t now, expiry_entry_t* due, const size_t max);
+
+/* reclaims the item an entry refers to, if it's still there and has expired.
+ * the caller must hold the item lock for entry->hv as well. */
+extern bool do_expiry_reap(const expiry_entry_t* entry);
+
+/* reclaims up to max expired items, for an allocation that is short of
+ * memory.  only tries for the item locks; entries whose locks are busy are
+ * filed again. */
+extern size_t do_expiry_reclaim(const size_t max);
+
+extern size_t append_expiry_stats(char* const buffer_start, const size_t buffer_size,
+                                  const size_t buffer_off, const size_t reserved);
+
+#endif /* #if !defined(_expiry_h_) */
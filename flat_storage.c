@@ -8,8 +8,12 @@
  */
 
 #include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <stdlib.h>
 #include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include "generic.h"
 
@@ -17,11 +21,19 @@
 
 #define FLAT_STORAGE_MODULE
 
+#include "admission.h"
+#include "hugepage.h"
 #include "assoc.h"
+#include "expiry.h"
 #include "flat_storage.h"
 #include "memcached.h"
 #include "stats.h"
 
+#if defined(USE_NUMA)
+#include <numa.h>
+#include <numaif.h>
+#endif /* #if defined(USE_NUMA) */
+
 typedef enum {
     COALESCE_NO_PROGRESS,               /* no progress was made in coalescing a block */
     COALESCE_LARGE_CHUNK_FORMED,        /* a large chunk was formed */
@@ -29,16 +41,197 @@ typedef enum {
                                          * forward progress was made. */
 } coalesce_progress_t;
 
+/* the item locks held while moving items off a broken chunk, and the items
+ * that own chunks on it, which are frozen while they are moved. */
+typedef struct {
+    uint32_t hv[SMALL_CHUNKS_PER_LARGE_CHUNK];
+    unsigned count;
+    item* owners[SMALL_CHUNKS_PER_LARGE_CHUNK];
+    unsigned owner_count;
+} broken_chunk_locks_t;
+
 
 flat_storage_info_t fsi;
 
 
+/**
+ * with -e, the arena lives in a file, ideally on tmpfs or a DAX mount, so
+ * that the items outlive the process.  the file starts with a header page
+ * that describes the arena after it.  a clean shutdown saves the tails of the
+ * LRU segments and marks the header clean; a restart that finds a clean
+ * header with the same geometry keeps the items, and rebuilds the free lists,
+ * the hashtable and the LRU from them.  anything else starts empty.
+ */
+#define MEMORY_FILE_MAGIC     "mcflat01"
+#define MEMORY_FILE_HEADER_SZ (LARGE_CHUNK_SZ < 4096 ? 4096 : LARGE_CHUNK_SZ)
+
+typedef struct memory_file_header_s memory_file_header_t;
+struct memory_file_header_s {
+    char magic[8];
+    uint32_t large_chunk_sz;
+    uint32_t small_chunk_sz;
+    uint32_t title_header_sz;
+    uint32_t clean;                     /* nonzero if saved by a clean
+                                         * shutdown. */
+    uint64_t maxbytes;
+    uint64_t initialized;               /* bytes of the arena made into
+                                         * chunks. */
+    int64_t started;                    /* what the items' times are relative
+                                         * to. */
+    chunkptr_t lru_tail[LRU_SEGMENTS];
+};
+
+static struct {
+    memory_file_header_t* header;       /* NULL without -e. */
+    bool restored;                      /* the arena held items at startup. */
+    chunkptr_t lru_tail[LRU_SEGMENTS];  /* where the saved LRU segments end. */
+    unsigned int restored_items;
+} mf;
+
+
 /** forward declarations */
 static void free_list_push(chunk_t* chunk, chunk_type_t chunk_type, bool try_merge);
 static chunk_t* free_list_pop(chunk_type_t chunk_type);
 static void break_large_chunk(chunk_t* chunk);
 static void unbreak_large_chunk(large_chunk_t* lc, bool mandatory);
 static void item_free(item *it);
+static void item_retire(item *it);
+static void flat_storage_reclaim(void);
+static void item_lru_bump(item* it);
+static void item_lru_balance(void);
+static void memory_file_recount(void);
+static void memory_file_drop_unlinked(void);
+
+
+#if defined(USE_NUMA)
+/**
+ * spread the arena over the NUMA nodes as -z asks, before any of it is paged
+ * in.  partitioning gives each node one contiguous slice, in LARGE_CHUNK_SZ
+ * units, with the last node taking the remainder.  the slices are preferred
+ * rather than strict, so a full node spills over instead of failing.
+ */
+static void flat_storage_place(size_t maxbytes) {
+    struct bitmask* nodes;
+    struct bitmask* node;
+    int n, nodes_left;
+    char* start = (char*) fsi.flat_storage_start;
+    char* end = start + maxbytes;
+    size_t slice;
+
+    if (settings.arena_numa == ARENA_NUMA_DEFAULT ||
+        numa_available() < 0) {
+        return;
+    }
+
+    nodes = numa_get_mems_allowed();
+    if (settings.arena_numa == ARENA_NUMA_INTERLEAVE) {
+        if (mbind(start, maxbytes, MPOL_INTERLEAVE,
+                  nodes->maskp, nodes->size + 1, 0) != 0) {
+            perror("failed to interleave the item arena");
+        }
+        numa_bitmask_free(nodes);
+        return;
+    }
+
+    nodes_left = numa_bitmask_weight(nodes);
+    slice = maxbytes / nodes_left / LARGE_CHUNK_SZ * LARGE_CHUNK_SZ;
+    node = numa_allocate_nodemask();
+    for (n = 0; n <= numa_max_node() && start < end; n ++) {
+        size_t len;
+
+        if (! numa_bitmask_isbitset(nodes, n)) {
+            continue;
+        }
+
+        len = (--nodes_left == 0) ? (size_t) (end - start) : slice;
+        if (len == 0) {
+            continue;
+        }
+
+        numa_bitmask_clearall(node);
+        numa_bitmask_setbit(node, n);
+        if (mbind(start, len, MPOL_PREFERRED, node->maskp, node->size + 1, 0) != 0) {
+            perror("failed to partition the item arena");
+            break;
+        }
+        start += len;
+    }
+    numa_bitmask_free(node);
+    numa_bitmask_free(nodes);
+}
+#endif /* #if defined(USE_NUMA) */
+
+
+/* maps the arena from the memory file, with a header page in front of it.
+ * returns true if the file held a cleanly saved arena of the same geometry,
+ * whose items should be kept. */
+static bool memory_file_map(size_t maxbytes) {
+    size_t len = MEMORY_FILE_HEADER_SZ + maxbytes;
+    memory_file_header_t saved;
+    struct stat st;
+    bool restore = false;
+    int fd;
+
+    fd = open(settings.memory_file, O_RDWR | O_CREAT, 0600);
+    if (fd == -1 || fstat(fd, &st) != 0) {
+        perror(settings.memory_file);
+        exit(EXIT_FAILURE);
+    }
+
+    if (st.st_size != 0) {
+        if (pread(fd, &saved, sizeof(saved), 0) != sizeof(saved) ||
+            (size_t) st.st_size != len ||
+            memcmp(saved.magic, MEMORY_FILE_MAGIC, sizeof(saved.magic)) != 0 ||
+            saved.large_chunk_sz != LARGE_CHUNK_SZ ||
+            saved.small_chunk_sz != SMALL_CHUNK_SZ ||
+            saved.title_header_sz != TITLE_CHUNK_HEADER_SZ ||
+            saved.maxbytes != maxbytes ||
+            saved.initialized > maxbytes ||
+            saved.initialized % FLAT_STORAGE_INCREMENT_DELTA != 0) {
+            fprintf(stderr, "Memory file %s doesn't match this server, starting empty\n",
+                    settings.memory_file);
+        } else if (! saved.clean) {
+            fprintf(stderr, "Memory file %s wasn't saved cleanly, starting empty\n",
+                    settings.memory_file);
+        } else {
+            restore = (saved.initialized != 0);
+        }
+    }
+
+    /* truncating first throws away whatever the file held before. */
+    if (! restore &&
+        (ftruncate(fd, 0) != 0 || ftruncate(fd, len) != 0)) {
+        perror(settings.memory_file);
+        exit(EXIT_FAILURE);
+    }
+
+    fsi.mmap_start = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (fsi.mmap_start == MAP_FAILED) {
+        perror(settings.memory_file);
+        exit(EXIT_FAILURE);
+    }
+    mf.header = fsi.mmap_start;
+    fsi.flat_storage_start = (large_chunk_t*) ((char*) fsi.mmap_start + MEMORY_FILE_HEADER_SZ);
+
+    /* until the next clean shutdown, what's in the file can't be trusted. */
+    mf.header->clean = 0;
+    msync(mf.header, MEMORY_FILE_HEADER_SZ, MS_SYNC);
+
+    if (restore) {
+        memcpy(mf.lru_tail, saved.lru_tail, sizeof(mf.lru_tail));
+        started = saved.started;
+        fsi.uninitialized_start = fsi.flat_storage_start + (saved.initialized / LARGE_CHUNK_SZ);
+        fsi.unused_memory = maxbytes - saved.initialized;
+    } else {
+        memcpy(mf.header->magic, MEMORY_FILE_MAGIC, sizeof(mf.header->magic));
+        mf.header->large_chunk_sz = LARGE_CHUNK_SZ;
+        mf.header->small_chunk_sz = SMALL_CHUNK_SZ;
+        mf.header->title_header_sz = TITLE_CHUNK_HEADER_SZ;
+        mf.header->maxbytes = maxbytes;
+    }
+    return restore;
+}
 
 
 /**
@@ -50,36 +243,43 @@ void flat_storage_init(size_t maxbytes) {
     always_assert(fsi.initialized == false);
     always_assert(maxbytes % LARGE_CHUNK_SZ == 0);
     always_assert(maxbytes % FLAT_STORAGE_INCREMENT_DELTA == 0);
-    fsi.mmap_start = mmap(NULL,
-                          maxbytes + LARGE_CHUNK_SZ - 1, /* alloc extra to
-                                                          * ensure we can align
-                                                          * our buffers. */
-                          PROT_READ | PROT_WRITE,
-                          MAP_PRIVATE | MAP_ANON,
-                          -1,
-                          0);
-    if (fsi.mmap_start == MAP_FAILED) {
-        fprintf(stderr, "failed to mmap memory\n");
-        exit(EXIT_FAILURE);
-    }
+    if (settings.memory_file != NULL) {
+        mf.restored = memory_file_map(maxbytes);
+    } else {
+        fsi.mmap_start = hugepage_map(maxbytes + LARGE_CHUNK_SZ - 1); /* alloc extra to
+                                                                       * ensure we can align
+                                                                       * our buffers. */
+        if (fsi.mmap_start == NULL) {
+            fprintf(stderr, "failed to mmap memory\n");
+            exit(EXIT_FAILURE);
+        }
 
-    /* ensure the alignment of mmap'ed region. */
-    addr = (intptr_t) fsi.mmap_start;
-    addr = ((addr + LARGE_CHUNK_SZ - 1) / LARGE_CHUNK_SZ) * LARGE_CHUNK_SZ;
-    fsi.flat_storage_start = (void*) addr;
-    fsi.uninitialized_start = fsi.flat_storage_start;
-    fsi.unused_memory = maxbytes;
+        /* ensure the alignment of mmap'ed region. */
+        addr = (intptr_t) fsi.mmap_start;
+        addr = ((addr + LARGE_CHUNK_SZ - 1) / LARGE_CHUNK_SZ) * LARGE_CHUNK_SZ;
+        fsi.flat_storage_start = (void*) addr;
+    }
+    if (! mf.restored) {
+        fsi.uninitialized_start = fsi.flat_storage_start;
+        fsi.unused_memory = maxbytes;
+    }
+#if defined(USE_NUMA)
+    flat_storage_place(maxbytes);
+#endif /* #if defined(USE_NUMA) */
 
     fsi.large_free_list = NULL_CHUNKPTR;
     fsi.large_free_list_sz = 0;
     fsi.small_free_list = NULL_CHUNKPTR;
     fsi.small_free_list_sz = 0;
-    fsi.lru_head = NULL_CHUNKPTR;
-    fsi.lru_tail = NULL_CHUNKPTR;
+    memset(fsi.lru, 0, sizeof(fsi.lru));
 
-    /* shouldn't fail here.... right? */
-    flat_storage_alloc();
-    always_assert(fsi.large_free_list_sz != 0);
+    if (mf.restored) {
+        memory_file_recount();
+    } else {
+        /* shouldn't fail here.... right? */
+        flat_storage_alloc();
+    }
+    always_assert(fsi.large_free_list_sz != 0 || mf.restored);
 
     fsi.initialized = 1;
 }
@@ -118,11 +318,16 @@ void item_init(void) {
     always_assert( &(((item*) 0)->empty_header.exptime) == &(((item*) 0)->small_title.exptime) );
     always_assert( &(((item*) 0)->empty_header.nbytes) == &(((item*) 0)->large_title.nbytes) );
     always_assert( &(((item*) 0)->empty_header.nbytes) == &(((item*) 0)->small_title.nbytes) );
+    always_assert( &(((item*) 0)->empty_header.hv) == &(((item*) 0)->large_title.hv) );
+    always_assert( &(((item*) 0)->empty_header.hv) == &(((item*) 0)->small_title.hv) );
     always_assert( &(((item*) 0)->empty_header.refcount) == &(((item*) 0)->large_title.refcount) );
     always_assert( &(((item*) 0)->empty_header.refcount) == &(((item*) 0)->small_title.refcount) );
     always_assert( &(((item*) 0)->empty_header.nkey) == &(((item*) 0)->large_title.nkey) );
     always_assert( &(((item*) 0)->empty_header.nkey) == &(((item*) 0)->small_title.nkey) );
 
+    /* the refcount is updated atomically, so it must be naturally aligned. */
+    always_assert( (offsetof(title_chunk_header_t, refcount) % sizeof(unsigned short)) == 0 );
+
     /* make sure that the casting functions in flat_storage.h are sane. */
     always_assert( (void*) &(((item*) 0)->small_title) == ((void*) 0));
     always_assert( (void*) &(((item*) 0)->large_title) == ((void*) 0));
@@ -393,25 +598,132 @@ static void unbreak_large_chunk(large_chunk_t* lc, bool mandatory) {
 
 
 /*
- * gets the oldest item on the LRU with refcount == 0.
+ * gets the oldest item on the LRU with refcount == 0, looking in the
+ * probationary segment before the protected one.
  */
 FA_STATIC item* get_lru_item(void) {
     int i;
+    lru_segment_t segment;
     item* iter, * prev;
 
-    for (i = 0,
-             iter = fsi.lru_tail;
-         i < LRU_SEARCH_DEPTH && iter != NULL_CHUNKPTR;
-         i ++, iter = prev) {
-        /* large chunk */
-        if (iter->empty_header.refcount == 0) {
-            return iter;
+    for (segment = LRU_PROBATION; segment < LRU_SEGMENTS; segment ++) {
+        for (i = 0,
+                 iter = fsi.lru[segment].tail;
+             i < LRU_SEARCH_DEPTH && iter != NULL_CHUNKPTR;
+             i ++, iter = prev) {
+            /* large chunk */
+            if (iter->empty_header.refcount == 0) {
+                return iter;
+            }
+
+            prev = get_item_from_chunk(get_chunk_address(iter->empty_header.prev));
         }
+    }
+
+    return NULL;
+}
+
 
+/*
+ * like get_lru_item(..), but only looks in one segment, and also acquires the
+ * item lock for the item it returns, so that it can be unlinked.  the cache
+ * lock is already held, so we can only try for the item locks; items whose
+ * locks are busy are skipped.
+ *
+ * items that were hit since they were last moved get the move they were
+ * promised on the way, rather than being returned.  if too many of them are
+ * in the way, the rest are returned regardless.
+ *
+ * with size-aware eviction, the items that could go are weighed against each
+ * other instead, and the one whose size earns the fewest hits per byte of
+ * memory it frees is returned (GreedyDual-Size, with the hit densities of the
+ * cost-benefit stats for the credit).  a large item that is seldom hit goes
+ * before several small ones that are hit more often.  if that item's lock is
+ * busy, the first item that can be locked goes instead.
+ */
+static item* get_evictable_segment_item(lru_segment_t segment, bool size_aware,
+                                        uint32_t* hv, int* bumps) {
+    int i;
+    item* iter, * prev, * best = NULL, * first = NULL;
+    double best_density = 0;
+
+    for (i = 0,
+             iter = fsi.lru[segment].tail;
+         i < LRU_SEARCH_DEPTH && iter != NULL;
+         iter = prev) {
         prev = get_item_from_chunk(get_chunk_address(iter->empty_header.prev));
+
+        if (ITEM_is_bumped(iter) && *bumps < LRU_SEARCH_DEPTH) {
+            item_lru_bump(iter);
+            (*bumps) ++;
+            continue;
+        }
+        i ++;
+
+        if (iter->empty_header.refcount != 0) {
+            continue;
+        }
+
+        if (size_aware) {
+            double density = cost_benefit_density(ITEM_nkey(iter) + ITEM_nbytes(iter)) /
+                ITEM_ntotal(iter);
+
+            if (first == NULL) {
+                first = iter;
+            }
+            if (best == NULL || density < best_density) {
+                best = iter;
+                best_density = density;
+            }
+            continue;
+        }
+
+        if (item_trylock(*hv = assoc_item_hash(iter))) {
+            /* the refcount may have been bumped before we got the lock. */
+            if (iter->empty_header.refcount == 0) {
+                return iter;
+            }
+            item_unlock(*hv);
+        }
     }
 
-    return NULL;
+    if (best == NULL) {
+        return NULL;
+    }
+    if (item_trylock(*hv = assoc_item_hash(best))) {
+        if (best->empty_header.refcount == 0) {
+            if (best != first) {
+                cost_benefit_count_eviction();
+            }
+            return best;
+        }
+        item_unlock(*hv);
+    }
+    return get_evictable_segment_item(segment, false, hv, bumps);
+}
+
+
+/*
+ * finds an item to evict, and acquires its item lock.  the protected segment
+ * is only touched if nothing in the probationary segment can go.
+ */
+static item* get_evictable_lru_item(uint32_t* hv) {
+    stats_t *stats = STATS_GET_TLS();
+    int bumps = 0;
+    lru_segment_t segment;
+    item* found = NULL;
+
+    for (segment = LRU_PROBATION; segment < LRU_SEGMENTS && found == NULL; segment ++) {
+        found = get_evictable_segment_item(segment, settings.size_aware_eviction, hv, &bumps);
+    }
+
+    STATS_LOCK(stats);
+    stats->lru_bumps += bumps;
+    if (found != NULL && ITEM_is_bumped(found)) {
+        stats->lru_bump_drops ++;
+    }
+    STATS_UNLOCK(stats);
+    return found;
 }
 
 
@@ -451,12 +763,111 @@ static bool large_broken_chunk_referenced(const large_broken_chunk_t* lc) {
 }
 
 
+static void unlock_broken_chunk_items(broken_chunk_locks_t* locks) {
+    while (locks->count > 0) {
+        locks->count --;
+        item_unlock(locks->hv[locks->count]);
+    }
+}
+
+
+/*
+ * acquires the item locks of all the items that have chunks on a broken
+ * chunk.  as the cache lock is already held, we can only try for the locks.
+ * returns false, with no locks held, if any of them are busy.
+ */
+static bool trylock_broken_chunk_items(const large_broken_chunk_t* lc, broken_chunk_locks_t* locks) {
+    unsigned counter, i;
+
+    locks->count = 0;
+    locks->owner_count = 0;
+    for (counter = 0;
+         counter < SMALL_CHUNKS_PER_LARGE_CHUNK;
+         counter ++) {
+        const small_chunk_t* iter = &(lc->lbc[counter]);
+        item* owner;
+        uint32_t hv;
+
+        if (iter->flags & SMALL_CHUNK_FREE) {
+            continue;
+        }
+
+        /* find the title block of the item that owns this chunk. */
+        for (;
+             (iter->flags & SMALL_CHUNK_TITLE) == 0;
+             iter = &get_chunk_address(iter->sc_body.prev_chunk)->sc) {
+        }
+        owner = get_item_from_small_title((small_title_chunk_t*) &(iter->sc_title));
+        hv = assoc_item_hash(owner);
+
+        for (i = 0; i < locks->owner_count; i ++) {
+            if (locks->owners[i] == owner) {
+                break;
+            }
+        }
+        if (i == locks->owner_count) {
+            locks->owners[locks->owner_count ++] = owner;
+        }
+
+        for (i = 0; i < locks->count; i ++) {
+            if (ITEM_LOCK_INDEX(locks->hv[i]) == ITEM_LOCK_INDEX(hv)) {
+                break;
+            }
+        }
+        if (i < locks->count) {
+            /* already hold this one. */
+            continue;
+        }
+
+        if (! item_trylock(hv)) {
+            unlock_broken_chunk_items(locks);
+            return false;
+        }
+        locks->hv[locks->count ++] = hv;
+    }
+
+    return true;
+}
+
+
+/*
+ * freezes the items that own chunks on a broken chunk, so that lock-free
+ * readers can't pick up references to them while they are being moved.  this
+ * fails, leaving nothing frozen, if any of them are referenced.
+ */
+static bool freeze_broken_chunk_items(broken_chunk_locks_t* locks) {
+    unsigned i;
+
+    for (i = 0; i < locks->owner_count; i ++) {
+        if (! ITEM_refcount_kill(locks->owners[i])) {
+            while (i > 0) {
+                i --;
+                ITEM_refcount_revive(locks->owners[i]);
+            }
+            return false;
+        }
+    }
+
+    return true;
+}
+
+
+static void thaw_broken_chunk_items(broken_chunk_locks_t* locks) {
+    unsigned i;
+
+    for (i = 0; i < locks->owner_count; i ++) {
+        ITEM_refcount_revive(locks->owners[i]);
+    }
+}
+
+
 /*
  * if search_depth is zero, then the search depth is not limited.  if the search
  * depth is non-zero, constrain search to the first search_depth items on the
- * small free list
+ * small free list.  the broken chunk is returned with the item locks of all
+ * the items on it held, and the items frozen.
  */
-static large_chunk_t* find_unreferenced_broken_chunk(size_t search_depth) {
+static large_chunk_t* find_unreferenced_broken_chunk(size_t search_depth, broken_chunk_locks_t* locks) {
     small_chunk_t* small_chunk_iter;
     unsigned counter;
 
@@ -468,8 +879,14 @@ static large_chunk_t* find_unreferenced_broken_chunk(size_t search_depth) {
         large_chunk_t* lc = get_parent_chunk(small_chunk_iter);
         large_broken_chunk_t* pc = &(lc->lc_broken);
 
-        if (large_broken_chunk_referenced(pc) == false) {
-            return lc;
+        if (large_broken_chunk_referenced(pc) == false &&
+            trylock_broken_chunk_items(pc, locks)) {
+            /* the refcounts may have changed before we got the locks, and
+             * lock-free gets can still change them. */
+            if (freeze_broken_chunk_items(locks)) {
+                return lc;
+            }
+            unlock_broken_chunk_items(locks);
         }
     }
 
@@ -491,9 +908,10 @@ static coalesce_progress_t coalesce_free_small_chunks(void) {
 
     while (fsi.small_free_list_sz >= SMALL_CHUNKS_PER_LARGE_CHUNK) {
         large_chunk_t* lc;
-        unsigned i;
+        broken_chunk_locks_t locks;
+        unsigned i, j;
 
-        lc = find_unreferenced_broken_chunk(0);
+        lc = find_unreferenced_broken_chunk(0, &locks);
         if (lc == NULL) {
             /* we don't want to be stuck in an infinite loop if we can't find a
              * large unreferenced chunk, so just report no progress. */
@@ -567,8 +985,8 @@ static coalesce_progress_t coalesce_free_small_chunks(void) {
                             assert(next->sc.sc_title.prev == get_chunkptr(old_chunk));
                             next->sc.sc_title.prev = replacement_chunkptr;
                         } else {
-                            assert(fsi.lru_tail == get_item_from_small_title(&old_chunk->sc.sc_title));
-                            fsi.lru_tail = get_item_from_small_title(&replacement->sc_title);
+                            assert(fsi.lru[ITEM_lru_segment(new_it)].tail == old_it);
+                            fsi.lru[ITEM_lru_segment(new_it)].tail = new_it;
                         }
 
                         if (replacement->sc_title.prev != NULL_CHUNKPTR) {
@@ -576,8 +994,8 @@ static coalesce_progress_t coalesce_free_small_chunks(void) {
                             assert(prev->sc.sc_title.next == get_chunkptr(old_chunk));
                             prev->sc.sc_title.next = replacement_chunkptr;
                         } else {
-                            assert(fsi.lru_head == get_item_from_small_title(&old_chunk->sc.sc_title));
-                            fsi.lru_head = get_item_from_small_title(&replacement->sc_title);
+                            assert(fsi.lru[ITEM_lru_segment(new_it)].head == old_it);
+                            fsi.lru[ITEM_lru_segment(new_it)].head = new_it;
                         }
 
                         /* edit the next_chunk's prev_chunk link */
@@ -590,8 +1008,14 @@ static coalesce_progress_t coalesce_free_small_chunks(void) {
                         /* update flags */
                         replacement->flags |= (SMALL_CHUNK_USED | SMALL_CHUNK_TITLE);
 
-                        /* do the replacement in the mapping. */
+                        /* do the replacement in the mapping.  the copy is
+                         * still frozen. */
                         assoc_update(old_it, new_it);
+                        for (j = 0; j < locks.owner_count; j ++) {
+                            if (locks.owners[j] == old_it) {
+                                locks.owners[j] = new_it;
+                            }
+                        }
                     } else {
                         /* body block.  this is more straightforward */
                         small_chunk_t* prev_chunk = &(get_chunk_address(replacement->sc_body.prev_chunk))->sc;
@@ -614,17 +1038,29 @@ static coalesce_progress_t coalesce_free_small_chunks(void) {
                         replacement->flags |= (SMALL_CHUNK_USED);
                     }
 
-                    /* don't push this onto the free list.  if we do, we'll immediately
-                     * pick it up when finding a replacement block.  instead, just mark
-                     * it coalesce-pending. */
-                    iter->flags = SMALL_CHUNK_INITIALIZED | SMALL_CHUNK_COALESCE_PENDING;
-
                     /* decrement the number of blocks allocated */
                     lc->lc_broken.small_chunks_allocated --;
                 }
             }
+
+            /* lock-free readers may still be walking the old copies, so they
+             * are left intact until the readers are gone.  then, rather than
+             * pushing the chunks onto the free list, where we'd immediately
+             * pick them up when finding a replacement block, just mark them
+             * coalesce-pending. */
+            epoch_synchronize();
+            for (i = 0; i < SMALL_CHUNKS_PER_LARGE_CHUNK; i ++) {
+                small_chunk_t* iter = &(lc->lc_broken.lbc[i]);
+
+                if (iter->flags & SMALL_CHUNK_USED) {
+                    iter->flags = SMALL_CHUNK_INITIALIZED | SMALL_CHUNK_COALESCE_PENDING;
+                }
+            }
         }
 
+        thaw_broken_chunk_items(&locks);
+        unlock_broken_chunk_items(&locks);
+
         /* STATS: update */
         fsi.stats.broken_chunk_histogram[0] ++;
 
@@ -637,17 +1073,41 @@ static coalesce_progress_t coalesce_free_small_chunks(void) {
 }
 
 
-static bool flat_storage_lru_evict(chunk_type_t chunk_type, size_t nchunks) {
+/* frees up memory until there are enough free chunks for nchunks chunks of
+ * chunk_type.  if rejected is not NULL, the allocation is for an item whose
+ * key has hash value candidate_hv, and is subject to admission: if a live
+ * victim's key has been seen more often, nothing more is evicted, and
+ * *rejected is set. */
+static bool flat_storage_lru_evict(chunk_type_t chunk_type, size_t nchunks,
+                                   const uint32_t candidate_hv, bool* rejected) {
     while (1) {
-        /* release one item from the LRU... */
+        /* release one item that has expired, or else one from the LRU... */
         item* lru_item;
+        uint32_t hv;
 
-        lru_item = get_lru_item();
-        if (lru_item == NULL) {
-            /* nothing to release, so we just fail. */
-            return false;
+        if (do_expiry_reclaim(1) == 0) {
+            lru_item = get_evictable_lru_item(&hv);
+            if (lru_item == NULL) {
+                /* nothing to release, so we just fail. */
+                return false;
+            }
+            if (rejected != NULL &&
+                (lru_item->empty_header.exptime == 0 ||
+                 lru_item->empty_header.exptime > current_time) &&
+                ! admission_admit(candidate_hv, hv)) {
+                stats_t *stats = STATS_GET_TLS();
+
+                item_unlock(hv);
+                STATS_LOCK(stats);
+                stats->admission_rejects ++;
+                STATS_UNLOCK(stats);
+                *rejected = true;
+                return false;
+            }
+            do_item_unlink(lru_item, UNLINK_MAYBE_EVICT, NULL);
+            item_unlock(hv);
         }
-        do_item_unlink(lru_item, UNLINK_MAYBE_EVICT, NULL);
+        flat_storage_reclaim();
 
         /* do we have enough free chunks to leave this loop? */
         switch (chunk_type) {
@@ -791,13 +1251,25 @@ void do_try_item_stamp(item* it, rel_time_t now, const struct in_addr addr) {
 
 /* allocates one item capable of storing a key of size nkey and a value field of
  * size nbytes.  stores the key, flags, and exptime.  the value field is not
- * initialized.  if there is insufficient memory, NULL is returned. */
+ * initialized.  if there is insufficient memory, NULL is returned.
+ *
+ * if rejected is not NULL, the item is subject to admission, and *rejected is
+ * set if NULL is returned because the admission filter turned it away. */
 item* do_item_alloc(const char *key, const size_t nkey, const int flags, const rel_time_t exptime,
-                    const size_t nbytes, const struct in_addr addr) {
+                    const size_t nbytes, const struct in_addr addr, bool* rejected) {
+    uint32_t hv = hash(key, nkey, 0);
+
+    if (rejected != NULL) {
+        *rejected = false;
+        admission_record(hv);
+    }
+
     if (item_size_ok(nkey, flags, nbytes) == false) {
         return NULL;
     }
 
+    flat_storage_reclaim();
+
     if (is_large_chunk(nkey, nbytes)) {
         /* allocate a large chunk */
 
@@ -834,7 +1306,7 @@ item* do_item_alloc(const char *key, const size_t nkey, const int flags, const r
                 continue;
             }
 
-            if (flat_storage_lru_evict(LARGE_CHUNK, needed)) {
+            if (flat_storage_lru_evict(LARGE_CHUNK, needed, hv, rejected)) {
                 continue;
             }
 
@@ -856,6 +1328,7 @@ item* do_item_alloc(const char *key, const size_t nkey, const int flags, const r
         title->nbytes = nbytes;
         title->exptime = exptime;
         title->flags = flags;
+        title->hv = hv;
         prev_next = &title->next_chunk;
 
         key_write = __fs_MIN(LARGE_TITLE_CHUNK_DATA_SZ, key_left);
@@ -874,6 +1347,7 @@ item* do_item_alloc(const char *key, const size_t nkey, const int flags, const r
         /* STATS: update */
         fsi.stats.large_title_chunks ++;
         fsi.stats.large_body_chunks += needed;
+        fsi.stats.large_item_bytes += nkey + nbytes;
 
         while (needed > 0) {
             temp = free_list_pop(LARGE_CHUNK);
@@ -937,7 +1411,7 @@ item* do_item_alloc(const char *key, const size_t nkey, const int flags, const r
                 continue;
             }
 
-            if (flat_storage_lru_evict(SMALL_CHUNK, needed)) {
+            if (flat_storage_lru_evict(SMALL_CHUNK, needed, hv, rejected)) {
                 continue;
             }
 
@@ -959,6 +1433,7 @@ item* do_item_alloc(const char *key, const size_t nkey, const int flags, const r
         title->nbytes = nbytes;
         title->exptime = exptime;
         title->flags = flags;
+        title->hv = hv;
         prev = get_chunkptr(temp);
         prev_next = &title->next_chunk;
 
@@ -978,6 +1453,7 @@ item* do_item_alloc(const char *key, const size_t nkey, const int flags, const r
         /* STATS: update */
         fsi.stats.small_title_chunks ++;
         fsi.stats.small_body_chunks += needed;
+        fsi.stats.small_item_bytes += nkey + nbytes;
 
         while (needed > 0) {
             chunkptr_t current_chunkptr;
@@ -1021,9 +1497,11 @@ static void item_free(item *it) {
     size_t expected_chunks_freed = chunks_in_item(it);
 #endif /* #if !defined(NDEBUG) */
     bool is_large_chunks = is_item_large_chunk(it);
+    size_t item_bytes = it->empty_header.nkey + it->empty_header.nbytes;
 
-    assert((it->empty_header.it_flags & ~(ITEM_HAS_TIMESTAMP | ITEM_HAS_IP_ADDRESS))== ITEM_VALID);
-    assert(it->empty_header.refcount == 0);
+    /* a hit may still have marked the item after it was unlinked. */
+    assert((it->empty_header.it_flags & ~(ITEM_HAS_TIMESTAMP | ITEM_HAS_IP_ADDRESS | ITEM_BUMPED))== ITEM_VALID);
+    assert(it->empty_header.refcount == ITEM_REFCOUNT_DEAD);
     assert(it->empty_header.next == NULL_CHUNKPTR);
     assert(it->empty_header.prev == NULL_CHUNKPTR);
     assert(it->empty_header.h_next == NULL_ITEM_PTR);
@@ -1064,6 +1542,7 @@ static void item_free(item *it) {
 
         /* STATS: update */
         fsi.stats.large_title_chunks --;
+        fsi.stats.large_item_bytes -= item_bytes;
     } else {
         chunk_t* chunk;
 
@@ -1099,12 +1578,46 @@ static void item_free(item *it) {
 
         /* STATS: update */
         fsi.stats.small_title_chunks --;
+        fsi.stats.small_item_bytes -= item_bytes;
     }
 
     assert(chunks_freed == expected_chunks_freed);
 }
 
 
+/* frees a dead item.  if lock-free gets are enabled, readers may still be
+ * looking at it, so it is parked on the limbo list (linked through the unused
+ * LRU pointers) until flat_storage_reclaim() has waited them out. */
+static void item_retire(item *it) {
+    if (! settings.lockfree_get) {
+        item_free(it);
+        return;
+    }
+
+    it->empty_header.next = (fsi.limbo_head == NULL) ? NULL_CHUNKPTR :
+        get_chunkptr((chunk_t*) fsi.limbo_head);
+    fsi.limbo_head = it;
+}
+
+
+/* frees the items on the limbo list, once no lock-free reader can see them. */
+static void flat_storage_reclaim(void) {
+    item* iter, * next;
+
+    if (fsi.limbo_head == NULL) {
+        return;
+    }
+
+    epoch_synchronize();
+    for (iter = fsi.limbo_head; iter != NULL; iter = next) {
+        next = get_item_from_chunk(get_chunk_address(iter->empty_header.next));
+        iter->empty_header.next = NULL_CHUNKPTR;
+        item_free(iter);
+    }
+    fsi.limbo_head = NULL;
+}
+
+
 /**
  * Returns true if an item will fit in the cache (its size does not exceed
  * the maximum for a cache entry.)
@@ -1121,37 +1634,43 @@ bool item_need_realloc(const item* it,
 }
 
 
+/* links an item at the head of the segment its flags put it in. */
 static void item_link_q(item *it) {
+    lru_segment_t segment = ITEM_lru_segment(it);
+
     assert(it->empty_header.next == NULL_CHUNKPTR);
     assert(it->empty_header.prev == NULL_CHUNKPTR);
 
-    assert( ((fsi.lru_head == NULL) ^ (fsi.lru_head == NULL)) == 0 );
-    if (fsi.lru_head != NULL) {
-        it->empty_header.next = get_chunkptr((chunk_t*) fsi.lru_head);
-        fsi.lru_head->empty_header.prev = get_chunkptr((chunk_t*) it);
+    assert( ((fsi.lru[segment].head == NULL) ^ (fsi.lru[segment].tail == NULL)) == 0 );
+    if (fsi.lru[segment].head != NULL) {
+        it->empty_header.next = get_chunkptr((chunk_t*) fsi.lru[segment].head);
+        fsi.lru[segment].head->empty_header.prev = get_chunkptr((chunk_t*) it);
     }
-    fsi.lru_head = it;
+    fsi.lru[segment].head = it;
 
-    if (fsi.lru_tail == NULL) {
-        fsi.lru_tail = it;
+    if (fsi.lru[segment].tail == NULL) {
+        fsi.lru[segment].tail = it;
     }
+    fsi.lru[segment].count ++;
 }
 
 
 static void item_unlink_q(item* it) {
+    lru_segment_t segment = ITEM_lru_segment(it);
     item* next, * prev;
 
     next = get_item_from_chunk(get_chunk_address(it->empty_header.next));
     prev = get_item_from_chunk(get_chunk_address(it->empty_header.prev));
 
-    if (it == fsi.lru_head) {
+    if (it == fsi.lru[segment].head) {
         assert(prev == NULL);
-        fsi.lru_head = next;
+        fsi.lru[segment].head = next;
     }
-    if (it == fsi.lru_tail) {
+    if (it == fsi.lru[segment].tail) {
         assert(next == NULL);
-        fsi.lru_tail = prev;
+        fsi.lru[segment].tail = prev;
     }
+    fsi.lru[segment].count --;
 
     if (next) {
         next->empty_header.prev = it->empty_header.prev;
@@ -1174,8 +1693,10 @@ int do_item_link(item* it, const char* key) {
     assert((it->empty_header.it_flags & ITEM_LINKED) == 0);
 
     it->empty_header.it_flags |= ITEM_LINKED;
+    it->empty_header.it_flags &= ~ITEM_BUMPED;
     it->empty_header.time = current_time;
     assoc_insert(it, key);
+    expiry_add(it->empty_header.hv, it->empty_header.exptime);
 
     STATS_LOCK(stats);
     stats->item_total_size += ITEM_nkey(it) + ITEM_nbytes(it);
@@ -1231,6 +1752,14 @@ void do_item_unlink(item* it, long flags, const char* key) {
             stats_evict(ITEM_nkey(it) + ITEM_nbytes(it));
             STATS_LOCK(stats);
             stats->evictions ++;
+            if (it->empty_header.exptime != 0) {
+                stats->evictions_of_live_items ++;
+            }
+            if (ITEM_is_protected(it)) {
+                stats->lru_protected_evictions ++;
+            } else {
+                stats->lru_probation_evictions ++;
+            }
             STATS_UNLOCK(stats);
         } else if (flags & UNLINK_IS_EXPIRED) {
             stats_expire(ITEM_nkey(it) + ITEM_nbytes(it));
@@ -1239,10 +1768,12 @@ void do_item_unlink(item* it, long flags, const char* key) {
             stats_prefix_record_removal(key, ITEM_nkey(it), ITEM_nkey(it) + ITEM_nbytes(it), it->empty_header.time, flags);
         }
         assoc_delete(key, ITEM_nkey(it));
+        expiry_remove(it->empty_header.hv, it->empty_header.exptime);
         it->empty_header.h_next = NULL_ITEM_PTR;
         item_unlink_q(it);
-        if (it->empty_header.refcount == 0) {
-            item_free(it);
+        ITEM_clear_protected(it);
+        if (ITEM_refcount_kill(it)) {
+            item_retire(it);
         }
     }
 }
@@ -1254,13 +1785,15 @@ void do_item_deref(item* it) {
 
     /* may not be ITEM_LINKED because the unlink may have preceeded the remove. */
     if (it->empty_header.refcount != 0) {
-        it->empty_header.refcount --;
+        ITEM_refcount_decr(it);
     }
     assert((it->empty_header.it_flags & ITEM_DELETED) == 0 ||
            it->empty_header.refcount != 0);
-    if (it->empty_header.refcount == 0 &&
-        (it->empty_header.it_flags & ITEM_LINKED) == 0) {
-        item_free(it);
+    if ((it->empty_header.it_flags & ITEM_LINKED) == 0 &&
+        ITEM_refcount_kill(it)) {
+        CACHE_LOCK();
+        item_retire(it);
+        CACHE_UNLOCK();
     }
 }
 
@@ -1271,13 +1804,43 @@ void do_item_update(item* it) {
         assert(it->empty_header.it_flags & ITEM_VALID);
 
         if (it->empty_header.it_flags & ITEM_LINKED) {
-            item_unlink_q(it);
-            it->empty_header.time = current_time;
-            item_link_q(it);
+            item_lru_bump(it);
         }
     }
 }
 
+/* moves a linked item to the head of the LRU.  an item in the probationary
+ * segment has now been hit since it was linked, so it is promoted to the
+ * protected segment, if there is one.  the cache lock must be held. */
+static void item_lru_bump(item* it) {
+    ITEM_clear_bumped(it);
+    item_unlink_q(it);
+    it->empty_header.time = current_time;
+    if (settings.lru_protected_pct != 0 && ! ITEM_is_protected(it)) {
+        ITEM_mark_protected(it);
+        fsi.stats.lru_promotions ++;
+    }
+    item_link_q(it);
+    item_lru_balance();
+}
+
+/* demotes the oldest items of the protected segment until it is back under its
+ * cap.  they keep their place in time, and their bumped flag, so one that was
+ * hit while protected is promoted again when it comes up for eviction. */
+static void item_lru_balance(void) {
+    size_t cap = (fsi.lru[LRU_PROBATION].count + fsi.lru[LRU_PROTECTED].count) *
+        settings.lru_protected_pct / 100;
+
+    while (fsi.lru[LRU_PROTECTED].count > cap) {
+        item* it = fsi.lru[LRU_PROTECTED].tail;
+
+        item_unlink_q(it);
+        ITEM_clear_protected(it);
+        item_link_q(it);
+        fsi.stats.lru_demotions ++;
+    }
+}
+
 int do_item_replace(item* it, item* new_it, const char* key) {
     int retval;
 
@@ -1301,24 +1864,27 @@ char* do_item_cachedump(const chunk_type_t type, const unsigned int limit, unsig
     char temp[512];
     char key_temp[KEY_MAX_LENGTH];
     const char* key;
+    lru_segment_t segment;
 
     buffer = malloc((size_t)memlimit);
     if (buffer == 0) return NULL;
     bufcurr = 0;
 
-    it = fsi.lru_head;
+    for (segment = LRU_PROBATION; segment < LRU_SEGMENTS; segment ++) {
+        it = fsi.lru[segment].head;
 
-    while (it != NULL && (limit == 0 || shown < limit)) {
-        key = item_key_copy(it, key_temp);
-        len = snprintf(temp, sizeof(temp), "ITEM %*s [%d b; %lu s]\r\n",
-                       ITEM_nkey(it), key,
-                       ITEM_nbytes(it), it->empty_header.time + started);
-        if (bufcurr + len + 6 > memlimit)  /* 6 is END\r\n\0 */
-            break;
-        strcpy(buffer + bufcurr, temp);
-        bufcurr += len;
-        shown++;
-        it = get_item_from_chunk(get_chunk_address(it->empty_header.next));
+        while (it != NULL && (limit == 0 || shown < limit)) {
+            key = item_key_copy(it, key_temp);
+            len = snprintf(temp, sizeof(temp), "ITEM %*s [%d b; %lu s]\r\n",
+                           ITEM_nkey(it), key,
+                           ITEM_nbytes(it), it->empty_header.time + started);
+            if (bufcurr + len + 6 > memlimit)  /* 6 is END\r\n\0 */
+                break;
+            strcpy(buffer + bufcurr, temp);
+            bufcurr += len;
+            shown++;
+            it = get_item_from_chunk(get_chunk_address(it->empty_header.next));
+        }
     }
 
     memcpy(buffer + bufcurr, "END\r\n", 6);
@@ -1345,22 +1911,16 @@ char* do_item_stats_sizes(int* bytes) {
     /* build the histogram */
     memset(histogram, 0, (size_t)num_buckets * sizeof(int));
 
-    item* iter = fsi.lru_head;
-    while (iter) {
-        int ntotal = ITEM_ntotal(iter);
-        int bucket = ntotal / 32;
-        if ((ntotal % 32) != 0) bucket++;
-        if (bucket < num_buckets) histogram[bucket]++;
-        iter = get_item_from_chunk(get_chunk_address(iter->small_title.next));
-    }
-
-    iter = fsi.lru_head;
-    while (iter) {
-        int ntotal = ITEM_ntotal(iter);
-        int bucket = ntotal / 32;
-        if ((ntotal % 32) != 0) bucket++;
-        if (bucket < num_buckets) histogram[bucket]++;
-        iter = get_item_from_chunk(get_chunk_address(iter->large_title.next));
+    lru_segment_t segment;
+    for (segment = LRU_PROBATION; segment < LRU_SEGMENTS; segment ++) {
+        item* iter = fsi.lru[segment].head;
+        while (iter) {
+            int ntotal = ITEM_ntotal(iter);
+            int bucket = ntotal / 32;
+            if ((ntotal % 32) != 0) bucket++;
+            if (bucket < num_buckets) histogram[bucket]++;
+            iter = get_item_from_chunk(get_chunk_address(iter->empty_header.next));
+        }
     }
 
     /* write the buffer */
@@ -1378,34 +1938,26 @@ char* do_item_stats_sizes(int* bytes) {
 
 void do_item_flush_expired(void) {
     item *iter, *next;
+    lru_segment_t segment;
     if (settings.oldest_live == 0)
         return;
 
-    for (iter = fsi.lru_head;
-         iter != NULL;
-         iter = next) {
-        if (iter->small_title.time >= settings.oldest_live) {
-            next = get_item_from_chunk(get_chunk_address(iter->small_title.next));
-            assert( (iter->empty_header.it_flags & (ITEM_VALID | ITEM_LINKED)) ==
-                    (ITEM_VALID | ITEM_LINKED) );
-            do_item_unlink(iter, UNLINK_IS_EXPIRED, NULL);
-        } else {
-            /* We've hit the first old item. Continue to the next queue. */
-            break;
-        }
-    }
-
-    for (iter = fsi.lru_head;
-         iter != NULL;
-         iter = next) {
-        if (iter->large_title.time >= settings.oldest_live) {
-            next = get_item_from_chunk(get_chunk_address(iter->large_title.next));
-            assert( (iter->empty_header.it_flags & (ITEM_VALID | ITEM_LINKED)) ==
-                    (ITEM_VALID | ITEM_LINKED) );
-            do_item_unlink(iter, UNLINK_IS_EXPIRED, NULL);
-        } else {
-            /* We've hit the first old item. Continue to the next queue. */
-            break;
+    for (segment = LRU_PROBATION; segment < LRU_SEGMENTS; segment ++) {
+        for (iter = fsi.lru[segment].head;
+             iter != NULL;
+             iter = next) {
+            next = get_item_from_chunk(get_chunk_address(iter->empty_header.next));
+            if (iter->empty_header.time >= settings.oldest_live) {
+                assert( (iter->empty_header.it_flags & (ITEM_VALID | ITEM_LINKED)) ==
+                        (ITEM_VALID | ITEM_LINKED) );
+                do_item_unlink(iter, UNLINK_IS_EXPIRED, NULL);
+            } else if (segment == LRU_PROTECTED ||
+                       settings.lru_protected_pct == 0) {
+                /* We've hit the first old item. Continue to the next queue.
+                 * demoted items keep their time, so the probationary
+                 * segment of a segmented LRU is not in order. */
+                break;
+            }
         }
     }
 }
@@ -1416,8 +1968,48 @@ item* item_get(const char* key, const size_t nkey) {
 }
 
 
-item* do_item_get_notedeleted(const char* key, const size_t nkey, bool* delete_locked) {
-    item *it = assoc_find(key, nkey);
+/* looks up a key without the item lock, for the -G option.  only plain hits
+ * are returned, with a reference held; anything else (misses, delete-locked or
+ * expired items) returns NULL and must be retried under the lock. */
+item* item_get_lockfree(const char* key, const size_t nkey, const uint32_t hv) {
+    stats_t *stats;
+    item* it;
+
+    if (! epoch_enter()) {
+        return NULL;
+    }
+    it = assoc_find_lockfree(key, nkey, hv);
+    if (it != NULL &&
+        ((it->empty_header.it_flags & ITEM_DELETED) ||
+         (settings.oldest_live != 0 && settings.oldest_live <= current_time &&
+          it->empty_header.time <= settings.oldest_live) ||
+         (it->empty_header.exptime != 0 && it->empty_header.exptime <= current_time) ||
+         ! ITEM_refcount_incr(it))) {
+        it = NULL;
+    }
+    epoch_exit();
+
+    if (it == NULL) {
+        return NULL;
+    }
+    if ((it->empty_header.it_flags & ITEM_LINKED) == 0) {
+        /* unlinked before our reference landed. */
+        item_deref(it);
+        return NULL;
+    }
+
+    stats = STATS_GET_TLS();
+    STATS_LOCK(stats);
+    stats->lockfree_hits ++;
+    STATS_UNLOCK(stats);
+    return it;
+}
+
+
+/* the caller must hold the item lock for the key. */
+item* do_item_get_notedeleted(const char* key, const size_t nkey, const uint32_t hv,
+                              bool* delete_locked) {
+    item *it = assoc_find(key, nkey, hv);
     if (delete_locked) *delete_locked = false;
     if (it != NULL && (it->empty_header.it_flags & ITEM_DELETED)) {
         /* it's flagged as delete-locked.  let's see if that condition
@@ -1430,25 +2022,29 @@ item* do_item_get_notedeleted(const char* key, const size_t nkey, bool* delete_l
     }
     if (it != NULL && settings.oldest_live != 0 && settings.oldest_live <= current_time &&
         it->empty_header.time <= settings.oldest_live) {
-        do_item_unlink(it, UNLINK_IS_EXPIRED, key); /* MTSAFE - cache_lock held */
+        CACHE_LOCK();
+        do_item_unlink(it, UNLINK_IS_EXPIRED, key); /* MTSAFE - item lock held */
+        CACHE_UNLOCK();
         it = NULL;
     }
     if (it != NULL && it->empty_header.exptime != 0 && it->empty_header.exptime <= current_time) {
-        do_item_unlink(it, UNLINK_IS_EXPIRED, key); /* MTSAFE - cache_lock held */
+        CACHE_LOCK();
+        do_item_unlink(it, UNLINK_IS_EXPIRED, key); /* MTSAFE - item lock held */
+        CACHE_UNLOCK();
         it = NULL;
     }
 
-    if (it != NULL) {
-        it->empty_header.refcount ++;
+    if (it != NULL && ! ITEM_refcount_incr(it)) {
+        it = NULL;
     }
     return it;
 }
 
 
 item* do_item_get_nocheck(const char* key, const size_t nkey) {
-    item *it = assoc_find(key, nkey);
-    if (it) {
-        it->empty_header.refcount ++;
+    item *it = assoc_find(key, nkey, hash(key, nkey, 0));
+    if (it && ! ITEM_refcount_incr(it)) {
+        it = NULL;
     }
     return it;
 }
@@ -1491,8 +2087,79 @@ const char* item_key_copy(const item* it, char* keyptr) {
 }
 
 
+/* reports on the segments of the LRU. */
+char* do_item_stats(int* bytes) {
+    static const char* segment_names[LRU_SEGMENTS] = { "probation", "protected" };
+    size_t bufsize = 1024, offset = 0;
+    char* buffer = malloc(bufsize);
+    char terminator[] = "END\r\n";
+    lru_segment_t segment;
+    stats_t stats;
+
+    if (buffer == NULL) {
+        *bytes = 0;
+        return NULL;
+    }
+
+    STATS_AGGREGATE(&stats);
+    for (segment = LRU_PROBATION; segment < LRU_SEGMENTS; segment ++) {
+        item* tail = fsi.lru[segment].tail;
+
+        offset = append_to_buffer(buffer, bufsize, offset, sizeof(terminator),
+                                  "STAT items:%s:number %lu\r\n"
+                                  "STAT items:%s:age %u\r\n"
+                                  "STAT items:%s:hits %" PRINTF_INT64_MODIFIER "u\r\n"
+                                  "STAT items:%s:evictions %" PRINTF_INT64_MODIFIER "u\r\n",
+                                  segment_names[segment], (unsigned long) fsi.lru[segment].count,
+                                  segment_names[segment],
+                                  tail == NULL ? 0 : current_time - tail->empty_header.time,
+                                  segment_names[segment],
+                                  segment == LRU_PROBATION ? stats.lru_probation_hits : stats.lru_protected_hits,
+                                  segment_names[segment],
+                                  segment == LRU_PROBATION ? stats.lru_probation_evictions : stats.lru_protected_evictions);
+    }
+    offset = append_to_buffer(buffer, bufsize, offset, sizeof(terminator),
+                              "STAT items:promotions %" PRINTF_INT64_MODIFIER "u\r\n"
+                              "STAT items:demotions %" PRINTF_INT64_MODIFIER "u\r\n",
+                              fsi.stats.lru_promotions,
+                              fsi.stats.lru_demotions);
+
+    offset = append_to_buffer(buffer, bufsize, offset, 0, terminator);
+
+    *bytes = offset;
+    return buffer;
+}
+
+
+/* appends how a tier's chunks are used: the bytes of chunks holding items,
+ * the keys and values in them, their headers, and the slack left over.
+ * fragmentation is the percentage of the chunks' bytes that isn't keys and
+ * values. */
+static size_t append_tier_stats(char* const buffer, const size_t bufsize, size_t offset,
+                                const size_t reserved, const char* tier,
+                                const size_t chunk_sz, const uint64_t title_chunks,
+                                const uint64_t body_chunks, const size_t title_overhead,
+                                const size_t body_overhead, const uint64_t item_bytes) {
+    uint64_t chunk_bytes = (title_chunks + body_chunks) * chunk_sz;
+    uint64_t header_bytes = (title_chunks * title_overhead) + (body_chunks * body_overhead);
+
+    return append_to_buffer(buffer, bufsize, offset, reserved,
+                            "STAT %s_chunk_bytes %" PRINTF_INT64_MODIFIER "u\r\n"
+                            "STAT %s_item_bytes %" PRINTF_INT64_MODIFIER "u\r\n"
+                            "STAT %s_header_bytes %" PRINTF_INT64_MODIFIER "u\r\n"
+                            "STAT %s_slack_bytes %" PRINTF_INT64_MODIFIER "u\r\n"
+                            "STAT %s_fragmentation %.2f\r\n",
+                            tier, chunk_bytes,
+                            tier, item_bytes,
+                            tier, header_bytes,
+                            tier, chunk_bytes - header_bytes - item_bytes,
+                            tier, chunk_bytes == 0 ? 0.0 :
+                            100.0 * (chunk_bytes - item_bytes) / chunk_bytes);
+}
+
+
 char* do_flat_allocator_stats(size_t* result_size) {
-    size_t bufsize = 2048, offset = 0, i;
+    size_t bufsize = 4096, offset = 0, i;
     char* buffer = malloc(bufsize);
     char terminator[] = "END\r\n";
     item* lru_item = NULL;
@@ -1512,13 +2179,13 @@ char* do_flat_allocator_stats(size_t* result_size) {
     }
 
     offset = append_to_buffer(buffer, bufsize, offset, sizeof(terminator),
-                              "STAT large_chunk_sz %d\n"
-                              "STAT small_chunk_sz %d\n"
-                              "STAT large_title_chunks %" PRINTF_INT64_MODIFIER "u\n"
-                              "STAT large_body_chunks %" PRINTF_INT64_MODIFIER "u\n"
-                              "STAT large_broken_chunks %" PRINTF_INT64_MODIFIER "u\n"
-                              "STAT small_title_chunks %" PRINTF_INT64_MODIFIER "u\n"
-                              "STAT small_body_chunks %" PRINTF_INT64_MODIFIER "u\n",
+                              "STAT large_chunk_sz %d\r\n"
+                              "STAT small_chunk_sz %d\r\n"
+                              "STAT large_title_chunks %" PRINTF_INT64_MODIFIER "u\r\n"
+                              "STAT large_body_chunks %" PRINTF_INT64_MODIFIER "u\r\n"
+                              "STAT large_broken_chunks %" PRINTF_INT64_MODIFIER "u\r\n"
+                              "STAT small_title_chunks %" PRINTF_INT64_MODIFIER "u\r\n"
+                              "STAT small_body_chunks %" PRINTF_INT64_MODIFIER "u\r\n",
                               LARGE_CHUNK_SZ,
                               SMALL_CHUNK_SZ,
                               fsi.stats.large_title_chunks,
@@ -1527,19 +2194,32 @@ char* do_flat_allocator_stats(size_t* result_size) {
                               fsi.stats.small_title_chunks,
                               fsi.stats.small_body_chunks);
 
+    offset = append_tier_stats(buffer, bufsize, offset, sizeof(terminator), "large",
+                               LARGE_CHUNK_SZ,
+                               fsi.stats.large_title_chunks, fsi.stats.large_body_chunks,
+                               LARGE_CHUNK_SZ - LARGE_TITLE_CHUNK_DATA_SZ,
+                               LARGE_CHUNK_SZ - LARGE_BODY_CHUNK_DATA_SZ,
+                               fsi.stats.large_item_bytes);
+    offset = append_tier_stats(buffer, bufsize, offset, sizeof(terminator), "small",
+                               SMALL_CHUNK_SZ,
+                               fsi.stats.small_title_chunks, fsi.stats.small_body_chunks,
+                               SMALL_CHUNK_SZ - SMALL_TITLE_CHUNK_DATA_SZ,
+                               SMALL_CHUNK_SZ - SMALL_BODY_CHUNK_DATA_SZ,
+                               fsi.stats.small_item_bytes);
+
     for (i = 0; i < SMALL_CHUNKS_PER_LARGE_CHUNK + 1; i ++) {
         offset = append_to_buffer(buffer, bufsize, offset, sizeof(terminator),
-                                  "STAT broken_chunk_histogram %lu %" PRINTF_INT64_MODIFIER "u\n", i, fsi.stats.broken_chunk_histogram[i]);
+                                  "STAT broken_chunk_histogram %lu %" PRINTF_INT64_MODIFIER "u\r\n", i, fsi.stats.broken_chunk_histogram[i]);
    }
 
     offset = append_to_buffer(buffer, bufsize, offset, sizeof(terminator),
-                              "STAT break_events %" PRINTF_INT64_MODIFIER "u\n"
-                              "STAT unbreak_events %" PRINTF_INT64_MODIFIER "u\n"
-                              "STAT migrates %" PRINTF_INT64_MODIFIER "u\n"
-                              "STAT unused_memory %lu\n"
-                              "STAT large_free_list_sz %lu\n"
-                              "STAT small_free_list_sz %lu\n"
-                              "STAT oldest_item_lifetime %us\n",
+                              "STAT break_events %" PRINTF_INT64_MODIFIER "u\r\n"
+                              "STAT unbreak_events %" PRINTF_INT64_MODIFIER "u\r\n"
+                              "STAT migrates %" PRINTF_INT64_MODIFIER "u\r\n"
+                              "STAT unused_memory %lu\r\n"
+                              "STAT large_free_list_sz %lu\r\n"
+                              "STAT small_free_list_sz %lu\r\n"
+                              "STAT oldest_item_lifetime %us\r\n",
                               fsi.stats.break_events,
                               fsi.stats.unbreak_events,
                               fsi.stats.migrates,
@@ -1555,4 +2235,189 @@ char* do_flat_allocator_stats(size_t* result_size) {
     return buffer;
 }
 
+
+/* a title found in the memory file at startup.  its place in the LRU is still
+ * chained through its next and prev pointers, which flat_storage_adopt()
+ * follows to link it again, but nothing else about it is linked yet. */
+static void memory_file_recount_title(item* it) {
+    it->empty_header.it_flags &= ~(ITEM_LINKED | ITEM_BUMPED | ITEM_PROTECTED);
+    it->empty_header.refcount = 0;
+    it->empty_header.h_next = NULL_ITEM_PTR;
+
+    /* STATS: update */
+    if (is_item_large_chunk(it)) {
+        fsi.stats.large_title_chunks ++;
+        fsi.stats.large_item_bytes += it->empty_header.nkey + it->empty_header.nbytes;
+    } else {
+        fsi.stats.small_title_chunks ++;
+        fsi.stats.small_item_bytes += it->empty_header.nkey + it->empty_header.nbytes;
+    }
+}
+
+
+/* rebuilds the free lists and the chunk counts from the flags of the chunks
+ * in a restored arena. */
+static void memory_file_recount(void) {
+    stats_t *stats = STATS_GET_TLS();
+    large_chunk_t* lc;
+    int i;
+
+    STATS_LOCK(stats);
+    stats->item_storage_allocated += settings.maxbytes - fsi.unused_memory;
+    STATS_UNLOCK(stats);
+
+    for (lc = fsi.flat_storage_start; lc < fsi.uninitialized_start; lc ++) {
+        if (lc->flags & LARGE_CHUNK_BROKEN) {
+            /* as in break_large_chunk(..), free_list_push takes the free
+             * chunks back off the allocated count. */
+            lc->lc_broken.small_chunks_allocated = SMALL_CHUNKS_PER_LARGE_CHUNK;
+            fsi.stats.broken_chunk_histogram[SMALL_CHUNKS_PER_LARGE_CHUNK] ++; /* STATS: update */
+            fsi.stats.large_broken_chunks ++;
+
+            for (i = SMALL_CHUNKS_PER_LARGE_CHUNK - 1; i >= 0; i --) {
+                small_chunk_t* sc = &(lc->lc_broken.lbc[i]);
+
+                if ((sc->flags & SMALL_CHUNK_USED) == 0) {
+                    sc->flags = SMALL_CHUNK_INITIALIZED;
+                    free_list_push( (chunk_t*) sc, SMALL_CHUNK, false);
+                } else if (sc->flags & SMALL_CHUNK_TITLE) {
+                    memory_file_recount_title(get_item_from_small_title(&(sc->sc_title)));
+                } else {
+                    fsi.stats.small_body_chunks ++;
+                }
+            }
+            if (lc->lc_broken.small_chunks_allocated == 0) {
+                unbreak_large_chunk(lc, false);
+            }
+        } else if ((lc->flags & LARGE_CHUNK_USED) == 0) {
+            lc->flags = LARGE_CHUNK_INITIALIZED;
+            free_list_push( (chunk_t*) lc, LARGE_CHUNK, false);
+        } else if (lc->flags & LARGE_CHUNK_TITLE) {
+            memory_file_recount_title(get_item_from_large_title(&(lc->lc_title)));
+        } else {
+            fsi.stats.large_body_chunks ++;
+        }
+    }
+}
+
+
+/* frees an item found in the memory file that wasn't linked again. */
+static void memory_file_drop(item* it) {
+    it->empty_header.it_flags &= (ITEM_VALID | ITEM_HAS_TIMESTAMP | ITEM_HAS_IP_ADDRESS);
+    it->empty_header.refcount = ITEM_REFCOUNT_DEAD;
+    it->empty_header.next = NULL_CHUNKPTR;
+    it->empty_header.prev = NULL_CHUNKPTR;
+    item_free(it);
+}
+
+
+/* frees the items that were in the memory file but not on the saved LRU, such
+ * as ones waiting out readers, or that were deleted or have expired since. */
+static void memory_file_drop_unlinked(void) {
+    large_chunk_t* lc;
+    int i;
+
+    for (lc = fsi.flat_storage_start; lc < fsi.uninitialized_start; lc ++) {
+        if (lc->flags == (LARGE_CHUNK_INITIALIZED | LARGE_CHUNK_USED | LARGE_CHUNK_TITLE)) {
+            if ((lc->lc_title.it_flags & ITEM_LINKED) == 0) {
+                memory_file_drop(get_item_from_large_title(&(lc->lc_title)));
+            }
+            continue;
+        }
+
+        /* freeing the last item on a broken chunk unbreaks it. */
+        for (i = 0;
+             i < SMALL_CHUNKS_PER_LARGE_CHUNK && (lc->flags & LARGE_CHUNK_BROKEN);
+             i ++) {
+            small_chunk_t* sc = &(lc->lc_broken.lbc[i]);
+
+            if (sc->flags == (SMALL_CHUNK_INITIALIZED | SMALL_CHUNK_USED | SMALL_CHUNK_TITLE) &&
+                (sc->sc_title.it_flags & ITEM_LINKED) == 0) {
+                memory_file_drop(get_item_from_small_title(&(sc->sc_title)));
+            }
+        }
+    }
+}
+
+
+/* links the items of a restored arena again, oldest first, so that they keep
+ * their order in the LRU.  the protected segment's items go in last, at the
+ * head of the probationary segment, and have to earn their promotion again.
+ * this has to wait until the hashtable and the expiry index are set up. */
+void do_flat_storage_adopt(void) {
+    static const lru_segment_t order[] = { LRU_PROBATION, LRU_PROTECTED };
+    char key[KEY_MAX_LENGTH];
+    unsigned int i;
+
+    if (! mf.restored) {
+        return;
+    }
+
+    for (i = 0; i < sizeof(order) / sizeof(order[0]); i ++) {
+        item* it = get_item_from_chunk(get_chunk_address(mf.lru_tail[order[i]]));
+
+        while (it != NULL) {
+            item* prev = get_item_from_chunk(get_chunk_address(it->empty_header.prev));
+
+            it->empty_header.next = NULL_CHUNKPTR;
+            it->empty_header.prev = NULL_CHUNKPTR;
+            if (! ITEM_is_deleted(it) &&
+                (it->empty_header.exptime == 0 ||
+                 it->empty_header.exptime > current_time)) {
+                rel_time_t time = it->empty_header.time;
+
+                do_item_link(it, item_key_copy(it, key));
+                it->empty_header.time = time;
+                mf.restored_items ++;
+            }
+            it = prev;
+        }
+    }
+    memory_file_drop_unlinked();
+
+    if (settings.verbose > 0) {
+        fprintf(stderr, "Restored %u items from %s\n", mf.restored_items,
+                settings.memory_file);
+    }
+    mf.restored = false;
+}
+
+
+/* saves what a restart needs to find the items in the memory file again, and
+ * marks the file clean.  nothing may change the arena afterwards. */
+void do_flat_storage_save(void) {
+    lru_segment_t segment;
+
+    if (mf.header == NULL) {
+        return;
+    }
+
+    for (segment = 0; segment < LRU_SEGMENTS; segment ++) {
+        mf.header->lru_tail[segment] = get_chunkptr((chunk_t*) fsi.lru[segment].tail);
+    }
+    mf.header->initialized = (fsi.uninitialized_start - fsi.flat_storage_start) * LARGE_CHUNK_SZ;
+    mf.header->started = started;
+
+    /* the arena has to be on its way to the file before the header says it's
+     * clean. */
+    if (msync(fsi.mmap_start, MEMORY_FILE_HEADER_SZ + settings.maxbytes, MS_SYNC) != 0) {
+        perror(settings.memory_file);
+        return;
+    }
+    mf.header->clean = 1;
+    msync(mf.header, MEMORY_FILE_HEADER_SZ, MS_SYNC);
+}
+
+
+/* appends how many items came back from the memory file to a "stats"
+ * response. */
+size_t append_memory_file_stats(char* const buffer_start, const size_t buffer_size,
+                                const size_t buffer_off, const size_t reserved) {
+    if (mf.header == NULL) {
+        return buffer_off;
+    }
+    return append_to_buffer(buffer_start, buffer_size, buffer_off, reserved,
+                            "STAT restored_items %u\r\n", mf.restored_items);
+}
+
 #endif /* #if defined(USE_FLAT_ALLOCATOR) */
@@ -86,6 +86,7 @@
 #include "generic.h"
 
 #include <assert.h>
+#include <stddef.h>
 #include <string.h>
 #include <stdint.h>
 
@@ -144,22 +145,58 @@ typedef enum it_flags_e {
     ITEM_VALID   = 0x1,
     ITEM_LINKED  = 0x2,                 /* linked into the LRU. */
     ITEM_DELETED = 0x4,                 /* deferred delete. */
+    ITEM_BUMPED  = 0x8,                 /* hit since it was last moved in the LRU. */
     ITEM_HAS_IP_ADDRESS = 0x10,
     ITEM_HAS_TIMESTAMP = 0x20,
+    ITEM_PROTECTED = 0x40,              /* in the protected segment of the LRU. */
 } it_flags_t;
 
 
+/* the LRU is split into segments.  items are linked into the probationary
+ * segment, and promoted to the protected segment when they are hit again.  the
+ * protected segment is capped at settings.lru_protected_pct percent of the
+ * items; its oldest items are demoted back to the head of the probationary
+ * segment to make room.  evictions come from the probationary segment first.
+ * with a cap of 0, every item stays in the probationary segment, and the LRU
+ * behaves as a single queue. */
+typedef enum lru_segment_e {
+    LRU_PROBATION,
+    LRU_PROTECTED,
+    LRU_SEGMENTS,
+} lru_segment_t;
+
+
 typedef enum chunk_type_e {
     SMALL_CHUNK,
     LARGE_CHUNK,
 } chunk_type_t;
 
 
+/* the chunk sizes can be chosen when memcached is configured, with
+ * --with-flat-large-chunk and --with-flat-small-chunk, to suit the sizes of
+ * the items it will hold.  "stats flat_allocator" reports how much of each
+ * tier's memory goes to headers and slack. */
+#if defined(FLAT_LARGE_CHUNK_SZ)
+#define LARGE_CHUNK_SZ       FLAT_LARGE_CHUNK_SZ
+#else
 #define LARGE_CHUNK_SZ       1024       /* large chunk size */
+#endif /* #if defined(FLAT_LARGE_CHUNK_SZ) */
+#if defined(FLAT_SMALL_CHUNK_SZ)
+#define SMALL_CHUNK_SZ       FLAT_SMALL_CHUNK_SZ
+#else
 #define SMALL_CHUNK_SZ       124        /* small chunk size */
+#endif /* #if defined(FLAT_SMALL_CHUNK_SZ) */
+
+#if (LARGE_CHUNK_SZ & (LARGE_CHUNK_SZ - 1)) != 0 || LARGE_CHUNK_SZ < 512
+#error "the large chunk size must be a power of 2, and at least 512"
+#endif
+#if SMALL_CHUNK_SZ < 64 || SMALL_CHUNK_SZ * 2 > LARGE_CHUNK_SZ || \
+    LARGE_CHUNK_SZ / SMALL_CHUNK_SZ > 64
+#error "the small chunk size must be at least 64, at most half the large chunk size, and at least 1/64th of it"
+#endif
 
-#define FLAT_STORAGE_INCREMENT_DELTA (LARGE_CHUNK_SZ * 1024) /* initialize 2k
-                                                              * chunks at a time. */
+#define FLAT_STORAGE_INCREMENT_DELTA (1024 * 1024) /* initialize 1MB of chunks
+                                                    * at a time. */
 
 /** instead of using raw pointers, we use chunk pointers.  we address things
  * intervals of CHUNK_ADDRESSING_SZ.  it is possible for SMALL_CHUNK_SZ to be
@@ -168,9 +205,15 @@ typedef enum chunk_type_e {
  *   floor(LARGE_CHUNK_SZ / SMALL_CHUNK_SZ) <=
  *         floor(LARGE_CHUNK_SZ / CHUNK_ADDRESSING_SZ)
  *
- * we will check for this condition in an assert in items_init(..).
+ * we will check for this condition in an assert in items_init(..).  the
+ * interval is 128 if that satisfies it, since a larger interval lets the chunk
+ * pointers reach more memory, and 64 otherwise.
  */
+#if LARGE_CHUNK_SZ / SMALL_CHUNK_SZ <= LARGE_CHUNK_SZ / 128
 #define CHUNK_ADDRESSING_SZ  128
+#else
+#define CHUNK_ADDRESSING_SZ  64
+#endif
 #define SMALL_CHUNKS_PER_LARGE_CHUNK ((LARGE_CHUNK_SZ - LARGE_CHUNK_TAIL_SZ) / (SMALL_CHUNK_SZ))
 
 #define MIN_LARGE_CHUNK_CAPACITY ((LARGE_TITLE_CHUNK_DATA_SZ <= LARGE_BODY_CHUNK_DATA_SZ) ? \
@@ -210,6 +253,7 @@ typedef struct small_chunk_s small_chunk_t;
     rel_time_t exptime;                     /* expire time */           \
     int nbytes;                             /* size of data */          \
     unsigned int flags;                     /* flags */                 \
+    uint32_t hv;                            /* hash of the key */       \
     unsigned short refcount;                                            \
     uint8_t it_flags;                       /* it flags */              \
     uint8_t nkey;                           /* key length */            \
@@ -356,9 +400,15 @@ struct flat_storage_info_s {
     small_chunk_t* small_free_list;     // free list head.
     size_t small_free_list_sz;          // number of small free list chunks.
 
-    // LRU.
-    item* lru_head;
-    item* lru_tail;
+    // LRU, one queue per segment.
+    struct {
+        item* head;
+        item* tail;
+        size_t count;                   // number of items in the segment.
+    } lru[LRU_SEGMENTS];
+
+    // unlinked items waiting out lock-free readers before they are freed.
+    item* limbo_head;
 
     bool initialized;
 
@@ -368,12 +418,17 @@ struct flat_storage_info_s {
         uint64_t large_broken_chunks;
         uint64_t small_title_chunks;
         uint64_t small_body_chunks;
+        uint64_t large_item_bytes;      // keys and values held in large chunks.
+        uint64_t small_item_bytes;      // keys and values held in small chunks.
         uint64_t broken_chunk_histogram[SMALL_CHUNKS_PER_LARGE_CHUNK + 1];
 
         uint64_t break_events;
         uint64_t unbreak_events;
 
         uint64_t migrates;
+
+        uint64_t lru_promotions;        // probationary -> protected.
+        uint64_t lru_demotions;         // protected -> probationary.
     } stats;
 };
 
@@ -651,8 +706,48 @@ static inline unsigned int   ITEM_flags(item* it)    { return it->empty_header.f
 static inline rel_time_t     ITEM_time(item* it)     { return it->empty_header.time; }
 static inline rel_time_t     ITEM_exptime(item* it)  { return it->empty_header.exptime; }
 static inline unsigned short ITEM_refcount(item* it) { return it->empty_header.refcount; }
+static inline uint32_t       ITEM_hv(const item* it) { return it->empty_header.hv; }
 
-static inline void ITEM_set_nbytes(item* it, int nbytes)    { it->empty_header.nbytes = nbytes; }
+/* refcounts are changed atomically, as lock-free gets pick up references
+ * without holding the item lock.  an item is freed by swapping a zero refcount
+ * for ITEM_REFCOUNT_DEAD, after which no new references can be taken.  the
+ * title header is packed, so we compute the (suitably aligned) address of the
+ * refcount by hand. */
+#define ITEM_REFCOUNT_DEAD ((unsigned short) 0xffff)
+
+static inline unsigned short* ITEM_refcount_p(item* it) {
+    return (unsigned short*) (((char*) it) + offsetof(title_chunk_header_t, refcount));
+}
+
+/* takes a reference.  returns false if the item is dead or the refcount would
+ * overflow. */
+static inline bool ITEM_refcount_incr(item* it) {
+    unsigned short* refcount_p = ITEM_refcount_p(it);
+    unsigned short refcount;
+
+    do {
+        refcount = *refcount_p;
+        if (refcount >= ITEM_REFCOUNT_DEAD - 1) {
+            return false;
+        }
+    } while (! __sync_bool_compare_and_swap(refcount_p, refcount, refcount + 1));
+    return true;
+}
+static inline unsigned short ITEM_refcount_decr(item* it) { return __sync_sub_and_fetch(ITEM_refcount_p(it), 1); }
+static inline bool ITEM_refcount_kill(item* it)   { return __sync_bool_compare_and_swap(ITEM_refcount_p(it), 0, ITEM_REFCOUNT_DEAD); }
+static inline void ITEM_refcount_revive(item* it) { __sync_bool_compare_and_swap(ITEM_refcount_p(it), ITEM_REFCOUNT_DEAD, 0); }
+
+/* an in-place update (incr/decr) can change the length without a new
+ * allocation; the tier's byte count has to follow, or item_free() takes off
+ * a different amount than was added.  called with the cache lock held. */
+static inline void ITEM_set_nbytes(item* it, int nbytes) {
+    if (is_item_large_chunk(it)) {
+        fsi.stats.large_item_bytes += nbytes - it->empty_header.nbytes;
+    } else {
+        fsi.stats.small_item_bytes += nbytes - it->empty_header.nbytes;
+    }
+    it->empty_header.nbytes = nbytes;
+}
 static inline void ITEM_set_exptime(item* it, rel_time_t t) { it->empty_header.exptime = t; }
 
 static inline item_ptr_t ITEM_PTR_h_next(item_ptr_t iptr)  { return ITEM(iptr)->empty_header.h_next; }
@@ -664,6 +759,7 @@ static inline bool ITEM_is_valid(item* it)        { return it->empty_header.it_f
 static inline bool ITEM_has_timestamp(item* it)   { return it->empty_header.it_flags & ITEM_HAS_TIMESTAMP; }
 static inline bool ITEM_has_ip_address(item* it)  { return it->empty_header.it_flags & ITEM_HAS_IP_ADDRESS; }
 
+static inline bool ITEM_is_deleted(item* it)      { return it->empty_header.it_flags & ITEM_DELETED; }
 static inline void ITEM_mark_deleted(item* it)    { it->empty_header.it_flags |= ITEM_DELETED; }
 static inline void ITEM_unmark_deleted(item* it)  { it->empty_header.it_flags &= ~ITEM_DELETED; }
 static inline void ITEM_set_has_timestamp(item* it)      { it->empty_header.it_flags |= ITEM_HAS_TIMESTAMP; }
@@ -671,11 +767,30 @@ static inline void ITEM_clear_has_timestamp(item* it)    { it->empty_header.it_f
 static inline void ITEM_set_has_ip_address(item* it)     { it->empty_header.it_flags |= ITEM_HAS_IP_ADDRESS; }
 static inline void ITEM_clear_has_ip_address(item* it)   { it->empty_header.it_flags &= ~(ITEM_HAS_IP_ADDRESS); }
 
+/* hits mark items without holding any lock, so the bumped flag is set and
+ * cleared atomically, lest it clobber a concurrent change to the other flags. */
+static inline bool ITEM_is_bumped(item* it)       { return it->empty_header.it_flags & ITEM_BUMPED; }
+static inline void ITEM_mark_bumped(item* it)     { __sync_fetch_and_or(&it->empty_header.it_flags, ITEM_BUMPED); }
+static inline void ITEM_clear_bumped(item* it)    { __sync_fetch_and_and(&it->empty_header.it_flags, (uint8_t) ~ITEM_BUMPED); }
+
+/* the segment is only changed under the cache lock, but shares the flags with
+ * the bumped flag, so it is changed atomically too. */
+static inline bool ITEM_is_protected(item* it)    { return it->empty_header.it_flags & ITEM_PROTECTED; }
+static inline void ITEM_mark_protected(item* it)  { __sync_fetch_and_or(&it->empty_header.it_flags, ITEM_PROTECTED); }
+static inline void ITEM_clear_protected(item* it) { __sync_fetch_and_and(&it->empty_header.it_flags, (uint8_t) ~ITEM_PROTECTED); }
+static inline lru_segment_t ITEM_lru_segment(item* it) {
+    return ITEM_is_protected(it) ? LRU_PROTECTED : LRU_PROBATION;
+}
+
 extern void flat_storage_init(size_t maxbytes);
 extern char* do_item_cachedump(const chunk_type_t type, const unsigned int limit, unsigned int *bytes);
 extern const char* item_key_copy(const item* it, char* keyptr);
 
 DECL_MT_FUNC(char*, flat_allocator_stats, (size_t* bytes));
+DECL_MT_FUNC(void, flat_storage_adopt, (void));
+DECL_MT_FUNC(void, flat_storage_save, (void));
+extern size_t append_memory_file_stats(char* const buffer_start, const size_t buffer_size,
+                                       const size_t buffer_off, const size_t reserved);
 
 FA_STATIC_DECL(bool flat_storage_alloc(void));
 FA_STATIC_DECL(item* get_lru_item(void));
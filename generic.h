@@ -110,4 +110,14 @@ typedef unsigned int rel_time_t;
 // bump a counter up by one. return 0 if the counter has overflowed, nonzero otherwise.
 #define BUMP(cntr)  ((++(cntr)) != 0)
 
+// full memory barrier, for data that is read by threads that don't hold our locks.
+#define memory_barrier()  __sync_synchronize()
+
+// keeps the stores before it ahead of the stores after it.  cheaper than a full
+// barrier, and enough for data that only one thread writes.
+#define write_barrier()  __atomic_thread_fence(__ATOMIC_RELEASE)
+
+// hint that addr will be read soon.  this never faults, even on a bad address.
+#define prefetch(addr)  __builtin_prefetch(addr)
+
 #endif /* #if !defined(_generic_h_) */
@@ -0,0 +1,143 @@
+/* -*- Mode: C; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+
+#include "generic.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <sys/mman.h>
+
+#include "hugepage.h"
+#include "memcached.h"
+
+#if !defined(MAP_ANONYMOUS) && defined(MAP_ANON)
+#define MAP_ANONYMOUS MAP_ANON
+#endif
+
+static struct {
+    size_t page_size;               /* 0 until it's been looked up. */
+    size_t explicit_bytes;          /* mapped with MAP_HUGETLB. */
+    size_t advised_bytes;           /* mapped with normal pages and
+                                     * MADV_HUGEPAGE. */
+    unsigned int fallbacks;         /* mappings the huge page pool couldn't
+                                     * cover. */
+} hp;
+
+
+/* reads a "<name>: <n> kB" line from a /proc file, in bytes.  returns false if
+ * there's no such file or line. */
+static bool read_proc_kb(const char* path, const char* name, size_t* bytes) {
+    FILE* f = fopen(path, "r");
+    char line[256];
+    size_t name_len = strlen(name);
+    bool found = false;
+
+    if (f == NULL) {
+        return false;
+    }
+    while (fgets(line, sizeof(line), f) != NULL) {
+        if (strncmp(line, name, name_len) == 0 && line[name_len] == ':') {
+            *bytes = strtoul(line + name_len + 1, NULL, 10) * 1024;
+            found = true;
+            break;
+        }
+    }
+    fclose(f);
+    return found;
+}
+
+
+static size_t hugepage_size(void) {
+    if (hp.page_size == 0 &&
+        (! read_proc_kb("/proc/meminfo", "Hugepagesize", &hp.page_size) ||
+         hp.page_size == 0)) {
+        hp.page_size = HUGEPAGE_DEFAULT_SIZE;
+    }
+    return hp.page_size;
+}
+
+
+void* hugepage_map(const size_t len) {
+    size_t page_size, rounded;
+    char* ptr;
+    uintptr_t aligned;
+
+    if (! settings.hugepages) {
+        ptr = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        return (ptr == MAP_FAILED) ? NULL : ptr;
+    }
+
+    page_size = hugepage_size();
+    rounded = (len + page_size - 1) / page_size * page_size;
+
+#if defined(MAP_HUGETLB)
+    /* a private huge page mapping reserves its pages up front, so if the pool
+     * is short, we find out here rather than on a fault later. */
+    ptr = mmap(NULL, rounded, PROT_READ | PROT_WRITE,
+               MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (ptr != MAP_FAILED) {
+        hp.explicit_bytes += rounded;
+        return ptr;
+    }
+    fprintf(stderr, "Not enough huge pages for %lu MB of items, "
+            "falling back to transparent huge pages\n",
+            (unsigned long) (rounded / (1024 * 1024)));
+#endif /* #if defined(MAP_HUGETLB) */
+    hp.fallbacks++;
+
+    /* map an extra huge page, so that the region can start on a huge page
+     * boundary, and trim what's left over on either side. */
+    ptr = mmap(NULL, rounded + page_size, PROT_READ | PROT_WRITE,
+               MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (ptr == MAP_FAILED) {
+        return NULL;
+    }
+    aligned = ((uintptr_t) ptr + page_size - 1) / page_size * page_size;
+    if (aligned != (uintptr_t) ptr) {
+        munmap(ptr, aligned - (uintptr_t) ptr);
+    }
+    munmap((char*) aligned + rounded, page_size - (aligned - (uintptr_t) ptr));
+
+#if defined(MADV_HUGEPAGE)
+    if (madvise((void*) aligned, rounded, MADV_HUGEPAGE) == 0) {
+        hp.advised_bytes += rounded;
+    } else {
+        perror("Transparent huge pages aren't available for items");
+    }
+#endif /* #if defined(MADV_HUGEPAGE) */
+
+    return (void*) aligned;
+}
+
+
+/* appends what huge pages item memory got to a "stats" response. */
+size_t append_hugepage_stats(char* const buffer_start, const size_t buffer_size,
+                             const size_t buffer_off, const size_t reserved) {
+    size_t off = buffer_off;
+    size_t page_size, transparent;
+
+    if (! settings.hugepages) {
+        return off;
+    }
+
+    page_size = hugepage_size();
+    off = append_to_buffer(buffer_start, buffer_size, off, reserved,
+                           "STAT hugepage_size %lu\r\n"
+                           "STAT hugepages_explicit %lu\r\n"
+                           "STAT hugepage_fallbacks %u\r\n",
+                           (unsigned long) page_size,
+                           (unsigned long) (hp.explicit_bytes / page_size),
+                           hp.fallbacks);
+
+    /* the kernel only counts transparent huge pages for the whole process, but
+     * item memory is nearly all of it. */
+    if (hp.advised_bytes != 0 &&
+        read_proc_kb("/proc/self/smaps_rollup", "AnonHugePages", &transparent)) {
+        off = append_to_buffer(buffer_start, buffer_size, off, reserved,
+                               "STAT hugepages_transparent %lu\r\n",
+                               (unsigned long) (transparent / page_size));
+    }
+    return off;
+}
@@ -0,0 +1,29 @@
+/* -*- Mode: C; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+
+/**
+ * Huge pages for item memory: with -L, the flat allocator's arena, the slab
+ * allocator's pages and the log allocator's segments are mapped with explicit
+ * huge pages (MAP_HUGETLB), so that random gets over a large cache don't keep
+ * missing the TLB.  if the huge page pool can't cover a mapping, it falls back
+ * to normal pages advised for transparent huge pages (MADV_HUGEPAGE), and says
+ * so on stderr.
+ */
+
+#include "generic.h"
+
+#if !defined(_hugepage_h_)
+#define _hugepage_h_
+
+#include "memcached.h"
+
+/* the huge page size, if /proc/meminfo doesn't say. */
+#define HUGEPAGE_DEFAULT_SIZE (2 * 1024 * 1024)
+
+/* maps at least len bytes of zeroed memory, aligned to the huge page size if
+ * -L was given.  returns NULL if it can't. */
+extern void* hugepage_map(const size_t len);
+
+extern size_t append_hugepage_stats(char* const buffer_start, const size_t buffer_size,
+                                    const size_t buffer_off, const size_t reserved);
+
+#endif /* #if !defined(_hugepage_h_) */
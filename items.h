@@ -23,13 +23,19 @@
 #include "flat_storage.h"
 #endif /* #if defined(USE_FLAT_ALLOCATOR) */
 
+#if defined(USE_LOG_ALLOCATOR)
+#include "log_storage.h"
+#endif /* #if defined(USE_LOG_ALLOCATOR) */
+
+#include "storage_engine.h"
+
 /* See items.c */
 extern void item_init(void);
 /*@null@*/
 extern void do_try_item_stamp(item* it, rel_time_t now, const struct in_addr addr);
 extern item* do_item_alloc(const char *key, const size_t nkey,
                            const int flags, const rel_time_t exptime, const size_t nbytes,
-                           const struct in_addr addr);
+                           const struct in_addr addr, bool* rejected);
 extern bool  item_size_ok(const size_t nkey, const int flags, const int nbytes);
 
 extern int   do_item_link(item *it, const char* key);     /** may fail if transgresses limits */
@@ -39,12 +45,16 @@ extern void  do_item_deref(item *it);
 extern void  do_item_update(item *it);   /** update LRU time to current and reposition */
 extern int   do_item_replace(item *it, item *new_it, const char* key);
 
+/*@null@*/
+extern char* do_item_stats(int *bytes);
 /*@null@*/
 extern char* do_item_stats_sizes(int *bytes);
 extern void  do_item_flush_expired(void);
 extern item* item_get(const char *key, const size_t nkey);
 
-extern item* do_item_get_notedeleted(const char *key, const size_t nkey, bool *delete_locked);
+extern item* do_item_get_notedeleted(const char *key, const size_t nkey, const uint32_t hv,
+                                     bool *delete_locked);
+extern item* item_get_lockfree(const char *key, const size_t nkey, const uint32_t hv);
 extern item* do_item_get_nocheck(const char *key, const size_t nkey);
 
 /* returns true if a deleted item's delete-locked-time is over, and it
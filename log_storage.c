@@ -0,0 +1,1034 @@
+/* -*- Mode: C; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+#include "generic.h"
+
+#if defined(USE_LOG_ALLOCATOR)
+#include <sys/types.h>
+#include <netinet/in.h>
+#include <sys/time.h>
+#include <assert.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define __need_ITEM_data
+
+#include "memcached.h"
+#include "assoc.h"
+#include "stats.h"
+#include "admission.h"
+#include "expiry.h"
+#include "hugepage.h"
+#include "log_storage.h"
+#include "storage_engine.h"
+#include "slabs_items_support.h"
+
+#define NO_SEGMENT ((uint32_t) -1)
+
+/* the expiration time of a segment holding an item that never expires. */
+#define NEVER_EXPIRES ((rel_time_t) -1)
+
+typedef enum {
+    SEGMENT_FREE = 0,
+    SEGMENT_OPEN,                       /* being appended to. */
+    SEGMENT_SEALED,                     /* full, waiting to be cleaned. */
+} segment_state_t;
+
+typedef enum {
+    CLEAN_EXPIRED,                      /* every item has expired. */
+    CLEAN_COMPACT,                      /* relocate every live item. */
+    CLEAN_EVICT,                        /* relocate the hot items only. */
+} clean_mode_t;
+
+typedef struct log_segment_s log_segment_t;
+struct log_segment_s {
+    uint32_t   used;                    /* bytes appended. */
+    uint32_t   live_bytes;              /* bytes of the items not yet freed. */
+    uint32_t   live_items;
+    rel_time_t sealed;                  /* when it filled up. */
+    rel_time_t retry;                   /* not cleaned again before this. */
+    rel_time_t expires;                 /* the latest expiration time of its
+                                         * items. */
+    uint32_t   next;                    /* free list link. */
+    uint8_t    state;
+    uint8_t    bucket;                  /* TTL bucket, with -E. */
+};
+
+static struct {
+    char*          start;
+    log_segment_t* segments;
+    uint32_t       count;
+    uint32_t       initialized;         /* segments appended to at least once. */
+    uint32_t       free_list;
+    uint32_t       free_count;          /* including the uninitialized ones. */
+    uint32_t       heads[LOG_TTL_BUCKETS]; /* new items are appended here.
+                                            * without -E, only heads[0]. */
+    uint32_t       survivor;            /* relocated items are appended here,
+                                         * without -E. */
+    uint32_t       cleaning;            /* the segment being cleaned. */
+
+    /* set when a segment goes back on the free list.  lock-free readers may
+     * still be looking at its items, so it can't be appended to again until
+     * they've left their epochs. */
+    bool           freed_since_sync;
+
+    struct {
+        uint64_t   compactions;
+        uint64_t   eviction_passes;
+        uint64_t   segments_cleaned;
+        uint64_t   segments_emptied;    /* freed without cleaning. */
+        uint64_t   relocated_items;
+        uint64_t   relocated_bytes;
+        uint64_t   foreground_cleans;
+        uint64_t   cleaner_wakeups;
+        uint64_t   expired_segments;
+    } stats;
+
+    pthread_mutex_t cleaner_lock;       /* taken after the cache lock. */
+    pthread_cond_t  cleaner_cond;
+    bool            cleaner_wanted;
+    bool            cleaner_running;
+} lsi;
+
+static void log_item_unlink_impl(item *it, long flags, bool to_freelist);
+
+
+static inline size_t item_footprint(const size_t nkey, const size_t nbytes) {
+    size_t ntotal = stritem_length + nkey + nbytes;
+
+    return (ntotal + LOG_ITEM_ALIGN - 1) & ~((size_t) LOG_ITEM_ALIGN - 1);
+}
+
+static inline size_t ITEM_footprint(const item* it) {
+    return item_footprint(ITEM_nkey(it), ITEM_nbytes(it));
+}
+
+static inline char* segment_start(const uint32_t ix) {
+    return lsi.start + ((size_t) ix * LOG_SEGMENT_SZ);
+}
+
+static inline uint32_t segment_of(const item* it) {
+    return ((const char*) it - lsi.start) / LOG_SEGMENT_SZ;
+}
+
+static inline bool segment_expired(const log_segment_t* seg, const rel_time_t now) {
+    return (seg->live_items != 0 && seg->expires <= now);
+}
+
+/* the TTL bucket an item with this expiration time is appended to. */
+static unsigned int ttl_bucket(const rel_time_t exptime) {
+    rel_time_t ttl;
+    unsigned int bucket = 1;
+
+    if (! settings.ttl_segments || exptime == 0) {
+        return 0;
+    }
+    ttl = (exptime > current_time) ? exptime - current_time : 1;
+    while ((ttl >>= 1) != 0 && bucket < LOG_TTL_BUCKETS - 1) {
+        bucket++;
+    }
+    return bucket;
+}
+
+
+static void log_storage_init(const size_t maxbytes) {
+    unsigned int bucket;
+
+    always_assert(LOG_SEGMENT_SZ % LOG_ITEM_ALIGN == 0);
+    always_assert(LOG_FREE_TARGET > LOG_CLEANER_RESERVE);
+
+    lsi.count = maxbytes / LOG_SEGMENT_SZ;
+    if (lsi.count < LOG_SEGMENTS_MIN) {
+        lsi.count = LOG_SEGMENTS_MIN;
+    }
+
+    lsi.start = hugepage_map((size_t) lsi.count * LOG_SEGMENT_SZ);
+    lsi.segments = calloc(lsi.count, sizeof(log_segment_t));
+    if (lsi.start == NULL || lsi.segments == NULL) {
+        fprintf(stderr, "failed to allocate %u log segments\n", lsi.count);
+        exit(EXIT_FAILURE);
+    }
+
+    lsi.initialized = 0;
+    lsi.free_list = NO_SEGMENT;
+    lsi.free_count = lsi.count;
+    for (bucket = 0; bucket < LOG_TTL_BUCKETS; bucket++) {
+        lsi.heads[bucket] = NO_SEGMENT;
+    }
+    lsi.survivor = NO_SEGMENT;
+    lsi.cleaning = NO_SEGMENT;
+    pthread_mutex_init(&lsi.cleaner_lock, NULL);
+    pthread_cond_init(&lsi.cleaner_cond, NULL);
+}
+
+
+static void cleaner_wake(void) {
+    pthread_mutex_lock(&lsi.cleaner_lock);
+    if (! lsi.cleaner_wanted) {
+        lsi.cleaner_wanted = true;
+        pthread_cond_signal(&lsi.cleaner_cond);
+    }
+    pthread_mutex_unlock(&lsi.cleaner_lock);
+}
+
+
+/* takes a free segment to append to.  only the cleaner may take the last
+ * LOG_CLEANER_RESERVE of them. */
+static uint32_t segment_take(const unsigned int bucket, const bool for_cleaner) {
+    stats_t *stats = STATS_GET_TLS();
+    uint32_t ix;
+
+    if (lsi.free_count == 0 ||
+        (! for_cleaner && lsi.free_count <= LOG_CLEANER_RESERVE)) {
+        return NO_SEGMENT;
+    }
+
+    if (lsi.free_list != NO_SEGMENT) {
+        if (lsi.freed_since_sync) {
+            epoch_synchronize();
+            lsi.freed_since_sync = false;
+        }
+        ix = lsi.free_list;
+        lsi.free_list = lsi.segments[ix].next;
+    } else {
+        ix = lsi.initialized++;
+        STATS_LOCK(stats);
+        stats->item_storage_allocated += LOG_SEGMENT_SZ;
+        STATS_UNLOCK(stats);
+    }
+    lsi.free_count--;
+    if (! for_cleaner && lsi.cleaner_running && lsi.free_count < LOG_FREE_TARGET) {
+        cleaner_wake();
+    }
+
+    memset(&lsi.segments[ix], 0, sizeof(log_segment_t));
+    lsi.segments[ix].state = SEGMENT_OPEN;
+    lsi.segments[ix].next = NO_SEGMENT;
+    lsi.segments[ix].bucket = bucket;
+    return ix;
+}
+
+
+static void segment_free(const uint32_t ix) {
+    log_segment_t* seg = &lsi.segments[ix];
+
+    assert(seg->live_items == 0);
+    if (lsi.heads[seg->bucket] == ix) {
+        lsi.heads[seg->bucket] = NO_SEGMENT;
+    }
+    if (lsi.survivor == ix) {
+        lsi.survivor = NO_SEGMENT;
+    }
+    seg->state = SEGMENT_FREE;
+    seg->next = lsi.free_list;
+    lsi.free_list = ix;
+    lsi.free_count++;
+    lsi.freed_since_sync = true;
+}
+
+
+/* takes an item that was freed or moved out of its segment off the segment's
+ * count.  a full segment with nothing left in it is freed at once, as there's
+ * nothing to clean. */
+static void segment_forget(const uint32_t ix, const size_t footprint) {
+    log_segment_t* seg = &lsi.segments[ix];
+
+    assert(seg->live_items > 0);
+    seg->live_bytes -= footprint;
+    seg->live_items--;
+    if (seg->live_items == 0 && seg->state == SEGMENT_SEALED) {
+        segment_free(ix);
+        if (ix != lsi.cleaning) {
+            lsi.stats.segments_emptied++;
+        }
+    }
+}
+
+
+/* seals an open segment, so that it's no longer appended to. */
+static void segment_seal(uint32_t* head) {
+    uint32_t ix = *head;
+    log_segment_t* seg = &lsi.segments[ix];
+
+    seg->state = SEGMENT_SEALED;
+    seg->sealed = current_time;
+    *head = NO_SEGMENT;
+    if (seg->live_items == 0) {
+        segment_free(ix);
+        lsi.stats.segments_emptied++;
+    }
+}
+
+
+/* appends room for an item to the head segment of its TTL bucket, or to the
+ * survivor segment if the cleaner is relocating it without -E.  returns NULL
+ * if no segment can be had. */
+static item* segment_append(const size_t footprint, const rel_time_t exptime,
+                            const bool for_cleaner) {
+    unsigned int bucket = ttl_bucket(exptime);
+    uint32_t* head = (for_cleaner && ! settings.ttl_segments) ?
+        &lsi.survivor : &lsi.heads[bucket];
+    log_segment_t* seg;
+    item* it;
+
+    if (*head != NO_SEGMENT &&
+        lsi.segments[*head].used + footprint > LOG_SEGMENT_SZ) {
+        segment_seal(head);
+    }
+    if (*head == NO_SEGMENT &&
+        (*head = segment_take(bucket, for_cleaner)) == NO_SEGMENT) {
+        return NULL;
+    }
+
+    seg = &lsi.segments[*head];
+    it = (item*) (segment_start(*head) + seg->used);
+    seg->used += footprint;
+    seg->live_bytes += footprint;
+    seg->live_items++;
+    if (exptime == 0) {
+        seg->expires = NEVER_EXPIRES;
+    } else if (exptime > seg->expires) {
+        seg->expires = exptime;
+    }
+    return it;
+}
+
+
+/* Enable this for reference-count debugging. */
+#if 0
+# define DEBUG_REFCNT(it,op) \
+                fprintf(stderr, "item %x refcnt(%c) %d %c%c%c\n", \
+                        it, op, it->refcount, \
+                        (it->it_flags & ITEM_LINKED) ? 'L' : ' ', \
+                        (it->it_flags & ITEM_SLABBED) ? 'S' : ' ', \
+                        (it->it_flags & ITEM_DELETED) ? 'D' : ' ')
+#else
+# define DEBUG_REFCNT(it,op) while(0)
+#endif
+
+
+/* items are packed, so there's no slack to stamp. */
+static void log_try_item_stamp(item* it, const rel_time_t now, const struct in_addr addr) {
+    it->it_flags &= ~(ITEM_HAS_TIMESTAMP | ITEM_HAS_IP_ADDRESS);
+}
+
+
+static void item_free(item *it) {
+    assert((it->it_flags & ITEM_LINKED) == 0);
+    assert(it->refcount == ITEM_REFCOUNT_DEAD);
+
+    it->it_flags |= ITEM_SLABBED;
+    DEBUG_REFCNT(it, 'F');
+    segment_forget(segment_of(it), ITEM_footprint(it));
+}
+
+
+/* moves a linked item to the survivor segment.  the caller holds its item lock
+ * and has checked that it isn't referenced.  returns false if there's no
+ * room, leaving the item where it was. */
+static bool item_relocate(item* it) {
+    size_t footprint = ITEM_footprint(it);
+    item* new_it;
+
+    /* lock-free gets can't pick up a reference to a frozen item. */
+    if (! ITEM_refcount_kill(it)) {
+        return false;
+    }
+    if ((new_it = segment_append(footprint, it->exptime, true)) == NULL) {
+        ITEM_refcount_revive(it);
+        return false;
+    }
+
+    memcpy(new_it, it, stritem_length + ITEM_nkey(it) + ITEM_nbytes(it));
+    new_it->it_flags &= ~(ITEM_BUMPED | ITEM_VISITED);
+    new_it->time = current_time;
+    new_it->refcount = 0;
+    assoc_update(it, new_it);
+
+    it->it_flags = (it->it_flags & ~ITEM_LINKED) | ITEM_SLABBED;
+    segment_forget(segment_of(it), footprint);
+
+    lsi.stats.relocated_items++;
+    lsi.stats.relocated_bytes += footprint;
+    return true;
+}
+
+
+/* picks the segment to clean, and how.  returns NO_SEGMENT if there's none. */
+static uint32_t victim_choose(clean_mode_t* mode) {
+    uint64_t used = 0, dead = 0;
+    uint32_t ix, best = NO_SEGMENT, oldest = NO_SEGMENT;
+    double best_score = -1.0;
+    rel_time_t now = current_time;
+    bool compact;
+
+    for (ix = 0; ix < lsi.initialized; ix++) {
+        log_segment_t* seg = &lsi.segments[ix];
+        double u, score;
+
+        if (seg->state != SEGMENT_SEALED) {
+            continue;
+        }
+        used += seg->used;
+        dead += seg->used - seg->live_bytes;
+        if (seg->retry > now) {
+            continue;
+        }
+        if (segment_expired(seg, now)) {
+            *mode = CLEAN_EXPIRED;
+            return ix;
+        }
+
+        if (oldest == NO_SEGMENT || seg->sealed < lsi.segments[oldest].sealed) {
+            oldest = ix;
+        }
+        if (seg->live_bytes < seg->used) {
+            u = (double) seg->live_bytes / LOG_SEGMENT_SZ;
+            score = (1.0 - u) * (double) (now - seg->sealed + 1) / (1.0 + u);
+            if (score > best_score) {
+                best_score = score;
+                best = ix;
+            }
+        }
+    }
+
+    /* with -M, there's nothing to do but compact. */
+    if (! settings.evict_to_free) {
+        *mode = CLEAN_COMPACT;
+        return best;
+    }
+
+    compact = (best != NO_SEGMENT &&
+               dead * 100 > used * (100 - LOG_UTILIZATION_TARGET) &&
+               (uint64_t) lsi.segments[best].live_bytes * 100 <
+               (uint64_t) lsi.segments[best].used * LOG_UTILIZATION_TARGET);
+    *mode = compact ? CLEAN_COMPACT : CLEAN_EVICT;
+    return compact ? best : oldest;
+}
+
+
+/*
+ * cleans segment ix, picked by victim_choose(); see log_storage.h.  if
+ * rejected is not NULL, the cleaning makes room for an item with the hash
+ * candidate_hv, which is subject to admission, and *rejected is set if the
+ * admission filter turned it away rather than evict a more popular item.
+ * returns true if the segment was freed.
+ */
+static bool do_log_clean(const uint32_t ix, const clean_mode_t mode,
+                         const uint32_t candidate_hv, bool* rejected) {
+    stats_t *stats = STATS_GET_TLS();
+    uint64_t bumped = 0, dropped = 0;
+    rel_time_t now = current_time;
+    log_segment_t* seg;
+    char *pos, *end;
+    bool compact;
+
+    switch (mode) {
+        case CLEAN_EXPIRED:
+            lsi.stats.expired_segments++;
+            break;
+        case CLEAN_COMPACT:
+            lsi.stats.compactions++;
+            break;
+        case CLEAN_EVICT:
+            lsi.stats.eviction_passes++;
+            break;
+    }
+    /* should anything in an expired segment turn out to be live, it's moved
+     * rather than evicted. */
+    compact = (mode != CLEAN_EVICT);
+
+    seg = &lsi.segments[ix];
+    lsi.cleaning = ix;
+    for (pos = segment_start(ix), end = pos + seg->used; pos < end; ) {
+        item* it = (item*) pos;
+        bool expired, hot;
+        uint32_t hv;
+
+        pos += ITEM_footprint(it);
+        if (it->it_flags & ITEM_SLABBED) {
+            continue;
+        }
+
+        /* referenced items, and items that haven't been linked yet, stay put,
+         * as does anything whose lock is busy.  we hold the cache lock, so we
+         * may only try for the item lock. */
+        if ((it->it_flags & ITEM_LINKED) == 0 || it->refcount != 0 ||
+            ! item_trylock(hv = ITEM_hv(it))) {
+            continue;
+        }
+        if ((it->it_flags & ITEM_LINKED) == 0 || it->refcount != 0) {
+            item_unlock(hv);
+            continue;
+        }
+
+        expired = (it->exptime != 0 && it->exptime <= now) ||
+            (settings.oldest_live != 0 && settings.oldest_live <= now &&
+             it->time <= settings.oldest_live);
+        hot = ITEM_is_bumped(it);
+        if (expired) {
+            log_item_unlink_impl(it, UNLINK_IS_EXPIRED, true);
+            STATS_LOCK(stats);
+            stats->expired_reclaimed++;
+            STATS_UNLOCK(stats);
+        } else if ((compact || hot) && item_relocate(it)) {
+            if (hot) {
+                bumped++;
+            }
+        } else if (! settings.evict_to_free) {
+            /* no room to move it, and it mustn't be evicted. */
+        } else if (rejected != NULL && ! admission_admit(candidate_hv, hv)) {
+            /* the victim's key has been seen more often. */
+            item_unlock(hv);
+            STATS_LOCK(stats);
+            stats->admission_rejects++;
+            STATS_UNLOCK(stats);
+            *rejected = true;
+            break;
+        } else {
+            STATS_LOCK(stats);
+            stats->evictions++;
+            if (it->exptime != 0) {
+                stats->evictions_of_live_items++;
+            }
+            STATS_UNLOCK(stats);
+            if (hot) {
+                dropped++;
+            }
+            log_item_unlink_impl(it, UNLINK_IS_EVICT, true);
+        }
+        item_unlock(hv);
+    }
+
+    STATS_LOCK(stats);
+    stats->lru_bumps += bumped;
+    stats->lru_bump_drops += dropped;
+    STATS_UNLOCK(stats);
+
+    /* the last item to go freed the segment.  if anything was left behind,
+     * give it a while before trying again, unless the admission filter cut
+     * the cleaning short. */
+    lsi.cleaning = NO_SEGMENT;
+    if (seg->state == SEGMENT_FREE) {
+        lsi.stats.segments_cleaned++;
+        return true;
+    }
+    if (rejected == NULL || ! *rejected) {
+        seg->retry = now + 1;
+    }
+    return false;
+}
+
+
+/* seals the open segments whose items have all expired, so that they're
+ * reclaimed with the sealed ones rather than left open until their TTL bucket
+ * is next appended to. */
+static void heads_seal_expired(void) {
+    rel_time_t now = current_time;
+    unsigned int bucket;
+
+    for (bucket = 1; bucket < LOG_TTL_BUCKETS; bucket++) {
+        uint32_t ix = lsi.heads[bucket];
+
+        if (ix != NO_SEGMENT && lsi.segments[ix].used != 0 &&
+            lsi.segments[ix].expires <= now) {
+            segment_seal(&lsi.heads[bucket]);
+        }
+    }
+}
+
+
+static void* log_cleaner_thread(void* arg) {
+    int tries;
+
+    /* evictions are accounted in the stats.  every thread must have its own,
+     * so we get the slot after the hashtable maintenance thread's. */
+    STATS_SET_TLS(settings.num_threads + 1);
+
+    pthread_mutex_lock(&lsi.cleaner_lock);
+    while (1) {
+        bool wanted;
+
+        /* with -E, it also wakes up every second to reclaim the segments that
+         * have expired. */
+        while (! lsi.cleaner_wanted) {
+            struct timeval now;
+            struct timespec deadline;
+
+            if (! settings.ttl_segments) {
+                pthread_cond_wait(&lsi.cleaner_cond, &lsi.cleaner_lock);
+                continue;
+            }
+            gettimeofday(&now, NULL);
+            deadline.tv_sec = now.tv_sec + 1;
+            deadline.tv_nsec = now.tv_usec * 1000;
+            if (pthread_cond_timedwait(&lsi.cleaner_cond, &lsi.cleaner_lock,
+                                       &deadline) == ETIMEDOUT) {
+                break;
+            }
+        }
+        wanted = lsi.cleaner_wanted;
+        lsi.cleaner_wanted = false;
+        pthread_mutex_unlock(&lsi.cleaner_lock);
+
+        CACHE_LOCK();
+        if (wanted) {
+            lsi.stats.cleaner_wakeups++;
+        }
+        if (settings.ttl_segments) {
+            heads_seal_expired();
+        }
+
+        /* expired segments are always reclaimed, and don't count against the
+         * tries.  with the admission filter, items are only evicted to make
+         * room for an item that it has admitted. */
+        for (tries = 0; tries < LOG_CLEAN_TRIES; ) {
+            clean_mode_t mode;
+            uint32_t ix;
+
+            if ((ix = victim_choose(&mode)) == NO_SEGMENT) {
+                break;
+            }
+            if (mode != CLEAN_EXPIRED) {
+                if (lsi.free_count >= LOG_FREE_TARGET ||
+                    (settings.admission_filter && mode == CLEAN_EVICT)) {
+                    break;
+                }
+                tries++;
+            }
+            do_log_clean(ix, mode, 0, NULL);
+
+            /* let the workers in between segments. */
+            CACHE_UNLOCK();
+            sched_yield();
+            CACHE_LOCK();
+        }
+        CACHE_UNLOCK();
+
+        pthread_mutex_lock(&lsi.cleaner_lock);
+    }
+    return NULL;
+}
+
+
+static void log_storage_start_cleaner(void) {
+    pthread_t thread;
+    int ret;
+
+    if ((ret = pthread_create(&thread, NULL, log_cleaner_thread, NULL)) != 0) {
+        fprintf(stderr, "Can't create log cleaner thread: %s\n", strerror(ret));
+        exit(EXIT_FAILURE);
+    }
+    lsi.cleaner_running = true;
+}
+
+
+/*
+ * if rejected is not NULL, the item is subject to admission, and *rejected is
+ * set if NULL is returned because the admission filter turned it away.
+ */
+/*@null@*/
+static item *log_item_alloc(const char *key, const size_t nkey, const int flags, const rel_time_t exptime,
+                            const size_t nbytes, const struct in_addr addr, bool* rejected) {
+    size_t footprint = item_footprint(nkey, nbytes);
+    uint32_t candidate_hv = hash(key, nkey, 0);
+    item *it;
+    int tries;
+
+    if (rejected != NULL) {
+        *rejected = false;
+        admission_record(candidate_hv);
+    }
+
+    if (footprint > LOG_SEGMENT_SZ) {
+        return NULL;
+    }
+
+    it = segment_append(footprint, exptime, false);
+    for (tries = LOG_CLEAN_TRIES; it == NULL && tries > 0; tries--) {
+        clean_mode_t mode;
+        uint32_t ix;
+
+        if ((ix = victim_choose(&mode)) == NO_SEGMENT) {
+            break;
+        }
+        lsi.stats.foreground_cleans++;
+        if (! do_log_clean(ix, mode, candidate_hv, rejected)) {
+            if (rejected != NULL && *rejected) {
+                return NULL;
+            }
+            continue;
+        }
+        it = segment_append(footprint, exptime, false);
+    }
+    if (it == NULL) {
+        return NULL;
+    }
+
+    it->next = it->prev = it->h_next = 0;
+    it->refcount = 1;     /* the caller will have a reference */
+    DEBUG_REFCNT(it, '*');
+    it->it_flags = 0;
+    it->slabs_clsid = 0;
+    it->nkey = nkey;
+    it->nbytes = nbytes;
+    memcpy(ITEM_key(it), key, nkey);
+    it->exptime = exptime;
+    it->flags = flags;
+    it->hv = candidate_hv;
+    it->time = current_time;
+
+    return it;
+}
+
+
+/**
+ * Returns true if an item will fit in the cache (its size does not exceed
+ * the maximum for a cache entry.)
+ */
+static bool log_item_size_ok(const size_t nkey, const int flags, const int nbytes) {
+    return (item_footprint(nkey, nbytes) <= LOG_SEGMENT_SZ);
+}
+
+
+static bool log_item_need_realloc(const item* it,
+                                  const size_t new_nkey, const int new_flags, const size_t new_nbytes) {
+    return (ITEM_footprint(it) != item_footprint(new_nkey, new_nbytes));
+}
+
+
+static int log_item_link(item *it, const char* key) {
+    stats_t *stats = STATS_GET_TLS();
+
+    assert((it->it_flags & (ITEM_LINKED|ITEM_SLABBED)) == 0);
+    assert(it->nbytes < (1024 * 1024));  /* 1MB max size */
+    it->it_flags |= ITEM_LINKED;
+    it->it_flags &= ~(ITEM_VISITED | ITEM_BUMPED);
+    it->time = current_time;
+    assoc_insert(it, key);
+    /* with -E, expired items are reclaimed a segment at a time instead. */
+    if (! settings.ttl_segments) {
+        expiry_add(it->hv, it->exptime);
+    }
+
+    STATS_LOCK(stats);
+    stats->item_total_size += it->nkey + it->nbytes; /* cr-lf shouldn't count */
+    stats->curr_items += 1;
+    stats->total_items += 1;
+    STATS_UNLOCK(stats);
+
+    return 1;
+}
+
+static void log_item_unlink_impl(item *it, long flags, bool to_freelist) {
+    stats_t *stats = STATS_GET_TLS();
+    if ((it->it_flags & ITEM_LINKED) != 0) {
+        it->it_flags &= ~ITEM_LINKED;
+        STATS_LOCK(stats);
+        stats->item_total_size -= it->nkey + it->nbytes; /* cr-lf shouldn't
+                                                         * count */
+        stats->curr_items -= 1;
+        STATS_UNLOCK(stats);
+        if (settings.detail_enabled) {
+            stats_prefix_record_removal(ITEM_key(it), ITEM_nkey(it), it->nkey + it->nbytes, it->time, flags);
+        }
+        if (flags & UNLINK_IS_EVICT) {
+            stats_evict(it->nkey + it->nbytes);
+        } else if (flags & UNLINK_IS_EXPIRED) {
+            stats_expire(it->nkey + it->nbytes);
+        }
+        assoc_delete(ITEM_key(it), it->nkey);
+        if (! settings.ttl_segments) {
+            expiry_remove(it->hv, it->exptime);
+        }
+        if (ITEM_refcount_kill(it)) {
+            item_free(it);
+        }
+    }
+}
+
+static void log_item_deref(item *it) {
+    assert((it->it_flags & ITEM_SLABBED) == 0);
+    if (it->refcount != 0) {
+        ITEM_refcount_decr(it);
+        DEBUG_REFCNT(it, '-');
+    }
+    assert((it->it_flags & ITEM_DELETED) == 0 || it->refcount != 0);
+    if ((it->it_flags & ITEM_LINKED) == 0 && ITEM_refcount_kill(it)) {
+        CACHE_LOCK();
+        item_free(it);
+        CACHE_UNLOCK();
+    }
+}
+
+/* items are only moved when their segment is cleaned, so this only marks the
+ * item as due a move. */
+static void log_item_update(item *it) {
+    if (it->time < current_time - ITEM_UPDATE_INTERVAL) {
+        assert((it->it_flags & ITEM_SLABBED) == 0);
+
+        if ((it->it_flags & ITEM_LINKED) != 0) {
+            ITEM_mark_bumped(it);
+        }
+    }
+}
+
+/* calls fn on every linked item in a segment.  fn may unlink the item. */
+static void segment_walk(const uint32_t ix, void (*fn)(item* it, void* arg), void* arg) {
+    char *pos, *end;
+
+    for (pos = segment_start(ix), end = pos + lsi.segments[ix].used; pos < end; ) {
+        item* it = (item*) pos;
+
+        pos += ITEM_footprint(it);
+        if ((it->it_flags & (ITEM_LINKED | ITEM_SLABBED)) == ITEM_LINKED) {
+            fn(it, arg);
+        }
+    }
+}
+
+typedef struct {
+    char*        buffer;
+    unsigned int bufcurr;
+    unsigned int memlimit;
+    unsigned int shown;
+    unsigned int limit;
+    bool         full;
+} cachedump_t;
+
+static void cachedump_item(item* it, void* arg) {
+    cachedump_t* dump = arg;
+    char key_tmp[KEY_MAX_LENGTH + 1 /* for null terminator */];
+    char temp[512];
+    int len;
+
+    if ((dump->limit != 0 && dump->shown >= dump->limit) || dump->full) {
+        return;
+    }
+    memcpy(key_tmp, ITEM_key(it), it->nkey);
+    key_tmp[it->nkey] = 0;          /* null terminate */
+    len = snprintf(temp, sizeof(temp), "ITEM %s [%d b; %lu s]\r\n", key_tmp, it->nbytes, it->time + started);
+    if (dump->bufcurr + len + 6 > dump->memlimit) {  /* 6 is END\r\n\0 */
+        dump->full = true;
+        return;
+    }
+    strcpy(dump->buffer + dump->bufcurr, temp);
+    dump->bufcurr += len;
+    dump->shown++;
+}
+
+/* dumps the items in a segment. */
+/*@null@*/
+static char *log_item_cachedump(const unsigned int segment, const unsigned int limit, unsigned int *bytes) {
+    cachedump_t dump;
+
+    memset(&dump, 0, sizeof(dump));
+    dump.memlimit = 2 * 1024 * 1024;   /* 2MB max response size */
+    dump.limit = limit;
+    if ((dump.buffer = malloc((size_t) dump.memlimit)) == NULL) {
+        return NULL;
+    }
+
+    if (segment < lsi.initialized && lsi.segments[segment].state != SEGMENT_FREE) {
+        segment_walk(segment, cachedump_item, &dump);
+    }
+
+    memcpy(dump.buffer + dump.bufcurr, "END\r\n", 6);
+    *bytes = dump.bufcurr + 5;
+    return dump.buffer;
+}
+
+/* the items in each segment, and how long ago it filled up. */
+static char *log_item_stats(int *bytes) {
+    size_t bufsize = (size_t) lsi.count * 80 + 6, offset = 0;
+    char *buffer = malloc(bufsize);
+    char terminator[] = "END\r\n";
+    rel_time_t now = current_time;
+    uint32_t ix;
+
+    if (buffer == NULL) {
+        return NULL;
+    }
+
+    for (ix = 0; ix < lsi.initialized; ix++) {
+        log_segment_t* seg = &lsi.segments[ix];
+
+        if (seg->state != SEGMENT_FREE && seg->live_items != 0) {
+            offset = append_to_buffer(buffer, bufsize, offset, sizeof(terminator),
+                                      "STAT items:%u:number %u\r\nSTAT items:%u:age %u\r\n",
+                                      ix, seg->live_items,
+                                      ix, (seg->state == SEGMENT_SEALED) ? now - seg->sealed : 0);
+        }
+    }
+    offset = append_to_buffer(buffer, bufsize, offset, 0, terminator);
+
+    *bytes = (int) offset;
+    return buffer;
+}
+
+static void histogram_item(item* it, void* arg) {
+    unsigned int *histogram = arg;
+    int ntotal = ITEM_ntotal(it);
+    int bucket = ntotal / 32;
+
+    if ((ntotal % 32) != 0) bucket++;
+    if (bucket < 32768) histogram[bucket]++;
+}
+
+/** dumps out a list of objects of each size, with granularity of 32 bytes */
+/*@null@*/
+static char* log_item_stats_sizes(int *bytes) {
+    const int num_buckets = 32768;   /* max 1MB object, divided into 32 bytes size buckets */
+    unsigned int *histogram = (unsigned int *)malloc((size_t)num_buckets * sizeof(int));
+    size_t bufsize = (2 * 1024 * 1024), offset = 0;
+    char *buf = (char *)malloc(bufsize); /* 2MB max response size */
+    char terminator[] = "END\r\n";
+    uint32_t ix;
+    int i;
+
+    if (histogram == 0 || buf == 0) {
+        if (histogram) free(histogram);
+        if (buf) free(buf);
+        return NULL;
+    }
+
+    /* build the histogram */
+    memset(histogram, 0, (size_t)num_buckets * sizeof(int));
+    for (ix = 0; ix < lsi.initialized; ix++) {
+        if (lsi.segments[ix].state != SEGMENT_FREE) {
+            segment_walk(ix, histogram_item, histogram);
+        }
+    }
+
+    /* write the buffer */
+    *bytes = 0;
+    for (i = 0; i < num_buckets; i++) {
+        if (histogram[i] != 0) {
+            offset = append_to_buffer(buf, bufsize, offset, sizeof(terminator), "%d %u\r\n", i * 32, histogram[i]);
+        }
+    }
+    offset = append_to_buffer(buf, bufsize, offset, 0, terminator);
+    *bytes = (int) offset;
+    free(histogram);
+    return buf;
+}
+
+static void flush_item(item* it, void* arg) {
+    if (it->time >= settings.oldest_live) {
+        log_item_unlink_impl(it, UNLINK_IS_EXPIRED, true);
+    }
+}
+
+/* expires items that are more recent than the oldest_live setting.  there's
+ * no LRU to stop early in, so every segment is walked. */
+static void log_item_flush_expired(void) {
+    uint32_t ix;
+
+    if (settings.oldest_live == 0)
+        return;
+    for (ix = 0; ix < lsi.initialized; ix++) {
+        if (lsi.segments[ix].state != SEGMENT_FREE) {
+            segment_walk(ix, flush_item, NULL);
+        }
+    }
+}
+
+
+static void log_item_mark_visited(item* it)
+{
+    it->it_flags |= ITEM_VISITED;
+}
+
+
+char* do_log_allocator_stats(size_t* result_size) {
+    size_t bufsize = 2048, offset = 0;
+    char* buffer = malloc(bufsize);
+    char terminator[] = "END\r\n";
+    uint64_t used = 0, live = 0;
+    uint32_t ix, open = 0, sealed = 0;
+
+    if (buffer == NULL) {
+        *result_size = 0;
+        return NULL;
+    }
+
+    for (ix = 0; ix < lsi.initialized; ix++) {
+        log_segment_t* seg = &lsi.segments[ix];
+
+        if (seg->state == SEGMENT_FREE) {
+            continue;
+        }
+        if (seg->state == SEGMENT_OPEN) {
+            open++;
+        } else {
+            sealed++;
+        }
+        used += seg->used;
+        live += seg->live_bytes;
+    }
+
+    offset = append_to_buffer(buffer, bufsize, offset, sizeof(terminator),
+                              "STAT segment_sz %d\r\n"
+                              "STAT segments %u\r\n"
+                              "STAT free_segments %u\r\n"
+                              "STAT open_segments %u\r\n"
+                              "STAT sealed_segments %u\r\n"
+                              "STAT appended_bytes %" PRINTF_INT64_MODIFIER "u\r\n"
+                              "STAT live_bytes %" PRINTF_INT64_MODIFIER "u\r\n"
+                              "STAT utilization %.1f\r\n"
+                              "STAT compactions %" PRINTF_INT64_MODIFIER "u\r\n"
+                              "STAT eviction_passes %" PRINTF_INT64_MODIFIER "u\r\n"
+                              "STAT segments_cleaned %" PRINTF_INT64_MODIFIER "u\r\n"
+                              "STAT segments_emptied %" PRINTF_INT64_MODIFIER "u\r\n"
+                              "STAT relocated_items %" PRINTF_INT64_MODIFIER "u\r\n"
+                              "STAT relocated_bytes %" PRINTF_INT64_MODIFIER "u\r\n"
+                              "STAT foreground_cleans %" PRINTF_INT64_MODIFIER "u\r\n"
+                              "STAT cleaner_wakeups %" PRINTF_INT64_MODIFIER "u\r\n"
+                              "STAT expired_segments %" PRINTF_INT64_MODIFIER "u\r\n",
+                              LOG_SEGMENT_SZ,
+                              lsi.count,
+                              lsi.free_count,
+                              open,
+                              sealed,
+                              used,
+                              live,
+                              (open + sealed == 0) ? 0.0 :
+                              (double) live * 100 / ((double) (open + sealed) * LOG_SEGMENT_SZ),
+                              lsi.stats.compactions,
+                              lsi.stats.eviction_passes,
+                              lsi.stats.segments_cleaned,
+                              lsi.stats.segments_emptied,
+                              lsi.stats.relocated_items,
+                              lsi.stats.relocated_bytes,
+                              lsi.stats.foreground_cleans,
+                              lsi.stats.cleaner_wakeups,
+                              lsi.stats.expired_segments);
+    offset = append_to_buffer(buffer, bufsize, offset, 0, terminator);
+
+    *result_size = offset;
+    return buffer;
+}
+
+
+const storage_engine_t log_engine = {
+    .name = "log",
+    .init = log_storage_init,
+    .start = log_storage_start_cleaner,
+    .try_stamp = log_try_item_stamp,
+    .alloc = log_item_alloc,
+    .size_ok = log_item_size_ok,
+    .need_realloc = log_item_need_realloc,
+    .link = log_item_link,
+    .unlink = log_item_unlink_impl,
+    .deref = log_item_deref,
+    .update = log_item_update,
+    .mark_visited = log_item_mark_visited,
+    .cachedump = log_item_cachedump,
+    .stats = log_item_stats,
+    .stats_sizes = log_item_stats_sizes,
+    .flush_expired = log_item_flush_expired,
+};
+
+#endif /* #if defined(USE_LOG_ALLOCATOR) */
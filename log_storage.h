@@ -0,0 +1,117 @@
+/* -*- Mode: C; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+
+/**
+ * overview
+ * --------
+ *
+ * the log allocator keeps items in the slab allocator's layout (see
+ * slabs_items.h), but rather than rounding each one up to a slab class, it
+ * appends them, whole and back to back, to large segments.  memory is only
+ * handed out a segment at a time, so there are no size classes to balance and
+ * no free lists of chunks to coalesce, whatever the mix of item sizes.  it is
+ * built alongside the slab allocator, as a storage engine to be picked with
+ * -S (see storage_engine.h).
+ *
+ * unlinking an item only counts its bytes as dead in its segment.  the space
+ * comes back when the segment is cleaned: the cleaner walks its items,
+ * relocates the ones that are still wanted to a segment of its own (the
+ * survivor segment), and puts the segment back on the free list.  a segment
+ * whose last item goes away is freed at once, without being cleaned.
+ *
+ *
+ * cleaning
+ * --------
+ *
+ * the cleaner runs on its own thread whenever fewer than LOG_FREE_TARGET
+ * segments are free, and on the allocating thread if none are left.  it works
+ * in one of two ways:
+ *
+ * 1) while more than (100 - LOG_UTILIZATION_TARGET) percent of the bytes that
+ *    have been appended belong to dead items, it compacts.  the victim is the
+ *    segment with the best cost-benefit ratio, as in LFS and RAMCloud:
+ *    (1 - u) * age / (1 + u), where u is the fraction of the segment still
+ *    live and age is how long it has been since it filled up.  every live
+ *    item in it is relocated.
+ *
+ * 2) otherwise, memory really is full of live items, and it evicts.  the
+ *    victim is the segment that filled up longest ago.  items that were hit
+ *    since they were last written (see ITEM_BUMPED) are relocated; the rest
+ *    are evicted.  relocated items lose the mark, so a segment of hot items
+ *    is evicted the next time round unless they are hit again.
+ *
+ * either way, expired items are reclaimed, and an item that can't be
+ * relocated for want of space is evicted instead.  items that are referenced
+ * or whose item lock is busy are left where they are, and the segment is
+ * retried later.
+ *
+ * relocation freezes the old copy (see ITEM_refcount_kill) and swaps the new
+ * one into its hash chain, so lock-free gets never see a half-made copy.
+ * freed segments aren't appended to again until those readers have left
+ * their epochs.
+ *
+ * a segment whose items have all expired (it keeps the latest expiration
+ * time of the items appended to it) is always cleaned first, whatever the
+ * mode: its items are unlinked, and none are relocated.
+ *
+ *
+ * time to live
+ * ------------
+ *
+ * with -E, items are appended to a segment of their own TTL bucket: bucket 0
+ * for items that never expire, and bucket n for a time to live of 2^(n-1) to
+ * 2^n - 1 seconds.  relocated items go to their bucket too, in place of the
+ * survivor segment.  the items in a segment then expire at about the same
+ * time, so a segment goes as a whole once its latest item has expired, and
+ * there is nothing left to compact or evict.  items aren't filed in the expiry
+ * queues (see expiry.h); instead, the cleaner thread wakes up every second,
+ * seals the open segments whose items have all expired, and reclaims every
+ * expired segment.  the usual cleaning is only needed when no segment has
+ * expired.
+ *
+ * every bucket in use keeps a segment of its own open, so the memory limit
+ * has to leave a segment for each distinct TTL, on top of the ones that are
+ * kept free for cleaning.
+ *
+ *
+ * locking
+ * -------
+ *
+ * the segments are protected by the cache lock.  the cleaner thread only
+ * holds it for one segment at a time.
+ */
+
+#if !defined(_log_storage_h_)
+#define _log_storage_h_
+
+#include "generic.h"
+
+/* the largest item is a whole segment. */
+#define LOG_SEGMENT_SZ          (1024 * 1024)
+
+/* however small the memory limit, there are enough segments to clean. */
+#define LOG_SEGMENTS_MIN        4
+
+/* item sizes are rounded up to this, so that item headers stay aligned. */
+#define LOG_ITEM_ALIGN          8
+
+/* free segments that only the cleaner may take, for the items it relocates. */
+#define LOG_CLEANER_RESERVE     1
+
+/* the cleaner thread runs until this many segments are free. */
+#define LOG_FREE_TARGET         (LOG_CLEANER_RESERVE + 2)
+
+/* the percentage of appended bytes that are kept live by compacting before
+ * the cleaner turns to eviction. */
+#define LOG_UTILIZATION_TARGET  95
+
+/* segments cleaned for one allocation, or one wakeup of the cleaner thread,
+ * before giving up. */
+#define LOG_CLEAN_TRIES         8
+
+/* TTL buckets for -E.  the last one takes every time to live from
+ * 2^(LOG_TTL_BUCKETS - 2) seconds (about 48 days) on. */
+#define LOG_TTL_BUCKETS         24
+
+DECL_MT_FUNC(char*, log_allocator_stats, (size_t* bytes));
+
+#endif /* #if !defined(_log_storage_h_) */
@@ -54,6 +54,11 @@
 #include "stats.h"
 #include "sigseg.h"
 #include "conn_buffer.h"
+#include "timer_wheel.h"
+#include "expiry.h"
+#include "admission.h"
+#include "hugepage.h"
+#include "snapshot.h"
 
 #if defined(USE_SLAB_ALLOCATOR)
 #include "slabs_items_support.h"
@@ -92,9 +97,7 @@ settings_t settings;
 int maps_fd = -1;
 
 /** file scope variables **/
-static item **todelete = NULL;
-static int delcurr;
-static int deltotal;
+static timer_wheel_t deferred_deletes;
 static conn* listen_conn;
 static conn* listen_binary_conn;
 struct event_base *main_base;
@@ -169,6 +172,23 @@ static void settings_init(void) {
     settings.prefix_delimiter = ':';
     settings.detail_enabled = 0;
     settings.reqs_per_event = 1;
+    settings.lockfree_get = false;
+    settings.hashpower_init = HASHPOWER_DEFAULT;
+    settings.hash_index = HASH_INDEX_CHAINED;
+    settings.latency_to_send = false;
+    settings.worker_accept = false;
+    settings.worker_cpus = NULL;
+    settings.worker_cpu_count = 0;
+    settings.arena_numa = ARENA_NUMA_DEFAULT;
+    settings.lru_protected_pct = 0;
+    settings.admission_filter = false;
+    settings.size_aware_eviction = false;
+    settings.hugepages = false;
+    settings.memory_file = NULL;
+    settings.snapshot_file = NULL;
+    settings.snapshot_dir = NULL;
+    settings.ttl_segments = false;
+    settings.bench_ops = 0;
 
 #ifdef HAVE__SC_NPROCESSORS_ONLN
     /*
@@ -469,6 +489,7 @@ conn *conn_new(const int sfd, const int init_state, const int event_flags,
     c->write_and_go = conn_read;
     c->write_and_free = 0;
     c->item = 0;
+    c->latency_class = LATENCY_NONE;
     c->bucket = -1;
     c->gen = 0;
 
@@ -660,6 +681,25 @@ void conn_shrink(conn* c) {
     }
 }
 
+/*
+ * Starts measuring the latency of a command of class cls, which ends with
+ * conn_latency_finish.
+ */
+void conn_latency_start(conn* c, const latency_class_t cls) {
+    c->latency_class = cls;
+    c->latency_start = latency_now();
+}
+
+/*
+ * Records the latency of the command being measured, if there is one.
+ */
+void conn_latency_finish(conn* c) {
+    if (c->latency_class != LATENCY_NONE) {
+        stats_latency_record(c->latency_class, latency_now() - c->latency_start);
+        c->latency_class = LATENCY_NONE;
+    }
+}
+
 /*
  * Sets a connection's current state in the state machine. Any special
  * processing that needs to happen on certain state transitions can
@@ -669,9 +709,15 @@ static void conn_set_state(conn* c, int state) {
     assert(c != NULL);
 
     if (state != c->state) {
+        /* a command is done once its response is queued, or if we're
+         * measuring to the last byte sent, once we're back to reading. */
+        if (state == conn_read ||
+            (! settings.latency_to_send &&
+             (state == conn_write || state == conn_mwrite))) {
+            conn_latency_finish(c);
+        }
         if (state == conn_read) {
             conn_shrink(c);
-            assoc_move_next_bucket();
 
             c->msgcurr = 0;
             c->msgused = 0;
@@ -892,7 +938,8 @@ static void complete_nread(conn* c) {
 
 /*
  * Stores an item in the cache according to the semantics of one of the set
- * commands. In threaded mode, this is protected by the cache lock.
+ * commands. In threaded mode, this is protected by the item lock for the key
+ * and the cache lock.
  *
  * Returns true if the item was stored.
  */
@@ -902,7 +949,7 @@ int do_store_item(item *it, int comm, const char* key) {
     int stored = 0;
     size_t nkey = ITEM_nkey(it);
 
-    old_it = do_item_get_notedeleted(key, nkey, &delete_locked);
+    old_it = do_item_get_notedeleted(key, nkey, assoc_item_hash(it), &delete_locked);
 
     if (old_it != NULL && comm == NREAD_ADD) {
         /* add only adds a nonexistent item, but promote to head of LRU */
@@ -1085,7 +1132,7 @@ static void process_stat(conn* c, token_t *tokens, const size_t ntokens) {
         offset = append_to_buffer(temp, bufsize, offset, sizeof(terminator), "STAT version " VERSION "\r\n");
         offset = append_to_buffer(temp, bufsize, offset, sizeof(terminator), "STAT pointer_size %lu\r\n", 8 * sizeof(void *));
 #if defined(USE_SLAB_ALLOCATOR)
-        offset = append_to_buffer(temp, bufsize, offset, sizeof(terminator), "STAT allocator slab\r\n");
+        offset = append_to_buffer(temp, bufsize, offset, sizeof(terminator), "STAT allocator %s\r\n", storage_engine->name);
 #endif /* #if defined(USE_SLAB_ALLOCATOR) */
 #if defined(USE_FLAT_ALLOCATOR)
         offset = append_to_buffer(temp, bufsize, offset, sizeof(terminator), "STAT allocator flat-sk\r\n");
@@ -1105,10 +1152,18 @@ static void process_stat(conn* c, token_t *tokens, const size_t ntokens) {
         offset = append_to_buffer(temp, bufsize, offset, sizeof(terminator), "STAT cmd_set %" PRINTF_INT64_MODIFIER "u\r\n", stats.set_cmds);
         offset = append_to_buffer(temp, bufsize, offset, sizeof(terminator), "STAT get_hits %" PRINTF_INT64_MODIFIER "u\r\n", stats.get_hits);
         offset = append_to_buffer(temp, bufsize, offset, sizeof(terminator), "STAT get_misses %" PRINTF_INT64_MODIFIER "u\r\n", stats.get_misses);
+        if (settings.lockfree_get) {
+            offset = append_to_buffer(temp, bufsize, offset, sizeof(terminator), "STAT lockfree_hits %" PRINTF_INT64_MODIFIER "u\r\n", stats.lockfree_hits);
+        }
         offset = append_to_buffer(temp, bufsize, offset, sizeof(terminator), "STAT cmd_arith %" PRINTF_INT64_MODIFIER "u\r\n", stats.arith_cmds);
         offset = append_to_buffer(temp, bufsize, offset, sizeof(terminator), "STAT arith_hits %" PRINTF_INT64_MODIFIER "u\r\n", stats.arith_hits);
         offset = append_to_buffer(temp, bufsize, offset, sizeof(terminator), "STAT hit_rate %g%%\r\n", (stats.get_hits + stats.get_misses) == 0 ? 0.0 : (double)stats.get_hits * 100 / (stats.get_hits + stats.get_misses));
         offset = append_to_buffer(temp, bufsize, offset, sizeof(terminator), "STAT evictions %" PRINTF_INT64_MODIFIER "u\r\n", stats.evictions);
+        offset = append_to_buffer(temp, bufsize, offset, sizeof(terminator), "STAT evictions_of_live_items %" PRINTF_INT64_MODIFIER "u\r\n", stats.evictions_of_live_items);
+        offset = append_to_buffer(temp, bufsize, offset, sizeof(terminator), "STAT expired_reclaimed %" PRINTF_INT64_MODIFIER "u\r\n", stats.expired_reclaimed);
+        offset = append_to_buffer(temp, bufsize, offset, sizeof(terminator), "STAT admission_rejects %" PRINTF_INT64_MODIFIER "u\r\n", stats.admission_rejects);
+        offset = append_to_buffer(temp, bufsize, offset, sizeof(terminator), "STAT lru_bumps %" PRINTF_INT64_MODIFIER "u\r\n", stats.lru_bumps);
+        offset = append_to_buffer(temp, bufsize, offset, sizeof(terminator), "STAT lru_bump_drops %" PRINTF_INT64_MODIFIER "u\r\n", stats.lru_bump_drops);
         offset = append_to_buffer(temp, bufsize, offset, sizeof(terminator), "STAT bytes_read %" PRINTF_INT64_MODIFIER "u\r\n", stats.bytes_read);
         offset = append_to_buffer(temp, bufsize, offset, sizeof(terminator), "STAT bytes_written %" PRINTF_INT64_MODIFIER "u\r\n", stats.bytes_written);
         offset = append_to_buffer(temp, bufsize, offset, sizeof(terminator), "STAT limit_maxbytes %lu\r\n", settings.maxbytes);
@@ -1116,6 +1171,15 @@ static void process_stat(conn* c, token_t *tokens, const size_t ntokens) {
         offset = append_to_buffer(temp, bufsize, offset, sizeof(terminator), "STAT byte_seconds %" PRINTF_INT64_MODIFIER "u\r\n", stats.byte_seconds);
         offset = append_to_buffer(temp, bufsize, offset, sizeof(terminator), "STAT threads %u\r\n", settings.num_threads);
         offset = append_thread_stats(temp, bufsize, offset, sizeof(terminator));
+        offset = append_assoc_stats(temp, bufsize, offset, sizeof(terminator));
+        offset = append_expiry_stats(temp, bufsize, offset, sizeof(terminator));
+        offset = append_admission_stats(temp, bufsize, offset, sizeof(terminator));
+        offset = append_cost_benefit_stats(temp, bufsize, offset, sizeof(terminator));
+        offset = append_hugepage_stats(temp, bufsize, offset, sizeof(terminator));
+#if defined(USE_FLAT_ALLOCATOR)
+        offset = append_memory_file_stats(temp, bufsize, offset, sizeof(terminator));
+#endif /* #if defined(USE_FLAT_ALLOCATOR) */
+        offset = append_snapshot_stats(temp, bufsize, offset, sizeof(terminator));
 #if defined(USE_SLAB_ALLOCATOR)
         offset = append_to_buffer(temp, bufsize, offset, sizeof(terminator), "STAT slabs_rebalance %d\r\n", slabs_get_rebalance_interval());
 #endif /* #if defined(USE_SLAB_ALLOCATOR) */
@@ -1198,6 +1262,7 @@ static void process_stat(conn* c, token_t *tokens, const size_t ntokens) {
 
     if (strcmp(subcommand, "cachedump") == 0) {
 #if defined(USE_SLAB_ALLOCATOR)
+        /* the id is a slab class, or a segment of the log allocator. */
         char *buf;
         unsigned int bytes, id, limit = 0;
 
@@ -1262,14 +1327,12 @@ static void process_stat(conn* c, token_t *tokens, const size_t ntokens) {
     }
 #endif /* #if defined(USE_SLAB_ALLOCATOR) */
 
-#if defined(USE_SLAB_ALLOCATOR)
     if (strcmp(subcommand, "items") == 0) {
         int bytes = 0;
         char *buf = item_stats(&bytes);
         write_and_free(c, buf, bytes);
         return;
     }
-#endif /* #if defined(USE_SLAB_ALLOCATOR) */
 
 #if defined(USE_FLAT_ALLOCATOR)
     if (strcmp(subcommand, "flat_allocator") == 0) {
@@ -1281,6 +1344,16 @@ static void process_stat(conn* c, token_t *tokens, const size_t ntokens) {
     }
 #endif /* #if defined(USE_FLAT_ALLOCATOR) */
 
+#if defined(USE_LOG_ALLOCATOR)
+    if (storage_engine == &log_engine && strcmp(subcommand, "log_allocator") == 0) {
+        size_t bytes = 0;
+        char* buf = log_allocator_stats(&bytes);
+
+        write_and_free(c, buf, bytes);
+        return;
+    }
+#endif /* #if defined(USE_LOG_ALLOCATOR) */
+
     if (strcmp(subcommand, "detail") == 0) {
         if (ntokens < 4)
             process_stats_detail(c, "");  /* outputs the error message */
@@ -1329,6 +1402,13 @@ static void process_stat(conn* c, token_t *tokens, const size_t ntokens) {
         return;
     }
 
+    if (strcmp(subcommand, "latency") == 0) {
+        int bytes = 0;
+        char *buf = latency_stats(&bytes);
+        write_and_free(c, buf, bytes);
+        return;
+    }
+
     if (strcmp(subcommand, "cost-benefit") == 0) {
         int bytes = 0;
         char *buf = cost_benefit_stats(&bytes);
@@ -1422,10 +1502,16 @@ static int ensure_wbuf(conn* const c, const size_t req_bytes)
 #define FLAGS_LENGTH_STRING_LEN (sizeof(" 4xxxyyyzzz 1xxxyyy\r\n") - 1)
 
 
+/* number of keys of a multi-get that are looked up together. */
+#define GET_BATCH_SIZE 64
+
 /* ntokens is overwritten here... shrug.. */
 static inline void process_get_command(conn* c, token_t *tokens, size_t ntokens) {
     stats_t *stats = STATS_GET_TLS();
-    char *key;
+    item_lookup_t batch[GET_BATCH_SIZE];
+    size_t nbatch, b;
+    uint64_t get_cmds = 0, get_hits = 0, get_misses = 0, get_bytes = 0;
+    const char *key;
     size_t nkey;
     int i = 0;
     item *it;
@@ -1463,22 +1549,44 @@ static inline void process_get_command(conn* c, token_t *tokens, size_t ntokens)
     }
 
     do {
-        while(key_token->length != 0) {
-
-            key = key_token->value;
-            nkey = key_token->length;
+        /*
+         * gather the next batch of keys, getting more tokens from the command
+         * string as needed.  the tokens are terminated in place, so the keys
+         * stay valid when the token array is reused.
+         */
+        nbatch = 0;
+        while (nbatch < GET_BATCH_SIZE) {
+            if (key_token->length == 0) {
+                if (key_token->value == NULL) {
+                    break;
+                }
+                ntokens = tokenize_command(key_token->value, tokens, MAX_TOKENS);
+                key_token = tokens;
+                continue;
+            }
 
-            if(nkey > KEY_MAX_LENGTH) {
+            if (key_token->length > KEY_MAX_LENGTH) {
+                while (i > 0) {
+                    item_deref(c->ilist[--i]);
+                }
                 out_string(c, "CLIENT_ERROR bad command line format");
                 return;
             }
+            batch[nbatch].key = key_token->value;
+            batch[nbatch].nkey = key_token->length;
+            nbatch++;
+            key_token++;
+        }
 
-            it = item_get(key, nkey);
+        item_get_multi(batch, nbatch);
 
-            STATS_LOCK(stats);
-            stats->get_cmds++;
-            stats->get_bytes += (NULL != it) ? ITEM_nbytes(it) : 0;
-            STATS_UNLOCK(stats);
+        for (b = 0; b < nbatch; b++) {
+            key = batch[b].key;
+            nkey = batch[b].nkey;
+            it = batch[b].it;
+
+            get_cmds++;
+            get_bytes += (NULL != it) ? ITEM_nbytes(it) : 0;
 
             if (settings.detail_enabled) {
                 stats_prefix_record_get(key, nkey, (NULL != it) ? ITEM_nbytes(it) : 0, NULL != it);
@@ -1525,10 +1633,8 @@ static inline void process_get_command(conn* c, token_t *tokens, size_t ntokens)
                     fprintf(stderr, ">%d sending key %*s\n", c->sfd, (int) nkey, key);
                 }
 
-                /* item_get() has incremented it->refcount for us */
-                STATS_LOCK(stats);
-                stats->get_hits++;
-                STATS_UNLOCK(stats);
+                /* item_get_multi() has incremented it->refcount for us */
+                get_hits++;
 
                 stats_get(ITEM_nkey(it) + ITEM_nbytes(it));
                 item_update(it);
@@ -1539,23 +1645,28 @@ static inline void process_get_command(conn* c, token_t *tokens, size_t ntokens)
                 i++;
 
             } else {
-                STATS_LOCK(stats);
-                stats->get_misses++;
-                STATS_UNLOCK(stats);
+                get_misses++;
             }
-
-            key_token++;
         }
-        /*
-         * If the command string hasn't been fully processed, get the next set
-         * of tokens.
-         */
-        if(key_token->value != NULL) {
-            ntokens = tokenize_command(key_token->value, tokens, MAX_TOKENS);
-            key_token = tokens;
+
+        if (b < nbatch) {
+            /* we ran out of memory for the response; send what we have, and
+             * drop the references to the rest. */
+            for (; b < nbatch; b++) {
+                if (batch[b].it != NULL) {
+                    item_deref(batch[b].it);
+                }
+            }
+            break;
         }
+    } while (nbatch == GET_BATCH_SIZE);
 
-    } while(key_token->value != NULL);
+    STATS_LOCK(stats);
+    stats->get_cmds += get_cmds;
+    stats->get_hits += get_hits;
+    stats->get_misses += get_misses;
+    stats->get_bytes += get_bytes;
+    STATS_UNLOCK(stats);
 
     c->icurr = c->ilist;
     c->ileft = i;
@@ -1665,6 +1776,7 @@ static void process_update_command(conn *c, token_t *tokens, const size_t ntoken
     time_t exptime;
     int vlen;
     item *it;
+    bool rejected;
 
     assert(c != NULL);
 
@@ -1706,7 +1818,22 @@ static void process_update_command(conn *c, token_t *tokens, const size_t ntoken
     }
 
     it = item_alloc(key, nkey, flags, realtime(exptime), vlen,
-                    get_request_addr(c));
+                    get_request_addr(c), &rejected);
+
+    if (it == 0 && rejected) {
+        /* the admission filter turned it away.  a value that a set or
+         * replace was meant to overwrite mustn't be left behind. */
+        if (comm != NREAD_ADD &&
+            (it = item_get(key, nkey)) != NULL) {
+            item_unlink(it, UNLINK_NORMAL, key);
+            item_deref(it);
+        }
+        out_string(c, "NOT_STORED");
+        /* swallow the data line */
+        c->write_and_go = conn_swallow;
+        c->sbytes = vlen + 2;
+        return;
+    }
 
     if (it == 0 ||
         item_setup_receive(it, c) == false) {
@@ -1791,7 +1918,7 @@ char *do_add_delta(const char* key, const size_t nkey, const int incr, const uns
     rel_time_t now;
     item* it;
 
-    it = do_item_get_notedeleted(key, nkey, NULL);
+    it = do_item_get_notedeleted(key, nkey, hash(key, nkey, 0), NULL);
     if (!it) {
         STATS_LOCK(stats);
         stats->arith_cmds ++;
@@ -1839,8 +1966,10 @@ char *do_add_delta(const char* key, const size_t nkey, const int incr, const uns
     }
 
     if (item_need_realloc(it, ITEM_nkey(it), ITEM_flags(it), res) ||
-        ITEM_refcount(it) > 1) {
-        /* need to realloc */
+        ITEM_refcount(it) > 1 ||
+        settings.lockfree_get) {
+        /* need to realloc.  lock-free gets may pick up a reference at any
+         * time, so with them enabled the value is never updated in place. */
         item *new_it;
 
         if (settings.detail_enabled) {
@@ -1851,7 +1980,7 @@ char *do_add_delta(const char* key, const size_t nkey, const int incr, const uns
 
         new_it = do_item_alloc(key, nkey,
                                ITEM_flags(it), ITEM_exptime(it),
-                               res, addr);
+                               res, addr, NULL);
         if (new_it == 0) {
             do_item_deref(it);
             return "SERVER_ERROR out of memory";
@@ -1946,32 +2075,29 @@ static void process_delete_command(conn* c, token_t *tokens, const size_t ntoken
 }
 
 /*
- * Adds an item to the deferred-delete list so it can be reaped later.
+ * Adds an item to the deferred-delete timer wheel so it can be reaped when its
+ * delete lock is over.
  *
  * Returns 0 if successfully deleted, -1 if there is a memory allocation error.
  */
 int do_defer_delete(item *it, time_t exptime)
 {
-    if (delcurr >= deltotal) {
-        item **new_delete = pool_realloc(todelete, sizeof(item *) * deltotal * 2,
-                                         sizeof(item*) * deltotal, DELETE_POOL);
-        if (new_delete) {
-            todelete = new_delete;
-            deltotal *= 2;
-        } else {
-            /*
-             * can't delete it immediately, user wants a delay,
-             * but we ran out of memory for the delete queue
-             */
-            item_deref(it);    /* release reference */
-            return -1;
-        }
+    rel_time_t when = realtime(exptime);
+
+    if (! timer_wheel_add(&deferred_deletes, it, when)) {
+        /*
+         * can't delete it immediately, user wants a delay,
+         * but we ran out of memory for the delete queue
+         */
+        do_item_deref(it);    /* release reference */
+        return -1;
     }
 
-    /* use its expiration time as its deletion time now */
-    ITEM_set_exptime(it, realtime(exptime));
+    /* use its expiration time as its deletion time now; the deferred deletes
+     * reclaim it, not the expiry queues. */
+    expiry_remove(ITEM_hv(it), ITEM_exptime(it));
+    ITEM_set_exptime(it, when);
     ITEM_mark_deleted(it);
-    todelete[delcurr++] = it;
 
     return 0;
 }
@@ -2018,6 +2144,8 @@ static void process_command(conn* c, char *command) {
         ((strcmp(tokens[COMMAND_TOKEN].value, "get") == 0) ||
          (strcmp(tokens[COMMAND_TOKEN].value, "bget") == 0))) {
 
+        /* one key, plus the command and the terminal token. */
+        conn_latency_start(c, ntokens == 3 ? LATENCY_GET : LATENCY_MULTIGET);
         process_get_command(c, tokens, ntokens);
 
     } else if (ntokens == 3 &&
@@ -2030,18 +2158,22 @@ static void process_command(conn* c, char *command) {
                 (strcmp(tokens[COMMAND_TOKEN].value, "set") == 0 && (comm = NREAD_SET)) ||
                 (strcmp(tokens[COMMAND_TOKEN].value, "replace") == 0 && (comm = NREAD_REPLACE)))) {
 
+        conn_latency_start(c, LATENCY_UPDATE);
         process_update_command(c, tokens, ntokens, comm);
 
     } else if (ntokens == 4 && (strcmp(tokens[COMMAND_TOKEN].value, "incr") == 0)) {
 
+        conn_latency_start(c, LATENCY_ARITH);
         process_arithmetic_command(c, tokens, ntokens, 1);
 
     } else if (ntokens == 4 && (strcmp(tokens[COMMAND_TOKEN].value, "decr") == 0)) {
 
+        conn_latency_start(c, LATENCY_ARITH);
         process_arithmetic_command(c, tokens, ntokens, 0);
 
     } else if (ntokens >= 3 && ntokens <= 4 && (strcmp(tokens[COMMAND_TOKEN].value, "delete") == 0)) {
 
+        conn_latency_start(c, LATENCY_DELETE);
         process_delete_command(c, tokens, ntokens);
 
     } else if (ntokens == 3 && strcmp(tokens[COMMAND_TOKEN].value, "own") == 0) {
@@ -2201,6 +2333,10 @@ static void process_command(conn* c, char *command) {
         else {
             out_string(c, "CLIENT_ERROR Bad regular expression (or regex not supported)");
         }
+    } else if (ntokens == 3 && (strcmp(tokens[COMMAND_TOKEN].value, "snapshot") == 0)) {
+        const char* error = snapshot_start(tokens[COMMAND_TOKEN + 1].value);
+
+        out_string(c, (error == NULL) ? "OK" : error);
     } else if (ntokens == 3 && (strcmp(tokens[COMMAND_TOKEN].value, "verbosity") == 0)) {
         process_verbosity_command(c, tokens, ntokens);
     } else {
@@ -2434,10 +2570,15 @@ bool update_event(conn* c, const int new_flags) {
  */
 void accept_new_conns(const bool do_accept, const bool binary) {
     conn* conn;
-    if (! is_listen_thread())
-        return;
 
-    if (binary) {
+    if (settings.worker_accept) {
+        /* each worker only stops and starts its own listener. */
+        conn = thread_listen_conn(binary);
+        if (conn == NULL)
+            return;
+    } else if (! is_listen_thread()) {
+        return;
+    } else if (binary) {
         conn = listen_binary_conn;
     } else {
         conn = listen_conn;
@@ -2576,9 +2717,14 @@ static void drive_machine(conn* c) {
                 close(sfd);
                 break;
             }
-            dispatch_conn_new(sfd, conn_read, EV_READ | EV_PERSIST,
-                              NULL, false, c->binary,
-                              &addr, addrlen);
+            if (settings.worker_accept) {
+                dispatch_conn_local(sfd, conn_read, EV_READ | EV_PERSIST,
+                                    c->binary, &addr, addrlen);
+            } else {
+                dispatch_conn_new(sfd, conn_read, EV_READ | EV_PERSIST,
+                                  NULL, false, c->binary,
+                                  &addr, addrlen);
+            }
 
             break;
 
@@ -2935,6 +3081,16 @@ static int server_socket(const int port, const bool is_udp) {
     }
 
     setsockopt(sfd, SOL_SOCKET, SO_REUSEADDR, (void *)&flags, sizeof(flags));
+#if defined(SO_REUSEPORT)
+    /* every worker binds a socket of its own to the port, and the kernel
+     * spreads incoming connections across them. */
+    if (settings.worker_accept && !is_udp &&
+        setsockopt(sfd, SOL_SOCKET, SO_REUSEPORT, (void *)&flags, sizeof(flags)) != 0) {
+        perror("setsockopt(SO_REUSEPORT)");
+        close(sfd);
+        return -1;
+    }
+#endif /* #if defined(SO_REUSEPORT) */
     if (is_udp) {
         maximize_socket_buffer(sfd, SO_SNDBUF);
         maximize_socket_buffer(sfd, SO_RCVBUF);
@@ -2966,6 +3122,27 @@ static int server_socket(const int port, const bool is_udp) {
     return sfd;
 }
 
+/*
+ * Creates count listening sockets on a port, one for each worker with -A.
+ * Exits on failure.
+ */
+static int *server_sockets(const int port, const int count) {
+    int *sfds = malloc(sizeof(int) * count);
+    int i;
+
+    if (sfds == NULL) {
+        fprintf(stderr, "failed to allocate listening sockets\n");
+        exit(EXIT_FAILURE);
+    }
+    for (i = 0; i < count; i++) {
+        if ((sfds[i] = server_socket(port, 0)) == -1) {
+            fprintf(stderr, "failed to listen on port %d\n", port);
+            exit(EXIT_FAILURE);
+        }
+    }
+    return sfds;
+}
+
 static int new_socket_unix(void) {
     int sfd;
     int flags;
@@ -3035,6 +3212,10 @@ static int server_socket_unix(const char *path) {
 /* listening socket */
 static int l_socket = 0;
 
+/* with -A, each worker's own listening sockets on the TCP ports. */
+static int *l_sockets;
+static int *b_sockets;
+
 /* udp socket */
 static int u_socket = -1;
 
@@ -3045,6 +3226,17 @@ static int b_socket = 0;
 static int bu_socket = -1;
 
 
+/* run by each worker with -A, to listen on its own socket. */
+static void listen_on_worker(void *arg) {
+    dispatch_conn_local((int) (intptr_t) arg, conn_listening, EV_READ | EV_PERSIST,
+                        false, NULL, 0);
+}
+
+static void listen_binary_on_worker(void *arg) {
+    dispatch_conn_local((int) (intptr_t) arg, conn_listening, EV_READ | EV_PERSIST,
+                        true, NULL, 0);
+}
+
 /* invoke right before gdb is called, on assert */
 void pre_gdb(void) {
     int i;
@@ -3081,7 +3273,7 @@ void update_stats(void) {
 static struct event deleteevent;
 
 static void delete_handler(const int fd, const short which, void *arg) {
-    struct timeval t = {.tv_sec = 5, .tv_usec = 0};
+    struct timeval t = {.tv_sec = 1, .tv_usec = 0};
     static bool initialized = false;
 
     if (initialized) {
@@ -3092,29 +3284,61 @@ static void delete_handler(const int fd, const short which, void *arg) {
         initialized = true;
     }
 
+    /* if there were more deletes due than one run takes on, come straight
+     * back for the rest once the other events have had a look in. */
+    if (run_deferred_deletes()) {
+        t.tv_sec = 0;
+    }
     evtimer_set(&deleteevent, delete_handler, 0);
     event_base_set(main_base, &deleteevent);
     evtimer_add(&deleteevent, &t);
-    run_deferred_deletes();
 }
 
-/* Call run_deferred_deletes instead of this. */
-void do_run_deferred_deletes(void)
+static struct event reapevent;
+
+static void reap_handler(const int fd, const short which, void *arg) {
+    struct timeval t = {.tv_sec = 1, .tv_usec = 0};
+    static bool initialized = false;
+
+    if (initialized) {
+        evtimer_del(&reapevent);
+    } else {
+        initialized = true;
+    }
+
+    if (reap_expired_items()) {
+        t.tv_sec = 0;
+    }
+    evtimer_set(&reapevent, reap_handler, 0);
+    event_base_set(main_base, &reapevent);
+    evtimer_add(&reapevent, &t);
+}
+
+/*
+ * Takes up to max deferred deletes that are due off the timer wheel.  The
+ * caller must hold the cache lock.
+ */
+size_t do_expire_deferred_deletes(item** due, size_t max)
 {
-    int i, j = 0;
-
-    for (i = 0; i < delcurr; i++) {
-        item *it = todelete[i];
-        if (item_delete_lock_over(it)) {
-            assert(ITEM_refcount(it) > 0);
-            ITEM_unmark_deleted(it);
-            do_item_unlink(it, UNLINK_NORMAL, NULL);
-            do_item_deref(it);
-        } else {
-            todelete[j++] = it;
-        }
+    return timer_wheel_expire(&deferred_deletes, current_time, (void**) due, max);
+}
+
+/*
+ * Carries out a deferred delete taken off the timer wheel, consuming the
+ * wheel's reference.  The caller must hold the item lock and the cache lock.
+ */
+void do_run_deferred_delete(item *it)
+{
+    assert(ITEM_refcount(it) > 0);
+    if (! item_delete_lock_over(it) &&
+        timer_wheel_add(&deferred_deletes, it, ITEM_exptime(it))) {
+        /* not due after all. */
+        return;
     }
-    delcurr = j;
+
+    ITEM_unmark_deleted(it);
+    do_item_unlink(it, UNLINK_NORMAL, NULL);
+    do_item_deref(it);
 }
 
 static void usage(void) {
@@ -3146,6 +3370,47 @@ static void usage(void) {
            "              to prevent starvation.  default 1\n");
     printf("-C            Maximum bytes used for connection buffers\n"
            "              default 16MB\n");
+    printf("-G            look up plain get hits without taking the item lock\n");
+    printf("-H <num>      initial hashtable size, as a power of 2, default %d\n",
+           HASHPOWER_DEFAULT);
+    printf("-I <layout>   hashtable layout, chained or bucketed, default chained\n");
+    printf("-T            measure command latency to the last byte sent, rather\n"
+           "              than to the response being queued\n");
+    printf("-A            let each worker thread accept its own connections, on\n"
+           "              SO_REUSEPORT sockets, rather than handing them out from\n"
+           "              the dispatch thread\n");
+    printf("-a <cpus>     pin worker threads, one cpu each, round-robin over a\n"
+           "              cpu list such as 0-3,8\n");
+    printf("-z <policy>   spread the item arena over NUMA nodes: interleave\n"
+           "              or partition, default first touch (flat allocator,\n"
+           "              --enable-numa builds only)\n");
+    printf("-W            turn away stores that would evict an item whose key\n"
+           "              has been seen more often (TinyLFU admission)\n");
+    printf("-Q <percent>  split the LRU into probationary and protected segments,\n"
+           "              capping the protected segment at this percentage of\n"
+           "              the items (flat allocator only)\n");
+    printf("-g            evict the items with the fewest hits per byte among\n"
+           "              the least recently used, and move slab pages away from\n"
+           "              the classes with the fewest (--enable-cost-benefit-stats\n"
+           "              builds only)\n");
+    printf("-L            back item memory with huge pages, falling back to\n"
+           "              transparent huge pages if there aren't enough\n");
+    printf("-e <file>     keep the items in this file, on tmpfs or a DAX mount,\n"
+           "              saving them on SIGINT or SIGTERM and picking them up\n"
+           "              again on restart (flat allocator only)\n");
+    printf("-F <file>     load a snapshot, written by the \"snapshot\" command,\n"
+           "              before accepting connections\n");
+    printf("-O <dir>      let the \"snapshot\" command write snapshots to this\n"
+           "              directory (refused without it)\n");
+    printf("-E            append items to segments by time to live, and free\n"
+           "              each segment once its items have expired (log\n"
+           "              engine only)\n");
+    printf("-S <engine>   store items with this engine: slab (the default), or\n"
+           "              log in --enable-log-allocator builds; flat builds\n"
+           "              only have flat\n");
+    printf("-K <ops>      replay <ops> requests against each storage engine in\n"
+           "              the build, report their hit ratio, memory efficiency\n"
+           "              and throughput, and exit\n");
     return;
 }
 
@@ -3253,6 +3518,78 @@ static void sig_handler(const int sig) {
     exit(EXIT_SUCCESS);
 }
 
+#if defined(USE_FLAT_ALLOCATOR)
+static struct event sigint_event, sigterm_event;
+
+/* with a memory file, SIGINT and SIGTERM are handled from the event loop
+ * rather than in a signal handler, as saving the items takes the cache lock. */
+static void save_and_exit(const int sig, const short which, void *arg) {
+    flat_storage_save();
+    if (settings.verbose > 0) {
+        fprintf(stderr, "Saved the items to %s\n", settings.memory_file);
+    }
+    exit(EXIT_SUCCESS);
+}
+#endif /* #if defined(USE_FLAT_ALLOCATOR) */
+
+#if defined(HAVE_PTHREAD_ATTR_SETAFFINITY_NP)
+/*
+ * parses a cpu list such as "0-3,8,10-11" into settings.worker_cpus.  returns
+ * false if the list is malformed or names a cpu this machine doesn't have.
+ */
+static bool parse_worker_cpus(const char *list) {
+    long ncpus = sysconf(_SC_NPROCESSORS_CONF);
+    const char *p = list;
+    int *cpus;
+    int count = 0;
+
+    cpus = malloc(sizeof(int) * ncpus);
+    if (cpus == NULL) {
+        return false;
+    }
+
+    for (;;) {
+        char *end;
+        long first, last, cpu;
+
+        first = last = strtol(p, &end, 10);
+        if (end == p) {
+            goto bad;
+        }
+        if (*end == '-') {
+            p = end + 1;
+            last = strtol(p, &end, 10);
+            if (end == p) {
+                goto bad;
+            }
+        }
+        if (first < 0 || last >= ncpus || first > last) {
+            goto bad;
+        }
+        for (cpu = first; cpu <= last && count < ncpus; cpu++) {
+            cpus[count++] = cpu;
+        }
+
+        if (*end == '\0') {
+            break;
+        }
+        if (*end != ',') {
+            goto bad;
+        }
+        p = end + 1;
+    }
+
+    free(settings.worker_cpus);
+    settings.worker_cpus = cpus;
+    settings.worker_cpu_count = count;
+    return true;
+
+ bad:
+    free(cpus);
+    return false;
+}
+#endif /* #if defined(HAVE_PTHREAD_ATTR_SETAFFINITY_NP) */
+
 int main (int argc, char **argv) {
     int c;
     struct in_addr addr;
@@ -3275,7 +3612,7 @@ int main (int argc, char **argv) {
     setbuf(stderr, NULL);
 
     /* process arguments */
-    while ((c = getopt(argc, argv, "bp:s:U:m:Mc:khirvdl:u:P:f:s:n:t:D:n:N:R:C:")) != -1) {
+    while ((c = getopt(argc, argv, "bp:s:U:m:Mc:khirvdl:u:P:f:s:n:t:D:n:N:R:C:GH:I:TAa:z:Q:WgLe:F:O:ES:K:")) != -1) {
         switch (c) {
         case 'U':
             settings.udpport = atoi(optarg);
@@ -3371,12 +3708,171 @@ int main (int argc, char **argv) {
             settings.max_conn_buffer_bytes = atoi(optarg);
             break;
 
+        case 'G':
+            settings.lockfree_get = true;
+            break;
+
+        case 'H':
+            settings.hashpower_init = atoi(optarg);
+            /* every bucket of the old table must map onto one item lock. */
+            if (settings.hashpower_init <= ITEM_LOCK_HASHPOWER ||
+                settings.hashpower_init > 30) {
+                fprintf(stderr, "Hashtable power must be between %d and 30\n",
+                        ITEM_LOCK_HASHPOWER + 1);
+                return 1;
+            }
+            break;
+
+        case 'I':
+            if (strcmp(optarg, "chained") == 0) {
+                settings.hash_index = HASH_INDEX_CHAINED;
+            } else if (strcmp(optarg, "bucketed") == 0) {
+                settings.hash_index = HASH_INDEX_BUCKETED;
+            } else {
+                fprintf(stderr, "Hashtable layout must be chained or bucketed\n");
+                return 1;
+            }
+            break;
+
+        case 'T':
+            settings.latency_to_send = true;
+            break;
+
+        case 'A':
+#if defined(SO_REUSEPORT)
+            settings.worker_accept = true;
+#else
+            fprintf(stderr, "-A needs SO_REUSEPORT, which this platform lacks\n");
+            return 1;
+#endif /* #if defined(SO_REUSEPORT) */
+            break;
+
+        case 'a':
+#if defined(HAVE_PTHREAD_ATTR_SETAFFINITY_NP)
+            if (! parse_worker_cpus(optarg)) {
+                fprintf(stderr, "Bad cpu list \"%s\"\n", optarg);
+                return 1;
+            }
+#else
+            fprintf(stderr, "-a isn't supported on this platform\n");
+            return 1;
+#endif /* #if defined(HAVE_PTHREAD_ATTR_SETAFFINITY_NP) */
+            break;
+
+        case 'z':
+#if defined(USE_NUMA) && defined(USE_FLAT_ALLOCATOR)
+            if (strcmp(optarg, "interleave") == 0) {
+                settings.arena_numa = ARENA_NUMA_INTERLEAVE;
+            } else if (strcmp(optarg, "partition") == 0) {
+                settings.arena_numa = ARENA_NUMA_PARTITION;
+            } else {
+                fprintf(stderr, "Arena placement must be interleave or partition\n");
+                return 1;
+            }
+#else
+            fprintf(stderr, "-z needs the flat allocator and --enable-numa\n");
+            return 1;
+#endif /* #if defined(USE_NUMA) && defined(USE_FLAT_ALLOCATOR) */
+            break;
+
+        case 'W':
+            settings.admission_filter = true;
+            break;
+
+        case 'Q':
+#if defined(USE_FLAT_ALLOCATOR)
+            settings.lru_protected_pct = atoi(optarg);
+            if (settings.lru_protected_pct <= 0 ||
+                settings.lru_protected_pct >= 100) {
+                fprintf(stderr, "Protected segment must be between 1 and 99 percent\n");
+                return 1;
+            }
+#else
+            fprintf(stderr, "-Q needs the flat allocator\n");
+            return 1;
+#endif /* #if defined(USE_FLAT_ALLOCATOR) */
+            break;
+
+        case 'L':
+            settings.hugepages = true;
+            break;
+
+        case 'g':
+#if defined(COST_BENEFIT_STATS)
+            settings.size_aware_eviction = true;
+#else
+            fprintf(stderr, "-g needs --enable-cost-benefit-stats\n");
+            return 1;
+#endif /* #if defined(COST_BENEFIT_STATS) */
+            break;
+
+        case 'e':
+#if defined(USE_FLAT_ALLOCATOR)
+            settings.memory_file = optarg;
+#else
+            fprintf(stderr, "-e needs the flat allocator\n");
+            return 1;
+#endif /* #if defined(USE_FLAT_ALLOCATOR) */
+            break;
+
+        case 'F':
+            settings.snapshot_file = optarg;
+            break;
+
+        case 'O':
+            settings.snapshot_dir = optarg;
+            break;
+
+        case 'E':
+#if defined(USE_LOG_ALLOCATOR)
+            settings.ttl_segments = true;
+#else
+            fprintf(stderr, "-E needs the log allocator\n");
+            return 1;
+#endif /* #if defined(USE_LOG_ALLOCATOR) */
+            break;
+
+        case 'S':
+            if (! storage_engine_select(optarg)) {
+                char names[80];
+
+                storage_engine_names(names, sizeof(names));
+                fprintf(stderr, "Unknown storage engine \"%s\" (this build has: %s)\n",
+                        optarg, names);
+                return 1;
+            }
+            break;
+
+        case 'K':
+            settings.bench_ops = atoi(optarg);
+            if (settings.bench_ops == 0) {
+                fprintf(stderr, "Number of benchmark requests must be greater than 0\n");
+                return 1;
+            }
+            break;
+
         default:
             fprintf(stderr, "Illegal argument \"%c\"\n", c);
             return 1;
         }
     }
 
+#if defined(USE_LOG_ALLOCATOR)
+    if (settings.ttl_segments && settings.bench_ops == 0 &&
+        storage_engine != &log_engine) {
+        fprintf(stderr, "-E needs the log engine (-S log)\n");
+        return 1;
+    }
+#endif /* #if defined(USE_LOG_ALLOCATOR) */
+    /* the benchmark doesn't listen on anything.  only the children, one for
+     * each engine, get past this. */
+    if (settings.bench_ops != 0) {
+        settings.port = settings.udpport = 0;
+        settings.binary_port = settings.binary_udpport = 0;
+        settings.socketpath = NULL;
+        storage_engine_bench_fork();
+    }
+
     if (maxcore != 0) {
         struct rlimit rlim_new;
         /*
@@ -3432,19 +3928,25 @@ int main (int argc, char **argv) {
 
     /* create the listening socket and bind it */
     if (settings.socketpath == NULL) {
-        if (settings.port == 0 && settings.binary_port == 0) {
+        if (settings.port == 0 && settings.binary_port == 0 && settings.bench_ops == 0) {
             fprintf(stderr, "Either -p or -n must be specified.\n");
             exit(1);
         }
 
-        if (settings.port > 0) {
+        if (settings.port > 0 && settings.worker_accept) {
+            l_sockets = server_sockets(settings.port, settings.num_threads - 1);
+            l_socket = l_sockets[0];
+        } else if (settings.port > 0) {
             l_socket = server_socket(settings.port, 0);
             if (l_socket == -1) {
                 fprintf(stderr, "failed to listen\n");
                 exit(1);
             }
         }
-        if (settings.binary_port > 0) {
+        if (settings.binary_port > 0 && settings.worker_accept) {
+            b_sockets = server_sockets(settings.binary_port, settings.num_threads - 1);
+            b_socket = b_sockets[0];
+        } else if (settings.binary_port > 0) {
             if ((b_socket = server_socket(settings.binary_port, 0)) == -1) {
                 fprintf(stderr, "bp failed to listen\n");
                 exit(1);
@@ -3543,7 +4045,7 @@ int main (int argc, char **argv) {
     assoc_init();
     conn_init();
 #if defined(USE_SLAB_ALLOCATOR)
-    slabs_init(settings.maxbytes, settings.factor);
+    storage_engine->init(settings.maxbytes);
 #endif /* #if defined(USE_SLAB_ALLOCATOR) */
 #if defined(USE_FLAT_ALLOCATOR)
     flat_storage_init(settings.maxbytes);
@@ -3581,7 +4083,9 @@ int main (int argc, char **argv) {
         exit(EXIT_FAILURE);
     }
     /* create the initial listening connection */
-    if (l_socket != 0) {
+    if (settings.worker_accept) {
+        /* the workers listen for themselves, once they're started. */
+    } else if (l_socket != 0) {
         if (!(listen_conn = conn_new(l_socket, conn_listening,
                                      EV_READ | EV_PERSIST, NULL, false, false,
                                      NULL, 0,
@@ -3590,7 +4094,8 @@ int main (int argc, char **argv) {
             exit(1);
         }
     }
-    if ((settings.binary_port != 0) &&
+    if (! settings.worker_accept &&
+        (settings.binary_port != 0) &&
         (listen_binary_conn = conn_new(b_socket, conn_listening,
                                        EV_READ | EV_PERSIST, NULL, false, true,
                                        NULL, 0,
@@ -3600,20 +4105,55 @@ int main (int argc, char **argv) {
     }
     /* start up worker threads if MT mode */
     thread_init(settings.num_threads, main_base);
+#if defined(USE_SLAB_ALLOCATOR)
+    if (storage_engine->start != NULL) {
+        storage_engine->start();
+    }
+#endif /* #if defined(USE_SLAB_ALLOCATOR) */
     /* save the PID in if we're a daemon, do this after thread_init due to
        a file descriptor handling bug somewhere in libevent */
     if (daemonize)
         save_pid(getpid(), pid_file);
     /* initialise clock event */
     clock_handler(0, 0, NULL);
-    /* initialise deletion array and timer event */
-    deltotal = 200;
-    delcurr = 0;
-    if ((todelete = pool_malloc(sizeof(item *) * deltotal, DELETE_POOL)) == NULL) {
-        perror("failed to allocate memory for deletion array");
+    /* initialise deferred deletes and their timer event */
+    timer_wheel_init(&deferred_deletes, current_time, DELETE_POOL);
+    delete_handler(0, 0, 0); /* sets up the event */
+    expiry_init(current_time);
+#if defined(USE_FLAT_ALLOCATOR)
+    flat_storage_adopt();
+    if (settings.memory_file != NULL) {
+        signal_set(&sigint_event, SIGINT, save_and_exit, 0);
+        event_base_set(main_base, &sigint_event);
+        signal_add(&sigint_event, 0);
+        signal_set(&sigterm_event, SIGTERM, save_and_exit, 0);
+        event_base_set(main_base, &sigterm_event);
+        signal_add(&sigterm_event, 0);
+    }
+#endif /* #if defined(USE_FLAT_ALLOCATOR) */
+    if (! admission_init(settings.maxbytes)) {
+        fprintf(stderr, "failed to allocate the admission filter\n");
         exit(EXIT_FAILURE);
     }
-    delete_handler(0, 0, 0); /* sets up the event */
+    reap_handler(0, 0, 0); /* sets up the event */
+    /* the workers load the snapshot before they have any connections. */
+    if (settings.snapshot_file != NULL &&
+        ! snapshot_load(settings.snapshot_file)) {
+        exit(EXIT_FAILURE);
+    }
+    /* give each worker its listening connections.  a unix socket can't be
+     * bound more than once, so the workers all share it. */
+    if (settings.worker_accept) {
+        for (c = 1; c < settings.num_threads; c++) {
+            if (l_socket != 0) {
+                dispatch_work(c, listen_on_worker,
+                              (void *) (intptr_t) (l_sockets != NULL ? l_sockets[c - 1] : l_socket));
+            }
+            if (settings.binary_port != 0) {
+                dispatch_work(c, listen_binary_on_worker, (void *) (intptr_t) b_sockets[c - 1]);
+            }
+        }
+    }
     /* create the initial listening udp connection, monitored on all threads */
     if (u_socket > -1) {
         /* Skip thread 0, the tcp accept socket dispatcher
@@ -3634,6 +4174,9 @@ int main (int argc, char **argv) {
                               get_conn_buffer_group(c - 1), true, true, NULL, 0);
         }
     }
+    if (settings.bench_ops != 0) {
+        exit(storage_engine_bench());
+    }
     /* enter the event loop */
     event_base_loop(main_base, 0);
     /* remove the PID file if we're a daemon */
@@ -6,6 +6,7 @@
 
 #include "generic.h"
 
+#include <assert.h>
 #include <netinet/in.h>
 #include <sys/time.h>
 #include <sys/socket.h>
@@ -52,6 +53,20 @@
  */
 #define ITEM_UPDATE_INTERVAL 60
 
+/*
+ * The hashtable is protected by 2^ITEM_LOCK_HASHPOWER item locks, striped by
+ * the low bits of the key's hash value.  This must not exceed the initial
+ * hashpower of the table (see assoc.c), so that every bucket maps to exactly
+ * one lock.
+ */
+#define ITEM_LOCK_HASHPOWER 10
+#define ITEM_LOCK_COUNT     (1 << ITEM_LOCK_HASHPOWER)
+#define ITEM_LOCK_INDEX(hv) ((hv) & (ITEM_LOCK_COUNT - 1))
+
+/* size of a cache line; per-thread data written on every request is padded out
+ * to this so that threads don't contend for the same line. */
+#define CACHE_LINE_SIZE 64
+
 
 /**
  * the following are the maximum sizes of the responses for various stat
@@ -118,6 +133,11 @@ enum transmit_sts_e {
   * NOTE:  When adding a field to this structure, mt_aggregate_stats
   * needs to be updated in addition to modifying process_stat to
   * display the statistics.
+  *
+  * Each thread has its own stats, which only that thread writes.  Updates are
+  * wrapped in STATS_LOCK/STATS_UNLOCK, which make seq odd for the duration
+  * rather than take a lock, so that readers can tell a consistent copy from a
+  * torn one.
   */
 struct stats_s {
     unsigned int  curr_items;
@@ -130,10 +150,24 @@ struct stats_s {
     uint64_t      get_cmds;
     uint64_t      set_cmds;
     uint64_t      get_hits;
+    uint64_t      lockfree_hits;
     uint64_t      get_misses;
     uint64_t      arith_cmds;
     uint64_t      arith_hits;
     uint64_t      evictions;
+    uint64_t      evictions_of_live_items; /* evicted before their expiration
+                                            * time */
+    uint64_t      expired_reclaimed;    /* reclaimed from the expiry queues */
+    uint64_t      admission_rejects;    /* stores turned away by the admission
+                                         * filter */
+    unsigned int  admission_samples;    /* sightings not yet added to the
+                                         * admission filter's total */
+    uint64_t      lru_bumps;            /* hit items moved at the LRU tail */
+    uint64_t      lru_bump_drops;       /* hit items evicted without the move */
+    uint64_t      lru_probation_hits;   /* hits and evictions in each segment */
+    uint64_t      lru_protected_hits;   /* of the flat allocator's LRU */
+    uint64_t      lru_probation_evictions;
+    uint64_t      lru_protected_evictions;
     uint64_t      bytes_read;
     uint64_t      bytes_written;
 
@@ -156,7 +190,37 @@ struct stats_s {
     uint64_t      mp_blk_errors;
     uint64_t      mp_bytecount_errors;
     uint64_t      mp_pool_errors;
-    pthread_mutex_t lock;
+#if defined(STATS_BUCKETS) || defined(COST_BENEFIT_STATS)
+    struct size_histograms_s *histograms;
+#endif /* #if defined(STATS_BUCKETS) || defined(COST_BENEFIT_STATS) */
+    struct latency_histograms_s *latency;
+    unsigned int  seq;                  /* odd while being updated */
+};
+
+/* the kinds of commands whose latency is measured; see "stats latency". */
+typedef enum latency_class_e latency_class_t;
+enum latency_class_e {
+    LATENCY_GET,
+    LATENCY_MULTIGET,
+    LATENCY_UPDATE,                     /* set, add and replace */
+    LATENCY_ARITH,
+    LATENCY_DELETE,
+    LATENCY_BINARY,
+    LATENCY_CLASSES,
+    LATENCY_NONE = LATENCY_CLASSES,     /* not measured */
+};
+
+/* hashtable layouts; see assoc.c. */
+enum hash_index {
+    HASH_INDEX_CHAINED,
+    HASH_INDEX_BUCKETED,
+};
+
+/* how the flat storage arena is spread over NUMA nodes. */
+enum arena_numa {
+    ARENA_NUMA_DEFAULT,         /* first touch */
+    ARENA_NUMA_INTERLEAVE,      /* pages round-robin over all nodes */
+    ARENA_NUMA_PARTITION,       /* one contiguous slice per node */
 };
 
 #define MAX_VERBOSITY_LEVEL 2
@@ -182,6 +246,31 @@ struct settings_s {
                                io-event. */
     size_t max_conn_buffer_bytes;       /* high-water mark for memory taken by
                                          * connection buffers. */
+    bool lockfree_get;      /* look up get hits without taking the item lock */
+    int hashpower_init;     /* initial hashtable size, as a power of 2 */
+    enum hash_index hash_index; /* hashtable layout */
+    bool latency_to_send;   /* measure latency to the last byte sent, rather
+                             * than to the response being queued */
+    bool worker_accept;     /* each worker accepts its own connections */
+    int *worker_cpus;       /* cpus the workers are pinned to, round-robin */
+    int worker_cpu_count;   /* number of worker_cpus, 0 if not pinning */
+    enum arena_numa arena_numa; /* placement of the flat storage arena */
+    int lru_protected_pct;  /* cap on the protected segment of the LRU, as a
+                             * percentage of the items; 0 for a plain LRU */
+    bool admission_filter;  /* turn away stores that would evict items whose
+                             * keys are seen more often */
+    bool size_aware_eviction;   /* weigh eviction candidates by their hit
+                                 * density per byte */
+    bool hugepages;         /* back item memory with huge pages */
+    char *memory_file;      /* file the flat allocator's arena lives in, so
+                             * that the items survive a restart */
+    char *snapshot_file;    /* snapshot to load at startup */
+    char *snapshot_dir;     /* directory the "snapshot" command writes to, or
+                             * NULL if it's refused */
+    bool ttl_segments;      /* group the log allocator's segments by time to
+                             * live */
+    unsigned int bench_ops; /* requests for each storage engine to replay,
+                             * instead of serving; 0 to serve */
 };
 
 
@@ -288,6 +377,9 @@ struct conn_s {
 
     char*  bp_key;
     char*  bp_string;
+
+    latency_class_t latency_class; /* the command being measured */
+    uint64_t latency_start; /* when it was parsed (see latency_now) */
 };
 
 extern settings_t settings;
@@ -306,7 +398,8 @@ extern time_t started;
 conn *do_conn_from_freelist();
 bool do_conn_add_to_freelist(conn* c);
 int  do_defer_delete(item *item, time_t exptime);
-void do_run_deferred_deletes(void);
+size_t do_expire_deferred_deletes(item** due, size_t max);
+void do_run_deferred_delete(item *it);
 char *do_add_delta(const char* key, const size_t nkey, const int incr, const unsigned int delta,
                    char *buf, uint32_t* res_val, const struct in_addr addr);
 int do_store_item(item *item, int comm, const char* key);
@@ -317,6 +410,8 @@ conn* conn_new(const int sfd, const int init_state, const int event_flags, conn_
 void conn_cleanup(conn* c);
 void conn_close(conn* c);
 void conn_shrink(conn* c);
+void conn_latency_start(conn* c, const latency_class_t cls);
+void conn_latency_finish(conn* c);
 void accept_new_conns(const bool do_accept, const bool is_binary);
 bool update_event(conn* c, const int new_flags);
 int add_iov(conn* c, const void *buf, int len, bool is_start);
@@ -344,35 +439,58 @@ void dispatch_conn_new(int sfd, int init_state, int event_flags,
                        conn_buffer_group_t* cbg,
                        const bool is_udp, const bool is_binary,
                        const struct sockaddr* addr, socklen_t addrlen);
+void dispatch_work(int tix, void (*fn)(void *arg), void *arg);
+void dispatch_conn_local(int sfd, int init_state, int event_flags, const bool is_binary,
+                         const struct sockaddr* addr, socklen_t addrlen);
+conn* thread_listen_conn(const bool is_binary);
+
+/* one key of a batched lookup; see mt_item_get_multi(). */
+typedef struct {
+    const char* key;
+    size_t nkey;
+    uint32_t hv;                /* filled in by the lookup */
+    item* it;                   /* the item, with a reference held, or NULL */
+} item_lookup_t;
 
 /* Lock wrappers for cache functions that are called from main loop. */
 char *mt_add_delta(const char* key, const size_t nkey, const int incr, const unsigned int delta,
                    char *buf, uint32_t *res, const struct in_addr addr);
 size_t mt_append_thread_stats(char* const buf, const size_t size, const size_t offset, const size_t reserved);
+void  mt_assoc_expand(void);
 int   mt_assoc_expire_regex(char *pattern);
-void  mt_assoc_move_next_bucket(void);
+void  mt_assoc_walk_stripe(uint32_t stripe, void (*fn)(item* it, void* arg), void* arg);
+void  mt_cache_lock(void);
+void  mt_cache_unlock(void);
 conn* mt_conn_from_freelist(void);
 bool  mt_conn_add_to_freelist(conn* c);
 int   mt_defer_delete(item *it, time_t exptime);
+bool  mt_epoch_enter(void);
+void  mt_epoch_exit(void);
+void  mt_epoch_synchronize(void);
 int   mt_is_listen_thread(void);
-item *mt_item_alloc(char *key, size_t nkey, int flags, rel_time_t exptime, int nbytes, const struct in_addr addr);
+item *mt_item_alloc(char *key, size_t nkey, int flags, rel_time_t exptime, int nbytes, const struct in_addr addr, bool *rejected);
 char *mt_item_cachedump(const unsigned int slabs_clsid, const unsigned int limit, unsigned int *bytes);
 void  mt_item_flush_expired(void);
 item *mt_item_get_notedeleted(const char *key, const size_t nkey, bool *delete_locked);
+void  mt_item_get_multi(item_lookup_t* lookups, const size_t count);
 void  mt_item_deref(item *it);
+void  mt_item_lock(uint32_t hv);
+bool  mt_item_trylock(uint32_t hv);
+bool  mt_item_trylock_all(void);
+void  mt_item_unlock(uint32_t hv);
+void  mt_item_unlock_all(void);
 char *mt_item_stats(int *bytes);
 char *mt_item_stats_sizes(int *bytes);
 void  mt_item_unlink(item *it, long flags, const char* key);
 void  mt_item_update(item *it);
-void  mt_run_deferred_deletes(void);
+bool  mt_run_deferred_deletes(void);
+bool  mt_reap_expired_items(void);
 void *mt_slabs_alloc(size_t size);
 void  mt_slabs_free(void *ptr, size_t size);
 int   mt_slabs_reassign(unsigned char srcid, unsigned char dstid);
 void  mt_slabs_rebalance();
 char *mt_slabs_stats(int *buflen);
-void  mt_stats_lock(stats_t *stats);
 void  mt_global_stats_lock(void);
-void  mt_stats_unlock(stats_t *stats);
 void  mt_global_stats_unlock(void);
 int   mt_store_item(item *item, int comm, const char* key);
 void  mt_stats_init(int threads);
@@ -383,25 +501,46 @@ void mt_stats_aggregate(stats_t *accum);
 void mt_clock_handler(const int fd, const short which, void *arg);
 
 
+static inline void mt_stats_lock(stats_t *stats) {
+    stats->seq++;
+    write_barrier();
+}
+
+static inline void mt_stats_unlock(stats_t *stats) {
+    write_barrier();
+    stats->seq++;
+}
+
 # define add_delta                   mt_add_delta
 # define append_thread_stats         mt_append_thread_stats
+# define assoc_expand                mt_assoc_expand
 # define assoc_expire_regex          mt_assoc_expire_regex
-# define assoc_move_next_bucket      mt_assoc_move_next_bucket
+# define assoc_walk_stripe           mt_assoc_walk_stripe
 # define clock_handler               mt_clock_handler
 # define conn_from_freelist          mt_conn_from_freelist
 # define conn_add_to_freelist        mt_conn_add_to_freelist
 # define defer_delete                mt_defer_delete
+# define epoch_enter                 mt_epoch_enter
+# define epoch_exit                  mt_epoch_exit
+# define epoch_synchronize           mt_epoch_synchronize
 # define is_listen_thread            mt_is_listen_thread
 # define item_alloc                  mt_item_alloc
 # define item_cachedump              mt_item_cachedump
 # define item_flush_expired          mt_item_flush_expired
 # define item_get_notedeleted        mt_item_get_notedeleted
+# define item_get_multi              mt_item_get_multi
 # define item_deref                  mt_item_deref
+# define item_lock                   mt_item_lock
+# define item_trylock                mt_item_trylock
+# define item_trylock_all            mt_item_trylock_all
+# define item_unlock                 mt_item_unlock
+# define item_unlock_all             mt_item_unlock_all
 # define item_stats                  mt_item_stats
 # define item_stats_sizes            mt_item_stats_sizes
 # define item_update                 mt_item_update
 # define item_unlink                 mt_item_unlink
 # define run_deferred_deletes        mt_run_deferred_deletes
+# define reap_expired_items          mt_reap_expired_items
 # define slabs_alloc                 mt_slabs_alloc
 # define slabs_free                  mt_slabs_free
 # define slabs_reassign              mt_slabs_reassign
@@ -417,6 +556,8 @@ void mt_clock_handler(const int fd, const short which, void *arg);
 # define STATS_UNLOCK                mt_stats_unlock
 # define GLOBAL_STATS_LOCK()         mt_global_stats_lock()
 # define GLOBAL_STATS_UNLOCK()       mt_global_stats_unlock()
+# define CACHE_LOCK()                mt_cache_lock()
+# define CACHE_UNLOCK()              mt_cache_unlock()
 
 static inline struct in_addr get_request_addr(conn* c) {
     struct in_addr retval = { INADDR_NONE };
@@ -2,6 +2,7 @@
 #define MEMORY_POOL(pool_enum, pool_counter, pool_string)
 #endif
 
+MEMORY_POOL(ADMISSION_POOL, admission_alloc, "admission")
 MEMORY_POOL(ASSOC_POOL, assoc_alloc, "assoc")
 MEMORY_POOL(CONN_POOL, conn_alloc, "conn")
 MEMORY_POOL(CONN_BUFFER_POOL, conn_buffer_alloc, "conn_buffer")
@@ -17,6 +18,7 @@ MEMORY_POOL(CONN_BUFFER_BP_HDRPOOL_POOL, conn_buffer_bp_hdrpool_alloc, "conn_buf
 MEMORY_POOL(CONN_BUFFER_BP_STRING_POOL, conn_buffer_bp_string_alloc, "conn_buffer_bp_string")
 MEMORY_POOL(CQ_POOL, cq_alloc, "cq")
 MEMORY_POOL(DELETE_POOL, delete_alloc, "defer_delete")
+MEMORY_POOL(EXPIRY_POOL, expiry_alloc, "expiry")
 MEMORY_POOL(STATS_PREFIX_POOL, stats_prefix_alloc, "prefix_stats")
 
 #undef MEMORY_POOL
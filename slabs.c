@@ -26,6 +26,8 @@
 
 #include "memcached.h"
 #include "items.h"
+#include "stats.h"
+#include "hugepage.h"
 
 #define POWER_SMALLEST 1
 #define POWER_LARGEST  200
@@ -65,6 +67,13 @@ static int power_largest;
 static int slab_rebalanced_count = 0;
 static int slab_rebalanced_reversed = 0;
 
+/* with -L, slab pages are carved out of one region mapped with huge pages at
+ * startup, rather than malloc'd one at a time.  pages are never given back, so
+ * the region is only ever bumped through. */
+static char *mem_base = NULL;
+static char *mem_current = NULL;
+static size_t mem_avail = 0;
+
 /*
  * Forward Declarations
  */
@@ -125,6 +134,17 @@ void slabs_init(const size_t limit, const double factor) {
     mem_limit = limit;
     memset(slabclass, 0, sizeof(slabclass));
 
+    if (settings.hugepages && limit > 0) {
+        mem_base = hugepage_map(limit);
+        if (mem_base != NULL) {
+            mem_current = mem_base;
+            mem_avail = limit;
+        } else {
+            fprintf(stderr, "Failed to map %lu bytes for slabs, allocating them one at a time\n",
+                    (unsigned long) limit);
+        }
+    }
+
     while (++i < POWER_LARGEST && size <= POWER_BLOCK / 2) {
         /* Make sure items are always n-byte aligned */
         if (size % CHUNK_ALIGN_BYTES)
@@ -197,6 +217,26 @@ static int grow_slab_list (const unsigned int id) {
     return 1;
 }
 
+/* returns a zeroed slab page from the huge page region, or from malloc once
+ * that runs out (the first page of each class may go over the limit). */
+static void *memory_allocate(const size_t size) {
+    void *ret;
+
+    if (size <= mem_avail) {
+        /* the region was mapped zeroed. */
+        ret = mem_current;
+        mem_current += size;
+        mem_avail -= size;
+        return ret;
+    }
+
+    ret = malloc(size);
+    if (ret != NULL) {
+        memset(ret, 0, size);
+    }
+    return ret;
+}
+
 static int do_slabs_newslab(const unsigned int id) {
     stats_t *stats = STATS_GET_TLS();
     slabclass_t *p = &slabclass[id];
@@ -210,10 +250,9 @@ static int do_slabs_newslab(const unsigned int id) {
 
     if (grow_slab_list(id) == 0) return 0;
 
-    ptr = malloc((size_t)len);
+    ptr = memory_allocate((size_t)len);
     if (ptr == 0) return 0;
 
-    memset(ptr, 0, (size_t)len);
     p->end_page_ptr = ptr;
     p->end_page_free = p->perslab;
 
@@ -368,7 +407,7 @@ char* do_slabs_stats(int *buflen) {
 int do_slabs_reassign(unsigned char srcid, unsigned char dstid) {
     void *slab, *slab_end;
     slabclass_t *p, *dp;
-    void *iter;
+    void *iter, *thaw;
     int fi;
 
     if (srcid < POWER_SMALLEST || srcid > power_largest ||
@@ -390,10 +429,16 @@ int do_slabs_reassign(unsigned char srcid, unsigned char dstid) {
     slab = p->slab_list[0];
     slab_end = (char*)slab + POWER_BLOCK - p->size; // inclusive!
 
-    /* if there are any items that are in the middle of something, abort */
+    /* if there are any items that are in the middle of something, abort.
+     * the rest are frozen, so lock-free readers can't take new references. */
     for (iter = slab; iter <= slab_end; iter += p->size) {
         item *it = (item *)iter;
-        if (it->slabs_clsid && it->refcount) {
+        if (it->slabs_clsid && ! ITEM_refcount_kill(it)) {
+            for (thaw = slab; thaw < iter; thaw += p->size) {
+                if (((item *)thaw)->slabs_clsid) {
+                    ITEM_refcount_revive((item *)thaw);
+                }
+            }
             /* we have picked a busy slab, maybe our decision wasn't right */
             p->rebalance_wait = 20;
             return -1;
@@ -408,7 +453,9 @@ int do_slabs_reassign(unsigned char srcid, unsigned char dstid) {
         }
     }
 
-    /* go through free list and discard items that were part of this slab */
+    /* go through free list and discard items that were part of this slab.
+     * the caller has already handed back the items in limbo (see
+     * do_item_reclaim()), so they're all on it. */
     for (fi = p->sl_curr - 1; fi >= 0; fi--) {
         if (p->slots[fi] >= slab && p->slots[fi] <= slab_end) {
             p->sl_curr--;
@@ -427,7 +474,8 @@ int do_slabs_reassign(unsigned char srcid, unsigned char dstid) {
     dp->end_page_free = dp->perslab;
     dp->rebalanced_to++;
 
-    /* clearing out entire slab */
+    /* clearing out entire slab, once no reader can still see its items */
+    epoch_synchronize();
     memset(slab, 0, POWER_BLOCK);
     return 1;
 }
@@ -475,6 +523,11 @@ void slabs_add_eviction(unsigned int clsid) {
  *
  *      unique hit rate = unique_hits / number_of_slabs
  *
+ *    With size-aware eviction (-g), the hit density the cost-benefit stats
+ *    keep for the class's item size stands in for the unique hit rate:
+ *
+ *      page hit rate = hits_per_item_second * items_per_slab
+ *
  * 4. Is it the end of the story? No. There are slab classes that have high
  *    eviction items AND low hit rates. To avoid this problem, we count
  *    total number of evictions of both classes that were rebalanced between,
@@ -535,6 +588,12 @@ void do_slabs_rebalance() {
         double uhit = (double)p->unique_hits / p->slabs;
         double miss = (double)p->evictions * p->perslab;
 
+        /* with size-aware eviction, a page is worth the hits per second its
+         * items earn, going by the hit density of items of the class's size. */
+        if (settings.size_aware_eviction) {
+            uhit = cost_benefit_density(p->size) * p->perslab;
+        }
+
         if (!highest_inited) {
             highest_inited = 1;
             slab_to = i; highest_miss = miss;
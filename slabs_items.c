@@ -22,19 +22,35 @@
 #include "assoc.h"
 #include "slabs.h"
 #include "stats.h"
+#include "admission.h"
 #include "conn_buffer.h"
+#include "expiry.h"
+#include "storage_engine.h"
 #include "slabs_items_support.h"
 
 /* Forward Declarations */
+static void slab_item_unlink_impl(item *it, long flags, bool to_freelist);
 static void item_link_q(item *it);
 static void item_unlink_q(item *it);
 static void item_free(item *it, bool to_freelist);
+static void item_lru_bump(item *it);
 
 #define LARGEST_ID 255
 static item *heads[LARGEST_ID];
 static item *tails[LARGEST_ID];
 static unsigned int sizes[LARGEST_ID];
 static time_t last_slab_rebalance = 0;
+/* freed items that lock-free readers may still be looking at, linked through
+ * their LRU next pointers, which readers don't follow.  they go back to the
+ * slab allocator a batch at a time, after one epoch_synchronize() for the lot.
+ * protected by the cache lock. */
+#define ITEM_LIMBO_BATCH 256
+static item *limbo_head = NULL;
+static unsigned int limbo_count = 0;
+/* with lock-free gets, a store that has to evict takes this many items off
+ * the LRU, so the wait before their memory can be reused is shared by as many
+ * stores. */
+#define ITEM_EVICT_BATCH 8
 static int slab_rebalance_interval = 0; /* off */
 
 void slabs_set_rebalance_interval(int interval) {
@@ -92,7 +108,7 @@ int item_key_compare(const item* it, const char* key, const size_t nkey) {
 }
 
 
-void do_try_item_stamp(item* it, const rel_time_t now, const struct in_addr addr) {
+static void slab_try_item_stamp(item* it, const rel_time_t now, const struct in_addr addr) {
     int slackspace;
     size_t offset = 0;
 
@@ -124,32 +140,62 @@ void do_try_item_stamp(item* it, const rel_time_t now, const struct in_addr addr
 }
 
 
+/*
+ * if rejected is not NULL, the item is subject to admission, and *rejected is
+ * set if NULL is returned because the admission filter turned it away.
+ */
 /*@null@*/
-item *do_item_alloc(const char *key, const size_t nkey, const int flags, const rel_time_t exptime,
-                    const size_t nbytes, const struct in_addr addr) {
+static item *slab_item_alloc(const char *key, const size_t nkey, const int flags, const rel_time_t exptime,
+                             const size_t nbytes, const struct in_addr addr, bool* rejected) {
     stats_t *stats = STATS_GET_TLS();
     item *it;
     size_t ntotal = stritem_length + nkey + nbytes;
     rel_time_t now = current_time;
+    uint32_t candidate_hv = hash(key, nkey, 0);
 
     unsigned int id = slabs_clsid(ntotal);
 
+    if (rejected != NULL) {
+        *rejected = false;
+        admission_record(candidate_hv);
+    }
+
     if (id == 0)
         return 0;
 
     it = slabs_alloc(ntotal);
 
+    /* items freed but still in limbo are the first memory to fall back on. */
+    if (it == 0 && limbo_head != NULL) {
+        do_item_reclaim();
+        it = slabs_alloc(ntotal);
+    }
+
+    /* reclaim items that have expired before evicting any that haven't.  they
+     * may be in other classes, but that memory was going spare anyway. */
+    if (it == 0 && do_expiry_reclaim(EXPIRY_RECLAIM_ON_ALLOC) > 0) {
+        do_item_reclaim();
+        it = slabs_alloc(ntotal);
+    }
+
     /* try to steal one slab from low-hit class */
     if (it == 0 && slab_rebalance_interval &&
-        (now - last_slab_rebalance) > slab_rebalance_interval) {
+        (now - last_slab_rebalance) > slab_rebalance_interval &&
+        item_trylock_all()) {
+        /* rebalancing unlinks every item on a slab page, so it needs all the
+         * item locks.  if any are busy, we'll try again on the next miss. */
+        do_item_reclaim();
         slabs_rebalance();
+        item_unlock_all();
         last_slab_rebalance = now;
         it = slabs_alloc(ntotal); /* there is a slim chance this retry would work */
     }
 
     if (it == 0) {
-        int tries = 50;
-        item *search;
+        int tries = 50, bumps = 50;
+        int evict_max = settings.lockfree_get ? ITEM_EVICT_BATCH : 1, evicted = 0;
+        uint64_t bumped = 0, dropped = 0;
+        item *search, *prev;
 
         /* If requested to not push old items out of cache when memory runs out,
          * we're out of luck at this point...
@@ -167,21 +213,74 @@ item *do_item_alloc(const char *key, const size_t nkey, const int flags, const r
         if (id > LARGEST_ID) return NULL;
         if (tails[id] == 0) return NULL;
 
-        for (search = tails[id]; tries > 0 && search != NULL; tries--, search=search->prev) {
-            if (search->refcount == 0) {
+        for (search = tails[id]; tries > 0 && search != NULL; search = prev) {
+            uint32_t hv;
+
+            prev = search->prev;
+
+            /* items that were hit since they were last moved get the move
+             * they were promised, rather than being evicted.  if too many
+             * of them are in the way, the rest are evicted regardless. */
+            if (ITEM_is_bumped(search) && bumps > 0) {
+                item_lru_bump(search);
+                bumps--;
+                bumped++;
+                continue;
+            }
+            tries--;
+
+            /* we hold the cache lock, so we may only try for the item lock.
+             * if someone else has it, the item is likely in use anyway. */
+            if (search->refcount == 0 &&
+                item_trylock(hv = assoc_item_hash(search))) {
+                if (search->refcount != 0) {
+                    /* picked up a reference before we got the lock. */
+                    item_unlock(hv);
+                    continue;
+                }
+                if ((search->exptime == 0 || search->exptime > now) &&
+                    rejected != NULL && ! admission_admit(candidate_hv, hv)) {
+                    /* the victim's key has been seen more often.  if earlier
+                     * victims have made room already, the store goes ahead,
+                     * but no more are evicted for it. */
+                    item_unlock(hv);
+                    if (evicted > 0) {
+                        break;
+                    }
+                    STATS_LOCK(stats);
+                    stats->admission_rejects++;
+                    STATS_UNLOCK(stats);
+                    *rejected = true;
+                    break;
+                }
                 if (search->exptime == 0 || search->exptime > now) {
                     STATS_LOCK(stats);
                     stats->evictions++;
+                    if (search->exptime != 0) {
+                        stats->evictions_of_live_items++;
+                    }
                     STATS_UNLOCK(stats);
 
+                    if (ITEM_is_bumped(search)) {
+                        dropped++;
+                    }
                     slabs_add_eviction(id);
-                    do_item_unlink(search, UNLINK_IS_EVICT, key);
+                    slab_item_unlink_impl(search, UNLINK_IS_EVICT, true);
                 } else {
-                    do_item_unlink(search, UNLINK_IS_EXPIRED, key);
+                    slab_item_unlink_impl(search, UNLINK_IS_EXPIRED, true);
+                }
+                item_unlock(hv);
+                if (++evicted == evict_max) {
+                    break;
                 }
-                break;
             }
         }
+        STATS_LOCK(stats);
+        stats->lru_bumps += bumped;
+        stats->lru_bump_drops += dropped;
+        STATS_UNLOCK(stats);
+        if (rejected != NULL && *rejected) return NULL;
+        do_item_reclaim();
         it = slabs_alloc(ntotal);
         if (it == 0) return NULL;
     }
@@ -201,8 +300,9 @@ item *do_item_alloc(const char *key, const size_t nkey, const int flags, const r
     memcpy(ITEM_key(it), key, nkey);
     it->exptime = exptime;
     it->flags = flags;
+    it->hv = candidate_hv;
 
-    do_try_item_stamp(it, now, addr);
+    slab_try_item_stamp(it, now, addr);
 
     return it;
 }
@@ -212,13 +312,44 @@ static void item_free(item *it, bool to_freelist) {
     assert((it->it_flags & ITEM_LINKED) == 0);
     assert(it != heads[it->slabs_clsid]);
     assert(it != tails[it->slabs_clsid]);
-    assert(it->refcount == 0);
+    assert(it->refcount == ITEM_REFCOUNT_DEAD);
 
     /* so slab size changer can tell later if item is already free or not */
     it->slabs_clsid = 0;
     it->it_flags |= ITEM_SLABBED;
     DEBUG_REFCNT(it, 'F');
-    if (to_freelist) slabs_free(it, ntotal);
+    if (! to_freelist) {
+        return;
+    }
+    if (! settings.lockfree_get) {
+        slabs_free(it, ntotal);
+        return;
+    }
+    it->next = limbo_head;
+    limbo_head = it;
+    if (++limbo_count == ITEM_LIMBO_BATCH) {
+        do_item_reclaim();
+    }
+}
+
+
+/*
+ * hands the items in limbo back to the slab allocator, once no lock-free
+ * reader can still be looking at them.  called with the cache lock held, but
+ * not the slabs lock.
+ */
+void do_item_reclaim(void) {
+    if (limbo_head == NULL) {
+        return;
+    }
+    epoch_synchronize();
+    while (limbo_head != NULL) {
+        item *it = limbo_head;
+
+        limbo_head = it->next;
+        slabs_free(it, ITEM_ntotal(it));
+    }
+    limbo_count = 0;
 }
 
 
@@ -235,13 +366,13 @@ static unsigned int item_slabs_clsid(const size_t nkey, const int flags,
  * Returns true if an item will fit in the cache (its size does not exceed
  * the maximum for a cache entry.)
  */
-bool item_size_ok(const size_t nkey, const int flags, const int nbytes) {
+static bool slab_item_size_ok(const size_t nkey, const int flags, const int nbytes) {
     return (item_slabs_clsid(nkey, flags, nbytes) != 0);
 }
 
 
-bool item_need_realloc(const item* it,
-                       const size_t new_nkey, const int new_flags, const size_t new_nbytes) {
+static bool slab_item_need_realloc(const item* it,
+                                   const size_t new_nkey, const int new_flags, const size_t new_nbytes) {
     return (it->slabs_clsid != item_slabs_clsid(new_nkey, new_flags, new_nbytes));
 }
 
@@ -287,15 +418,16 @@ static void item_unlink_q(item *it) {
     return;
 }
 
-int do_item_link(item *it, const char* key) {
+static int slab_item_link(item *it, const char* key) {
     stats_t *stats = STATS_GET_TLS();
 
     assert((it->it_flags & (ITEM_LINKED|ITEM_SLABBED)) == 0);
     assert(it->nbytes < (1024 * 1024));  /* 1MB max size */
     it->it_flags |= ITEM_LINKED;
-    it->it_flags &= ~ITEM_VISITED;
+    it->it_flags &= ~(ITEM_VISITED | ITEM_BUMPED);
     it->time = current_time;
     assoc_insert(it, key);
+    expiry_add(it->hv, it->exptime);
 
     STATS_LOCK(stats);
     stats->item_total_size += it->nkey + it->nbytes; /* cr-lf shouldn't count */
@@ -308,11 +440,7 @@ int do_item_link(item *it, const char* key) {
     return 1;
 }
 
-void do_item_unlink(item *it, long flags, const char* key) {
-    do_item_unlink_impl(it, flags, true);
-}
-
-void do_item_unlink_impl(item *it, long flags, bool to_freelist) {
+static void slab_item_unlink_impl(item *it, long flags, bool to_freelist) {
     stats_t *stats = STATS_GET_TLS();
     if ((it->it_flags & ITEM_LINKED) != 0) {
         it->it_flags &= ~ITEM_LINKED;
@@ -330,46 +458,49 @@ void do_item_unlink_impl(item *it, long flags, bool to_freelist) {
             stats_expire(it->nkey + it->nbytes);
         }
         assoc_delete(ITEM_key(it), it->nkey);
+        expiry_remove(it->hv, it->exptime);
         item_unlink_q(it);
-        if (it->refcount == 0) {
+        /* items on a slab being reassigned are already frozen. */
+        if (it->refcount == ITEM_REFCOUNT_DEAD || ITEM_refcount_kill(it)) {
             item_free(it, to_freelist);
         }
     }
 }
 
-void do_item_deref(item *it) {
+static void slab_item_deref(item *it) {
     assert((it->it_flags & ITEM_SLABBED) == 0);
     if (it->refcount != 0) {
-        it->refcount--;
+        ITEM_refcount_decr(it);
         DEBUG_REFCNT(it, '-');
     }
     assert((it->it_flags & ITEM_DELETED) == 0 || it->refcount != 0);
-    if (it->refcount == 0 && (it->it_flags & ITEM_LINKED) == 0) {
+    if ((it->it_flags & ITEM_LINKED) == 0 && ITEM_refcount_kill(it)) {
+        CACHE_LOCK();
         item_free(it, true);
+        CACHE_UNLOCK();
     }
 }
 
-void do_item_update(item *it) {
+static void slab_item_update(item *it) {
     if (it->time < current_time - ITEM_UPDATE_INTERVAL) {
         assert((it->it_flags & ITEM_SLABBED) == 0);
 
         if ((it->it_flags & ITEM_LINKED) != 0) {
-            item_unlink_q(it);
-            it->time = current_time;
-            item_link_q(it);
+            item_lru_bump(it);
         }
     }
 }
 
-int do_item_replace(item *it, item *new_it, const char* key) {
-    assert((it->it_flags & ITEM_SLABBED) == 0);
-
-    do_item_unlink(it, UNLINK_NORMAL, key);
-    return do_item_link(new_it, key);
+/* moves a linked item to the head of its LRU.  the cache lock must be held. */
+static void item_lru_bump(item *it) {
+    ITEM_clear_bumped(it);
+    item_unlink_q(it);
+    it->time = current_time;
+    item_link_q(it);
 }
 
 /*@null@*/
-char *do_item_cachedump(const unsigned int slabs_clsid, const unsigned int limit, unsigned int *bytes) {
+static char *slab_item_cachedump(const unsigned int slabs_clsid, const unsigned int limit, unsigned int *bytes) {
     unsigned int memlimit = 2 * 1024 * 1024;   /* 2MB max response size */
     char *buffer;
     unsigned int bufcurr;
@@ -405,7 +536,7 @@ char *do_item_cachedump(const unsigned int slabs_clsid, const unsigned int limit
     return buffer;
 }
 
-char *do_item_stats(int *bytes) {
+static char *slab_item_stats(int *bytes) {
     size_t bufleft = (size_t) LARGEST_ID * 80;
     char *buffer = malloc(bufleft);
     char *bufcurr = buffer;
@@ -440,7 +571,7 @@ char *do_item_stats(int *bytes) {
 
 /** dumps out a list of objects of each size, with granularity of 32 bytes */
 /*@null@*/
-char* do_item_stats_sizes(int *bytes) {
+static char* slab_item_stats_sizes(int *bytes) {
     const int num_buckets = 32768;   /* max 1MB object, divided into 32 bytes size buckets */
     unsigned int *histogram = (unsigned int *)malloc((size_t)num_buckets * sizeof(int));
     size_t bufsize = (2 * 1024 * 1024), offset = 0;
@@ -487,9 +618,11 @@ bool item_delete_lock_over (item *it) {
     return (current_time >= it->exptime);
 }
 
-/** wrapper around assoc_find which does the lazy expiration/deletion logic */
-item *do_item_get_notedeleted(const char *key, const size_t nkey, bool *delete_locked) {
-    item *it = assoc_find(key, nkey);
+/** wrapper around assoc_find which does the lazy expiration/deletion logic.
+    the caller must hold the item lock for the key. */
+item *do_item_get_notedeleted(const char *key, const size_t nkey, const uint32_t hv,
+                              bool *delete_locked) {
+    item *it = assoc_find(key, nkey, hv);
     if (delete_locked) *delete_locked = false;
     if (it != NULL && (it->it_flags & ITEM_DELETED)) {
         /* it's flagged as delete-locked.  let's see if that condition
@@ -502,16 +635,20 @@ item *do_item_get_notedeleted(const char *key, const size_t nkey, bool *delete_l
     }
     if (it != NULL && settings.oldest_live != 0 && settings.oldest_live <= current_time &&
         it->time <= settings.oldest_live) {
-        do_item_unlink(it, UNLINK_IS_EXPIRED, key); /* MTSAFE - cache_lock held */
+        CACHE_LOCK();
+        do_item_unlink(it, UNLINK_IS_EXPIRED, key); /* MTSAFE - item lock held */
+        CACHE_UNLOCK();
         it = NULL;
     }
     if (it != NULL && it->exptime != 0 && it->exptime <= current_time) {
-        do_item_unlink(it, UNLINK_IS_EXPIRED, key); /* MTSAFE - cache_lock held */
+        CACHE_LOCK();
+        do_item_unlink(it, UNLINK_IS_EXPIRED, key); /* MTSAFE - item lock held */
+        CACHE_UNLOCK();
         it = NULL;
     }
 
     if (it != NULL) {
-        if (BUMP(it->refcount)) {
+        if (ITEM_refcount_incr(it)) {
             DEBUG_REFCNT(it, '+');
         } else {
             it = NULL;
@@ -520,15 +657,53 @@ item *do_item_get_notedeleted(const char *key, const size_t nkey, bool *delete_l
     return it;
 }
 
+/** looks up a key without the item lock, for the -G option.  only plain hits
+    are returned, with a reference held; anything else (misses, delete-locked
+    or expired items) returns NULL and must be retried under the lock. */
+item *item_get_lockfree(const char *key, const size_t nkey, const uint32_t hv) {
+    stats_t *stats;
+    item *it;
+
+    if (! epoch_enter()) {
+        return NULL;
+    }
+    it = assoc_find_lockfree(key, nkey, hv);
+    if (it != NULL &&
+        ((it->it_flags & ITEM_DELETED) ||
+         (settings.oldest_live != 0 && settings.oldest_live <= current_time &&
+          it->time <= settings.oldest_live) ||
+         (it->exptime != 0 && it->exptime <= current_time) ||
+         ! ITEM_refcount_incr(it))) {
+        it = NULL;
+    }
+    epoch_exit();
+
+    if (it == NULL) {
+        return NULL;
+    }
+    if ((it->it_flags & ITEM_LINKED) == 0) {
+        /* unlinked before our reference landed. */
+        item_deref(it);
+        return NULL;
+    }
+    DEBUG_REFCNT(it, '+');
+
+    stats = STATS_GET_TLS();
+    STATS_LOCK(stats);
+    stats->lockfree_hits++;
+    STATS_UNLOCK(stats);
+    return it;
+}
+
 item *item_get(const char *key, const size_t nkey) {
     return item_get_notedeleted(key, nkey, 0);
 }
 
 /** returns an item whether or not it's delete-locked or expired. */
 item *do_item_get_nocheck(const char *key, const size_t nkey) {
-    item *it = assoc_find(key, nkey);
+    item *it = assoc_find(key, nkey, hash(key, nkey, 0));
     if (it) {
-        if (BUMP(it->refcount)) {
+        if (ITEM_refcount_incr(it)) {
             DEBUG_REFCNT(it, '+');
         } else {
             it = NULL;
@@ -539,7 +714,7 @@ item *do_item_get_nocheck(const char *key, const size_t nkey) {
 }
 
 /* expires items that are more recent than the oldest_live setting. */
-void do_item_flush_expired(void) {
+static void slab_item_flush_expired(void) {
     int i;
     item *iter, *next;
     if (settings.oldest_live == 0)
@@ -554,7 +729,7 @@ void do_item_flush_expired(void) {
             if (iter->time >= settings.oldest_live) {
                 next = iter->next;
                 if ((iter->it_flags & ITEM_SLABBED) == 0) {
-                    do_item_unlink(iter, UNLINK_IS_EXPIRED, NULL);
+                    slab_item_unlink_impl(iter, UNLINK_IS_EXPIRED, true);
                 }
             } else {
                 /* We've hit the first old item. Continue to the next queue. */
@@ -565,7 +740,7 @@ void do_item_flush_expired(void) {
 }
 
 
-void item_mark_visited(item* it)
+static void slab_item_mark_visited(item* it)
 {
     if ((it->it_flags & ITEM_VISITED) == 0) {
         it->it_flags |= ITEM_VISITED;
@@ -576,4 +751,29 @@ void item_mark_visited(item* it)
 }
 
 
+static void slab_storage_init(const size_t maxbytes) {
+    slabs_init(maxbytes, settings.factor);
+}
+
+
+const storage_engine_t slab_engine = {
+    .name = "slab",
+    .init = slab_storage_init,
+    .start = NULL,
+    .try_stamp = slab_try_item_stamp,
+    .alloc = slab_item_alloc,
+    .size_ok = slab_item_size_ok,
+    .need_realloc = slab_item_need_realloc,
+    .link = slab_item_link,
+    .unlink = slab_item_unlink_impl,
+    .deref = slab_item_deref,
+    .update = slab_item_update,
+    .mark_visited = slab_item_mark_visited,
+    .cachedump = slab_item_cachedump,
+    .stats = slab_item_stats,
+    .stats_sizes = slab_item_stats_sizes,
+    .flush_expired = slab_item_flush_expired,
+};
+
+
 #endif /* #if defined(USE_SLAB_ALLOCATOR) */
@@ -20,6 +20,7 @@ typedef item* item_ptr_t;
 #define ITEM_VISITED 8  /* cache hit */
 #define ITEM_HAS_IP_ADDRESS 0x10
 #define ITEM_HAS_TIMESTAMP  0x20
+#define ITEM_BUMPED 0x40    /* hit since it was last moved in the LRU */
 
 struct _stritem {
     struct _stritem *next;
@@ -29,6 +30,7 @@ struct _stritem {
     rel_time_t      exptime;    /* expire time */
     int             nbytes;     /* size of data */
     unsigned int    flags;      /* flags field */
+    uint32_t        hv;         /* hash of the key */
     unsigned short  refcount;
     uint8_t         it_flags;   /* ITEM_* above */
     uint8_t         slabs_clsid;/* which slab class we're in */
@@ -54,6 +56,29 @@ static inline unsigned int   ITEM_flags(const item* it)    { return it->flags; }
 static inline rel_time_t     ITEM_time(const item* it)     { return it->time; }
 static inline rel_time_t     ITEM_exptime(const item* it)  { return it->exptime; }
 static inline unsigned short ITEM_refcount(const item* it) { return it->refcount; }
+static inline uint32_t       ITEM_hv(const item* it)       { return it->hv; }
+
+/* refcounts are changed atomically, as lock-free gets pick up references
+ * without holding the item lock.  an item is freed by swapping a zero refcount
+ * for ITEM_REFCOUNT_DEAD, after which no new references can be taken. */
+#define ITEM_REFCOUNT_DEAD ((unsigned short) 0xffff)
+
+/* takes a reference.  returns false if the item is dead or the refcount would
+ * overflow. */
+static inline bool ITEM_refcount_incr(item* it) {
+    unsigned short refcount;
+
+    do {
+        refcount = it->refcount;
+        if (refcount >= ITEM_REFCOUNT_DEAD - 1) {
+            return false;
+        }
+    } while (! __sync_bool_compare_and_swap(&it->refcount, refcount, refcount + 1));
+    return true;
+}
+static inline unsigned short ITEM_refcount_decr(item* it) { return __sync_sub_and_fetch(&it->refcount, 1); }
+static inline bool ITEM_refcount_kill(item* it)   { return __sync_bool_compare_and_swap(&it->refcount, 0, ITEM_REFCOUNT_DEAD); }
+static inline void ITEM_refcount_revive(item* it) { __sync_bool_compare_and_swap(&it->refcount, ITEM_REFCOUNT_DEAD, 0); }
 
 
 static inline void ITEM_set_nbytes(item* it, int new_nbytes)     { it->nbytes = new_nbytes; }
@@ -68,6 +93,7 @@ static inline bool ITEM_is_valid(const item* it)        { return !(it->it_flags
 static inline bool ITEM_has_timestamp(const item* it)   { return (it->it_flags & ITEM_HAS_TIMESTAMP); }
 static inline bool ITEM_has_ip_address(const item* it)  { return (it->it_flags & ITEM_HAS_IP_ADDRESS); }
 
+static inline bool ITEM_is_deleted(const item* it)     { return (it->it_flags & ITEM_DELETED); }
 static inline void ITEM_mark_deleted(item* it)    { it->it_flags |= ITEM_DELETED; }
 static inline void ITEM_unmark_deleted(item* it)  { it->it_flags &= ~ITEM_DELETED; }
 static inline void ITEM_set_has_timestamp(item* it)     { it->it_flags |= ITEM_HAS_TIMESTAMP; }
@@ -75,10 +101,15 @@ static inline void ITEM_clear_has_timestamp(item* it)   { it->it_flags &= ~(ITEM
 static inline void ITEM_set_has_ip_address(item* it)    { it->it_flags |= ITEM_HAS_IP_ADDRESS; }
 static inline void ITEM_clear_has_ip_address(item* it)  { it->it_flags &= ~(ITEM_HAS_IP_ADDRESS); }
 
-extern char* do_item_cachedump(const unsigned int slabs_clsid, const unsigned int limit, unsigned int *bytes);
+/* hits mark items without holding any lock, so the bumped flag is set and
+ * cleared atomically, lest it clobber a concurrent change to the other flags. */
+static inline bool ITEM_is_bumped(const item* it)       { return (it->it_flags & ITEM_BUMPED); }
+static inline void ITEM_mark_bumped(item* it)           { __sync_fetch_and_or(&it->it_flags, ITEM_BUMPED); }
+static inline void ITEM_clear_bumped(item* it)          { __sync_fetch_and_and(&it->it_flags, (uint8_t) ~ITEM_BUMPED); }
 
-extern char* do_item_stats(int *bytes);
+extern char* do_item_cachedump(const unsigned int slabs_clsid, const unsigned int limit, unsigned int *bytes);
 
 extern void  item_mark_visited(item* it);
+extern void  do_item_reclaim(void);
 
 #endif /* #if !defined(_slabs_items_h_) */
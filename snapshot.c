@@ -0,0 +1,411 @@
+/* -*- Mode: C; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+
+#include "generic.h"
+
+#include <assert.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include "assoc.h"
+#include "items.h"
+#include "memcached.h"
+#include "snapshot.h"
+
+#define SNAPSHOT_TEMP_SUFFIX ".tmp"
+#define SNAPSHOT_BLOCK_MIN   (64 * 1024)
+
+/* the snapshot being written, or the last one. */
+static struct {
+    pthread_mutex_t lock;               /* guards running. */
+    bool running;
+    FILE* file;
+    char* path;
+    char* temp_path;
+    uint64_t items;
+    uint64_t bytes;
+    uint64_t snapshots;                 /* written in full. */
+    uint64_t failures;
+} save = { PTHREAD_MUTEX_INITIALIZER };
+
+/* the snapshot loaded at startup. */
+static struct {
+    const char* base;
+    size_t* blocks;                     /* offsets of the blocks. */
+    uint32_t block_count;
+    uint32_t next_block;                /* claimed atomically by the loaders. */
+    int loaders;                        /* still running. */
+    pthread_mutex_t lock;
+    pthread_cond_t done;
+    uint64_t items;
+    uint64_t skipped;                   /* expired, or already stored. */
+    uint64_t failed;                    /* no memory for them. */
+    double seconds;
+    bool loaded;
+} load = { .lock = PTHREAD_MUTEX_INITIALIZER, .done = PTHREAD_COND_INITIALIZER };
+
+/* the records of one item lock's buckets, copied out under that lock. */
+typedef struct {
+    char* buf;
+    size_t len;
+    size_t size;
+    uint32_t items;
+    bool short_of_memory;
+} snapshot_block_t;
+
+
+static void block_append(item* it, void* arg) {
+    snapshot_block_t* block = arg;
+    snapshot_record_t record;
+#if defined(USE_FLAT_ALLOCATOR)
+    char key_temp[KEY_MAX_LENGTH];
+#endif /* #if defined(USE_FLAT_ALLOCATOR) */
+    const char* key;
+    size_t need;
+
+    if (ITEM_is_deleted(it) ||
+        (ITEM_exptime(it) != 0 && ITEM_exptime(it) <= current_time)) {
+        return;
+    }
+
+    need = block->len + sizeof(record) + ITEM_nkey(it) + ITEM_nbytes(it);
+    if (need > block->size) {
+        size_t size = (block->size == 0) ? SNAPSHOT_BLOCK_MIN : block->size;
+        char* buf;
+
+        while (size < need) {
+            size *= 2;
+        }
+        if ((buf = realloc(block->buf, size)) == NULL) {
+            block->short_of_memory = true;
+            return;
+        }
+        block->buf = buf;
+        block->size = size;
+    }
+
+#if defined(USE_FLAT_ALLOCATOR)
+    key = item_key_copy(it, key_temp);
+#endif /* #if defined(USE_FLAT_ALLOCATOR) */
+#if defined(USE_SLAB_ALLOCATOR)
+    key = ITEM_key(it);
+#endif /* #if defined(USE_SLAB_ALLOCATOR) */
+
+    record.flags = ITEM_flags(it);
+    record.exptime = (ITEM_exptime(it) == 0) ? 0 : (uint32_t) (ITEM_exptime(it) + started);
+    record.nbytes = ITEM_nbytes(it);
+    record.nkey = ITEM_nkey(it);
+    memcpy(block->buf + block->len, &record, sizeof(record));
+    block->len += sizeof(record);
+    memcpy(block->buf + block->len, key, record.nkey);
+    block->len += record.nkey;
+    item_memcpy_from(block->buf + block->len, it, 0, record.nbytes, false);
+    block->len += record.nbytes;
+    block->items++;
+}
+
+
+static void* snapshot_thread(void* arg) {
+    snapshot_block_t block;
+    snapshot_block_header_t header;
+    uint32_t stripe;
+    bool ok = true;
+
+    memset(&block, 0, sizeof(block));
+    for (stripe = 0; stripe < ITEM_LOCK_COUNT && ok; stripe++) {
+        block.len = 0;
+        block.items = 0;
+        assoc_walk_stripe(stripe, block_append, &block);
+        if (block.short_of_memory) {
+            ok = false;
+            break;
+        }
+        if (block.items == 0) {
+            continue;
+        }
+
+        header.nbytes = block.len;
+        header.items = block.items;
+        ok = (fwrite(&header, sizeof(header), 1, save.file) == 1 &&
+              fwrite(block.buf, block.len, 1, save.file) == 1);
+        save.items += block.items;
+        save.bytes += sizeof(header) + block.len;
+    }
+    free(block.buf);
+
+    /* the empty block marks the end, so a torn copy can be told apart. */
+    memset(&header, 0, sizeof(header));
+    ok = (ok &&
+          fwrite(&header, sizeof(header), 1, save.file) == 1 &&
+          fflush(save.file) == 0 &&
+          fsync(fileno(save.file)) == 0);
+    ok = (fclose(save.file) == 0 && ok);
+    ok = (ok && rename(save.temp_path, save.path) == 0);
+    if (! ok) {
+        if (settings.verbose > 0) {
+            fprintf(stderr, "Failed to write the snapshot to %s\n", save.path);
+        }
+        unlink(save.temp_path);
+    }
+
+    pthread_mutex_lock(&save.lock);
+    free(save.path);
+    free(save.temp_path);
+    if (ok) {
+        save.snapshots++;
+    } else {
+        save.failures++;
+    }
+    save.running = false;
+    pthread_mutex_unlock(&save.lock);
+    return NULL;
+}
+
+
+const char* snapshot_start(const char* name) {
+    pthread_attr_t attr;
+    pthread_t thread;
+    const char* error = NULL;
+    size_t path_size;
+
+    if (settings.snapshot_dir == NULL) {
+        return "SERVER_ERROR snapshots aren't enabled (see -O)";
+    }
+    /* the name mustn't lead out of the snapshot directory. */
+    if (name[0] == '\0' || strchr(name, '/') != NULL || strstr(name, "..") != NULL) {
+        return "CLIENT_ERROR bad snapshot name";
+    }
+
+    pthread_mutex_lock(&save.lock);
+    if (save.running) {
+        pthread_mutex_unlock(&save.lock);
+        return "SERVER_ERROR a snapshot is already being written";
+    }
+
+    save.file = NULL;
+    path_size = strlen(settings.snapshot_dir) + 1 + strlen(name) + 1;
+    save.path = malloc(path_size);
+    save.temp_path = malloc(path_size + strlen(SNAPSHOT_TEMP_SUFFIX));
+    if (save.path == NULL || save.temp_path == NULL) {
+        error = "SERVER_ERROR out of memory";
+    } else {
+        sprintf(save.path, "%s/%s", settings.snapshot_dir, name);
+        sprintf(save.temp_path, "%s" SNAPSHOT_TEMP_SUFFIX, save.path);
+        if ((save.file = fopen(save.temp_path, "w")) == NULL) {
+            error = "SERVER_ERROR can't create the snapshot file";
+        } else if (fwrite(SNAPSHOT_MAGIC, strlen(SNAPSHOT_MAGIC), 1, save.file) != 1) {
+            error = "SERVER_ERROR can't write the snapshot file";
+        }
+    }
+
+    if (error == NULL) {
+        save.items = 0;
+        save.bytes = strlen(SNAPSHOT_MAGIC);
+        pthread_attr_init(&attr);
+        pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+        if (pthread_create(&thread, &attr, snapshot_thread, NULL) != 0) {
+            error = "SERVER_ERROR can't start the snapshot";
+        }
+        pthread_attr_destroy(&attr);
+    }
+
+    if (error != NULL) {
+        if (save.file != NULL) {
+            fclose(save.file);
+            unlink(save.temp_path);
+        }
+        free(save.path);
+        free(save.temp_path);
+    } else {
+        save.running = true;
+    }
+    pthread_mutex_unlock(&save.lock);
+    return error;
+}
+
+
+static void load_record(const snapshot_record_t* record, const char* key,
+                        const char* value, const time_t now) {
+    const struct in_addr no_addr = { INADDR_NONE };
+    char key_temp[KEY_MAX_LENGTH + 1];
+    item* it;
+
+    if (record->exptime != 0 && record->exptime <= now) {
+        __sync_fetch_and_add(&load.skipped, 1);
+        return;
+    }
+
+    memcpy(key_temp, key, record->nkey);
+    key_temp[record->nkey] = '\0';
+    it = item_alloc(key_temp, record->nkey, record->flags, realtime(record->exptime),
+                    record->nbytes, no_addr, NULL);
+    if (it == NULL) {
+        __sync_fetch_and_add(&load.failed, 1);
+        return;
+    }
+    item_memcpy_to(it, 0, value, record->nbytes, false);
+    if (store_item(it, NREAD_ADD, key_temp)) {
+        __sync_fetch_and_add(&load.items, 1);
+    } else {
+        __sync_fetch_and_add(&load.skipped, 1);
+    }
+    item_deref(it);
+}
+
+
+/* stores the items of the blocks that this thread claims, until there are
+ * none left. */
+static void load_blocks(void* arg) {
+    time_t now = time(0);
+    uint32_t ix;
+
+    while ((ix = __sync_fetch_and_add(&load.next_block, 1)) < load.block_count) {
+        snapshot_block_header_t header;
+        const char* ptr = load.base + load.blocks[ix];
+        const char* end;
+        uint32_t i;
+
+        memcpy(&header, ptr, sizeof(header));
+        ptr += sizeof(header);
+        end = ptr + header.nbytes;
+        for (i = 0; i < header.items && (size_t) (end - ptr) >= sizeof(snapshot_record_t); i++) {
+            snapshot_record_t record;
+
+            memcpy(&record, ptr, sizeof(record));
+            ptr += sizeof(record);
+            /* compared with the space left, so that a corrupt length can't
+             * carry the pointer past the mapping.  a uint8_t nkey can't
+             * exceed KEY_MAX_LENGTH. */
+            if (record.nkey == 0 ||
+                (size_t) record.nkey + record.nbytes > (size_t) (end - ptr)) {
+                break;
+            }
+            load_record(&record, ptr, ptr + record.nkey, now);
+            ptr += record.nkey + record.nbytes;
+        }
+    }
+
+    pthread_mutex_lock(&load.lock);
+    if (--load.loaders == 0) {
+        pthread_cond_signal(&load.done);
+    }
+    pthread_mutex_unlock(&load.lock);
+}
+
+
+bool snapshot_load(const char* path) {
+    struct timeval start, end;
+    struct stat st;
+    size_t offset, size, blocks_size = 0;
+    bool complete = false;
+    void* base;
+    int fd, tix;
+
+    if ((fd = open(path, O_RDONLY)) == -1 || fstat(fd, &st) != 0) {
+        perror(path);
+        return false;
+    }
+    size = st.st_size;
+    base = (size == 0) ? MAP_FAILED : mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED ||
+        size < strlen(SNAPSHOT_MAGIC) ||
+        memcmp(base, SNAPSHOT_MAGIC, strlen(SNAPSHOT_MAGIC)) != 0) {
+        fprintf(stderr, "%s isn't a snapshot\n", path);
+        if (base != MAP_FAILED) {
+            munmap(base, size);
+        }
+        return false;
+    }
+    load.base = base;
+
+    /* find the blocks, so that the loaders can share them out. */
+    for (offset = strlen(SNAPSHOT_MAGIC);
+         offset + sizeof(snapshot_block_header_t) <= size; ) {
+        snapshot_block_header_t header;
+
+        memcpy(&header, load.base + offset, sizeof(header));
+        if (header.nbytes == 0 && header.items == 0) {
+            complete = true;
+            break;
+        }
+        if (offset + sizeof(header) + header.nbytes > size) {
+            break;
+        }
+        if (load.block_count == blocks_size) {
+            size_t* blocks;
+
+            blocks_size = (blocks_size == 0) ? ITEM_LOCK_COUNT : blocks_size * 2;
+            if ((blocks = realloc(load.blocks, blocks_size * sizeof(size_t))) == NULL) {
+                break;
+            }
+            load.blocks = blocks;
+        }
+        load.blocks[load.block_count++] = offset;
+        offset += sizeof(header) + header.nbytes;
+    }
+    if (! complete) {
+        fprintf(stderr, "Snapshot %s is incomplete, loading what there is\n", path);
+    }
+
+    gettimeofday(&start, NULL);
+    load.loaders = settings.num_threads;
+    for (tix = 1; tix < settings.num_threads; tix++) {
+        dispatch_work(tix, load_blocks, NULL);
+    }
+    load_blocks(NULL);
+    pthread_mutex_lock(&load.lock);
+    while (load.loaders != 0) {
+        pthread_cond_wait(&load.done, &load.lock);
+    }
+    pthread_mutex_unlock(&load.lock);
+    gettimeofday(&end, NULL);
+
+    load.seconds = (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) / 1000000.0;
+    load.loaded = true;
+    munmap(base, size);
+    free(load.blocks);
+    load.blocks = NULL;
+
+    if (settings.verbose > 0) {
+        fprintf(stderr, "Loaded %llu items from %s in %.3f seconds\n",
+                (unsigned long long) load.items, path, load.seconds);
+    }
+    return true;
+}
+
+
+/* appends the snapshot counters to a "stats" response, once there is a
+ * snapshot to speak of. */
+size_t append_snapshot_stats(char* const buffer_start, const size_t buffer_size,
+                             const size_t buffer_off, const size_t reserved) {
+    size_t off = buffer_off;
+
+    if (load.loaded) {
+        off = append_to_buffer(buffer_start, buffer_size, off, reserved,
+                               "STAT snapshot_loaded_items %" PRINTF_INT64_MODIFIER "u\r\n"
+                               "STAT snapshot_load_skipped %" PRINTF_INT64_MODIFIER "u\r\n"
+                               "STAT snapshot_load_failed %" PRINTF_INT64_MODIFIER "u\r\n"
+                               "STAT snapshot_load_seconds %.3f\r\n"
+                               "STAT snapshot_load_rate %.0f\r\n",
+                               load.items, load.skipped, load.failed, load.seconds,
+                               (load.seconds > 0) ? load.items / load.seconds : 0.0);
+    }
+    if (save.running || save.snapshots != 0 || save.failures != 0) {
+        off = append_to_buffer(buffer_start, buffer_size, off, reserved,
+                               "STAT snapshot_in_progress %d\r\n"
+                               "STAT snapshots %" PRINTF_INT64_MODIFIER "u\r\n"
+                               "STAT snapshot_failures %" PRINTF_INT64_MODIFIER "u\r\n"
+                               "STAT snapshot_items %" PRINTF_INT64_MODIFIER "u\r\n"
+                               "STAT snapshot_bytes %" PRINTF_INT64_MODIFIER "u\r\n",
+                               save.running ? 1 : 0, save.snapshots, save.failures,
+                               save.items, save.bytes);
+    }
+    return off;
+}
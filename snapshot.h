@@ -0,0 +1,52 @@
+/* -*- Mode: C; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+
+/**
+ * Snapshots: "snapshot <name>" streams the live items to a file of that name,
+ * in the directory given with -O, from a background thread, one item lock's
+ * worth of hash buckets at a time, so the server keeps serving while it runs.
+ * clients only pick the name, never a path.  the file is written under a
+ * temporary name and only renamed into place once it is complete.  -F <path> loads a
+ * snapshot at startup, before any connection is accepted, with every worker
+ * thread storing items from its own blocks of the file.
+ *
+ * the file is a magic string followed by blocks, each holding the items of
+ * one item lock, and ends with an empty block.  expiration times are stored
+ * as unix times, so a snapshot can be loaded by another server.  numbers are
+ * in host byte order.
+ */
+
+#include "generic.h"
+
+#if !defined(_snapshot_h_)
+#define _snapshot_h_
+
+#include "memcached.h"
+
+#define SNAPSHOT_MAGIC "mcsnap01"
+
+typedef struct snapshot_block_header_s snapshot_block_header_t;
+struct snapshot_block_header_s {
+    uint32_t nbytes;                    /* bytes of records that follow. */
+    uint32_t items;
+};
+
+typedef struct snapshot_record_s snapshot_record_t;
+struct snapshot_record_s {
+    uint32_t flags;
+    uint32_t exptime;                   /* unix time, or 0 for never. */
+    uint32_t nbytes;                    /* bytes of value after the key. */
+    uint8_t nkey;
+} __attribute__((packed));
+
+/* starts writing a snapshot called name, in settings.snapshot_dir.  returns
+ * NULL if it has started, or the response to send if it hasn't. */
+extern const char* snapshot_start(const char* name);
+
+/* loads the snapshot at path into the cache, using the worker threads.
+ * returns false if the file can't be read. */
+extern bool snapshot_load(const char* path);
+
+extern size_t append_snapshot_stats(char* const buffer_start, const size_t buffer_size,
+                                    const size_t buffer_off, const size_t reserved);
+
+#endif /* #if !defined(_snapshot_h_) */
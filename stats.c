@@ -51,38 +51,60 @@ static int num_prefixes = 0;
 static int total_prefix_size = 0;
 static PREFIX_STATS wildcard;
 
-#if defined(STATS_BUCKETS)
-SIZE_BUCKETS set;
-SIZE_BUCKETS hit;
-SIZE_BUCKETS evict;
-SIZE_BUCKETS delete;
-SIZE_BUCKETS overwrite;
-SIZE_BUCKETS expires;
-#endif /* #if defined(STATS_BUCKETS) */
-
-#if defined(COST_BENEFIT_STATS)
-cost_benefit_buckets_t cb_buckets;
-#endif /* #if defined(COST_BENEFIT_STATS) */
+#if defined(STATS_BUCKETS) || defined(COST_BENEFIT_STATS)
+/* one for each thread's stats. */
+static size_histograms_t *histograms;
+static size_t histogram_count;
+#endif /* #if defined(STATS_BUCKETS) || defined(COST_BENEFIT_STATS) */
+
+/* one for each thread's stats, and their sum at the last "stats reset". */
+static latency_histograms_t *latencies;
+static size_t latency_count;
+static latency_histograms_t latency_baseline;
+
+static const char *latency_class_names[LATENCY_CLASSES] = {
+    "get",
+    "multiget",
+    "update",
+    "arith",
+    "delete",
+    "binary",
+};
 
 void stats_prefix_init() {
     memset(prefix_stats, 0, sizeof(prefix_stats));
     memset(&wildcard, 0, sizeof(PREFIX_STATS));
 }
 
-void stats_buckets_init(void) {
-#if defined(STATS_BUCKETS)
-    memset(&set, 0, sizeof(set));
-    memset(&hit, 0, sizeof(hit));
-    memset(&evict, 0, sizeof(evict));
-    memset(&delete, 0, sizeof(delete));
-    memset(&overwrite, 0, sizeof(overwrite));
-#endif /* #if defined(STATS_BUCKETS) */
+void stats_histograms_init(stats_t *stats, const size_t count) {
+#if defined(STATS_BUCKETS) || defined(COST_BENEFIT_STATS)
+    size_t ix;
+
+    histograms = calloc(count, sizeof(size_histograms_t));
+    if (histograms == NULL) {
+        perror("Can't allocate size histograms");
+        exit(1);
+    }
+    histogram_count = count;
+    for (ix = 0; ix < count; ix++) {
+        stats[ix].histograms = &histograms[ix];
+    }
+#endif /* #if defined(STATS_BUCKETS) || defined(COST_BENEFIT_STATS) */
 }
 
-void stats_cost_benefit_init(void) {
-#if defined(COST_BENEFIT_STATS)
-    memset(&cb_buckets, 0, sizeof(cb_buckets));
-#endif /* #if defined(COST_BENEFIT_STATS) */
+void stats_latency_init(stats_t *stats, const size_t count) {
+    size_t ix;
+
+    latencies = calloc(count, sizeof(latency_histograms_t));
+    if (latencies == NULL) {
+        perror("Can't allocate latency histograms");
+        exit(1);
+    }
+    latency_count = count;
+    for (ix = 0; ix < count; ix++) {
+        stats[ix].latency = &latencies[ix];
+    }
+    memset(&latency_baseline, 0, sizeof(latency_baseline));
 }
 
 /*
@@ -378,7 +400,6 @@ char *stats_prefix_dump(int *length) {
 char* item_stats_buckets(int *bytes) {
     size_t bufsize = (2 * 1024 * 1024), offset = 0;
     char *buf = (char *)malloc(bufsize); /* 2MB max response size */
-    int i, j;
     char terminator[] = "END\r\n";
 
     *bytes = 0;
@@ -387,38 +408,60 @@ char* item_stats_buckets(int *bytes) {
     }
 
 #if defined(STATS_BUCKETS)
-    GLOBAL_STATS_LOCK();
-    /* write the buffer */
-#define BUCKETS_RANGE(start, end, skip)                                 \
-    for (i = start, j = 0; i < end; i += skip, j ++) {                  \
-        if (set.size_ ## start ## _ ## end[j] != 0 ||                   \
-            hit.size_ ## start ## _ ## end[j] != 0 ||                   \
-            evict.size_ ## start ## _ ## end[j] != 0 ||                 \
-            delete.size_ ## start ## _ ## end[j] != 0 ||                \
-            overwrite.size_ ## start ## _ ## end[j] != 0) {             \
-            offset = append_to_buffer(buf, bufsize, offset,             \
-                                      sizeof(terminator),               \
-                                      "%8d-%-8d:%16" PRINTF_INT64_MODIFIER \
-                                      "u sets %16" PRINTF_INT64_MODIFIER \
-                                      "u hits %16" PRINTF_INT64_MODIFIER \
-                                      "u evicts %16" PRINTF_INT64_MODIFIER \
-                                      "u deletes %16" PRINTF_INT64_MODIFIER \
-                                      "u expires %16" PRINTF_INT64_MODIFIER \
-                                      "u overwrites\r\n",               \
-                                      i, i + skip - 1,                  \
-                                      set.size_ ## start ## _ ## end[j], \
-                                      hit.size_ ## start ## _ ## end[j], \
-                                      evict.size_ ## start ## _ ## end[j], \
-                                      delete.size_ ## start ## _ ## end[j], \
-                                      expires.size_ ## start ## _ ## end[j], \
-                                      overwrite.size_ ## start ## _ ## end[j]); \
-        }                                                               \
-}
-#include "buckets.h"
-    GLOBAL_STATS_UNLOCK();
-#else
-    (void) i;
-    (void) j;
+    {
+        size_histograms_t *sum = calloc(1, sizeof(size_histograms_t));
+        size_t th;
+        unsigned int ix;
+
+        if (sum == NULL) {
+            free(buf);
+            return NULL;
+        }
+
+        /* a thread may be counting while we read; each count is read whole, but
+         * they don't all come from the same moment. */
+        for (th = 0; th < histogram_count; th++) {
+            const volatile size_histograms_t *h = &histograms[th];
+
+            for (ix = 0; ix < SIZE_BUCKET_COUNT; ix++) {
+                sum->set[ix] += h->set[ix];
+                sum->hit[ix] += h->hit[ix];
+                sum->evict[ix] += h->evict[ix];
+                sum->delete[ix] += h->delete[ix];
+                sum->overwrite[ix] += h->overwrite[ix];
+                sum->expires[ix] += h->expires[ix];
+            }
+        }
+
+        /* write the buffer */
+        for (ix = 0; ix < SIZE_BUCKET_COUNT; ix++) {
+            if (sum->set[ix] != 0 ||
+                sum->hit[ix] != 0 ||
+                sum->evict[ix] != 0 ||
+                sum->delete[ix] != 0 ||
+                sum->expires[ix] != 0 ||
+                sum->overwrite[ix] != 0) {
+                offset = append_to_buffer(buf, bufsize, offset,
+                                          sizeof(terminator),
+                                          "%8d-%-8d:%16" PRINTF_INT64_MODIFIER
+                                          "u sets %16" PRINTF_INT64_MODIFIER
+                                          "u hits %16" PRINTF_INT64_MODIFIER
+                                          "u evicts %16" PRINTF_INT64_MODIFIER
+                                          "u deletes %16" PRINTF_INT64_MODIFIER
+                                          "u expires %16" PRINTF_INT64_MODIFIER
+                                          "u overwrites\r\n",
+                                          (int) size_bucket_start(ix),
+                                          (int) size_bucket_start(ix + 1) - 1,
+                                          sum->set[ix],
+                                          sum->hit[ix],
+                                          sum->evict[ix],
+                                          sum->delete[ix],
+                                          sum->expires[ix],
+                                          sum->overwrite[ix]);
+            }
+        }
+        free(sum);
+    }
 #endif /* #if defined(STATS_BUCKETS) */
 
     offset = append_to_buffer(buf, bufsize, offset, 0, terminator);
@@ -427,15 +470,121 @@ char* item_stats_buckets(int *bytes) {
 }
 
 
+#if defined(COST_BENEFIT_STATS)
+/* copies a thread's cost-benefit bucket, retrying until the copy isn't torn
+ * by an update. */
+static void cost_benefit_snapshot(cost_benefit_bucket_t *snapshot,
+                                  const size_histograms_t *h, const unsigned int ix) {
+    unsigned int seq;
+
+    do {
+        seq = *(volatile const unsigned int *) &h->cb_seq;
+        memory_barrier();
+        memcpy(snapshot, &h->cb[ix], sizeof(*snapshot));
+        memory_barrier();
+    } while ((seq & 1) || seq != *(volatile const unsigned int *) &h->cb_seq);
+}
+
+
+/* adds up bucket ix over every thread, bringing each thread's integral up to
+ * now. */
+static void cost_benefit_sum(const unsigned int ix, const rel_time_t now,
+                             uint64_t *hits, int64_t *slot_seconds) {
+    cost_benefit_bucket_t cb;
+    size_t th;
+
+    *hits = 0;
+    *slot_seconds = 0;
+    for (th = 0; th < histogram_count; th++) {
+        cost_benefit_snapshot(&cb, &histograms[th], ix);
+        *hits += cb.hits;
+        *slot_seconds += cb.slot_seconds + (int64_t) cb.slots * (now - cb.last_update);
+    }
+}
+
+
+/*
+ * the hit density of each bucket, for size-aware eviction.  each refresh takes
+ * the hits and slot-seconds since the last one, and moves the density
+ * 1/COST_BENEFIT_DECAY of the way towards their ratio.
+ */
+static struct {
+    double     density[SIZE_BUCKET_COUNT];
+    uint64_t   hits[SIZE_BUCKET_COUNT];             /* sums at the last refresh. */
+    int64_t    slot_seconds[SIZE_BUCKET_COUNT];
+    bool       refreshed;
+    rel_time_t last_refresh;
+    uint64_t   size_aware_evictions;
+} cb_live;
+
+
+static void cost_benefit_refresh(const rel_time_t now) {
+    unsigned int ix;
+
+    for (ix = 0; ix < SIZE_BUCKET_COUNT; ix++) {
+        uint64_t hits;
+        int64_t slot_seconds;
+
+        cost_benefit_sum(ix, now, &hits, &slot_seconds);
+        if (slot_seconds > cb_live.slot_seconds[ix]) {
+            double sample = (double) (hits - cb_live.hits[ix]) /
+                (slot_seconds - cb_live.slot_seconds[ix]);
+
+            if (cb_live.refreshed) {
+                cb_live.density[ix] += (sample - cb_live.density[ix]) / COST_BENEFIT_DECAY;
+            } else {
+                cb_live.density[ix] = sample;
+            }
+        }
+        cb_live.hits[ix] = hits;
+        cb_live.slot_seconds[ix] = slot_seconds;
+    }
+    cb_live.refreshed = true;
+    cb_live.last_refresh = now;
+}
+
+
+double cost_benefit_density(const size_t sz) {
+    rel_time_t now = current_time;
+    unsigned int ix = size_bucket(sz);
+
+    if (! cb_live.refreshed || cb_live.last_refresh != now) {
+        cost_benefit_refresh(now);
+    }
+    if (ix >= SIZE_BUCKET_COUNT) {
+        ix = SIZE_BUCKET_COUNT - 1;
+    }
+    return cb_live.density[ix];
+}
+
+
+void cost_benefit_count_eviction(void) {
+    cb_live.size_aware_evictions++;
+}
+#endif /* #if defined(COST_BENEFIT_STATS) */
+
+
+/* appends the state of size-aware eviction to a "stats" response. */
+size_t append_cost_benefit_stats(char* const buffer_start, const size_t buffer_size,
+                                 const size_t buffer_off, const size_t reserved) {
+    size_t off = buffer_off;
+
+#if defined(COST_BENEFIT_STATS)
+    if (settings.size_aware_eviction) {
+        off = append_to_buffer(buffer_start, buffer_size, off, reserved,
+                               "STAT size_aware_evictions %" PRINTF_INT64_MODIFIER "u\r\n",
+                               cb_live.size_aware_evictions);
+    }
+#endif /* #if defined(COST_BENEFIT_STATS) */
+    return off;
+}
+
+
 /** dumps out stats about cost-benefit on a per-bucket basis. */
 char* cost_benefit_stats(int *bytes) {
     size_t bufsize = (2 * 1024 * 1024), offset = 0;
     char *buf = (char *)malloc(bufsize); /* 2MB max response size */
-    int i, j;
     char terminator[] = "END\r\n";
-    rel_time_t now = current_time;
-    (void) now;                                   /* if we're not dumping any stats, we need to
-                                                   * consume the now variable. */
 
     *bytes = 0;
     if (buf == 0) {
@@ -443,36 +592,132 @@ char* cost_benefit_stats(int *bytes) {
     }
 
 #if defined(COST_BENEFIT_STATS)
+    {
+        rel_time_t now = current_time;
+        unsigned int ix;
+
+        for (ix = 0; ix < SIZE_BUCKET_COUNT; ix++) {
+            uint64_t hits;
+            int64_t slot_seconds;
+
+            cost_benefit_sum(ix, now, &hits, &slot_seconds);
+
+            if (slot_seconds != 0 || hits != 0) {
+                offset = append_to_buffer(buf, bufsize, offset,
+                                          sizeof(terminator),
+                                          "%8d-%-8d:"
+                                          " cost: %16" PRINTF_INT64_MODIFIER "u"
+                                          " hits: %16" PRINTF_INT64_MODIFIER "u"
+                                          "\r\n",
+                                          (int) size_bucket_start(ix),
+                                          (int) size_bucket_start(ix + 1) - 1,
+                                          (uint64_t) slot_seconds, hits);
+            }
+        }
+    }
+#endif /* #if defined(COST_BENEFIT_STATS) */
+
+    offset = append_to_buffer(buf, bufsize, offset, 0, terminator);
+    *bytes = offset;
+    return buf;
+}
+
+
+/*
+ * adds up every thread's latency histograms.  a thread may be counting while we
+ * read; each count is read whole, but they don't all come from the same moment.
+ */
+static void latency_sum(latency_histograms_t *sum) {
+    size_t th;
+    unsigned int cls, ix;
+
+    memset(sum, 0, sizeof(*sum));
+    for (th = 0; th < latency_count; th++) {
+        const volatile latency_histograms_t *latency = &latencies[th];
+
+        for (cls = 0; cls < LATENCY_CLASSES; cls++) {
+            for (ix = 0; ix < LATENCY_BUCKET_COUNT; ix++) {
+                sum->counts[cls][ix] += latency->counts[cls][ix];
+            }
+        }
+    }
+}
+
+/*
+ * threads can't clear each other's histograms, so a reset remembers what they
+ * added up to, and later dumps subtract it.
+ */
+void stats_latency_reset(void) {
+    latency_histograms_t *sum = malloc(sizeof(latency_histograms_t));
+
+    if (sum == NULL) {
+        return;
+    }
+    latency_sum(sum);
     GLOBAL_STATS_LOCK();
-    /* flush pending stats and write the buffer */
-#define BUCKETS_RANGE(start, end, skip)                                 \
-    for (i = start, j = 0;                                              \
-         i < end;                                                       \
-         i += skip, j ++) {                                             \
-        cb_buckets.slot_seconds_ ## start ## _ ## end [j] +=            \
-            (now - cb_buckets.last_update_ ## start ## _ ## end [j]) *  \
-            cb_buckets.slots_ ## start ## _ ## end [j];                 \
-        cb_buckets.last_update_ ## start ## _ ## end [j] = now;         \
-        if (cb_buckets.slot_seconds_ ## start ## _ ## end[j] != 0 ||    \
-            cb_buckets.hits_ ## start ## _ ## end[j] != 0) {            \
-            offset = append_to_buffer(buf, bufsize, offset,             \
-                                      sizeof(terminator),               \
-                                      "%8d-%-8d:"                       \
-                                      " cost: %16" PRINTF_INT64_MODIFIER "u" \
-                                      " hits: %16" PRINTF_INT64_MODIFIER "u" \
-                                      "\r\n",               \
-                                      i, i + skip - 1,                  \
-                                      cb_buckets.slot_seconds_ ## start ## _ ## end[j], \
-                                      cb_buckets.hits_ ## start ## _ ## end[j]); \
-        }                                                               \
-    }
-#include "buckets.h"
+    memcpy(&latency_baseline, sum, sizeof(latency_baseline));
     GLOBAL_STATS_UNLOCK();
-#else
-    (void) i;
-    (void) j;
-    (void) now;
-#endif /* #if defined(COST_BENEFIT_STATS) */
+    free(sum);
+}
+
+
+/** dumps out the number of commands of each class and their latency
+ * percentiles, in microseconds. */
+char* latency_stats(int *bytes) {
+    static const unsigned int permilles[] = { 500, 900, 990, 999 };
+    size_t bufsize = 4096, offset = 0;
+    char *buf = (char *)malloc(bufsize);
+    latency_histograms_t *sum = malloc(sizeof(latency_histograms_t));
+    char terminator[] = "END\r\n";
+    unsigned int cls, ix, p;
+
+    *bytes = 0;
+    if (buf == NULL || sum == NULL) {
+        free(buf);
+        free(sum);
+        return NULL;
+    }
+
+    latency_sum(sum);
+    GLOBAL_STATS_LOCK();
+    for (cls = 0; cls < LATENCY_CLASSES; cls++) {
+        for (ix = 0; ix < LATENCY_BUCKET_COUNT; ix++) {
+            sum->counts[cls][ix] -= latency_baseline.counts[cls][ix];
+        }
+    }
+    GLOBAL_STATS_UNLOCK();
+
+    for (cls = 0; cls < LATENCY_CLASSES; cls++) {
+        const uint64_t* counts = sum->counts[cls];
+        uint64_t total = 0, seen;
+
+        for (ix = 0; ix < LATENCY_BUCKET_COUNT; ix++) {
+            total += counts[ix];
+        }
+        offset = append_to_buffer(buf, bufsize, offset, sizeof(terminator),
+                                  "STAT %s_count %" PRINTF_INT64_MODIFIER "u\r\n",
+                                  latency_class_names[cls], total);
+
+        /* report the top of the bucket the percentile falls in. */
+        for (p = 0, ix = 0, seen = 0; p < sizeof(permilles) / sizeof(permilles[0]); p++) {
+            uint64_t rank = (total * permilles[p] + 999) / 1000;
+            uint64_t ns = 0;
+
+            if (total != 0) {
+                while (seen + counts[ix] < rank) {
+                    seen += counts[ix];
+                    ix++;
+                }
+                ns = log_linear_bucket_start(ix + 1, LATENCY_LINEAR_BITS, LATENCY_SUB_BITS);
+            }
+            offset = append_to_buffer(buf, bufsize, offset, sizeof(terminator),
+                                      "STAT %s_p%u %.3f\r\n",
+                                      latency_class_names[cls],
+                                      permilles[p] / (permilles[p] % 10 ? 1 : 10),
+                                      ns / 1000.0);
+        }
+    }
+    free(sum);
 
     offset = append_to_buffer(buf, bufsize, offset, 0, terminator);
     *bytes = offset;
@@ -627,10 +872,6 @@ static void run_test(char *what, void (*func)(void)) {
     printf("\t%d / %d pass\n", (test_count - fail_count), test_count);
 }
 
-/* In case we're compiled in thread mode */
-void mt_stats_lock() { }
-void mt_stats_unlock() { }
-
 main(int argc, char **argv) {
     stats_prefix_init();
     settings.prefix_delimiter = ':';
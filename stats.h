@@ -4,6 +4,7 @@
 #define _stats_h
 
 #include <assert.h>
+#include <time.h>
 
 typedef enum prefix_stats_flags_e prefix_stats_flags_t;
 enum prefix_stats_flags_e {
@@ -23,267 +24,308 @@ extern void stats_prefix_record_removal(const char *key, const size_t nkey, cons
 /*@null@*/
 extern char *stats_prefix_dump(int *length);
 
-#if defined(STATS_BUCKETS)
-#define BUCKETS_RANGE(start, end, skip)  uint64_t   size_ ## start ## _ ## end [ ((end-start) / skip) ];
-typedef struct _size_buckets SIZE_BUCKETS;
-struct _size_buckets {
-#include "buckets.h"
-};
+/*
+ * log-linear buckets: one for each value below 2^linear_bits, then 2^sub_bits
+ * equal buckets for each power of two above that.  a value's bucket is
+ * computed from its highest set bit, rather than searched for.  linear_bits
+ * must be at least sub_bits.
+ */
+static inline unsigned int log_linear_bucket(const uint64_t value,
+                                             const unsigned int linear_bits,
+                                             const unsigned int sub_bits) {
+    unsigned int log;
+
+    if (value < ((uint64_t) 1 << linear_bits)) {
+        return value;
+    }
+    log = 63 - __builtin_clzll(value);
+    return (1 << linear_bits) + ((log - linear_bits) << sub_bits) +
+        ((value >> (log - sub_bits)) & ((1 << sub_bits) - 1));
+}
 
-extern SIZE_BUCKETS set;
-extern SIZE_BUCKETS hit;
-extern SIZE_BUCKETS evict;
-extern SIZE_BUCKETS delete;
-extern SIZE_BUCKETS overwrite;
-extern SIZE_BUCKETS expires;
-#endif /* #if defined(STATS_BUCKETS) */
+/* returns the smallest value in bucket ix. */
+static inline uint64_t log_linear_bucket_start(unsigned int ix,
+                                               const unsigned int linear_bits,
+                                               const unsigned int sub_bits) {
+    unsigned int log;
+
+    if (ix < (1 << linear_bits)) {
+        return ix;
+    }
+    ix -= 1 << linear_bits;
+    log = linear_bits + (ix >> sub_bits);
+    return ((uint64_t) 1 << log) +
+        ((uint64_t) (ix & ((1 << sub_bits) - 1)) << (log - sub_bits));
+}
+
+#if defined(STATS_BUCKETS) || defined(COST_BENEFIT_STATS)
+/*
+ * sizes are counted in the buckets buckets.h used to list: one for each size
+ * below 128, then ranges that each end at eight times their start, cut into
+ * buckets a sixteenth of the start wide (8 bytes from 128, 64 from 1KB, 512
+ * from 8KB), except that the last, of 4KB buckets, runs from 64KB all the way
+ * to SIZE_BUCKET_MAX.  a size's range is computed from its highest set bit,
+ * rather than searched for.
+ */
+#define SIZE_BUCKET_LINEAR_BITS (7)
+#define SIZE_BUCKET_LINEAR      (1 << SIZE_BUCKET_LINEAR_BITS)
+#define SIZE_BUCKET_RANGE_BITS  (3)
+#define SIZE_BUCKET_SUB_BITS    (4)
+#define SIZE_BUCKET_RANGES      (4)
+#define SIZE_BUCKET_PER_RANGE   (((1 << SIZE_BUCKET_RANGE_BITS) - 1) << SIZE_BUCKET_SUB_BITS)
+#define SIZE_BUCKET_MAX_BITS    (20)
+#define SIZE_BUCKET_MAX         (1 << SIZE_BUCKET_MAX_BITS)
+#define SIZE_BUCKET_LAST_START  (SIZE_BUCKET_LINEAR << ((SIZE_BUCKET_RANGES - 1) * SIZE_BUCKET_RANGE_BITS))
+#define SIZE_BUCKET_COUNT       (SIZE_BUCKET_LINEAR +                                   \
+                                 (SIZE_BUCKET_RANGES - 1) * SIZE_BUCKET_PER_RANGE +     \
+                                 ((SIZE_BUCKET_MAX - SIZE_BUCKET_LAST_START) /          \
+                                  (SIZE_BUCKET_LAST_START >> SIZE_BUCKET_SUB_BITS)))
+
+/* returns the bucket for sz, or SIZE_BUCKET_COUNT if it's too large. */
+static inline unsigned int size_bucket(size_t sz) {
+    unsigned int range, shift;
+
+    if (sz >= SIZE_BUCKET_MAX) {
+        return SIZE_BUCKET_COUNT;
+    }
+    if (sz < SIZE_BUCKET_LINEAR) {
+        return sz;
+    }
+    range = (63 - __builtin_clzll(sz) - SIZE_BUCKET_LINEAR_BITS) / SIZE_BUCKET_RANGE_BITS;
+    if (range > SIZE_BUCKET_RANGES - 1) {
+        range = SIZE_BUCKET_RANGES - 1;
+    }
+    shift = SIZE_BUCKET_LINEAR_BITS + range * SIZE_BUCKET_RANGE_BITS;
+    return SIZE_BUCKET_LINEAR + range * SIZE_BUCKET_PER_RANGE +
+        ((sz - ((size_t) 1 << shift)) >> (shift - SIZE_BUCKET_SUB_BITS));
+}
+
+/* returns the smallest size in bucket ix. */
+static inline size_t size_bucket_start(unsigned int ix) {
+    unsigned int range, shift;
+
+    if (ix < SIZE_BUCKET_LINEAR) {
+        return ix;
+    }
+    ix -= SIZE_BUCKET_LINEAR;
+    range = ix / SIZE_BUCKET_PER_RANGE;
+    if (range > SIZE_BUCKET_RANGES - 1) {
+        range = SIZE_BUCKET_RANGES - 1;
+    }
+    shift = SIZE_BUCKET_LINEAR_BITS + range * SIZE_BUCKET_RANGE_BITS;
+    return ((size_t) 1 << shift) +
+        ((size_t) (ix - range * SIZE_BUCKET_PER_RANGE) << (shift - SIZE_BUCKET_SUB_BITS));
+}
 
 #if defined(COST_BENEFIT_STATS)
-#define BUCKETS_RANGE(start, end, skip)                                 \
-    uint64_t   hits_ ## start ## _ ## end [ ((end-start) / skip) ];     \
-    uint64_t   slot_seconds_ ## start ## _ ## end [ ((end-start) / skip) ]; \
-    rel_time_t last_update_ ## start ## _ ## end [ ((end-start) / skip) ]; \
-    uint32_t   slots_ ## start ## _ ## end [ ((end-start) / skip) ];
-typedef struct cost_benefit_buckets_s cost_benefit_buckets_t;
-struct cost_benefit_buckets_s {
-#include "buckets.h"
+/*
+ * slot_seconds integrates slots over time, up to last_update.  items can be
+ * stored by one thread and removed by another, so a thread's slots can go
+ * negative; only the sum over all threads means anything.
+ */
+typedef struct cost_benefit_bucket_s cost_benefit_bucket_t;
+struct cost_benefit_bucket_s {
+    uint64_t   hits;
+    int64_t    slot_seconds;
+    rel_time_t last_update;
+    int32_t    slots;
 };
+#endif /* #if defined(COST_BENEFIT_STATS) */
 
-extern cost_benefit_buckets_t cb_buckets;
+/*
+ * each thread counts into its own histograms (see stats_t), without locking;
+ * item_stats_buckets and cost_benefit_stats add them up when they're asked.
+ */
+typedef struct size_histograms_s size_histograms_t;
+struct size_histograms_s {
+#if defined(STATS_BUCKETS)
+    uint64_t      set[SIZE_BUCKET_COUNT];
+    uint64_t      hit[SIZE_BUCKET_COUNT];
+    uint64_t      evict[SIZE_BUCKET_COUNT];
+    uint64_t      delete[SIZE_BUCKET_COUNT];
+    uint64_t      overwrite[SIZE_BUCKET_COUNT];
+    uint64_t      expires[SIZE_BUCKET_COUNT];
+#endif /* #if defined(STATS_BUCKETS) */
+#if defined(COST_BENEFIT_STATS)
+    /* odd while a cost-benefit bucket is being updated, so that readers can
+     * tell whether they saw its fields from the same moment. */
+    unsigned int  cb_seq;
+    cost_benefit_bucket_t cb[SIZE_BUCKET_COUNT];
 #endif /* #if defined(COST_BENEFIT_STATS) */
+};
+#endif /* #if defined(STATS_BUCKETS) || defined(COST_BENEFIT_STATS) */
 
 
 /* stats size buckets */
-extern void stats_buckets_init(void);
-extern void stats_cost_benefit_init(void);
+extern void stats_histograms_init(stats_t *stats, const size_t count);
+
+#if defined(COST_BENEFIT_STATS)
+/* moves delta items into bucket cb at time now. */
+static inline void cost_benefit_move(size_histograms_t *histograms,
+                                     cost_benefit_bucket_t *cb,
+                                     const int delta, const rel_time_t now) {
+    histograms->cb_seq++;
+    write_barrier();
+    cb->slot_seconds += (int64_t) cb->slots * (now - cb->last_update);
+    cb->slots += delta;
+    cb->last_update = now;
+    write_barrier();
+    histograms->cb_seq++;
+}
+#endif /* #if defined(COST_BENEFIT_STATS) */
 
 static inline void stats_set(size_t sz, size_t overwritten_sz) {
 #if defined(STATS_BUCKETS) || defined(COST_BENEFIT_STATS)
-    GLOBAL_STATS_LOCK();
+    size_histograms_t *histograms = STATS_GET_TLS()->histograms;
+    unsigned int ix = size_bucket(sz);
+    unsigned int overwritten_ix = size_bucket(overwritten_sz);
+
 #if defined(STATS_BUCKETS)
-    if (overwritten_sz != 0) {
-#define BUCKETS_RANGE(start, end, skip)                                 \
-        do {                                                            \
-            if (overwritten_sz >= start && overwritten_sz < end) {      \
-                overwrite.size_ ## start ## _ ## end[ (overwritten_sz - start) / skip ] ++; \
-                break;                                                  \
-            }                                                           \
-        } while (0);
-#include "buckets.h"
+    if (overwritten_sz != 0 && overwritten_ix < SIZE_BUCKET_COUNT) {
+        histograms->overwrite[overwritten_ix] ++;
+    }
+    if (ix < SIZE_BUCKET_COUNT) {
+        histograms->set[ix] ++;
     }
-#define BUCKETS_RANGE(start, end, skip)                                 \
-    do {                                                                \
-        if (sz >= start && sz < end) {                                  \
-            set.size_ ## start ## _ ## end[ (sz - start) / skip ] ++;   \
-            break;                                                      \
-        }                                                               \
-    } while (0);
-#include "buckets.h"
 #endif /* #if defined(STATS_BUCKETS) */
 
 #if defined(COST_BENEFIT_STATS)
-    {
-        uint64_t* from_slot_seconds_ptr = NULL, * to_slot_seconds_ptr = NULL;
-        rel_time_t* from_last_update_ptr = NULL, * to_last_update_ptr = NULL;
-        uint32_t* from_slots_ptr = NULL, * to_slots_ptr = NULL;
+    /* only need to do an update if the item has changed buckets. */
+    if (overwritten_sz == 0 || overwritten_ix != ix) {
         rel_time_t now = current_time;
 
-        if (overwritten_sz != 0) {
-#define BUCKETS_RANGE(start, end, skip)                                 \
-            do {                                                        \
-                if (overwritten_sz >= start && overwritten_sz < end) {  \
-                    unsigned slot = (overwritten_sz - start) / skip;    \
-                    from_slot_seconds_ptr = &cb_buckets.slot_seconds_ ## start ## _ ## end[slot]; \
-                    from_last_update_ptr = &cb_buckets.last_update_ ## start ## _ ## end[slot]; \
-                    from_slots_ptr = &cb_buckets.slots_ ## start ## _ ## end[slot]; \
-                    break;                                              \
-                }                                                       \
-            } while (0);
-#include "buckets.h"
+        if (overwritten_sz != 0 && overwritten_ix < SIZE_BUCKET_COUNT) {
+            cost_benefit_move(histograms, &histograms->cb[overwritten_ix], -1, now);
         }
-
-#define BUCKETS_RANGE(start, end, skip)                                 \
-        do {                                                            \
-            if (sz >= start && sz < end) {                              \
-                unsigned slot = (sz - start) / skip;                    \
-                to_slot_seconds_ptr = &cb_buckets.slot_seconds_ ## start ## _ ## end[slot]; \
-                to_last_update_ptr = &cb_buckets.last_update_ ## start ## _ ## end[slot]; \
-                to_slots_ptr = &cb_buckets.slots_ ## start ## _ ## end[slot]; \
-                break;                                                  \
-            }                                                           \
-        } while (0);
-#include "buckets.h"
-
-        assert( (from_slot_seconds_ptr == NULL && from_last_update_ptr == NULL && from_slots_ptr == NULL) ||
-                (from_slot_seconds_ptr != NULL && from_last_update_ptr != NULL && from_slots_ptr != NULL) );
-        assert(to_slot_seconds_ptr != NULL);
-        assert(to_last_update_ptr != NULL);
-        assert(to_slots_ptr != NULL);
-
-        if (from_slots_ptr != to_slots_ptr) {
-            /* only need to do an update if the item has changed slots. */
-            if (from_slots_ptr) {
-                /* we are doing an overwrite, so refresh the from slot. */
-                (*from_slot_seconds_ptr) += (*from_slots_ptr) * (now - *from_last_update_ptr);
-
-                assert((*from_slots_ptr) > 0);
-                (*from_slots_ptr) --;
-                (*from_last_update_ptr) = now;
-            }
-
-            /* the to_slot is always updated */
-            (*to_slot_seconds_ptr) += (*to_slots_ptr) * (now - *to_last_update_ptr);
-
-            (*to_slots_ptr) ++;
-            (*to_last_update_ptr) = now;
-
+        if (ix < SIZE_BUCKET_COUNT) {
+            cost_benefit_move(histograms, &histograms->cb[ix], 1, now);
         }
     }
 #endif /* #if defined(COST_BENEFIT_STATS) */
-    GLOBAL_STATS_UNLOCK();
 #endif /* #if defined(STATS_BUCKETS) || defined(COST_BENEFIT_STATS) */
 }
 
 static inline void stats_get(size_t sz) {
 #if defined(STATS_BUCKETS) || defined(COST_BENEFIT_STATS)
-    GLOBAL_STATS_LOCK();
+    size_histograms_t *histograms = STATS_GET_TLS()->histograms;
+    unsigned int ix = size_bucket(sz);
+
+    if (ix >= SIZE_BUCKET_COUNT) {
+        return;
+    }
 #if defined(STATS_BUCKETS)
-#define BUCKETS_RANGE(start, end, skip)                                 \
-    do {                                                                \
-        if (sz >= start && sz < end) {                                  \
-            hit.size_ ## start ## _ ## end[ (sz - start) / skip ] ++;   \
-            break;                                                      \
-        }                                                               \
-    } while (0);
-#include "buckets.h"
+    histograms->hit[ix] ++;
 #endif /* #if defined(STATS_BUCKETS) */
-
 #if defined(COST_BENEFIT_STATS)
-#define BUCKETS_RANGE(start, end, skip)                                 \
-    do {                                                                \
-        if (sz >= start && sz < end) {                                  \
-            cb_buckets.hits_ ## start ## _ ## end[ (sz - start) / skip ] ++;   \
-            break;                                                      \
-        }                                                               \
-    } while (0);
-#include "buckets.h"
+    histograms->cb[ix].hits ++;
 #endif /* #if defined(COST_BENEFIT_STATS) */
-    GLOBAL_STATS_UNLOCK();
 #endif /* #if defined(STATS_BUCKETS) || defined(COST_BENEFIT_STATS) */
 }
 
-static inline void stats_evict(size_t sz) {
 #if defined(STATS_BUCKETS) || defined(COST_BENEFIT_STATS)
-    GLOBAL_STATS_LOCK();
+/* counts an item of size sz leaving the cache, in the given histogram. */
+static inline void stats_removal(size_t sz, const size_t histogram_offset) {
+    size_histograms_t *histograms = STATS_GET_TLS()->histograms;
+    unsigned int ix = size_bucket(sz);
+
+    if (ix >= SIZE_BUCKET_COUNT) {
+        return;
+    }
 #if defined(STATS_BUCKETS)
-#define BUCKETS_RANGE(start, end, skip)                                 \
-    do {                                                                \
-        if (sz >= start && sz < end) {                                  \
-            evict.size_ ## start ## _ ## end[ (sz - start) / skip ] ++; \
-            break;                                                      \
-        }                                                               \
-    } while (0);
-#include "buckets.h"
+    ((uint64_t *) ((char *) histograms + histogram_offset))[ix] ++;
 #endif /* #if defined(STATS_BUCKETS) */
-
 #if defined(COST_BENEFIT_STATS)
-    {
-        rel_time_t now = current_time;
-
-#define BUCKETS_RANGE(start, end, skip)                                 \
-        do {                                                            \
-            if (sz >= start && sz < end) {                              \
-                unsigned slot = (sz - start) / skip;                    \
-                cb_buckets.slot_seconds_ ## start ## _ ## end[slot] +=  \
-                    (now - cb_buckets.last_update_ ## start ## _ ## end [slot]) * \
-                    cb_buckets.slots_ ## start ## _ ## end [slot];      \
-                assert(cb_buckets.slots_ ## start ## _ ## end [slot] > 0); \
-                cb_buckets.slots_ ## start ## _ ## end [slot] --;       \
-                break;                                                  \
-            }                                                           \
-        } while (0);
-#include "buckets.h"
-    }
+    cost_benefit_move(histograms, &histograms->cb[ix], -1, current_time);
 #endif /* #if defined(COST_BENEFIT_STATS) */
-    GLOBAL_STATS_UNLOCK();
-#endif /* #if defined(STATS_BUCKETS) || defined(COST_BENEFIT_STATS) */
 }
+#endif /* #if defined(STATS_BUCKETS) || defined(COST_BENEFIT_STATS) */
 
-static inline void stats_delete(size_t sz) {
-#if defined(STATS_BUCKETS) || defined(COST_BENEFIT_STATS)
-    GLOBAL_STATS_LOCK();
 #if defined(STATS_BUCKETS)
-#define BUCKETS_RANGE(start, end, skip)                                 \
-    do {                                                                \
-        if (sz >= start && sz < end) {                                  \
-            delete.size_ ## start ## _ ## end[ (sz - start) / skip ] ++; \
-            break;                                                      \
-        }                                                               \
-    } while (0);
-#include "buckets.h"
-#endif /* #if defined(STATS_BUCKETS) */
+#define STATS_REMOVAL(sz, histogram)  stats_removal((sz), offsetof(size_histograms_t, histogram))
+#elif defined(COST_BENEFIT_STATS)
+#define STATS_REMOVAL(sz, histogram)  stats_removal((sz), 0)
+#else
+#define STATS_REMOVAL(sz, histogram)
+#endif
 
-#if defined(COST_BENEFIT_STATS)
-    {
-        rel_time_t now = current_time;
+static inline void stats_evict(size_t sz) {
+    STATS_REMOVAL(sz, evict);
+}
 
-#define BUCKETS_RANGE(start, end, skip)                                 \
-        do {                                                            \
-            if (sz >= start && sz < end) {                              \
-                unsigned slot = (sz - start) / skip;                    \
-                cb_buckets.slot_seconds_ ## start ## _ ## end[slot] +=  \
-                    (now - cb_buckets.last_update_ ## start ## _ ## end [slot]) * \
-                    cb_buckets.slots_ ## start ## _ ## end [slot];      \
-                assert(cb_buckets.slots_ ## start ## _ ## end [slot] > 0); \
-                cb_buckets.slots_ ## start ## _ ## end [slot] --;       \
-                break;                                                  \
-            }                                                           \
-        } while (0);
-#include "buckets.h"
-    }
-#endif /* #if defined(COST_BENEFIT_STATS) */
-    GLOBAL_STATS_UNLOCK();
-#endif /* #if defined(STATS_BUCKETS) || defined(COST_BENEFIT_STATS) */
+static inline void stats_delete(size_t sz) {
+    STATS_REMOVAL(sz, delete);
 }
 
 static inline void stats_expire(size_t sz) {
-#if defined(STATS_BUCKETS) || defined(COST_BENEFIT_STATS)
-    GLOBAL_STATS_LOCK();
-#if defined(STATS_BUCKETS)
-#define BUCKETS_RANGE(start, end, skip)                                 \
-    do {                                                                \
-        if (sz >= start && sz < end) {                                  \
-            expires.size_ ## start ## _ ## end[ (sz - start) / skip ] ++; \
-            break;                                                      \
-        }                                                               \
-    } while (0);
-#include "buckets.h"
-#endif /* #if defined(STATS_BUCKETS) */
+    STATS_REMOVAL(sz, expires);
+}
 
-#if defined(COST_BENEFIT_STATS)
-    { 
-        rel_time_t now = current_time;
+#undef STATS_REMOVAL
+
+/*
+ * command latencies, in nanoseconds, are counted in log-linear buckets up to
+ * LATENCY_BUCKET_MAX; anything slower lands in the last bucket.  with 16
+ * buckets per power of two, a reported percentile is within 1/16th of the
+ * real one.
+ */
+#define LATENCY_LINEAR_BITS     (4)
+#define LATENCY_SUB_BITS        (4)
+#define LATENCY_MAX_BITS        (36)    /* about 69 seconds */
+#define LATENCY_BUCKET_COUNT    ((1 << LATENCY_LINEAR_BITS) +           \
+                                 ((LATENCY_MAX_BITS - LATENCY_LINEAR_BITS) << LATENCY_SUB_BITS))
+
+typedef struct latency_histograms_s latency_histograms_t;
+struct latency_histograms_s {
+    uint64_t counts[LATENCY_CLASSES][LATENCY_BUCKET_COUNT];
+};
+
+extern void stats_latency_init(stats_t *stats, const size_t count);
+extern void stats_latency_reset(void);
+
+/* returns a timestamp for measuring latencies, in nanoseconds. */
+static inline uint64_t latency_now(void) {
+    struct timespec ts;
 
-#define BUCKETS_RANGE(start, end, skip)                                 \
-        do {                                                            \
-            if (sz >= start && sz < end) {                              \
-                unsigned slot = (sz - start) / skip;                    \
-                cb_buckets.slot_seconds_ ## start ## _ ## end[slot] +=  \
-                    (now - cb_buckets.last_update_ ## start ## _ ## end [slot]) * \
-                    cb_buckets.slots_ ## start ## _ ## end [slot];      \
-                assert(cb_buckets.slots_ ## start ## _ ## end [slot] > 0); \
-                cb_buckets.slots_ ## start ## _ ## end [slot] --;       \
-                break;                                                  \
-            }                                                           \
-        } while (0);
-#include "buckets.h"
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* counts a command of class cls that took ns nanoseconds.  each thread counts
+ * into its own histograms, so this doesn't lock. */
+static inline void stats_latency_record(const latency_class_t cls, const uint64_t ns) {
+    latency_histograms_t *latency = STATS_GET_TLS()->latency;
+    unsigned int ix = log_linear_bucket(ns, LATENCY_LINEAR_BITS, LATENCY_SUB_BITS);
+
+    assert(cls < LATENCY_CLASSES);
+    if (ix >= LATENCY_BUCKET_COUNT) {
+        ix = LATENCY_BUCKET_COUNT - 1;
     }
-#endif /* #if defined(COST_BENEFIT_STATS) */
-    GLOBAL_STATS_UNLOCK();
-#endif /* #if defined(STATS_BUCKETS) || defined(COST_BENEFIT_STATS) */
+    latency->counts[cls][ix] ++;
 }
 
+#if defined(COST_BENEFIT_STATS)
+/* how far each refresh of the hit densities moves them towards the latest
+ * second's. */
+#define COST_BENEFIT_DECAY 8
+
+/* the recent hit density of items of size sz, in hits per item-second.  the
+ * densities are refreshed from the cost-benefit buckets at most once a second,
+ * by whichever caller comes first.  the caller must hold the cache lock. */
+extern double cost_benefit_density(const size_t sz);
+
+/* counts an eviction that size-aware eviction chose over the least recently
+ * used candidate.  the caller must hold the cache lock. */
+extern void cost_benefit_count_eviction(void);
+#else
+static inline double cost_benefit_density(const size_t sz) { return 0; }
+static inline void cost_benefit_count_eviction(void) { }
+#endif /* #if defined(COST_BENEFIT_STATS) */
+
+extern size_t append_cost_benefit_stats(char* const buffer_start, const size_t buffer_size,
+                                        const size_t buffer_off, const size_t reserved);
+
 extern char* item_stats_buckets(int *bytes);
 extern char* cost_benefit_stats(int *bytes);
+extern char* latency_stats(int *bytes);
 
 #endif /* #if !defined(_stats_h_) */
@@ -0,0 +1,370 @@
+/* -*- Mode: C; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+#include "generic.h"
+
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "memcached.h"
+#include "storage_engine.h"
+
+#if defined(USE_FLAT_ALLOCATOR)
+/* flat_storage.c has the items.h functions itself, so there's no table. */
+const storage_engine_t flat_engine = {
+    .name = "flat",
+};
+#endif /* #if defined(USE_FLAT_ALLOCATOR) */
+
+static const storage_engine_t* const engines[] = {
+#if defined(USE_SLAB_ALLOCATOR)
+    &slab_engine,
+#endif /* #if defined(USE_SLAB_ALLOCATOR) */
+#if defined(USE_LOG_ALLOCATOR)
+    &log_engine,
+#endif /* #if defined(USE_LOG_ALLOCATOR) */
+#if defined(USE_FLAT_ALLOCATOR)
+    &flat_engine,
+#endif /* #if defined(USE_FLAT_ALLOCATOR) */
+    NULL
+};
+
+#if defined(USE_SLAB_ALLOCATOR)
+const storage_engine_t* storage_engine = &slab_engine;
+#endif /* #if defined(USE_SLAB_ALLOCATOR) */
+#if defined(USE_FLAT_ALLOCATOR)
+const storage_engine_t* storage_engine = &flat_engine;
+#endif /* #if defined(USE_FLAT_ALLOCATOR) */
+
+
+bool storage_engine_select(const char* name) {
+    const storage_engine_t* const* engine;
+
+    for (engine = engines; *engine != NULL; engine++) {
+        if (strcmp((*engine)->name, name) == 0) {
+            storage_engine = *engine;
+            return true;
+        }
+    }
+    return false;
+}
+
+
+void storage_engine_names(char* buffer, const size_t size) {
+    const storage_engine_t* const* engine;
+    size_t offset = 0;
+
+    buffer[0] = '\0';
+    for (engine = engines; *engine != NULL && offset < size; engine++) {
+        offset += snprintf(buffer + offset, size - offset, "%s%s",
+                           (engine == engines) ? "" : " ", (*engine)->name);
+    }
+}
+
+
+#if defined(USE_SLAB_ALLOCATOR)
+/* the items.h functions that depend on the engine. */
+
+void do_try_item_stamp(item* it, const rel_time_t now, const struct in_addr addr) {
+    storage_engine->try_stamp(it, now, addr);
+}
+
+/*@null@*/
+item *do_item_alloc(const char *key, const size_t nkey, const int flags, const rel_time_t exptime,
+                    const size_t nbytes, const struct in_addr addr, bool* rejected) {
+    return storage_engine->alloc(key, nkey, flags, exptime, nbytes, addr, rejected);
+}
+
+bool item_size_ok(const size_t nkey, const int flags, const int nbytes) {
+    return storage_engine->size_ok(nkey, flags, nbytes);
+}
+
+bool item_need_realloc(const item* it,
+                       const size_t new_nkey, const int new_flags, const size_t new_nbytes) {
+    return storage_engine->need_realloc(it, new_nkey, new_flags, new_nbytes);
+}
+
+int do_item_link(item *it, const char* key) {
+    return storage_engine->link(it, key);
+}
+
+void do_item_unlink(item *it, long flags, const char* key) {
+    storage_engine->unlink(it, flags, true);
+}
+
+void do_item_unlink_impl(item *it, long flags, bool to_freelist) {
+    storage_engine->unlink(it, flags, to_freelist);
+}
+
+void do_item_deref(item *it) {
+    storage_engine->deref(it);
+}
+
+void do_item_update(item *it) {
+    storage_engine->update(it);
+}
+
+int do_item_replace(item *it, item *new_it, const char* key) {
+    assert((it->it_flags & ITEM_SLABBED) == 0);
+
+    do_item_unlink(it, UNLINK_NORMAL, key);
+    return do_item_link(new_it, key);
+}
+
+void item_mark_visited(item* it) {
+    storage_engine->mark_visited(it);
+}
+
+/*@null@*/
+char *do_item_cachedump(const unsigned int id, const unsigned int limit, unsigned int *bytes) {
+    return storage_engine->cachedump(id, limit, bytes);
+}
+
+/*@null@*/
+char *do_item_stats(int *bytes) {
+    return storage_engine->stats(bytes);
+}
+
+/*@null@*/
+char *do_item_stats_sizes(int *bytes) {
+    return storage_engine->stats_sizes(bytes);
+}
+
+void do_item_flush_expired(void) {
+    storage_engine->flush_expired();
+}
+#endif /* #if defined(USE_SLAB_ALLOCATOR) */
+
+
+/*
+ * the benchmark's workload: a get for a key, then a set for it if it missed,
+ * as a cache in front of a database would see, with a plain set for every
+ * (100 - BENCH_GET_PCT)th request.  keys are picked by a zipfian distribution
+ * (the kth most popular is asked for 1/k as often as the first), and each key
+ * has a value size of its own, most of them small and a few large.  the
+ * random numbers are seeded the same way for every engine, so each replays
+ * exactly the same requests.  the clock doesn't run while the benchmark does,
+ * so it's moved on a second for every BENCH_OPS_PER_SEC requests instead, for
+ * the engines' timing to see the same workload however fast they replay it.
+ */
+#define BENCH_GET_PCT       90
+#define BENCH_OPS_PER_SEC   100000
+#define BENCH_KEYS_PER_OP   8           /* one key for every this many requests */
+#define BENCH_KEYS_MIN      1000
+#define BENCH_VALUE_MAX     (64 * 1024)
+#define BENCH_SEED          0x9e3779b97f4a7c15ULL
+
+static uint64_t bench_state;
+
+static inline uint64_t bench_random(void) {
+    /* xorshift64* */
+    bench_state ^= bench_state >> 12;
+    bench_state ^= bench_state << 25;
+    bench_state ^= bench_state >> 27;
+    return bench_state * 0x2545f4914f6cdd1dULL;
+}
+
+/* the value size of key ix: 70% of the keys have 16 to 511 bytes, 25% up to
+ * 4KB, and 5% up to BENCH_VALUE_MAX. */
+static size_t bench_value_size(const unsigned int ix) {
+    uint32_t h = ix * 2654435761U;
+
+    if (h % 100 < 70) {
+        return 16 + (h / 100) % 496;
+    } else if (h % 100 < 95) {
+        return 512 + (h / 100) % (4096 - 512);
+    }
+    return 4096 + (h / 100) % (BENCH_VALUE_MAX - 4096);
+}
+
+/* picks a key by binary search of the zipfian cumulative distribution. */
+static unsigned int bench_key(const double* cdf, const unsigned int nkeys) {
+    double u = (double) (bench_random() >> 11) / (double) (1ULL << 53);
+    unsigned int low = 0, high = nkeys - 1;
+
+    while (low < high) {
+        unsigned int mid = low + (high - low) / 2;
+
+        if (cdf[mid] < u) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    return low;
+}
+
+static double bench_now(void) {
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+
+#if defined(USE_SLAB_ALLOCATOR)
+/*
+ * what calling through an engine's table costs: BENCH_DISPATCH_CALLS calls of
+ * a function that does next to nothing, made directly and then through a
+ * table that, like storage_engine, is loaded for every call.
+ */
+#define BENCH_DISPATCH_CALLS 50000000
+
+static volatile uint64_t bench_dispatch_count;
+
+static void __attribute__((noinline)) bench_dispatch_probe(item* it) {
+    bench_dispatch_count++;
+}
+
+static const storage_engine_t bench_dispatch_engine = {
+    .name = "probe",
+    .update = bench_dispatch_probe,
+};
+static const storage_engine_t* volatile bench_dispatch_table = &bench_dispatch_engine;
+
+static void bench_dispatch(void) {
+    double start, direct, table;
+    unsigned int ix;
+
+    start = bench_now();
+    for (ix = 0; ix < BENCH_DISPATCH_CALLS; ix++) {
+        bench_dispatch_probe(NULL);
+    }
+    direct = bench_now() - start;
+
+    start = bench_now();
+    for (ix = 0; ix < BENCH_DISPATCH_CALLS; ix++) {
+        bench_dispatch_table->update(NULL);
+    }
+    table = bench_now() - start;
+
+    printf("dispatch: %.2f ns a call through an engine table, %.2f ns a direct call\n",
+           table * 1e9 / BENCH_DISPATCH_CALLS, direct * 1e9 / BENCH_DISPATCH_CALLS);
+}
+#endif /* #if defined(USE_SLAB_ALLOCATOR) */
+
+
+void storage_engine_bench_fork(void) {
+    const storage_engine_t* const* engine;
+    int status, failed = 0;
+
+    printf("%-8s %10s %10s %12s %12s\n",
+           "engine", "hit ratio", "efficiency", "ops/sec", "evictions");
+    fflush(stdout);
+    for (engine = engines; *engine != NULL; engine++) {
+        pid_t pid = fork();
+
+        if (pid == -1) {
+            perror("fork");
+            exit(EXIT_FAILURE);
+        }
+        if (pid == 0) {
+            storage_engine = *engine;
+            return;
+        }
+        if (waitpid(pid, &status, 0) == -1 ||
+            ! WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+            fprintf(stderr, "the %s engine's benchmark failed\n", (*engine)->name);
+            failed = 1;
+        }
+    }
+#if defined(USE_SLAB_ALLOCATOR)
+    bench_dispatch();
+#endif /* #if defined(USE_SLAB_ALLOCATOR) */
+    exit(failed ? EXIT_FAILURE : EXIT_SUCCESS);
+}
+
+
+/*
+ * replays the workload against the engine that was picked.  the hit ratio is
+ * over every get; the efficiency is the size of the items that are stored at
+ * the end, as a percentage of the memory the engine has allocated for items
+ * (which the slab allocator may take beyond the limit, a page for each
+ * class).
+ */
+int storage_engine_bench(void) {
+    unsigned int nkeys = settings.bench_ops / BENCH_KEYS_PER_OP;
+    uint64_t op, gets = 0, hits = 0;
+    struct in_addr no_addr;
+    double* cdf;
+    double sum = 0.0, start, elapsed;
+    char* value;
+    stats_t stats;
+    unsigned int ix;
+
+    if (nkeys < BENCH_KEYS_MIN) {
+        nkeys = BENCH_KEYS_MIN;
+    }
+    cdf = malloc(nkeys * sizeof(double));
+    value = malloc(BENCH_VALUE_MAX + 2);
+    if (cdf == NULL || value == NULL) {
+        fprintf(stderr, "failed to allocate the benchmark's workload\n");
+        return EXIT_FAILURE;
+    }
+    for (ix = 0; ix < nkeys; ix++) {
+        sum += 1.0 / (ix + 1);
+        cdf[ix] = sum;
+    }
+    for (ix = 0; ix < nkeys; ix++) {
+        cdf[ix] /= sum;
+    }
+    memset(value, 'v', BENCH_VALUE_MAX + 2);
+    memset(&no_addr, 0, sizeof(no_addr));
+    bench_state = BENCH_SEED;
+
+    start = bench_now();
+    for (op = 0; op < settings.bench_ops; op++) {
+        char key[KEY_MAX_LENGTH + 1];
+        size_t nkey, nbytes;
+        item* it;
+
+        if (op % BENCH_OPS_PER_SEC == 0) {
+            current_time++;
+        }
+        ix = bench_key(cdf, nkeys);
+        nkey = snprintf(key, sizeof(key), "bench:%u", ix);
+        if (bench_random() % 100 < BENCH_GET_PCT) {
+            gets++;
+            if ((it = item_get(key, nkey)) != NULL) {
+                hits++;
+                item_update(it);
+#if defined(USE_SLAB_ALLOCATOR)
+                item_mark_visited(it);
+#endif /* #if defined(USE_SLAB_ALLOCATOR) */
+                item_deref(it);
+                continue;
+            }
+        }
+
+        nbytes = bench_value_size(ix) + 2;
+        it = item_alloc(key, nkey, 0, 0, nbytes, no_addr, NULL);
+        if (it == NULL) {
+            continue;
+        }
+        memcpy(value + nbytes - 2, "\r\n", 2);
+        item_memcpy_to(it, 0, value, nbytes, false);
+        memset(value + nbytes - 2, 'v', 2);
+        store_item(it, NREAD_SET, key);
+        item_deref(it);
+    }
+    elapsed = bench_now() - start;
+
+    STATS_AGGREGATE(&stats);
+    printf("%-8s %9.1f%% %9.1f%% %12.0f %12" PRINTF_INT64_MODIFIER "u\n",
+           storage_engine->name,
+           (gets == 0) ? 0.0 : (double) hits * 100 / gets,
+           (stats.item_storage_allocated == 0) ? 0.0 :
+           (double) stats.item_total_size * 100 / stats.item_storage_allocated,
+           (elapsed > 0) ? settings.bench_ops / elapsed : 0.0,
+           stats.evictions);
+    fflush(stdout);
+
+    free(cdf);
+    free(value);
+    return EXIT_SUCCESS;
+}
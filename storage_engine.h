@@ -0,0 +1,91 @@
+/* -*- Mode: C; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+
+/**
+ * Storage engines: the slab allocator and the log allocator (see
+ * log_storage.h) keep items in the same layout, so a build with both
+ * (--enable-log-allocator) picks one of them at startup, with -S.  the
+ * functions in items.h that allocate, link, free, bump and walk items call
+ * through the table of the engine that was picked; lookups, and copying into
+ * and out of items, only depend on the layout, and are shared (see
+ * slabs_items.c).  every engine is reached through its table, even in a build
+ * with just the one.
+ *
+ * the flat allocator lays its items out differently, and everything that
+ * touches an item (the protocol code, assoc.c, the binary protocol) is
+ * compiled for one layout or the other, so it is still chosen when memcached
+ * is configured.  a flat build has the one engine, "flat", with no table:
+ * flat_storage.c has the functions in items.h itself.
+ *
+ * -K <ops> benchmarks the engines: every engine in the build replays the same
+ * workload, in a process of its own, and reports on it.  the workload is
+ * seeded, so flat is compared with the others by running -K in each build.
+ * builds with tables also report what a call through one costs against a
+ * direct call.
+ */
+
+#include "generic.h"
+
+#if !defined(_storage_engine_h_)
+#define _storage_engine_h_
+
+#include "memcached.h"
+
+typedef struct storage_engine_s storage_engine_t;
+struct storage_engine_s {
+    const char* name;
+
+    /* sets up the engine's memory, before the threads are started. */
+    void  (*init)(const size_t maxbytes);
+    /* starts anything that runs in the background, once they are.  may be
+     * NULL. */
+    void  (*start)(void);
+
+    /* the engine's own versions of the functions in items.h. */
+    void  (*try_stamp)(item* it, const rel_time_t now, const struct in_addr addr);
+    item* (*alloc)(const char* key, const size_t nkey, const int flags,
+                   const rel_time_t exptime, const size_t nbytes,
+                   const struct in_addr addr, bool* rejected);
+    bool  (*size_ok)(const size_t nkey, const int flags, const int nbytes);
+    bool  (*need_realloc)(const item* it, const size_t new_nkey,
+                          const int new_flags, const size_t new_nbytes);
+    int   (*link)(item* it, const char* key);
+    void  (*unlink)(item* it, long flags, bool to_freelist);
+    void  (*deref)(item* it);
+    void  (*update)(item* it);
+    void  (*mark_visited)(item* it);
+    char* (*cachedump)(const unsigned int id, const unsigned int limit,
+                       unsigned int* bytes);
+    char* (*stats)(int* bytes);
+    char* (*stats_sizes)(int* bytes);
+    void  (*flush_expired)(void);
+};
+
+#if defined(USE_SLAB_ALLOCATOR)
+extern const storage_engine_t slab_engine;
+#endif /* #if defined(USE_SLAB_ALLOCATOR) */
+#if defined(USE_LOG_ALLOCATOR)
+extern const storage_engine_t log_engine;
+#endif /* #if defined(USE_LOG_ALLOCATOR) */
+#if defined(USE_FLAT_ALLOCATOR)
+extern const storage_engine_t flat_engine;
+#endif /* #if defined(USE_FLAT_ALLOCATOR) */
+
+/* the engine picked at startup; the slab allocator (or flat, in a flat build)
+ * unless -S says otherwise. */
+extern const storage_engine_t* storage_engine;
+
+/* picks the engine called name.  returns false if there's no such engine. */
+extern bool storage_engine_select(const char* name);
+
+/* writes the names of the engines in the build, separated by spaces. */
+extern void storage_engine_names(char* buffer, const size_t size);
+
+/* -K: the parent process runs every engine's benchmark in a child of its
+ * own, reports, and exits; storage_engine_bench_fork() only returns in the
+ * children, with the engine picked.  once a child has started up, it calls
+ * storage_engine_bench(), which replays settings.bench_ops requests and
+ * returns the exit status. */
+extern void storage_engine_bench_fork(void);
+extern int storage_engine_bench(void);
+
+#endif /* #if !defined(_storage_engine_h_) */
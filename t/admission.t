@@ -0,0 +1,49 @@
+#!/usr/bin/perl
+
+use strict;
+use Test::More tests => 5;
+use FindBin qw($Bin);
+use lib "$Bin/lib";
+use MemcachedTest;
+
+my $server = new_memcached("-m 2 -W");
+my $sock = $server->sock;
+my $filler = "x" x 1024;
+
+# a small working set that is read often, then a stream of keys that are only
+# ever stored.
+my $hot = 20;
+for my $i (1..$hot) {
+    print $sock "set hot$i 0 0 " . length($filler) . "\r\n$filler\r\n";
+    scalar <$sock>;
+}
+for my $round (1..4) {
+    for my $i (1..$hot) {
+        print $sock "get hot$i\r\n";
+        scalar <$sock> for 1..3;
+    }
+}
+
+my ($stored, $not_stored) = (0, 0);
+for my $i (1..4000) {
+    print $sock "set cold$i 0 0 " . length($filler) . "\r\n$filler\r\n";
+    my $res = scalar <$sock>;
+    $stored++ if $res eq "STORED\r\n";
+    $not_stored++ if $res eq "NOT_STORED\r\n";
+}
+is($stored + $not_stored, 4000, "every store was either stored or turned away");
+ok($stored > 0, "cold keys stored while they only displace each other");
+ok($not_stored > 0, "cold keys turned away rather than evict the working set");
+
+my $survivors = 0;
+for my $i (1..$hot) {
+    print $sock "get hot$i\r\n";
+    next if scalar(<$sock>) eq "END\r\n";
+    $survivors++;
+    scalar <$sock> for 1..2;
+}
+is($survivors, $hot, "working set survived");
+
+my $stats = mem_stats($sock);
+is($stats->{admission_rejects}, $not_stored, "rejections counted");
+
@@ -0,0 +1,28 @@
+#!/usr/bin/perl
+
+use strict;
+use Test::More tests => 5;
+use FindBin qw($Bin);
+use lib "$Bin/lib";
+use MemcachedTest;
+
+# -a pins the workers round-robin over a cpu list; cpu 0 always exists, so
+# four workers share it here.
+my $server = new_memcached("-a 0 -t 4");
+my @socks = map { $server->new_sock } 1..8;
+is(scalar(grep { defined } @socks), 8, "made 8 connections");
+
+my $ok = 1;
+foreach my $i (0..$#socks) {
+    my $sock = $socks[$i];
+    print $sock "set key$i 0 0 " . length("val$i") . "\r\nval$i\r\n";
+    $ok = 0 unless scalar(<$sock>) eq "STORED\r\n";
+}
+ok($ok, "every pinned worker stores");
+mem_get_is($socks[0], "key7", "val7");
+
+# malformed lists and cpus that don't exist are refused at startup.
+my $exe = "$Bin/../memcached-debug";
+foreach my $list ("0-", "99999") {
+    isnt(system("$exe -a $list >/dev/null 2>&1"), 0, "cpu list '$list' refused");
+}
@@ -0,0 +1,32 @@
+#!/usr/bin/perl
+
+use strict;
+use Test::More tests => 3;
+use FindBin qw($Bin);
+use lib "$Bin/lib";
+use MemcachedTest;
+
+# new connections reach the workers through their queues; a burst of them
+# must all be set up, however the wakeups coalesce.
+my $server = new_memcached("-t 4");
+my $sock = $server->sock;
+print $sock "set foo 0 0 3\r\nbar\r\n";
+is(scalar <$sock>, "STORED\r\n", "stored foo");
+
+my $before = mem_stats($sock);
+my @socks = map { $server->new_sock } 1..200;
+my $ok = 1;
+foreach my $s (@socks) {
+    print $s "get foo\r\n";
+}
+foreach my $s (@socks) {
+    $ok = 0 unless scalar(<$s>) eq "VALUE foo 0 3\r\n";
+    scalar <$s>;
+    scalar <$s>;
+    close($s);
+}
+ok($ok, "every connection in the burst was served");
+
+my $after = mem_stats($sock);
+is($after->{total_connections} - $before->{total_connections}, 200,
+   "every connection counted");
@@ -0,0 +1,35 @@
+#!/usr/bin/perl
+
+use strict;
+use Test::More tests => 5;
+use FindBin qw($Bin);
+use lib "$Bin/lib";
+use MemcachedTest;
+
+my $server = new_memcached();
+my $sock = $server->sock;
+
+# deferred deletes with windows of 1 and 5 seconds; each one holds on to its
+# item until the window is over, and is reaped within a second or so after.
+my $keys = 300;
+for my $i (1..$keys) {
+    print $sock "set key$i 0 0 " . length("val$i") . "\r\nval$i\r\n";
+    scalar <$sock>;
+}
+my $deleted = 0;
+for my $i (1..$keys) {
+    print $sock "delete key$i " . ($i % 2 ? 1 : 5) . "\r\n";
+    $deleted++ if scalar(<$sock>) eq "DELETED\r\n";
+}
+is($deleted, $keys, "deleted every key with a window");
+is(mem_stats($sock)->{curr_items}, $keys, "items held while delete-locked");
+
+print $sock "add key3 0 0 3\r\nnew\r\n";
+is(scalar <$sock>, "NOT_STORED\r\n", "add refused inside the window");
+
+sleep(2.5);
+my $stats = mem_stats($sock);
+is($stats->{curr_items}, $keys / 2, "short windows reaped, long ones held");
+
+sleep(4);
+is(mem_stats($sock)->{curr_items}, 0, "every item reaped");
@@ -0,0 +1,47 @@
+#!/usr/bin/perl
+
+use strict;
+use Test::More tests => 9;
+use FindBin qw($Bin);
+use lib "$Bin/lib";
+use MemcachedTest;
+
+my $server = new_memcached();
+my $sock = $server->sock;
+
+# items with a short expiration time are reclaimed without anyone asking for
+# them; the rest are left alone.
+my $keys = 200;
+for my $i (1..$keys) {
+    print $sock "set short$i 0 2 " . length("val$i") . "\r\nval$i\r\n";
+    scalar <$sock>;
+    print $sock "set long$i 0 1000 " . length("val$i") . "\r\nval$i\r\n";
+    scalar <$sock>;
+    print $sock "set forever$i 0 0 " . length("val$i") . "\r\nval$i\r\n";
+    scalar <$sock>;
+}
+
+my $stats = mem_stats($sock);
+is($stats->{curr_items}, $keys * 3, "every item stored");
+is($stats->{expiry_queued}, $keys * 2, "items with an expiration time queued");
+
+# a bucket covers a few seconds, and comes due once the last of them is over.
+sleep(8);
+$stats = mem_stats($sock);
+is($stats->{curr_items}, $keys * 2, "expired items reclaimed without a get");
+is($stats->{expired_reclaimed}, $keys, "counted as reclaimed");
+is($stats->{evictions_of_live_items}, 0, "nothing live evicted");
+
+# an item's entry goes with it, so overwriting a key over and over leaves
+# nothing behind, and no other item's entry is lost.
+for my $i (1..3000) {
+    print $sock "set busy 0 86400 3\r\nbsy\r\n";
+    scalar <$sock>;
+}
+$stats = mem_stats($sock);
+is($stats->{expiry_queued}, $keys + 1, "overwritten items leave no entries behind");
+is($stats->{expiry_dropped}, 0, "no entries dropped");
+print $sock "delete long1\r\n";
+scalar <$sock>;
+is(mem_stats($sock)->{expiry_queued}, $keys, "deleted items leave no entries behind");
+mem_get_is($sock, "busy", "bsy");
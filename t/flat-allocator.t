@@ -0,0 +1,65 @@
+#!/usr/bin/perl
+
+use strict;
+use Test::More;
+use FindBin qw($Bin);
+use lib "$Bin/lib";
+use MemcachedTest;
+
+my $server = new_memcached();
+my $sock = $server->sock;
+if (mem_stats($sock)->{allocator} !~ /^flat/) {
+    plan skip_all => 'Chunk stats are only in the flat allocator';
+    exit 0;
+}
+plan tests => 12;
+
+my $small = "s" x 60;
+my $large = "l" x 3000;
+for my $i (1..10) {
+    print $sock "set small$i 0 0 " . length($small) . "\r\n$small\r\n";
+    is(scalar <$sock>, "STORED\r\n", "stored small$i") if $i == 1;
+    print $sock "set large$i 0 0 " . length($large) . "\r\n$large\r\n";
+    scalar <$sock>;
+}
+
+my $stats = mem_stats($sock, "flat_allocator");
+is($stats->{small_item_bytes}, 10 * (length("small1") + length($small)) + 1,
+   "small tier counts its keys and values");
+is($stats->{large_item_bytes}, 10 * (length("large1") + length($large)) + 1,
+   "large tier counts its keys and values");
+is($stats->{small_chunk_bytes},
+   ($stats->{small_title_chunks} + $stats->{small_body_chunks}) * $stats->{small_chunk_sz},
+   "small tier counts its chunks");
+is($stats->{small_chunk_bytes},
+   $stats->{small_item_bytes} + $stats->{small_header_bytes} + $stats->{small_slack_bytes},
+   "small chunks are keys, values, headers and slack");
+is($stats->{large_chunk_bytes},
+   $stats->{large_item_bytes} + $stats->{large_header_bytes} + $stats->{large_slack_bytes},
+   "large chunks are keys, values, headers and slack");
+ok($stats->{small_fragmentation} > 0 && $stats->{small_fragmentation} < 100,
+   "small tier fragmentation is a percentage");
+
+for my $i (1..10) {
+    print $sock "delete small$i\r\n";
+    scalar <$sock>;
+    print $sock "delete large$i\r\n";
+    scalar <$sock>;
+}
+$stats = mem_stats($sock, "flat_allocator");
+is($stats->{small_item_bytes} + $stats->{large_item_bytes}, 0, "deleted items aren't counted");
+is($stats->{small_fragmentation}, "0.00", "empty tier has no fragmentation");
+
+# incr rewrites a value in place, growing or shrinking it.
+print $sock "set counter 0 0 1\r\n1\r\n";
+is(scalar <$sock>, "STORED\r\n", "stored a counter");
+print $sock "incr counter 1000000\r\n";
+scalar <$sock>;
+$stats = mem_stats($sock, "flat_allocator");
+is($stats->{small_chunk_bytes},
+   $stats->{small_item_bytes} + $stats->{small_header_bytes} + $stats->{small_slack_bytes},
+   "incremented value is counted at its new length");
+print $sock "delete counter\r\n";
+scalar <$sock>;
+$stats = mem_stats($sock, "flat_allocator");
+is($stats->{small_item_bytes} + $stats->{large_item_bytes}, 0, "incremented then deleted item isn't counted");
@@ -0,0 +1,62 @@
+#!/usr/bin/perl
+
+use strict;
+use Test::More tests => 16;
+use FindBin qw($Bin);
+use lib "$Bin/lib";
+use MemcachedTest;
+
+# a 2^11 bucket table expands once it holds more than 3072 items, or 6144 with
+# the bucketed layout.
+foreach my $layout (["chained", 4000], ["bucketed", 7000]) {
+    my ($index, $items) = @$layout;
+    my $server = new_memcached("-H 11 -I $index");
+    my $sock = $server->sock;
+
+    my $stats = mem_stats($sock);
+    is($stats->{hash_power_level}, 11, "$index: table starts at the requested size");
+    is($stats->{hash_is_expanding}, 0, "$index: not expanding");
+
+    my $stored = 0;
+    for my $i (1..$items) {
+        print $sock "set key$i 0 0 " . length("val$i") . "\r\nval$i\r\n";
+        $stored++ if scalar(<$sock>) eq "STORED\r\n";
+    }
+    is($stored, $items, "$index: stored all items");
+
+    # the maintenance thread finishes the migration without any further traffic.
+    for (1..50) {
+        $stats = mem_stats($sock);
+        last unless $stats->{hash_is_expanding};
+        select(undef, undef, undef, 0.1);
+    }
+    is($stats->{hash_is_expanding}, 0, "$index: expansion finished");
+    is($stats->{hash_power_level}, 12, "$index: table doubled");
+    is($stats->{hash_expansions}, 1, "$index: one expansion");
+
+    my $found = 0;
+    for my $i (1..$items) {
+        print $sock "get key$i\r\n";
+        my $line = scalar <$sock>;
+        next unless $line eq "VALUE key$i 0 " . length("val$i") . "\r\n";
+        $found++ if scalar(<$sock>) eq "val$i\r\n";
+        scalar <$sock>;
+    }
+    is($found, $items, "$index: all items found after the expansion");
+
+    # deletes take items out of both the slots and the overflow chains.
+    my $deleted = 0;
+    for my $i (grep { $_ % 3 == 0 } 1..$items) {
+        print $sock "delete key$i\r\n";
+        $deleted++ if scalar(<$sock>) eq "DELETED\r\n";
+    }
+    $found = 0;
+    for my $i (1..$items) {
+        print $sock "get key$i\r\n";
+        next if scalar(<$sock>) eq "END\r\n";
+        $found++;
+        scalar <$sock>;
+        scalar <$sock>;
+    }
+    is($found, $items - $deleted, "$index: deleted items are gone");
+}
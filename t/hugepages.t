@@ -0,0 +1,29 @@
+#!/usr/bin/perl
+
+use strict;
+use Test::More tests => 6;
+use FindBin qw($Bin);
+use lib "$Bin/lib";
+use MemcachedTest;
+
+my $server = new_memcached();
+my $stats = mem_stats($server->sock);
+ok(! defined $stats->{hugepages_explicit}, "no huge page stats by default");
+
+# whether or not the huge page pool has room, the server starts.
+$server = new_memcached("-L");
+my $sock = $server->sock;
+$stats = mem_stats($sock);
+ok($stats->{hugepage_size} > 0, "huge page size reported");
+ok($stats->{hugepages_explicit} > 0 || $stats->{hugepage_fallbacks} > 0,
+   "item memory got huge pages, or fell back");
+ok($stats->{hugepages_explicit} == 0 || $stats->{hugepage_fallbacks} == 0,
+   "item memory is mapped once");
+
+my $value = "x" x 2000;
+for my $i (1..200) {
+    print $sock "set key$i 0 0 " . length($value) . "\r\n$value\r\n";
+    scalar <$sock>;
+}
+mem_get_is($sock, "key1", $value);
+mem_get_is($sock, "key200", $value);
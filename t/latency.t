@@ -0,0 +1,43 @@
+#!/usr/bin/perl
+
+use strict;
+use Test::More tests => 14;
+use FindBin qw($Bin);
+use lib "$Bin/lib";
+use MemcachedTest;
+
+sub latency_stats {
+    my $sock = shift;
+    my %stats;
+
+    print $sock "stats latency\r\n";
+    while (<$sock>) {
+        last if /^END\r\n/;
+        $stats{$1} = $2 if /^STAT (\S+) (\S+)\r\n/;
+    }
+    return \%stats;
+}
+
+foreach my $args ("", "-T") {
+    my $server = new_memcached($args);
+    my $sock = $server->sock;
+
+    print $sock "set foo 0 0 3\r\nbar\r\n";
+    is(scalar <$sock>, "STORED\r\n", "'$args': stored foo");
+    mem_get_is($sock, "foo", "bar");
+    print $sock "get foo bar\r\n";
+    is(scalar <$sock>, "VALUE foo 0 3\r\n", "'$args': multiget hit");
+    scalar <$sock>;
+    scalar <$sock>;
+
+    my $stats = latency_stats($sock);
+    ok($stats->{get_count} == 1 && $stats->{multiget_count} == 1 &&
+       $stats->{update_count} == 1 && $stats->{delete_count} == 0,
+       "'$args': commands counted by class");
+    ok($stats->{get_p50} > 0 && $stats->{get_p50} <= $stats->{get_p999},
+       "'$args': percentiles are in order");
+
+    print $sock "stats reset\r\n";
+    is(scalar <$sock>, "RESET\r\n", "'$args': reset stats");
+    is(latency_stats($sock)->{get_count}, 0, "'$args': counts start over");
+}
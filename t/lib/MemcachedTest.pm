@@ -7,7 +7,7 @@ use FindBin qw($Bin);
 use Carp qw(croak);
 use vars qw(@EXPORT);
 
-@EXPORT = qw(new_memcached sleep mem_get_is mem_stats free_port);
+@EXPORT = qw(new_memcached sleep mem_get_is mem_stats free_port supports_engine);
 
 sub sleep {
     my $n = shift;
@@ -78,10 +78,20 @@ sub supports_udp {
     return 1;
 }
 
+# whether the build has the storage engine called $name (see -S).
+sub supports_engine {
+    my $name = shift;
+    return system("$Bin/../memcached-debug -S $name -h >/dev/null 2>&1") == 0;
+}
+
 sub new_memcached {
     my $args = shift || "";
     my $port = free_port();
     my $udpport = free_port("udp");
+    # MEMCACHED_ENGINE runs every test against that storage engine.
+    if ($ENV{MEMCACHED_ENGINE} && $args !~ /-S /) {
+        $args .= " -S $ENV{MEMCACHED_ENGINE}";
+    }
     $args .= " -l 127.0.0.1 -p $port";
     if (supports_udp()) {
         $args .= " -U $udpport";
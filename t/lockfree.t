@@ -0,0 +1,106 @@
+#!/usr/bin/perl
+
+use strict;
+use Test::More tests => 14;
+use POSIX qw(_exit);
+use FindBin qw($Bin);
+use lib "$Bin/lib";
+use MemcachedTest;
+
+my $children = 4;
+
+# runs $code in $children forked clients, each with its own connection, and
+# returns the number of clients that failed.
+sub run_clients {
+    my ($server, $code) = @_;
+    my @pids;
+
+    for my $child (1..$children) {
+        my $pid = fork();
+        die "fork failed: $!" unless defined $pid;
+        unless ($pid) {
+            my $sock = $server->new_sock;
+            _exit($code->($sock, $child) ? 0 : 1);
+        }
+        push @pids, $pid;
+    }
+
+    my $failed = 0;
+    foreach my $pid (@pids) {
+        waitpid($pid, 0);
+        $failed++ if $? != 0;
+    }
+    return $failed;
+}
+
+# the stat is only reported when lock-free gets are enabled.
+{
+    my $server = new_memcached("-t 2");
+    my $stats = mem_stats($server->sock);
+    ok(! defined $stats->{lockfree_hits}, "no lockfree_hits without -G");
+}
+
+# hits are served without the lock; misses, deletes and expiry still work.
+{
+    my $server = new_memcached("-t 2 -G");
+    my $sock = $server->sock;
+
+    print $sock "set foo 0 0 3\r\nbar\r\n";
+    is(scalar <$sock>, "STORED\r\n", "stored foo");
+    mem_get_is($sock, "foo", "bar");
+    mem_get_is($sock, "missing", undef);
+
+    print $sock "delete foo\r\n";
+    is(scalar <$sock>, "DELETED\r\n", "deleted foo");
+    mem_get_is($sock, "foo", undef);
+
+    print $sock "set num 0 0 1\r\n1\r\n";
+    is(scalar <$sock>, "STORED\r\n", "stored num");
+    mem_get_is($sock, "num", "1");
+    print $sock "incr num 1\r\n";
+    is(scalar <$sock>, "2\r\n", "incremented num");
+
+    my $before = mem_stats($sock)->{lockfree_hits};
+    mem_get_is($sock, "num", "2");
+    is(mem_stats($sock)->{lockfree_hits}, $before + 1, "hit was lock-free");
+}
+
+# concurrent gets race against sets, deletes and evictions.
+{
+    my $server = new_memcached("-t 5 -G -m 2");
+    my $sock = $server->sock;
+
+    my $failed = run_clients($server, sub {
+        my ($sock, $child) = @_;
+        for my $i (1..400) {
+            # half of the clients share a few keys, so that gets see other
+            # clients' sets and deletes; the other half fill the cache.
+            my $key = $child % 2 ? "shared_" . ($i % 23) : "own_${child}_$i";
+            my $val = ($key x 400) . ":$i";
+            my $len = length($val);
+            print $sock "set $key 0 0 $len\r\n$val\r\n";
+            return 0 unless scalar(<$sock>) eq "STORED\r\n";
+
+            print $sock "get $key\r\n";
+            my $line = scalar <$sock>;
+            next if $line eq "END\r\n";
+            return 0 unless $line =~ /^VALUE \Q$key\E 0 (\d+)\r\n$/;
+            my $got_len = $1;
+            my $data = scalar <$sock>;
+            return 0 unless $data =~ /^(\Q$key\E){400}:\d+\r\n$/;
+            return 0 unless length($data) == $got_len + 2;
+            return 0 unless scalar(<$sock>) eq "END\r\n";
+
+            if ($i % 7 == 0) {
+                print $sock "delete $key\r\n";
+                return 0 unless scalar(<$sock>) =~ /^(DELETED|NOT_FOUND)\r\n$/;
+            }
+        }
+        return 1;
+    });
+    is($failed, 0, "all clients saw intact values");
+
+    my $stats = mem_stats($sock);
+    ok($stats->{lockfree_hits} > 0, "hits were lock-free");
+    ok($stats->{evictions} > 0, "items were evicted");
+}
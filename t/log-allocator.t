@@ -0,0 +1,59 @@
+#!/usr/bin/perl
+
+use strict;
+use Test::More;
+use FindBin qw($Bin);
+use lib "$Bin/lib";
+use MemcachedTest;
+
+if (! supports_engine("log")) {
+    plan skip_all => 'Segment stats are only in the log engine';
+    exit 0;
+}
+plan tests => 11;
+
+my $server = new_memcached("-S log -m 8");
+my $sock = $server->sock;
+
+is(mem_stats($sock)->{allocator}, "log", "the log engine was picked");
+my $stats = mem_stats($sock, "log_allocator");
+is($stats->{segments}, 8, "one segment for each megabyte");
+is($stats->{free_segments}, 8, "all of them free");
+
+# a mix of sizes that would strand memory in slab classes, overwritten often
+# enough that segments have to be compacted as well as evicted from.
+srand(42);
+for my $i (1..20000) {
+    my $len = (10, 100, 1000, 8000)[rand(4)] + int(rand(100));
+    my $key = "key" . int(rand(8000));
+    print $sock "set $key 0 0 $len\r\n" . ("x" x $len) . "\r\n";
+    scalar <$sock>;
+    if ($i % 200 == 0) {
+        print $sock "get hot\r\n";
+        if (scalar(<$sock>) eq "END\r\n") {
+            print $sock "set hot 7 0 3\r\nhot\r\n";
+            scalar <$sock>;
+        } else {
+            scalar <$sock> for 1..2;
+        }
+    }
+}
+mem_get_is({ sock => $sock, flags => 7 }, "hot", "hot", "hot key was relocated rather than evicted");
+
+$stats = mem_stats($sock, "log_allocator");
+ok($stats->{compactions} > 0, "segments were compacted");
+ok($stats->{eviction_passes} > 0, "and evicted from");
+ok($stats->{relocated_items} > 0, "live items were relocated");
+ok($stats->{live_bytes} > $stats->{appended_bytes} * 0.9,
+   "over 90% of the appended bytes belong to live items");
+
+my $items = mem_stats($sock, "items");
+my ($segment) = grep { /^items:\d+:number$/ && $items->{$_} > 0 } keys %$items;
+$segment =~ s/^items:(\d+):number$/$1/;
+print $sock "stats cachedump $segment 1\r\n";
+like(scalar <$sock>, qr/^ITEM key\d+ \[\d+ b; \d+ s\]\r\n$/, "cachedump lists a segment's items");
+is(scalar <$sock>, "END\r\n", "up to the limit");
+
+my $big = "b" x (1024 * 1024 - 512);
+print $sock "set big 0 0 " . length($big) . "\r\n$big\r\n";
+is(scalar <$sock>, "STORED\r\n", "an item can take up most of a segment");
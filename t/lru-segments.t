@@ -0,0 +1,55 @@
+#!/usr/bin/perl
+
+use strict;
+use Test::More;
+use FindBin qw($Bin);
+use lib "$Bin/lib";
+use MemcachedTest;
+
+my $server = new_memcached();
+if (mem_stats($server->sock)->{allocator} !~ /^flat/) {
+    plan skip_all => 'Segmented LRU is only in the flat allocator';
+    exit 0;
+}
+plan tests => 7;
+
+$server = new_memcached("-m 2 -Q 20");
+my $sock = $server->sock;
+my $filler = "x" x 1024;
+
+# a small working set, each hit once, then a scan of keys that are never hit.
+my $hot = 20;
+for my $i (1..$hot) {
+    print $sock "set hot$i 0 0 " . length($filler) . "\r\n$filler\r\n";
+    scalar <$sock>;
+}
+for my $i (1..$hot) {
+    print $sock "get hot$i\r\n";
+    scalar <$sock> for 1..3;
+}
+for my $i (1..4000) {
+    print $sock "set scan$i 0 0 " . length($filler) . "\r\n$filler\r\n";
+    scalar <$sock>;
+}
+
+# the working set was promoted when the scan reached it, and the scan was
+# evicted from the probationary segment around it.
+my $survivors = 0;
+for my $i (1..$hot) {
+    print $sock "get hot$i\r\n";
+    next if scalar(<$sock>) eq "END\r\n";
+    $survivors++;
+    scalar <$sock> for 1..2;
+}
+is($survivors, $hot, "working set survived the scan");
+
+my $items = mem_stats($sock, "items");
+ok($items->{"items:promotions"} >= $hot, "working set promoted");
+is($items->{"items:protected:number"}, $hot, "working set is protected");
+ok($items->{"items:probation:evictions"} > 0, "scan evicted from probation");
+is($items->{"items:protected:evictions"}, 0, "nothing evicted from protected");
+is($items->{"items:protected:hits"}, $hot, "hits counted in protected");
+
+# the cap must leave room for a probationary segment.
+my $exe = "$Bin/../memcached-debug";
+isnt(system("$exe -Q 100 >/dev/null 2>&1"), 0, "cap of 100% refused");
@@ -1,11 +1,35 @@
 #!/usr/bin/perl
 
 use strict;
-use Test::More skip_all => "Tests not written.";  # tests => 1
+use Test::More tests => 4;
 use FindBin qw($Bin);
 use lib "$Bin/lib";
 use MemcachedTest;
 
-my $server = new_memcached();
+my $server = new_memcached("-m 2");
 my $sock = $server->sock;
+my $filler = "x" x 1024;
 
+# the hot key is the same size as the rest, so that they share an LRU.
+print $sock "set hot 0 0 " . length($filler) . "\r\n$filler\r\n";
+is(scalar <$sock>, "STORED\r\n", "stored hot");
+
+# keep hitting one key while the cache churns.  hits only mark the item; the
+# move to the head of the LRU is made when eviction reaches it.  (in the
+# server's first ITEM_UPDATE_INTERVAL seconds, every hit is due for a move.)
+my $hot_hits = 0;
+for my $i (1..4000) {
+    print $sock "set filler$i 0 0 " . length($filler) . "\r\n$filler\r\n";
+    scalar <$sock>;
+    next if $i % 100;
+    print $sock "get hot\r\n";
+    next if scalar(<$sock>) eq "END\r\n";
+    $hot_hits++;
+    scalar <$sock>;
+    scalar <$sock>;
+}
+is($hot_hits, 40, "hot key survived the churn");
+
+my $stats = mem_stats($sock);
+ok($stats->{evictions} > 0, "items were evicted");
+ok($stats->{lru_bumps} > 0, "hit items were moved at the tail");
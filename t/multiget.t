@@ -0,0 +1,36 @@
+#!/usr/bin/perl
+
+use strict;
+use Test::More tests => 10;
+use FindBin qw($Bin);
+use lib "$Bin/lib";
+use MemcachedTest;
+
+# multi-gets are looked up in batches; make sure a command spanning several
+# batches still answers every key, in order, with or without -G.
+foreach my $args ("", "-G") {
+    my $server = new_memcached($args);
+    my $sock = $server->sock;
+    my $keys = 150;
+
+    for my $i (1..$keys) {
+        next if $i % 5 == 0;
+        print $sock "set key$i 0 0 " . length("val$i") . "\r\nval$i\r\n";
+        scalar <$sock>;
+    }
+
+    my $before = mem_stats($sock);
+    print $sock "get " . join(" ", map { "key$_" } 1..$keys) . "\r\n";
+    my $ok = 1;
+    for my $i (grep { $_ % 5 != 0 } 1..$keys) {
+        $ok = 0 unless scalar(<$sock>) eq "VALUE key$i 0 " . length("val$i") . "\r\n";
+        $ok = 0 unless scalar(<$sock>) eq "val$i\r\n";
+    }
+    is(scalar <$sock>, "END\r\n", "'$args': response ends after the hits");
+    ok($ok, "'$args': hits returned in order");
+
+    my $after = mem_stats($sock);
+    is($after->{cmd_get} - $before->{cmd_get}, $keys, "'$args': every key counted");
+    is($after->{get_hits} - $before->{get_hits}, $keys * 4 / 5, "'$args': hits counted");
+    is($after->{get_misses} - $before->{get_misses}, $keys / 5, "'$args': misses counted");
+}
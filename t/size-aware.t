@@ -0,0 +1,74 @@
+#!/usr/bin/perl
+
+use strict;
+use Test::More;
+use FindBin qw($Bin);
+use lib "$Bin/lib";
+use MemcachedTest;
+
+my $server = new_memcached();
+my $sock = $server->sock;
+print $sock "set probe 0 0 1\r\nx\r\n";
+scalar <$sock>;
+print $sock "get probe\r\n";
+scalar <$sock> for 1..3;
+print $sock "stats cost-benefit\r\n";
+if (scalar(<$sock>) eq "END\r\n") {
+    plan skip_all => 'Size-aware eviction needs --enable-cost-benefit-stats';
+    exit 0;
+}
+plan tests => 5;
+
+# small items that are read often, in among large ones that never are, then a
+# stream of large items that pushes them all towards the end of the LRU.
+sub small_survivors {
+    my ($args) = @_;
+    my $server = new_memcached("-m 2 $args");
+    my $sock = $server->sock;
+    my $small = "s" x 100;
+    my $large = "l" x 4000;
+    my $count = 100;
+
+    for my $i (1..$count) {
+        print $sock "set small$i 0 0 " . length($small) . "\r\n$small\r\n";
+        scalar <$sock>;
+        print $sock "set large$i 0 0 " . length($large) . "\r\n$large\r\n";
+        scalar <$sock>;
+    }
+    for my $round (1..5) {
+        for my $i (1..$count) {
+            print $sock "get small$i\r\n";
+            scalar <$sock> for 1..3;
+        }
+    }
+    # let the once-a-second density refresh see the hits.
+    sleep(2);
+    for my $i (1..1300) {
+        print $sock "set stream$i 0 0 " . length($large) . "\r\n$large\r\n";
+        scalar <$sock>;
+    }
+
+    my $survivors = 0;
+    for my $i (1..$count) {
+        print $sock "get small$i\r\n";
+        next if scalar(<$sock>) eq "END\r\n";
+        $survivors++;
+        scalar <$sock> for 1..2;
+    }
+    return ($survivors, mem_stats($sock));
+}
+
+my ($plain, $plain_stats) = small_survivors("");
+ok(! defined $plain_stats->{size_aware_evictions}, "no size-aware stats by default");
+
+my ($aware, $aware_stats) = small_survivors("-g");
+ok($aware_stats->{evictions} > 0, "items were evicted");
+ok(defined $aware_stats->{size_aware_evictions}, "size-aware stats with -g");
+
+SKIP: {
+    # the slab allocator evicts within a class, where the sizes hardly differ.
+    skip "Size-aware LRU eviction is only in the flat allocator", 2
+        if $aware_stats->{allocator} !~ /^flat/;
+    ok($aware_stats->{size_aware_evictions} > 0, "size-aware evictions counted");
+    ok($aware > $plain, "more small items survived with size-aware eviction");
+}
@@ -0,0 +1,63 @@
+#!/usr/bin/perl
+
+use strict;
+use Test::More tests => 17;
+use FindBin qw($Bin);
+use lib "$Bin/lib";
+use MemcachedTest;
+
+my $name = "memcached-snapshot.$$";
+my $file = "/tmp/$name";
+END { unlink $file }
+
+# without -O, clients can't write snapshots anywhere.
+my $server = new_memcached();
+my $sock = $server->sock;
+print $sock "snapshot $name\r\n";
+like(scalar <$sock>, qr/^SERVER_ERROR /, "snapshot refused without -O");
+
+$server = new_memcached("-O /nonexistent");
+$sock = $server->sock;
+print $sock "snapshot $name\r\n";
+like(scalar <$sock>, qr/^SERVER_ERROR /, "snapshot to a missing directory");
+
+$server = new_memcached("-O /tmp");
+$sock = $server->sock;
+ok(! defined mem_stats($sock)->{snapshots}, "no snapshot stats before a snapshot");
+
+my $value = "v" x 3000;
+for my $i (1..500) {
+    print $sock "set key$i $i 0 " . length($value) . "\r\n$value\r\n";
+    scalar <$sock>;
+}
+print $sock "set short 0 2 5\r\nshort\r\n";
+is(scalar <$sock>, "STORED\r\n", "stored an item that expires");
+print $sock "delete key500\r\n";
+is(scalar <$sock>, "DELETED\r\n", "deleted key500");
+
+foreach my $bad ("../$name", "sub/$name", "..") {
+    print $sock "snapshot $bad\r\n";
+    is(scalar <$sock>, "CLIENT_ERROR bad snapshot name\r\n", "name '$bad' refused");
+}
+
+print $sock "snapshot $name\r\n";
+is(scalar <$sock>, "OK\r\n", "snapshot started");
+my $stats;
+for (1..50) {
+    $stats = mem_stats($sock);
+    last if $stats->{snapshot_in_progress} == 0;
+    sleep(0.1);
+}
+is($stats->{snapshots}, 1, "snapshot written");
+is($stats->{snapshot_items}, 500, "every live item was written");
+ok(! -e "$file.tmp", "the temporary file was renamed");
+
+sleep(2.5);
+$server = new_memcached("-t 4 -F $file");
+$sock = $server->sock;
+$stats = mem_stats($sock);
+is($stats->{snapshot_loaded_items}, 499, "the snapshot was loaded");
+is($stats->{snapshot_load_skipped}, 1, "the expired item was skipped");
+ok(defined $stats->{snapshot_load_rate}, "load rate reported");
+mem_get_is({ sock => $sock, flags => 42 }, "key42", $value, "key42 and its flags were loaded");
+mem_get_is($sock, "key500", undef, "deleted item wasn't written");
@@ -0,0 +1,26 @@
+#!/usr/bin/perl
+
+use strict;
+use Test::More tests => 7;
+use FindBin qw($Bin);
+use lib "$Bin/lib";
+use MemcachedTest;
+
+my $server = new_memcached();
+my $sock = $server->sock;
+
+print $sock "set foo 0 0 3\r\nbar\r\n";
+is(scalar <$sock>, "STORED\r\n", "stored foo");
+mem_get_is($sock, "foo", "bar");
+
+# other threads' counters can't be cleared; a reset is subtracted from them.
+print $sock "stats reset\r\n";
+is(scalar <$sock>, "RESET\r\n", "reset stats");
+
+my $stats = mem_stats($sock);
+is($stats->{cmd_get}, 0, "gets cleared by the reset");
+is($stats->{curr_items}, 1, "current items aren't reset");
+
+mem_get_is($sock, "foo", "bar");
+$stats = mem_stats($sock);
+is($stats->{cmd_get}, 1, "gets counted again after the reset");
@@ -0,0 +1,43 @@
+#!/usr/bin/perl
+
+use strict;
+use Test::More;
+use FindBin qw($Bin);
+use lib "$Bin/lib";
+use MemcachedTest;
+
+my @engines = grep { supports_engine($_) } ("slab", "log", "flat");
+plan tests => 7 + 3 * @engines;
+
+my $exe = "$Bin/../memcached-debug";
+my $user = ($< == 0) ? "-u root" : "";
+
+foreach my $engine (@engines) {
+    my $server = new_memcached("-S $engine");
+    my $sock = $server->sock;
+    # the flat allocator has always called itself flat-sk in "stats".
+    is(mem_stats($sock)->{allocator}, ($engine eq "flat") ? "flat-sk" : $engine,
+       "picked the $engine engine");
+    print $sock "set foo 0 0 3\r\nbar\r\n";
+    is(scalar <$sock>, "STORED\r\n", "stored with it");
+    mem_get_is($sock, "foo", "bar");
+}
+
+isnt(system("$exe -S nosuch >/dev/null 2>&1"), 0, "an unknown engine is refused");
+SKIP: {
+    skip "No log engine in this build", 1 unless supports_engine("log");
+    isnt(system("$exe -E >/dev/null 2>&1"), 0, "-E is refused without the log engine");
+}
+isnt(system("$exe -K 0 >/dev/null 2>&1"), 0, "a benchmark of no requests is refused");
+
+# every engine replays the same requests, in a process of its own.
+my @lines = `$exe $user -m 8 -K 50000 2>&1`;
+is($?, 0, "the benchmark ran");
+like(shift(@lines), qr/^engine\s+hit ratio\s+efficiency\s+ops\/sec\s+evictions$/, "with a header");
+SKIP: {
+    skip "No engine tables in this build", 1 unless supports_engine("slab");
+    like(pop(@lines), qr/^dispatch: [\d.]+ ns a call through an engine table, [\d.]+ ns a direct call$/,
+         "and what a call through an engine's table costs");
+}
+is_deeply([map { /^(\w+)\s+[\d.]+%\s+[\d.]+%\s+\d+\s+\d+$/ ? $1 : $_ } @lines],
+          \@engines, "and a line for every engine");
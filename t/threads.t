@@ -0,0 +1,131 @@
+#!/usr/bin/perl
+
+use strict;
+use Test::More tests => 12;
+use POSIX qw(_exit);
+use FindBin qw($Bin);
+use lib "$Bin/lib";
+use MemcachedTest;
+
+my $children = 4;
+
+# runs $code in $children forked clients, each with its own connection, and
+# returns the number of clients that failed.
+sub run_clients {
+    my ($server, $code) = @_;
+    my @pids;
+
+    for my $child (1..$children) {
+        my $pid = fork();
+        die "fork failed: $!" unless defined $pid;
+        unless ($pid) {
+            my $sock = $server->new_sock;
+            # _exit, so that the server handle isn't destroyed (and the
+            # server killed) when the child goes away.
+            _exit($code->($sock, $child) ? 0 : 1);
+        }
+        push @pids, $pid;
+    }
+
+    my $failed = 0;
+    foreach my $pid (@pids) {
+        waitpid($pid, 0);
+        $failed++ if $? != 0;
+    }
+    return $failed;
+}
+
+# concurrent increments of the same key are not lost.
+{
+    my $server = new_memcached("-t 5");
+    my $sock = $server->sock;
+    my $incrs = 250;
+
+    print $sock "set counter 0 0 1\r\n0\r\n";
+    is(scalar <$sock>, "STORED\r\n", "stored counter");
+
+    my $failed = run_clients($server, sub {
+        my ($sock) = @_;
+        for (1..$incrs) {
+            print $sock "incr counter 1\r\n";
+            return 0 unless scalar(<$sock>) =~ /^\d+\r\n$/;
+        }
+        return 1;
+    });
+    is($failed, 0, "all incrementing clients succeeded");
+    mem_get_is($sock, "counter", $children * $incrs, "no increments lost");
+}
+
+# concurrent sets and gets on disjoint keys see their own values.
+{
+    my $server = new_memcached("-t 5");
+    my $sock = $server->sock;
+
+    my $failed = run_clients($server, sub {
+        my ($sock, $child) = @_;
+        for my $i (1..300) {
+            my $key = "key_${child}_" . ($i % 37);
+            my $val = "$key:$i";
+            my $len = length($val);
+            print $sock "set $key 0 0 $len\r\n$val\r\n";
+            return 0 unless scalar(<$sock>) eq "STORED\r\n";
+            print $sock "get $key\r\n";
+            return 0 unless scalar(<$sock>) eq "VALUE $key 0 $len\r\n";
+            return 0 unless scalar(<$sock>) eq "$val\r\n";
+            return 0 unless scalar(<$sock>) eq "END\r\n";
+            if ($i % 10 == 0) {
+                print $sock "delete $key\r\n";
+                return 0 unless scalar(<$sock>) eq "DELETED\r\n";
+            }
+        }
+        return 1;
+    });
+    is($failed, 0, "all set/get clients saw their own values");
+
+    my $stats = mem_stats($sock);
+    is($stats->{cmd_set}, $children * 300, "all sets counted");
+    is($stats->{get_hits}, $children * 300, "all gets hit");
+    # each client leaves behind the keys it didn't delete on their last set.
+    my %live;
+    $live{$_ % 37} = ($_ % 10 != 0) for 1..300;
+    is($stats->{curr_items}, $children * grep($_, values %live),
+       "expected number of items");
+}
+
+# concurrent sets that force evictions.
+{
+    my $server = new_memcached("-t 5 -m 2");
+    my $sock = $server->sock;
+    my $sets = 400;
+
+    my $failed = run_clients($server, sub {
+        my ($sock, $child) = @_;
+        for my $i (1..$sets) {
+            my $key = "evict_${child}_$i";
+            my $val = ($child x 2048) . $i;
+            my $len = length($val);
+            print $sock "set $key 0 0 $len\r\n$val\r\n";
+            return 0 unless scalar(<$sock>) eq "STORED\r\n";
+
+            # read back an older key; it is either evicted or intact.
+            my $old = "evict_${child}_" . int(($i + 1) / 2);
+            print $sock "get $old\r\n";
+            my $line = scalar <$sock>;
+            next if $line eq "END\r\n";
+            return 0 unless $line =~ /^VALUE \Q$old\E 0 (\d+)\r\n$/;
+            my $data = scalar <$sock>;
+            return 0 unless $data eq ($child x 2048) . int(($i + 1) / 2) . "\r\n";
+            return 0 unless scalar(<$sock>) eq "END\r\n";
+        }
+        return 1;
+    });
+    is($failed, 0, "all evicting clients succeeded");
+
+    my $stats = mem_stats($sock);
+    is($stats->{cmd_set}, $children * $sets, "all sets counted");
+    ok($stats->{evictions} > 0, "items were evicted");
+    ok($stats->{curr_items} < $children * $sets, "not every item fits");
+
+    print $sock "version\r\n";
+    like(scalar <$sock>, qr/^VERSION /, "server still responsive");
+}
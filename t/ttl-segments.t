@@ -0,0 +1,46 @@
+#!/usr/bin/perl
+
+use strict;
+use Test::More;
+use FindBin qw($Bin);
+use lib "$Bin/lib";
+use MemcachedTest;
+
+if (! supports_engine("log")) {
+    plan skip_all => 'TTL segments are only in the log engine';
+    exit 0;
+}
+plan tests => 8;
+
+my $server = new_memcached("-S log -m 16 -E");
+my $sock = $server->sock;
+
+# enough short-lived items to fill a segment and start another, among items
+# that never expire.
+my $value = "v" x 1000;
+for my $i (1..1500) {
+    print $sock "set short$i 0 2 1000\r\n$value\r\n";
+    scalar <$sock>;
+    next if $i % 15;
+    print $sock "set long$i 0 0 1000\r\n$value\r\n";
+    scalar <$sock>;
+}
+my $stats = mem_stats($sock);
+is($stats->{curr_items}, 1600, "stored every item");
+is(mem_stats($sock, "log_allocator")->{expired_segments}, 0, "nothing expired yet");
+
+# the cleaner looks for expired segments once a second.
+sleep(3);
+for (1..20) {
+    $stats = mem_stats($sock);
+    last if $stats->{curr_items} == 100;
+    sleep(0.25);
+}
+is($stats->{curr_items}, 100, "the short-lived items went with their segments");
+is($stats->{expired_reclaimed}, 1500, "without a get to notice them");
+
+my $log = mem_stats($sock, "log_allocator");
+is($log->{expired_segments}, 2, "the sealed segment and the open one expired");
+is($log->{free_segments}, 15, "leaving the segment of the items that never expire");
+is($log->{live_bytes}, $log->{appended_bytes}, "which holds no expired items");
+mem_get_is($sock, "long1500", $value, "an item that never expires is still there");
@@ -0,0 +1,77 @@
+#!/usr/bin/perl
+
+use strict;
+use Test::More;
+use FindBin qw($Bin);
+use lib "$Bin/lib";
+use MemcachedTest;
+
+my $file = "/tmp/memcached-warm-restart.$$";
+END { unlink $file }
+
+my $server = new_memcached();
+if (mem_stats($server->sock)->{allocator} !~ /^flat/) {
+    plan skip_all => 'Memory files are only in the flat allocator';
+    exit 0;
+}
+plan tests => 13;
+
+sub stop {
+    my ($server, $signal) = @_;
+    kill $signal, $server->{pid};
+    waitpid($server->{pid}, 0);
+}
+
+$server = new_memcached("-m 4 -e $file");
+my $sock = $server->sock;
+is(mem_stats($sock)->{restored_items}, 0, "nothing to restore from a new file");
+
+my $small = "s" x 50;
+my $large = "l" x 5000;
+for my $i (1..100) {
+    print $sock "set small$i $i 0 " . length($small) . "\r\n$small\r\n";
+    scalar <$sock>;
+}
+for my $i (1..20) {
+    print $sock "set large$i $i 0 " . length($large) . "\r\n$large\r\n";
+    scalar <$sock>;
+}
+print $sock "set gone 0 0 1\r\nx\r\n";
+scalar <$sock>;
+print $sock "delete gone\r\n";
+is(scalar <$sock>, "DELETED\r\n", "deleted gone");
+print $sock "set expiring 0 2 1\r\nx\r\n";
+is(scalar <$sock>, "STORED\r\n", "stored an item that expires");
+my $before = mem_stats($sock, "flat_allocator");
+stop($server, 'TERM');
+sleep(2.5);
+
+$server = new_memcached("-m 4 -e $file");
+$sock = $server->sock;
+is(mem_stats($sock)->{restored_items}, 120, "the items came back");
+is(mem_stats($sock)->{curr_items}, 120, "and were linked");
+mem_get_is({ sock => $sock, flags => 1 }, "small1", $small, "small1 came back");
+mem_get_is({ sock => $sock, flags => 20 }, "large20", $large, "large20 came back");
+print $sock "get small42\r\n";
+is(scalar <$sock>, "VALUE small42 42 50\r\n", "flags survived");
+scalar <$sock> for 1..2;
+mem_get_is($sock, "gone", undef);
+mem_get_is($sock, "expiring", undef);
+
+my $after = mem_stats($sock, "flat_allocator");
+is($after->{small_title_chunks} . " " . $after->{large_title_chunks},
+   ($before->{small_title_chunks} - 1) . " " . $before->{large_title_chunks},
+   "chunk counts were rebuilt without the expired item");
+
+# a crash leaves the file marked as unsaved.
+stop($server, 'KILL');
+$server = new_memcached("-m 4 -e $file");
+$sock = $server->sock;
+mem_get_is($sock, "small1", undef);
+
+# and a different size doesn't fit the file.
+print $sock "set small1 0 0 1\r\nx\r\n";
+scalar <$sock>;
+stop($server, 'INT');
+$server = new_memcached("-m 8 -e $file");
+is(mem_stats($server->sock)->{restored_items}, 0, "a file of another size starts empty");
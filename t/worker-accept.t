@@ -0,0 +1,42 @@
+#!/usr/bin/perl
+
+use strict;
+use Test::More tests => 5;
+use FindBin qw($Bin);
+use lib "$Bin/lib";
+use MemcachedTest;
+
+# with -A, every worker accepts on its own socket; connections must work
+# whichever worker the kernel hands them to.
+my $server = new_memcached("-A -t 4");
+my @socks = map { $server->new_sock } 1..20;
+is(scalar(grep { defined } @socks), 20, "made 20 connections");
+
+my $ok = 1;
+foreach my $i (0..$#socks) {
+    my $sock = $socks[$i];
+    print $sock "set key$i 0 0 " . length("val$i") . "\r\nval$i\r\n";
+    $ok = 0 unless scalar(<$sock>) eq "STORED\r\n";
+}
+foreach my $i (0..$#socks) {
+    my $sock = $socks[($i + 7) % @socks];
+    print $sock "get key$i\r\n";
+    $ok = 0 unless scalar(<$sock>) eq "VALUE key$i 0 " . length("val$i") . "\r\n";
+    scalar <$sock>;
+    scalar <$sock>;
+}
+ok($ok, "every connection stores and reads");
+
+# closing connections re-arms the closing worker's own listener.
+close($_) foreach @socks;
+my $sock = $server->new_sock;
+ok(defined($sock), "connected after closing the others");
+mem_get_is($sock, "key3", "val3");
+
+# a unix socket can only be bound once, so the workers share it.
+my $filename = "/tmp/memcachetest$$";
+my $unix = new_memcached("-A -t 4 -s $filename");
+$sock = $unix->sock;
+print $sock "set foo 0 0 6\r\nfooval\r\n";
+is(scalar <$sock>, "STORED\r\n", "stored foo over a shared unix socket");
+unlink($filename);
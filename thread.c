@@ -14,16 +14,31 @@
 #include <stdlib.h>
 #include <errno.h>
 #include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#if defined(HAVE_EVENTFD)
+#include <sys/eventfd.h>
+#endif /* #if defined(HAVE_EVENTFD) */
 
 #include "memcached.h"
 #include "assoc.h"
 #include "items.h"
 #include "stats.h"
 #include "conn_buffer.h"
+#include "expiry.h"
+#include "admission.h"
 
-#define ITEMS_PER_ALLOC 64
+#if defined(USE_NUMA)
+#include <numa.h>
+#endif /* #if defined(USE_NUMA) */
 
-/* An item in the connection queue. */
+/* the number of items a thread's queue holds.  must be a power of 2. */
+#define CQ_SIZE 1024
+
+/*
+ * An item in a thread's queue: either a new connection for it to set up, or
+ * if fn is set, some other work for it to do by calling fn(arg).
+ */
 typedef struct conn_queue_item CQ_ITEM;
 struct conn_queue_item {
     int     sfd;
@@ -34,26 +49,85 @@ struct conn_queue_item {
     struct sockaddr addr;
     socklen_t addrlen;
     conn_buffer_group_t* cbg;
-    CQ_ITEM *next;
+    void    (*fn)(void *arg);
+    void    *arg;
 };
 
-/* A connection queue. */
+typedef struct {
+    volatile unsigned int seq;  /* which lap of the ring the cell is ready for */
+    CQ_ITEM item;
+} CQ_CELL;
+
+/*
+ * A thread's queue: a ring that any thread can push to without locking, and
+ * that only the owning thread pops from.  A cell can be written when its seq
+ * equals the position being pushed, and read once it is one past that; see
+ * cq_push and cq_pop.
+ */
 typedef struct conn_queue CQ;
 struct conn_queue {
-    CQ_ITEM *head;
-    CQ_ITEM *tail;
-    size_t count;
-    pthread_mutex_t lock;
-    pthread_cond_t  cond;
+    CQ_CELL *cells;
+    volatile unsigned int head;     /* next position to push */
+    char pad[CACHE_LINE_SIZE - sizeof(unsigned int)];
+    volatile unsigned int tail;     /* next position to pop */
+    volatile int notified;          /* a wakeup is pending for the owner */
 };
 
 /* Lock for connection freelist */
 static pthread_mutex_t conn_lock;
 
-/* Lock for cache operations (item_*, assoc_*) */
+/*
+ * Lock for the LRU and the storage allocator (item_alloc, item_update, ...).
+ * This is recursive, as the item functions that normally run under an item
+ * lock alone take it themselves when they have to unlink or free an item.
+ */
 static pthread_mutex_t cache_lock;
 static pthread_mutexattr_t cache_attr;
 
+/*
+ * Locks for the hashtable, striped by the hash value of the key.  An item lock
+ * protects the hash chains of the buckets that map to it, and the refcounts of
+ * the items on those chains.  Locks are always acquired in the order
+ * expand_lock, item locks (in ascending order), cache_lock, slabs_lock.
+ */
+static pthread_mutex_t item_locks[ITEM_LOCK_COUNT];
+static pthread_mutexattr_t item_attr;
+
+/* Lock for hashtable expansion and bucket migration */
+static pthread_mutex_t expand_lock;
+
+/* signalled, under the expand lock, when an expansion starts. */
+static pthread_cond_t expand_cond;
+
+/* the number of buckets the maintenance thread migrates before it lets go of
+ * the expand lock. */
+#define ASSOC_MIGRATE_BATCH 256
+
+/* deferred deletes are taken off the timer wheel this many at a time, and one
+ * run carries out at most DEFERRED_DELETE_RUN_MAX of them before giving the
+ * main thread's other events a turn. */
+#define DEFERRED_DELETE_BATCH   64
+#define DEFERRED_DELETE_RUN_MAX 4096
+
+/* likewise for items whose expiration time has passed. */
+#define EXPIRY_REAP_BATCH       64
+#define EXPIRY_REAP_RUN_MAX     4096
+
+/*
+ * Per-thread epochs for lock-free gets.  A thread's epoch is odd while it is
+ * walking the hashtable without holding any locks.  Memory such a walk might
+ * touch (unlinked items, relocated chunks, the old hashtable) is not reused
+ * until every epoch that was odd has moved on; see mt_epoch_synchronize().
+ */
+typedef struct {
+    volatile uint64_t count;
+    char pad[CACHE_LINE_SIZE - sizeof(uint64_t)];
+} reader_epoch_t;
+
+static reader_epoch_t *reader_epochs;
+static int reader_epoch_count;
+static pthread_key_t reader_epoch_key;
+
 #if defined(USE_SLAB_ALLOCATOR)
 /* Lock for slab allocator operations */
 static pthread_mutex_t slabs_lock;
@@ -65,26 +139,26 @@ static pthread_mutex_t gstats_lock;
 /* Lock for global stats */
 static pthread_mutex_t conn_buffer_lock;
 
-/* Free list of CQ_ITEM structs */
-static CQ_ITEM *cqi_freelist;
-static pthread_mutex_t cqi_freelist_lock;
-
 /*
- * Each libevent instance has a wakeup pipe, which other threads
- * can use to signal that they've put a new connection on its queue.
+ * Each libevent instance has a wakeup eventfd (or a pipe, where there is no
+ * eventfd), which other threads use to signal that they've put something on
+ * its queue.
  */
 typedef struct {
     pthread_t thread_id;        /* unique ID of this thread */
     struct event_base *base;    /* libevent handle this thread uses */
-    struct event notify_event;  /* listen event for notify pipe */
+    struct event notify_event;  /* listen event for notify fd */
     struct event timer_event;   /* periodic timer */
     bool timer_initialized;     /* timer is up and running */
-    int notify_receive_fd;      /* receiving end of notify pipe */
-    int notify_send_fd;         /* sending end of notify pipe */
-    CQ  new_conn_queue;         /* queue of new connections to handle */
+    int notify_receive_fd;      /* receiving end of notify pipe, or the eventfd */
+    int notify_send_fd;         /* sending end of notify pipe, or the eventfd */
+    CQ  new_conn_queue;         /* queue of new connections and other work */
+    conn *listen_conn;          /* this thread's own listeners, with -A */
+    conn *listen_binary_conn;
 } LIBEVENT_THREAD;
 
 static LIBEVENT_THREAD *threads;
+static pthread_key_t thread_key;    /* the LIBEVENT_THREAD a worker runs */
 
 /*
  * Number of threads that have finished setting themselves up.
@@ -100,100 +174,85 @@ static void thread_libevent_process(int fd, short which, void *arg);
  * Initializes a connection queue.
  */
 static void cq_init(CQ *cq) {
-    pthread_mutex_init(&cq->lock, NULL);
-    pthread_cond_init(&cq->cond, NULL);
-    cq->head = NULL;
-    cq->tail = NULL;
-    cq->count = 0;
-}
+    unsigned int i;
 
-/*
- * Looks for an item on a connection queue, but doesn't block if there isn't
- * one.
- * Returns the item, or NULL if no item is available
- */
-static CQ_ITEM *cq_peek(CQ *cq) {
-    CQ_ITEM *item;
-
-    pthread_mutex_lock(&cq->lock);
-    item = cq->head;
-    if (NULL != item) {
-        cq->head = item->next;
-        if (NULL == cq->head) {
-            cq->tail = NULL;
-        }
-        assert(cq->count > 0);
-        cq->count--;
+    cq->cells = pool_malloc(sizeof(CQ_CELL) * CQ_SIZE, CQ_POOL);
+    if (cq->cells == NULL) {
+        perror("Can't allocate connection queue");
+        exit(1);
     }
-    pthread_mutex_unlock(&cq->lock);
-
-    return item;
+    for (i = 0; i < CQ_SIZE; i++) {
+        cq->cells[i].seq = i;
+    }
+    cq->head = 0;
+    cq->tail = 0;
+    cq->notified = 0;
 }
 
 /*
- * Adds an item to a connection queue.
+ * Takes the next item off a connection queue.  Only the thread that owns the
+ * queue may call this.
+ *
+ * Returns false if the queue is empty.
  */
-static void cq_push(CQ *cq, CQ_ITEM *item) {
-    item->next = NULL;
+static bool cq_pop(CQ *cq, CQ_ITEM *item) {
+    unsigned int pos = cq->tail;
+    CQ_CELL *cell = &cq->cells[pos & (CQ_SIZE - 1)];
 
-    pthread_mutex_lock(&cq->lock);
-    if (NULL == cq->tail)
-        cq->head = item;
-    else
-        cq->tail->next = item;
-    cq->tail = item;
-    cq->count++;
-    pthread_cond_signal(&cq->cond);
-    pthread_mutex_unlock(&cq->lock);
+    if (cell->seq != pos + 1) {
+        return false;
+    }
+    memory_barrier();
+    *item = cell->item;
+    memory_barrier();
+    /* ready for the push one lap later. */
+    cell->seq = pos + CQ_SIZE;
+    cq->tail = pos + 1;
+    return true;
 }
 
-
 /*
- * Returns a fresh connection queue item.
+ * Adds an item to a connection queue.  Any number of threads may push at
+ * once; each claims a position by advancing head.
+ *
+ * Returns false if the queue is full.
  */
-static CQ_ITEM *cqi_new() {
-    CQ_ITEM *item = NULL;
-    pthread_mutex_lock(&cqi_freelist_lock);
-    if (cqi_freelist) {
-        item = cqi_freelist;
-        cqi_freelist = item->next;
-    }
-    pthread_mutex_unlock(&cqi_freelist_lock);
+static bool cq_push(CQ *cq, const CQ_ITEM *item) {
+    unsigned int pos = cq->head;
+    CQ_CELL *cell;
 
-    if (NULL == item) {
-        int i;
+    while (1) {
+        int dif;
 
-        /* Allocate a bunch of items at once to reduce fragmentation */
-        item = pool_malloc(sizeof(CQ_ITEM) * ITEMS_PER_ALLOC, CQ_POOL);
-        if (NULL == item)
-            return NULL;
+        cell = &cq->cells[pos & (CQ_SIZE - 1)];
+        dif = (int) (cell->seq - pos);
+        if (dif == 0) {
+            unsigned int prev = __sync_val_compare_and_swap(&cq->head, pos, pos + 1);
 
-        /*
-         * Link together all the new items except the first one
-         * (which we'll return to the caller) for placement on
-         * the freelist.
-         */
-        for (i = 2; i < ITEMS_PER_ALLOC; i++)
-            item[i - 1].next = &item[i];
-
-        pthread_mutex_lock(&cqi_freelist_lock);
-        item[ITEMS_PER_ALLOC - 1].next = cqi_freelist;
-        cqi_freelist = &item[1];
-        pthread_mutex_unlock(&cqi_freelist_lock);
+            if (prev == pos) {
+                break;
+            }
+            pos = prev;
+        } else if (dif < 0) {
+            /* the owner hasn't popped this cell from the last lap. */
+            return false;
+        } else {
+            /* another thread pushed here first. */
+            pos = cq->head;
+        }
     }
 
-    return item;
+    cell->item = *item;
+    write_barrier();
+    cell->seq = pos + 1;
+    return true;
 }
 
-
 /*
- * Frees a connection queue item (adds it to the freelist.)
+ * Returns the number of items waiting on a connection queue.
  */
-static void cqi_free(CQ_ITEM *item) {
-    pthread_mutex_lock(&cqi_freelist_lock);
-    item->next = cqi_freelist;
-    cqi_freelist = item;
-    pthread_mutex_unlock(&cqi_freelist_lock);
+static unsigned int cq_depth(const CQ *cq) {
+    return cq->head - cq->tail;
 }
 
 
@@ -207,6 +266,24 @@ static void create_worker(unsigned worker_num, void *(*func)(void *), void *arg)
 
     pthread_attr_init(&attr);
 
+#if defined(HAVE_PTHREAD_ATTR_SETAFFINITY_NP)
+    /* pin the thread before it starts, so that everything it touches first
+     * lands on its own node. */
+    if (settings.worker_cpu_count > 0) {
+        int cpu = settings.worker_cpus[(worker_num - 1) % settings.worker_cpu_count];
+        cpu_set_t cpus;
+
+        CPU_ZERO(&cpus);
+        CPU_SET(cpu, &cpus);
+        pthread_attr_setaffinity_np(&attr, sizeof(cpus), &cpus);
+#if defined(USE_NUMA)
+        if (numa_available() >= 0 && numa_node_of_cpu(cpu) >= 0) {
+            conn_buffer_group_set_node(worker_num - 1, numa_node_of_cpu(cpu));
+        }
+#endif /* #if defined(USE_NUMA) */
+    }
+#endif /* #if defined(HAVE_PTHREAD_ATTR_SETAFFINITY_NP) */
+
     if ((ret = pthread_create(&thread, &attr, func, arg)) != 0) {
         fprintf(stderr, "Can't create thread: %s\n",
                 strerror(ret));
@@ -296,6 +373,8 @@ static void *worker_libevent(void *arg) {
     pthread_cond_signal(&init_cond);
     pthread_mutex_unlock(&init_lock);
     STATS_SET_TLS(me - threads); /* set thread specific stats structure */
+    pthread_setspecific(reader_epoch_key, &reader_epochs[me - threads]);
+    pthread_setspecific(thread_key, me);
     clock_handler(0, 0, me);
 
     return (void*) (intptr_t) event_base_loop(me->base, 0);
@@ -303,38 +382,76 @@ static void *worker_libevent(void *arg) {
 
 
 /*
- * Processes an incoming "handle a new connection" item. This is called when
- * input arrives on the libevent wakeup pipe.
+ * Processes the items on a thread's queue. This is called when input arrives
+ * on the libevent wakeup fd.
  */
 static void thread_libevent_process(int fd, short which, void *arg) {
     LIBEVENT_THREAD *me = arg;
-    CQ_ITEM *item;
+    CQ_ITEM item;
+#if defined(HAVE_EVENTFD)
+    uint64_t buf;
+#else
     char buf[1];
+#endif /* #if defined(HAVE_EVENTFD) */
 
-    if (read(fd, buf, 1) != 1)
+    if (read(fd, &buf, sizeof(buf)) != sizeof(buf))
         if (settings.verbose > 0)
             fprintf(stderr, "Can't read from libevent pipe\n");
 
-    item = cq_peek(&me->new_conn_queue);
+    /* anything pushed from here on needs another wakeup; anything pushed
+     * before is drained below. */
+    me->new_conn_queue.notified = 0;
+    memory_barrier();
+
+    while (cq_pop(&me->new_conn_queue, &item)) {
+        conn* c;
 
-    if (NULL != item) {
-        conn* c = conn_new(item->sfd, item->init_state, item->event_flags,
-                           item->cbg, item->is_udp,
-                           item->is_binary, &item->addr, item->addrlen,
-                           me->base);
+        if (item.fn != NULL) {
+            item.fn(item.arg);
+            continue;
+        }
+
+        c = conn_new(item.sfd, item.init_state, item.event_flags,
+                     item.cbg, item.is_udp,
+                     item.is_binary, &item.addr, item.addrlen,
+                     me->base);
         if (c == NULL) {
-            if (item->is_udp) {
+            if (item.is_udp) {
                 fprintf(stderr, "Can't listen for events on UDP socket\n");
                 exit(1);
             } else {
                 if (settings.verbose > 0) {
                     fprintf(stderr, "Can't listen for events on fd %d\n",
-                        item->sfd);
+                        item.sfd);
                 }
-                close(item->sfd);
+                close(item.sfd);
             }
         }
-        cqi_free(item);
+    }
+}
+
+/*
+ * Puts an item on a thread's queue, and wakes the thread up unless a wakeup
+ * is already pending.  A burst of items thus costs the thread one wakeup.
+ * Must not be called by the thread that owns the queue.
+ */
+static void thread_queue_push(LIBEVENT_THREAD *thread, const CQ_ITEM *item) {
+    while (! cq_push(&thread->new_conn_queue, item)) {
+        /* full, but the thread is draining it; it never waits on us. */
+        sched_yield();
+    }
+
+    memory_barrier();
+    if (__sync_bool_compare_and_swap(&thread->new_conn_queue.notified, 0, 1)) {
+#if defined(HAVE_EVENTFD)
+        uint64_t one = 1;
+
+        if (write(thread->notify_send_fd, &one, sizeof(one)) != sizeof(one)) {
+#else
+        if (write(thread->notify_send_fd, "", 1) != 1) {
+#endif /* #if defined(HAVE_EVENTFD) */
+            perror("Writing to thread notify pipe");
+        }
     }
 }
 
@@ -349,7 +466,7 @@ static int last_thread = 0;
 void dispatch_conn_new(int sfd, int init_state, int event_flags,
                        conn_buffer_group_t* cbg, const bool is_udp, const bool is_binary,
                        const struct sockaddr* const addr, socklen_t addrlen) {
-    CQ_ITEM *item = cqi_new();
+    CQ_ITEM item;
     /* Count threads from 1..N to skip the dispatch thread.*/
     int tix = (last_thread % (settings.num_threads - 1)) + 1;
     LIBEVENT_THREAD *thread = threads+tix;
@@ -357,24 +474,75 @@ void dispatch_conn_new(int sfd, int init_state, int event_flags,
     assert(tix != 0); /* Never dispatch to thread 0 */
     last_thread = tix;
 
-    item->sfd = sfd;
-    item->init_state = init_state;
-    item->event_flags = event_flags;
+    item.sfd = sfd;
+    item.init_state = init_state;
+    item.event_flags = event_flags;
     if (cbg) {
-        item->cbg = cbg;
+        item.cbg = cbg;
     } else {
-        item->cbg = get_conn_buffer_group(tix - 1);
+        item.cbg = get_conn_buffer_group(tix - 1);
+    }
+    item.is_udp = is_udp;
+    item.is_binary = is_binary;
+    memcpy(&item.addr, addr, addrlen);
+    item.addrlen = addrlen;
+    item.fn = NULL;
+    item.arg = NULL;
+
+    thread_queue_push(thread, &item);
+}
+
+/*
+ * Has worker thread tix call fn(arg) from its event loop.
+ */
+void dispatch_work(int tix, void (*fn)(void *arg), void *arg) {
+    CQ_ITEM item;
+
+    assert(tix > 0 && tix < settings.num_threads);
+    memset(&item, 0, sizeof(item));
+    item.fn = fn;
+    item.arg = arg;
+    thread_queue_push(&threads[tix], &item);
+}
+
+/*
+ * Sets up a connection that the calling worker thread accepted itself, rather
+ * than handing it to another thread.  This is how connections arrive when
+ * each worker has its own listening socket (see -A).
+ */
+void dispatch_conn_local(int sfd, int init_state, int event_flags, const bool is_binary,
+                         const struct sockaddr* const addr, socklen_t addrlen) {
+    LIBEVENT_THREAD *me = pthread_getspecific(thread_key);
+    conn* c;
+
+    assert(me != NULL);
+    c = conn_new(sfd, init_state, event_flags, get_conn_buffer_group(me - threads - 1),
+                 false, is_binary, addr, addrlen, me->base);
+    if (c == NULL) {
+        if (settings.verbose > 0) {
+            fprintf(stderr, "Can't listen for events on fd %d\n", sfd);
+        }
+        close(sfd);
+    } else if (init_state == conn_listening) {
+        if (is_binary) {
+            me->listen_binary_conn = c;
+        } else {
+            me->listen_conn = c;
+        }
     }
-    item->is_udp = is_udp;
-    item->is_binary = is_binary;
-    memcpy(&item->addr, addr, addrlen);
-    item->addrlen = addrlen;
+}
 
-    cq_push(&thread->new_conn_queue, item);
+/*
+ * Returns the calling worker's own listening connection for the given
+ * protocol, or NULL if it has none.
+ */
+conn* thread_listen_conn(const bool is_binary) {
+    LIBEVENT_THREAD *me = pthread_getspecific(thread_key);
 
-    if (write(thread->notify_send_fd, "", 1) != 1) {
-        perror("Writing to thread notify pipe");
+    if (me == NULL) {
+        return NULL;
     }
+    return is_binary ? me->listen_binary_conn : me->listen_conn;
 }
 
 /*
@@ -412,23 +580,175 @@ void mt_clock_handler(int fd, short which, void *arg)
 
 /********************************* ITEM ACCESS *******************************/
 
+void mt_item_lock(uint32_t hv) {
+    pthread_mutex_lock(&item_locks[ITEM_LOCK_INDEX(hv)]);
+}
+
+/*
+ * Acquires an item lock only if it is free.  This is how code that already
+ * holds the cache lock (e.g., eviction) gets at items in arbitrary buckets
+ * without violating the lock order.
+ */
+bool mt_item_trylock(uint32_t hv) {
+    return (pthread_mutex_trylock(&item_locks[ITEM_LOCK_INDEX(hv)]) == 0);
+}
+
+void mt_item_unlock(uint32_t hv) {
+    pthread_mutex_unlock(&item_locks[ITEM_LOCK_INDEX(hv)]);
+}
+
+static void item_lock_all(void) {
+    int ix;
+
+    for (ix = 0; ix < ITEM_LOCK_COUNT; ix++) {
+        pthread_mutex_lock(&item_locks[ix]);
+    }
+}
+
 /*
- * Walks through the list of deletes that have been deferred because the items
- * were locked down at the tmie.
+ * Acquires every item lock, or none of them if any one is busy.
  */
-void mt_run_deferred_deletes() {
+bool mt_item_trylock_all(void) {
+    int ix;
+
+    for (ix = 0; ix < ITEM_LOCK_COUNT; ix++) {
+        if (pthread_mutex_trylock(&item_locks[ix]) != 0) {
+            while (ix-- > 0) {
+                pthread_mutex_unlock(&item_locks[ix]);
+            }
+            return false;
+        }
+    }
+    return true;
+}
+
+void mt_item_unlock_all(void) {
+    int ix;
+
+    for (ix = ITEM_LOCK_COUNT - 1; ix >= 0; ix--) {
+        pthread_mutex_unlock(&item_locks[ix]);
+    }
+}
+
+void mt_cache_lock(void) {
     pthread_mutex_lock(&cache_lock);
-    do_run_deferred_deletes();
+}
+
+void mt_cache_unlock(void) {
     pthread_mutex_unlock(&cache_lock);
 }
 
 /*
- * Allocates a new item.
+ * Starts a lock-free walk of the hashtable.  Returns false if this thread
+ * can't do one, in which case the caller must take the item lock.
+ */
+bool mt_epoch_enter(void) {
+    reader_epoch_t *epoch = pthread_getspecific(reader_epoch_key);
+
+    if (epoch == NULL) {
+        return false;
+    }
+    epoch->count++;
+    memory_barrier();
+    return true;
+}
+
+void mt_epoch_exit(void) {
+    reader_epoch_t *epoch = pthread_getspecific(reader_epoch_key);
+
+    memory_barrier();
+    epoch->count++;
+}
+
+/*
+ * Waits until no thread can still be looking at memory that was unlinked
+ * before this was called.  This is called with locks held; that's fine, as
+ * lock-free readers never wait on a lock inside an epoch.
+ */
+void mt_epoch_synchronize(void) {
+    int ix;
+
+    if (! settings.lockfree_get) {
+        return;
+    }
+
+    memory_barrier();
+    for (ix = 0; ix < reader_epoch_count; ix++) {
+        uint64_t count = reader_epochs[ix].count;
+
+        if (count & 1) {
+            while (reader_epochs[ix].count == count) {
+                sched_yield();
+            }
+        }
+    }
+}
+
+/*
+ * Carries out the deferred deletes that are due, a batch at a time.  The
+ * cache lock is only held to take a batch off the timer wheel and then for
+ * each item in turn, under that item's own lock.  Returns true if it stopped
+ * at DEFERRED_DELETE_RUN_MAX with more deletes possibly due.
+ */
+bool mt_run_deferred_deletes() {
+    item *due[DEFERRED_DELETE_BATCH];
+    size_t count, ix, total = 0;
+
+    do {
+        pthread_mutex_lock(&cache_lock);
+        count = do_expire_deferred_deletes(due, DEFERRED_DELETE_BATCH);
+        pthread_mutex_unlock(&cache_lock);
+
+        for (ix = 0; ix < count; ix++) {
+            uint32_t hv = assoc_item_hash(due[ix]);
+
+            mt_item_lock(hv);
+            pthread_mutex_lock(&cache_lock);
+            do_run_deferred_delete(due[ix]);
+            pthread_mutex_unlock(&cache_lock);
+            mt_item_unlock(hv);
+        }
+        total += count;
+    } while (count == DEFERRED_DELETE_BATCH && total < DEFERRED_DELETE_RUN_MAX);
+
+    return count == DEFERRED_DELETE_BATCH;
+}
+
+/*
+ * Reclaims the items whose expiration time has passed, a batch at a time, in
+ * the same way.  Returns true if it stopped at EXPIRY_REAP_RUN_MAX with more
+ * items possibly due.
  */
-item *mt_item_alloc(char *key, size_t nkey, int flags, rel_time_t exptime, int nbytes, const struct in_addr addr) {
+bool mt_reap_expired_items() {
+    expiry_entry_t due[EXPIRY_REAP_BATCH];
+    size_t count, ix, total = 0;
+
+    do {
+        pthread_mutex_lock(&cache_lock);
+        count = expiry_take_due(current_time, due, EXPIRY_REAP_BATCH);
+        pthread_mutex_unlock(&cache_lock);
+
+        for (ix = 0; ix < count; ix++) {
+            mt_item_lock(due[ix].hv);
+            pthread_mutex_lock(&cache_lock);
+            do_expiry_reap(&due[ix]);
+            pthread_mutex_unlock(&cache_lock);
+            mt_item_unlock(due[ix].hv);
+        }
+        total += count;
+    } while (count == EXPIRY_REAP_BATCH && total < EXPIRY_REAP_RUN_MAX);
+
+    return count == EXPIRY_REAP_BATCH;
+}
+
+/*
+ * Allocates a new item.  If rejected isn't NULL, the item is subject to the
+ * admission filter.
+ */
+item *mt_item_alloc(char *key, size_t nkey, int flags, rel_time_t exptime, int nbytes, const struct in_addr addr, bool *rejected) {
     item *it;
     pthread_mutex_lock(&cache_lock);
-    it = do_item_alloc(key, nkey, flags, exptime, nbytes, addr);
+    it = do_item_alloc(key, nkey, flags, exptime, nbytes, addr, rejected);
     pthread_mutex_unlock(&cache_lock);
     return it;
 }
@@ -439,38 +759,139 @@ item *mt_item_alloc(char *key, size_t nkey, int flags, rel_time_t exptime, int n
  */
 item *mt_item_get_notedeleted(const char *key, const size_t nkey, bool *delete_locked) {
     item *it;
-    pthread_mutex_lock(&cache_lock);
-    it = do_item_get_notedeleted(key, nkey, delete_locked);
-    pthread_mutex_unlock(&cache_lock);
+    uint32_t hv = hash(key, nkey, 0);
+
+    admission_record(hv);
+
+    /* plain hits don't need the lock.  anything else (misses, delete-locked
+     * or expired items) is sorted out under it. */
+    if (settings.lockfree_get &&
+        (it = item_get_lockfree(key, nkey, hv)) != NULL) {
+        if (delete_locked) *delete_locked = false;
+        return it;
+    }
+
+    mt_item_lock(hv);
+    it = do_item_get_notedeleted(key, nkey, hv, delete_locked);
+    mt_item_unlock(hv);
     return it;
 }
 
+/* the most keys mt_item_get_multi() groups by item lock at a time. */
+#define ITEM_GET_MULTI_MAX 64
+
+static void item_get_multi_batch(item_lookup_t* lookups, const size_t count) {
+    item_lookup_t* order[ITEM_GET_MULTI_MAX];
+    size_t i, j, n = 0;
+
+    assert(count <= ITEM_GET_MULTI_MAX);
+
+    for (i = 0; i < count; i++) {
+        lookups[i].hv = hash(lookups[i].key, lookups[i].nkey, 0);
+        assoc_prefetch(lookups[i].hv);
+        admission_record(lookups[i].hv);
+    }
+
+    for (i = 0; i < count; i++) {
+        item_lookup_t* l = &lookups[i];
+
+        /* no item lock may be held here: item_get_lockfree() may drop a
+         * reference, which takes an item lock of its own. */
+        if (settings.lockfree_get &&
+            (l->it = item_get_lockfree(l->key, l->nkey, l->hv)) != NULL) {
+            continue;
+        }
+
+        /* the rest are sorted by item lock, as they come. */
+        for (j = n; j > 0 && ITEM_LOCK_INDEX(order[j - 1]->hv) > ITEM_LOCK_INDEX(l->hv); j--) {
+            order[j] = order[j - 1];
+        }
+        order[j] = l;
+        n++;
+    }
+
+    for (i = 0; i < n; i = j) {
+        uint32_t hv = order[i]->hv;
+
+        mt_item_lock(hv);
+        for (j = i; j < n && ITEM_LOCK_INDEX(order[j]->hv) == ITEM_LOCK_INDEX(hv); j++) {
+            order[j]->it = do_item_get_notedeleted(order[j]->key, order[j]->nkey,
+                                                   order[j]->hv, NULL);
+        }
+        mt_item_unlock(hv);
+    }
+}
+
+/*
+ * Looks up a batch of keys, as item_get() would look up each of them.  all the
+ * keys are hashed and their buckets prefetched before any of them are resolved,
+ * so that the cache misses on the hashtable overlap rather than being taken
+ * one key at a time.  the keys that need an item lock are grouped by lock, and
+ * each lock is taken once for all the keys in its group.
+ */
+void mt_item_get_multi(item_lookup_t* lookups, const size_t count) {
+    size_t done, n;
+
+    for (done = 0; done < count; done += n) {
+        n = count - done;
+        if (n > ITEM_GET_MULTI_MAX) {
+            n = ITEM_GET_MULTI_MAX;
+        }
+        item_get_multi_batch(lookups + done, n);
+    }
+}
+
 /*
  * Decrements the reference count on an item and adds it to the freelist if
  * needed.
  */
 void mt_item_deref(item *item) {
-    pthread_mutex_lock(&cache_lock);
+    uint32_t hv = assoc_item_hash(item);
+
+    mt_item_lock(hv);
     do_item_deref(item);
-    pthread_mutex_unlock(&cache_lock);
+    mt_item_unlock(hv);
 }
 
 /*
  * Unlinks an item from the LRU and hashtable.
  */
 void mt_item_unlink(item *item, long flags, const char* key) {
+    uint32_t hv = assoc_item_hash(item);
+
+    mt_item_lock(hv);
     pthread_mutex_lock(&cache_lock);
     do_item_unlink(item, flags, key);
     pthread_mutex_unlock(&cache_lock);
+    mt_item_unlock(hv);
 }
 
 /*
- * Moves an item to the back of the LRU queue.
+ * Moves an item to the back of the LRU queue.  Rather than take the cache lock
+ * on every hit, this only marks the item; the move is made when the item comes
+ * up for eviction at the tail of the LRU.
  */
 void mt_item_update(item *item) {
-    pthread_mutex_lock(&cache_lock);
-    do_item_update(item);
-    pthread_mutex_unlock(&cache_lock);
+#if defined(USE_FLAT_ALLOCATOR)
+    stats_t *stats = STATS_GET_TLS();
+
+    STATS_LOCK(stats);
+    if (ITEM_is_protected(item)) {
+        stats->lru_protected_hits++;
+    } else {
+        stats->lru_probation_hits++;
+    }
+    STATS_UNLOCK(stats);
+#endif /* #if defined(USE_FLAT_ALLOCATOR) */
+
+    /* do_item_update() will not reposition recently bumped items, and items
+     * that are already marked need not be marked again. */
+    if (ITEM_time(item) >= current_time - ITEM_UPDATE_INTERVAL ||
+        ITEM_is_bumped(item)) {
+        return;
+    }
+
+    ITEM_mark_bumped(item);
 }
 
 /*
@@ -478,10 +899,13 @@ void mt_item_update(item *item) {
  */
 int mt_defer_delete(item *item, time_t exptime) {
     int ret;
+    uint32_t hv = assoc_item_hash(item);
 
+    mt_item_lock(hv);
     pthread_mutex_lock(&cache_lock);
     ret = do_defer_delete(item, exptime);
     pthread_mutex_unlock(&cache_lock);
+    mt_item_unlock(hv);
     return ret;
 }
 
@@ -491,10 +915,17 @@ int mt_defer_delete(item *item, time_t exptime) {
 char *mt_add_delta(const char* key, const size_t nkey, const int incr, const unsigned int delta,
                    char *buf, uint32_t *res, const struct in_addr addr) {
     char *ret;
+    uint32_t hv = hash(key, nkey, 0);
 
+    mt_item_lock(hv);
     pthread_mutex_lock(&cache_lock);
     ret = do_add_delta(key, nkey, incr, delta, buf, res, addr);
     pthread_mutex_unlock(&cache_lock);
+    mt_item_unlock(hv);
+
+    if (assoc_expand_needed()) {
+        mt_assoc_expand();
+    }
     return ret;
 }
 
@@ -503,10 +934,17 @@ char *mt_add_delta(const char* key, const size_t nkey, const int incr, const uns
  */
 int mt_store_item(item *item, int comm, const char* key) {
     int ret;
+    uint32_t hv = assoc_item_hash(item);
 
+    mt_item_lock(hv);
     pthread_mutex_lock(&cache_lock);
     ret = do_store_item(item, comm, key);
     pthread_mutex_unlock(&cache_lock);
+    mt_item_unlock(hv);
+
+    if (assoc_expand_needed()) {
+        mt_assoc_expand();
+    }
     return ret;
 }
 
@@ -514,9 +952,11 @@ int mt_store_item(item *item, int comm, const char* key) {
  * Flushes expired items after a flush_all call
  */
 void mt_item_flush_expired() {
+    item_lock_all();
     pthread_mutex_lock(&cache_lock);
     do_item_flush_expired();
     pthread_mutex_unlock(&cache_lock);
+    item_unlock_all();
 }
 
 /*
@@ -531,9 +971,8 @@ char *mt_item_cachedump(unsigned int slabs_clsid, unsigned int limit, unsigned i
     return ret;
 }
 
-#if defined(USE_SLAB_ALLOCATOR)
 /*
- * Dumps statistics about slab classes
+ * Dumps statistics about slab classes, or LRU segments
  */
 char *mt_item_stats(int *bytes) {
     char *ret;
@@ -543,7 +982,6 @@ char *mt_item_stats(int *bytes) {
     pthread_mutex_unlock(&cache_lock);
     return ret;
 }
-#endif /* #if defined(USE_SLAB_ALLOCATOR) */
 
 /*
  * Dumps a list of objects of each size in 32-byte increments
@@ -571,26 +1009,80 @@ size_t mt_append_thread_stats(char* const buffer_start,
         off = append_to_buffer(buffer_start, buffer_size, off, reserved,
                                "STAT thread_cq_depth_%d %u\r\n",
                                ix,
-                               threads[ix].new_conn_queue.count);
+                               cq_depth(&threads[ix].new_conn_queue));
     }
     return off;
 }
 
 /****************************** HASHTABLE MODULE *****************************/
 
+/*
+ * Grows the hashtable.  Every item lock is held, so this can't be done by the
+ * thread that noticed the table was full until it has dropped its own.
+ */
+void mt_assoc_expand() {
+    pthread_mutex_lock(&expand_lock);
+    item_lock_all();
+    do_assoc_expand();
+    item_unlock_all();
+    pthread_cond_signal(&expand_cond);
+    pthread_mutex_unlock(&expand_lock);
+}
+
+/*
+ * Calls fn on every item whose key hashes onto the item lock of the given
+ * stripe.  Walking the table a stripe at a time only ever holds up the
+ * commands on one item lock.
+ */
+void mt_assoc_walk_stripe(uint32_t stripe, void (*fn)(item* it, void* arg), void* arg) {
+    pthread_mutex_lock(&expand_lock);
+    mt_item_lock(stripe);
+    do_assoc_walk_stripe(stripe, fn, arg);
+    mt_item_unlock(stripe);
+    pthread_mutex_unlock(&expand_lock);
+}
+
 int mt_assoc_expire_regex(char *pattern) {
     int ret;
 
-    pthread_mutex_lock(&cache_lock);
+    item_lock_all();
     ret = do_assoc_expire_regex(pattern);
-    pthread_mutex_unlock(&cache_lock);
+    item_unlock_all();
     return ret;
 }
 
-void mt_assoc_move_next_bucket() {
-    pthread_mutex_lock(&cache_lock);
-    do_assoc_move_next_bucket();
-    pthread_mutex_unlock(&cache_lock);
+/*
+ * Migrates buckets to the new hashtable whenever an expansion is in progress,
+ * so that it finishes (and the old table is freed) whether or not there is
+ * any traffic.  Each bucket is moved under its own item lock, and the expand
+ * lock is dropped between batches.
+ */
+static void *assoc_maintenance_thread(void *arg) {
+    uint32_t bucket;
+    int i;
+
+    /* freeing the old table is accounted in the stats.  every thread must have
+     * its own, so we get the slot after the workers'. */
+    STATS_SET_TLS(settings.num_threads);
+
+    pthread_mutex_lock(&expand_lock);
+    while (1) {
+        while (! assoc_expanding(&bucket)) {
+            pthread_cond_wait(&expand_cond, &expand_lock);
+        }
+
+        for (i = 0; i < ASSOC_MIGRATE_BATCH && assoc_expanding(&bucket); i++) {
+            mt_item_lock(bucket);
+            do_assoc_move_next_bucket();
+            mt_item_unlock(bucket);
+        }
+
+        pthread_mutex_unlock(&expand_lock);
+        sched_yield();
+        pthread_mutex_lock(&expand_lock);
+    }
+
+    return NULL;
 }
 
 #if defined(USE_SLAB_ALLOCATOR)
@@ -623,9 +1115,15 @@ char *mt_slabs_stats(int *buflen) {
 int mt_slabs_reassign(unsigned char srcid, unsigned char dstid) {
     int ret;
 
+    /* reassigning unlinks every item on the slab page. */
+    item_lock_all();
+    pthread_mutex_lock(&cache_lock);
+    do_item_reclaim();
     pthread_mutex_lock(&slabs_lock);
     ret = do_slabs_reassign(srcid, dstid);
     pthread_mutex_unlock(&slabs_lock);
+    pthread_mutex_unlock(&cache_lock);
+    item_unlock_all();
     return ret;
 }
 
@@ -646,38 +1144,64 @@ char* flat_allocator_stats(size_t* result_size) {
     pthread_mutex_unlock(&cache_lock);
     return ret;
 }
+
+void flat_storage_adopt(void) {
+    pthread_mutex_lock(&cache_lock);
+    do_flat_storage_adopt();
+    pthread_mutex_unlock(&cache_lock);
+}
+
+/* the cache lock is never given back, so that nothing changes the items
+ * between saving them and exiting. */
+void flat_storage_save(void) {
+    pthread_mutex_lock(&cache_lock);
+    do_flat_storage_save();
+}
 #endif /* #if defined(USE_FLAT_ALLOCATOR) */
 
+#if defined(USE_LOG_ALLOCATOR)
+/******************************* LOG ALLOCATOR *******************************/
+char* log_allocator_stats(size_t* result_size) {
+    char* ret;
+
+    pthread_mutex_lock(&cache_lock);
+    ret = do_log_allocator_stats(result_size);
+    pthread_mutex_unlock(&cache_lock);
+    return ret;
+}
+#endif /* #if defined(USE_LOG_ALLOCATOR) */
+
 /******************************* GLOBAL STATS ******************************/
 
+/*
+ * each thread only ever writes its own stats, so updates don't take a lock.
+ * other threads read them through mt_stats_aggregate, which retries a copy
+ * that raced with an update (see STATS_LOCK).  "stats reset" can't zero
+ * another thread's counters either; instead it remembers their totals at the
+ * time, which are subtracted from every later aggregate.
+ */
 static struct {
     stats_t *stats;
     size_t stats_count;
     pthread_key_t tlsKey;
+    pthread_mutex_t reset_lock;         /* protects reset. */
+    stats_t reset;
 } l;
 
 void mt_stats_init(int threads) {
-    int ix;
-
     pthread_key_create(&l.tlsKey, NULL);
-    l.stats = calloc(threads, sizeof(stats_t));
-    l.stats_count = threads;
+    /* one for each worker, and one for the hashtable maintenance thread. */
+    l.stats_count = threads + 1;
+#if defined(USE_LOG_ALLOCATOR)
+    /* and one for the log cleaner. */
+    l.stats_count++;
+#endif /* #if defined(USE_LOG_ALLOCATOR) */
+    l.stats = calloc(l.stats_count, sizeof(stats_t));
+    pthread_mutex_init(&l.reset_lock, NULL);
 
-    for (ix = 0; ix < threads; ix++) {
-      stats_t *stats = &l.stats[ix];
-      pthread_mutex_init(&stats->lock, NULL);
-    }
     stats_prefix_init();
-    stats_buckets_init();
-    stats_cost_benefit_init();
-}
-
-void mt_stats_lock(stats_t *stats) {
-    pthread_mutex_lock(&stats->lock);
-}
-
-void mt_stats_unlock(stats_t *stats) {
-    pthread_mutex_unlock(&stats->lock);
+    stats_histograms_init(l.stats, l.stats_count);
+    stats_latency_init(l.stats, l.stats_count);
 }
 
 void mt_global_stats_lock() {
@@ -703,32 +1227,28 @@ void mt_stats_set_tls(int ix) {
     assert(rc == 0);
 }
 
-void mt_stats_reset(void) {
-    stats_t *stats;
-    int ix;
+/* copies a thread's stats, retrying until the copy isn't torn by an update. */
+static void stats_snapshot(stats_t *snapshot, const stats_t *stats) {
+    unsigned int seq;
 
-    for (ix = 0; ix < l.stats_count; ix++) {
-        stats = &l.stats[ix];
-        STATS_LOCK(stats);
-        stats->total_items = stats->total_conns = 0;
-        stats->get_cmds = stats->set_cmds = stats->get_hits = stats->get_misses = stats->evictions = 0;
-        stats->arith_cmds = stats->arith_hits = 0;
-        stats->bytes_read = stats->bytes_written = 0;
-        STATS_UNLOCK(stats);
-    }
-    stats_prefix_clear();
+    do {
+        seq = *(volatile const unsigned int *) &stats->seq;
+        memory_barrier();
+        memcpy(snapshot, stats, sizeof(*snapshot));
+        memory_barrier();
+    } while ((seq & 1) || seq != *(volatile const unsigned int *) &stats->seq);
 }
 
-void mt_stats_aggregate(stats_t *accum) {
-    stats_t *stats;
+/* sums every thread's stats, without subtracting the last reset. */
+static void stats_aggregate_raw(stats_t *accum) {
+    stats_t snapshot, *stats = &snapshot;
     int ix;
 
 #define _AGGREGATE(x)    (accum->x += stats->x)
 
     memset(accum, 0, sizeof(*accum));
     for (ix = 0; ix < l.stats_count; ix++) {
-        stats = &l.stats[ix];
-        STATS_LOCK(stats);
+        stats_snapshot(&snapshot, &l.stats[ix]);
         _AGGREGATE(curr_items);
         _AGGREGATE(total_items);
         _AGGREGATE(item_storage_allocated);
@@ -739,10 +1259,20 @@ void mt_stats_aggregate(stats_t *accum) {
         _AGGREGATE(get_cmds);
         _AGGREGATE(set_cmds);
         _AGGREGATE(get_hits);
+        _AGGREGATE(lockfree_hits);
         _AGGREGATE(get_misses);
         _AGGREGATE(arith_cmds);
         _AGGREGATE(arith_hits);
         _AGGREGATE(evictions);
+        _AGGREGATE(evictions_of_live_items);
+        _AGGREGATE(expired_reclaimed);
+        _AGGREGATE(admission_rejects);
+        _AGGREGATE(lru_bumps);
+        _AGGREGATE(lru_bump_drops);
+        _AGGREGATE(lru_probation_hits);
+        _AGGREGATE(lru_protected_hits);
+        _AGGREGATE(lru_probation_evictions);
+        _AGGREGATE(lru_protected_evictions);
         _AGGREGATE(bytes_read);
         _AGGREGATE(bytes_written);
         _AGGREGATE(get_bytes);
@@ -763,11 +1293,49 @@ void mt_stats_aggregate(stats_t *accum) {
         _AGGREGATE(mp_bytecount_errors);
         _AGGREGATE(mp_pool_errors);
 #endif /* #if defined(MEMORY_POOL_CHECKS) */
-        STATS_UNLOCK(stats);
     }
 #undef _AGGREGATE
 }
 
+/* applies fn to each of the stats that "stats reset" clears. */
+#define RESET_STATS(fn)                         \
+    fn(total_items); fn(total_conns);           \
+    fn(get_cmds); fn(set_cmds);                 \
+    fn(get_hits); fn(get_misses);               \
+    fn(evictions); fn(lockfree_hits);           \
+    fn(evictions_of_live_items);                \
+    fn(expired_reclaimed);                      \
+    fn(admission_rejects);                      \
+    fn(lru_bumps); fn(lru_bump_drops);          \
+    fn(lru_probation_hits);                     \
+    fn(lru_protected_hits);                     \
+    fn(lru_probation_evictions);                \
+    fn(lru_protected_evictions);                \
+    fn(arith_cmds); fn(arith_hits);             \
+    fn(bytes_read); fn(bytes_written)
+
+void mt_stats_reset(void) {
+    stats_t accum;
+
+    stats_aggregate_raw(&accum);
+    pthread_mutex_lock(&l.reset_lock);
+#define _RESET(x)        (l.reset.x = accum.x)
+    RESET_STATS(_RESET);
+#undef _RESET
+    pthread_mutex_unlock(&l.reset_lock);
+    stats_prefix_clear();
+    stats_latency_reset();
+}
+
+void mt_stats_aggregate(stats_t *accum) {
+    stats_aggregate_raw(accum);
+    pthread_mutex_lock(&l.reset_lock);
+#define _SUBTRACT(x)     (accum->x -= l.reset.x)
+    RESET_STATS(_SUBTRACT);
+#undef _SUBTRACT
+    pthread_mutex_unlock(&l.reset_lock);
+}
+
 /*
  * Initializes the thread subsystem, creating various worker threads.
  *
@@ -775,14 +1343,31 @@ void mt_stats_aggregate(stats_t *accum) {
  * main_base Event base for main thread
  */
 void thread_init(int nthreads, struct event_base *main_base) {
-    int         i;
+    int         i, ret;
+    pthread_t   maintenance_thread;
 
     pthread_mutexattr_init(&cache_attr);
+    pthread_mutexattr_settype(&cache_attr, PTHREAD_MUTEX_RECURSIVE);
+    pthread_mutex_init(&cache_lock, &cache_attr);
+    pthread_mutexattr_init(&item_attr);
 #ifdef PTHREAD_ADAPTIVE_MUTEX_INITIALIZER_NP
-    pthread_mutexattr_settype(&cache_attr, PTHREAD_MUTEX_ADAPTIVE_NP);
+    pthread_mutexattr_settype(&item_attr, PTHREAD_MUTEX_ADAPTIVE_NP);
 #endif
-    pthread_mutex_init(&cache_lock, &cache_attr);
+    for (i = 0; i < ITEM_LOCK_COUNT; i++) {
+        pthread_mutex_init(&item_locks[i], &item_attr);
+    }
+    pthread_mutex_init(&expand_lock, NULL);
+    pthread_cond_init(&expand_cond, NULL);
     pthread_mutex_init(&conn_lock, NULL);
+
+    reader_epochs = calloc(nthreads, sizeof(reader_epoch_t));
+    if (! reader_epochs) {
+        perror("Can't allocate reader epochs");
+        exit(1);
+    }
+    reader_epoch_count = nthreads;
+    pthread_key_create(&reader_epoch_key, NULL);
+    pthread_key_create(&thread_key, NULL);
 #if defined(USE_SLAB_ALLOCATOR)
     pthread_mutex_init(&slabs_lock, NULL);
 #endif /* #if defined(USE_SLAB_ALLOCATOR) */
@@ -792,9 +1377,6 @@ void thread_init(int nthreads, struct event_base *main_base) {
     pthread_mutex_init(&init_lock, NULL);
     pthread_cond_init(&init_cond, NULL);
 
-    pthread_mutex_init(&cqi_freelist_lock, NULL);
-    cqi_freelist = NULL;
-
     threads = calloc(nthreads, sizeof(LIBEVENT_THREAD));
     if (! threads) {
         perror("Can't allocate thread descriptors");
@@ -805,6 +1387,15 @@ void thread_init(int nthreads, struct event_base *main_base) {
     threads[0].thread_id = pthread_self();
 
     for (i = 0; i < nthreads; i++) {
+#if defined(HAVE_EVENTFD)
+        int efd = eventfd(0, EFD_NONBLOCK);
+        if (efd == -1) {
+            perror("Can't create notify eventfd");
+            exit(1);
+        }
+
+        threads[i].notify_receive_fd = threads[i].notify_send_fd = efd;
+#else
         int fds[2];
         if (pipe(fds)) {
             perror("Can't create notify pipe");
@@ -813,6 +1404,7 @@ void thread_init(int nthreads, struct event_base *main_base) {
 
         threads[i].notify_receive_fd = fds[0];
         threads[i].notify_send_fd = fds[1];
+#endif /* #if defined(HAVE_EVENTFD) */
 
         setup_thread(&threads[i]);
     }
@@ -822,6 +1414,13 @@ void thread_init(int nthreads, struct event_base *main_base) {
         create_worker(i, worker_libevent, &threads[i]);
     }
 
+    if ((ret = pthread_create(&maintenance_thread, NULL,
+                              assoc_maintenance_thread, NULL)) != 0) {
+        fprintf(stderr, "Can't create hash maintenance thread: %s\n",
+                strerror(ret));
+        exit(1);
+    }
+
     /* Wait for all the threads to set themselves up before returning. */
     pthread_mutex_lock(&init_lock);
     init_count++; /* main thread */
@@ -0,0 +1,165 @@
+/* -*- Mode: C; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+
+#include "generic.h"
+
+#include <assert.h>
+#include <string.h>
+
+#include "memcached.h"
+#include "timer_wheel.h"
+
+#define BASE_MASK  (TIMER_WHEEL_BASE_SLOTS - 1)
+#define LEVEL_MASK (TIMER_WHEEL_LEVEL_SLOTS - 1)
+
+/* the bit where the index into an upper level starts.  level 0 is the first
+ * level above the base. */
+#define LEVEL_SHIFT(level) (TIMER_WHEEL_BASE_BITS + (level) * TIMER_WHEEL_LEVEL_BITS)
+
+/* how far ahead of next the wheel can file an entry in its proper slot. */
+#define WHEEL_SPAN ((rel_time_t) 1 << LEVEL_SHIFT(TIMER_WHEEL_LEVELS - 1))
+
+
+void timer_wheel_init(timer_wheel_t* wheel, rel_time_t now, memory_pool_t pool) {
+    memset(wheel, 0, sizeof(timer_wheel_t));
+    wheel->next = now;
+    wheel->pool = pool;
+}
+
+
+/*
+ * files a node in the slot for its time, relative to the wheel's next second.
+ * overdue nodes go in the slot that is handed out next.
+ */
+static void file_node(timer_wheel_t* wheel, timer_node_t* node) {
+    rel_time_t when = node->when;
+    rel_time_t delta;
+    timer_node_t** slot;
+    int level;
+
+    if (when < wheel->next) {
+        when = wheel->next;
+    }
+    delta = when - wheel->next;
+
+    if (delta < TIMER_WHEEL_BASE_SLOTS) {
+        slot = &wheel->base[when & BASE_MASK];
+    } else {
+        if (delta >= WHEEL_SPAN) {
+            /* park it in the last slot in range; it's filed again when that
+             * slot is cascaded. */
+            when = wheel->next + WHEEL_SPAN - 1;
+            delta = WHEEL_SPAN - 1;
+        }
+        for (level = 0; delta >= ((rel_time_t) 1 << LEVEL_SHIFT(level + 1)); level++) {
+        }
+        slot = &wheel->levels[level][(when >> LEVEL_SHIFT(level)) & LEVEL_MASK];
+    }
+
+    node->next = *slot;
+    *slot = node;
+}
+
+
+bool timer_wheel_add(timer_wheel_t* wheel, void* entry, rel_time_t when) {
+    timer_node_t* node;
+
+    if (wheel->free_nodes == NULL) {
+        timer_node_t* block = pool_malloc(sizeof(timer_node_t) * TIMER_WHEEL_NODE_BLOCK,
+                                          wheel->pool);
+        int i;
+
+        if (block == NULL) {
+            return false;
+        }
+        for (i = 0; i < TIMER_WHEEL_NODE_BLOCK; i++) {
+            block[i].next = wheel->free_nodes;
+            wheel->free_nodes = &block[i];
+        }
+    }
+
+    node = wheel->free_nodes;
+    wheel->free_nodes = node->next;
+    node->entry = entry;
+    node->when = when;
+    file_node(wheel, node);
+    wheel->count++;
+
+    return true;
+}
+
+
+/*
+ * when the base wraps around, the slot of each level that has come around
+ * is emptied and its nodes filed again, now that they are closer.  higher
+ * levels go first so their nodes can land in the lower slots being emptied.
+ */
+static void cascade(timer_wheel_t* wheel) {
+    rel_time_t next = wheel->next;
+    int level, top;
+
+    if ((next & BASE_MASK) != 0) {
+        return;
+    }
+
+    for (top = 0;
+         top < TIMER_WHEEL_LEVELS - 2 &&
+             ((next >> LEVEL_SHIFT(top)) & LEVEL_MASK) == 0;
+         top++) {
+    }
+
+    for (level = top; level >= 0; level--) {
+        timer_node_t** slot = &wheel->levels[level][(next >> LEVEL_SHIFT(level)) & LEVEL_MASK];
+        timer_node_t* node = *slot;
+
+        *slot = NULL;
+        while (node != NULL) {
+            timer_node_t* following = node->next;
+
+            file_node(wheel, node);
+            node = following;
+        }
+    }
+}
+
+
+size_t timer_wheel_expire(timer_wheel_t* wheel, rel_time_t now,
+                          void** out, size_t max) {
+    size_t n = 0;
+
+    if (wheel->count == 0) {
+        /* nothing to cascade either, so skip straight ahead. */
+        if (wheel->next <= now) {
+            wheel->next = now + 1;
+            wheel->cascaded = false;
+        }
+        return 0;
+    }
+
+    while (n < max && wheel->next <= now) {
+        timer_node_t** slot = &wheel->base[wheel->next & BASE_MASK];
+
+        if (! wheel->cascaded) {
+            cascade(wheel);
+            wheel->cascaded = true;
+        }
+
+        while (*slot != NULL && n < max) {
+            timer_node_t* node = *slot;
+
+            assert(node->when <= wheel->next);
+            *slot = node->next;
+            out[n++] = node->entry;
+            wheel->count--;
+
+            node->next = wheel->free_nodes;
+            wheel->free_nodes = node;
+        }
+
+        if (*slot == NULL) {
+            wheel->next++;
+            wheel->cascaded = false;
+        }
+    }
+
+    return n;
+}
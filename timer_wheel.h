@@ -0,0 +1,69 @@
+/* -*- Mode: C; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+
+/**
+ * A hierarchical timer wheel: entries are filed by the second they fall due,
+ * and handing out the due entries only touches those entries, however many
+ * others are waiting.
+ *
+ * The first level has a slot for each of the next 256 seconds.  Each level
+ * above it has 64 slots, each covering a whole turn of the level below; when
+ * the level below wraps around, the next slot up is emptied and its entries
+ * are filed again, closer to their time.  Four levels reach 2^26 seconds
+ * (about two years) ahead; anything further out is parked in the top level
+ * until it comes into range.
+ *
+ * Entries due in the same second are handed out in no particular order.  The
+ * wheel does no locking of its own.
+ */
+
+#include "generic.h"
+
+#if !defined(_timer_wheel_h_)
+#define _timer_wheel_h_
+
+#include "memcached.h"
+
+#define TIMER_WHEEL_LEVELS      4
+#define TIMER_WHEEL_BASE_BITS   8
+#define TIMER_WHEEL_LEVEL_BITS  6
+#define TIMER_WHEEL_BASE_SLOTS  (1 << TIMER_WHEEL_BASE_BITS)
+#define TIMER_WHEEL_LEVEL_SLOTS (1 << TIMER_WHEEL_LEVEL_BITS)
+
+/* entries are kept in lists of nodes, so moving them down a level never
+ * needs to allocate.  nodes are allocated in blocks and kept on a free list
+ * once they have been handed out. */
+#define TIMER_WHEEL_NODE_BLOCK  1024
+
+typedef struct timer_node_s timer_node_t;
+struct timer_node_s {
+    timer_node_t* next;
+    void* entry;
+    rel_time_t when;
+};
+
+typedef struct timer_wheel_s timer_wheel_t;
+struct timer_wheel_s {
+    rel_time_t next;            /* the next second to hand out.  everything
+                                 * due before it has been handed out. */
+    bool cascaded;              /* the upper levels have been cascaded for
+                                 * next. */
+    size_t count;               /* entries in the wheel. */
+    memory_pool_t pool;         /* pool the nodes are allocated from. */
+    timer_node_t* free_nodes;
+    timer_node_t* base[TIMER_WHEEL_BASE_SLOTS];
+    timer_node_t* levels[TIMER_WHEEL_LEVELS - 1][TIMER_WHEEL_LEVEL_SLOTS];
+};
+
+extern void timer_wheel_init(timer_wheel_t* wheel, rel_time_t now, memory_pool_t pool);
+
+/* files an entry to be handed out at when.  returns false if the wheel can't
+ * grow to hold it. */
+extern bool timer_wheel_add(timer_wheel_t* wheel, void* entry, rel_time_t when);
+
+/* hands out up to max entries that are due at or before now, in order of
+ * time, and returns how many it stored in out.  if it returns max, more may
+ * be due. */
+extern size_t timer_wheel_expire(timer_wheel_t* wheel, rel_time_t now,
+                                 void** out, size_t max);
+
+#endif /* #if !defined(_timer_wheel_h_) */